@@ -0,0 +1,656 @@
+/** @file bridge_health.c
+ *  @brief Cached health of the bridge (IP, STP mode, port states) from rtnetlink and sysfs
+ *
+ *  See bridge_health.h.
+ *
+ *  @author Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_addr.h>
+#include <linux/if_bridge.h>
+#include "bridge_health.h"
+
+#define NL_BUFFER_SIZE 16384
+
+
+static pthread_mutex_t health_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t health_changed;
+static BridgeHealth health;            // The cache, under health_lock
+static char bridge_name[IFNAMSIZ];
+static int nl_fd = -1;
+static int stp_fd = -1;                // /sys/class/net/<bridge>/bridge/stp_state
+static uint32_t dump_seq;
+
+
+/** @brief read_stp_state
+ *
+ *  Reads stp_state of the bridge; the file is kept open and reopened when
+ *  the bridge was deleted and created again.
+ *
+ *  @return int : HEALTH_STP_*
+ */
+static int read_stp_state(void)
+{
+    char path[64];
+    char value[8];
+    int attempt;
+    ssize_t len;
+
+    for (attempt = 0; attempt < 2; attempt++)
+    {
+        if (stp_fd < 0)
+        {
+            snprintf(path, sizeof(path), "/sys/class/net/%s/bridge/stp_state", bridge_name);
+            stp_fd = open(path, O_RDONLY | O_CLOEXEC);
+            if (stp_fd < 0)
+            {
+                return HEALTH_STP_UNKNOWN;
+            }
+        }
+
+        len = pread(stp_fd, value, sizeof(value) - 1, 0);
+        if (len > 0)
+        {
+            value[len] = '\0';
+            return (int)strtol(value, NULL, 10);
+        }
+
+        /*
+         * Stale file of a deleted bridge: open it again once
+         */
+        close(stp_fd);
+        stp_fd = -1;
+    }
+
+    return HEALTH_STP_UNKNOWN;
+}
+
+/** @brief read_sysfs_port_id
+ *
+ *  Port ID of a bridge port from sysfs ("0x8001"), for kernels whose
+ *  netlink messages do not carry IFLA_BRPORT_ID.
+ *
+ *  @param ifname  : Port interface name
+ *  @param port_id : Receives the ID as brctl prints it ("8001")
+ *
+ *  @return int : Returns 0 on success, -1 on failure
+ */
+static int read_sysfs_port_id(const char *ifname, char *port_id)
+{
+    FILE *fp;
+    char path[64];
+    unsigned int id;
+
+    snprintf(path, sizeof(path), "/sys/class/net/%s/brport/port_id", ifname);
+    fp = fopen(path, "r");
+    if (fp == NULL)
+    {
+        return -1;
+    }
+
+    if (fscanf(fp, "%x", &id) != 1)
+    {
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+
+    snprintf(port_id, sizeof(((HealthPort *)0)->port_id), "%04x", id & 0xFFFF);
+    return 0;
+}
+
+/** @brief forget_bridge
+ *
+ *  The bridge is gone: nothing of it is valid any more.
+ *
+ *  @return void : This function does not return any value.
+ */
+static void forget_bridge(void)
+{
+    health.bridge_index = 0;
+    health.has_ip = 0;
+    health.ip[0] = '\0';
+    health.port_count = 0;
+}
+
+/** @brief update_port
+ *
+ *  Adds, updates or removes one port of the cache.
+ *
+ *  @param add     : 1 for RTM_NEWLINK, 0 for RTM_DELLINK
+ *  @param ifindex : Port interface index
+ *  @param ifname  : Port interface name, NULL if unknown
+ *  @param port_id : Port ID, NULL if unknown
+ *  @param state   : BR_STATE_*
+ *
+ *  @return void : This function does not return any value.
+ */
+static void update_port(int add, int ifindex, const char *ifname, const char *port_id, int state)
+{
+    HealthPort *port;
+    int i;
+
+    for (i = 0; i < health.port_count; i++)
+    {
+        if (health.ports[i].ifindex == ifindex)
+        {
+            break;
+        }
+    }
+
+    if (!add)
+    {
+        if (i < health.port_count)
+        {
+            health.ports[i] = health.ports[--health.port_count];
+        }
+        return;
+    }
+
+    if (i == health.port_count)
+    {
+        if (health.port_count >= HEALTH_MAX_PORTS)
+        {
+            return;
+        }
+        memset(&health.ports[i], 0, sizeof(health.ports[i]));
+        health.ports[i].ifindex = ifindex;
+        health.port_count++;
+    }
+
+    port = &health.ports[i];
+    port->state = state;
+    if (ifname != NULL)
+    {
+        snprintf(port->ifname, sizeof(port->ifname), "%s", ifname);
+    }
+    if (port_id != NULL)
+    {
+        snprintf(port->port_id, sizeof(port->port_id), "%s", port_id);
+    }
+    else if (port->port_id[0] == '\0')
+    {
+        read_sysfs_port_id(port->ifname, port->port_id);
+    }
+}
+
+/** @brief parse_link
+ *
+ *  Handles one RTM_NEWLINK / RTM_DELLINK: the bridge itself appearing or
+ *  going away (any family), or a port of it (AF_BRIDGE, with the port
+ *  attributes nested in IFLA_PROTINFO; sent for every port state change).
+ *
+ *  @param nh : Netlink message
+ *
+ *  @return void : This function does not return any value.
+ */
+static void parse_link(const struct nlmsghdr *nh)
+{
+    struct ifinfomsg *ifi = NLMSG_DATA(nh);
+    struct rtattr *rta;
+    struct rtattr *nested;
+    const char *ifname = NULL;
+    char port_id[8];
+    int have_id = 0;
+    int master = 0;
+    int state = -1;
+    int len;
+    int nested_len;
+
+    if (nh->nlmsg_len < NLMSG_LENGTH(sizeof(*ifi)))
+    {
+        return;
+    }
+
+    len = nh->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi));
+    for (rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len))
+    {
+        switch (rta->rta_type & NLA_TYPE_MASK)
+        {
+            case IFLA_IFNAME:
+                ifname = (const char *)RTA_DATA(rta);
+                break;
+
+            case IFLA_MASTER:
+                master = *(int *)RTA_DATA(rta);
+                break;
+
+            case IFLA_PROTINFO:
+                nested_len = RTA_PAYLOAD(rta);
+                for (nested = RTA_DATA(rta); RTA_OK(nested, nested_len); nested = RTA_NEXT(nested, nested_len))
+                {
+                    if ((nested->rta_type & NLA_TYPE_MASK) == IFLA_BRPORT_STATE)
+                    {
+                        state = *(uint8_t *)RTA_DATA(nested);
+                    }
+                    else if ((nested->rta_type & NLA_TYPE_MASK) == IFLA_BRPORT_ID)
+                    {
+                        snprintf(port_id, sizeof(port_id), "%04x", *(uint16_t *)RTA_DATA(nested));
+                        have_id = 1;
+                    }
+                }
+                break;
+        }
+    }
+
+    /*
+     * The bridge itself
+     */
+    if ((ifname != NULL && strcmp(ifname, bridge_name) == 0) ||
+        (health.bridge_index != 0 && ifi->ifi_index == health.bridge_index))
+    {
+        if (nh->nlmsg_type == RTM_DELLINK)
+        {
+            if (ifi->ifi_family != AF_BRIDGE)
+            {
+                forget_bridge();
+            }
+        }
+        else if (health.bridge_index != ifi->ifi_index)
+        {
+            forget_bridge();
+            health.bridge_index = ifi->ifi_index;
+        }
+        return;
+    }
+
+    if (ifi->ifi_family != AF_BRIDGE || health.bridge_index == 0)
+    {
+        return;
+    }
+
+    if (nh->nlmsg_type == RTM_DELLINK)
+    {
+        update_port(0, ifi->ifi_index, NULL, NULL, 0);
+    }
+    else if (master == health.bridge_index && state >= 0)
+    {
+        update_port(1, ifi->ifi_index, ifname, have_id ? port_id : NULL, state);
+    }
+    else
+    {
+        /*
+         * Moved to another bridge
+         */
+        update_port(0, ifi->ifi_index, NULL, NULL, 0);
+    }
+}
+
+/** @brief parse_addr
+ *
+ *  Handles one RTM_NEWADDR / RTM_DELADDR; only the primary IPv4 address of
+ *  the bridge is kept (the one ifconfig shows).
+ *
+ *  @param nh : Netlink message
+ *
+ *  @return void : This function does not return any value.
+ */
+static void parse_addr(const struct nlmsghdr *nh)
+{
+    struct ifaddrmsg *ifa = NLMSG_DATA(nh);
+    struct rtattr *rta;
+    const void *addr = NULL;
+    char ip[sizeof(health.ip)];
+    int len;
+
+    if (nh->nlmsg_len < NLMSG_LENGTH(sizeof(*ifa)) || ifa->ifa_family != AF_INET ||
+        health.bridge_index == 0 || (int)ifa->ifa_index != health.bridge_index ||
+        (ifa->ifa_flags & IFA_F_SECONDARY))
+    {
+        return;
+    }
+
+    len = nh->nlmsg_len - NLMSG_LENGTH(sizeof(*ifa));
+    for (rta = IFA_RTA(ifa); RTA_OK(rta, len); rta = RTA_NEXT(rta, len))
+    {
+        /*
+         * IFA_LOCAL is the own address, IFA_ADDRESS the peer on point-to-point links
+         */
+        if (rta->rta_type == IFA_LOCAL || (rta->rta_type == IFA_ADDRESS && addr == NULL))
+        {
+            addr = RTA_DATA(rta);
+        }
+    }
+
+    if (addr == NULL || inet_ntop(AF_INET, addr, ip, sizeof(ip)) == NULL)
+    {
+        return;
+    }
+
+    if (nh->nlmsg_type == RTM_NEWADDR)
+    {
+        if (!health.has_ip)
+        {
+            snprintf(health.ip, sizeof(health.ip), "%s", ip);
+            health.has_ip = 1;
+        }
+    }
+    else if (health.has_ip && strcmp(health.ip, ip) == 0)
+    {
+        health.has_ip = 0;
+        health.ip[0] = '\0';
+    }
+}
+
+/** @brief receive_messages
+ *
+ *  Reads netlink messages (events and dump replies) into the cache.
+ *
+ *  @param flags    : recv() flags, MSG_DONTWAIT to only read what is queued
+ *  @param dump_done: Set to 1 when the end of the current dump was read, may be NULL
+ *
+ *  @return int : Returns 0 on success, -1 on failure (ENOBUFS: events were lost)
+ */
+static int receive_messages(int flags, int *dump_done)
+{
+    char buffer[NL_BUFFER_SIZE] __attribute__((aligned(4)));
+    struct nlmsghdr *nh;
+    int len;
+
+    while (1)
+    {
+        len = recv(nl_fd, buffer, sizeof(buffer), flags);
+        if (len < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+
+        for (nh = (struct nlmsghdr *)buffer; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len))
+        {
+            switch (nh->nlmsg_type)
+            {
+                case NLMSG_DONE:
+                case NLMSG_ERROR:
+                    if (dump_done != NULL && nh->nlmsg_seq == dump_seq)
+                    {
+                        *dump_done = 1;
+                    }
+                    break;
+
+                case RTM_NEWLINK:
+                case RTM_DELLINK:
+                    parse_link(nh);
+                    break;
+
+                case RTM_NEWADDR:
+                case RTM_DELADDR:
+                    parse_addr(nh);
+                    break;
+            }
+        }
+
+        if (dump_done != NULL && *dump_done)
+        {
+            return 0;
+        }
+    }
+}
+
+/** @brief dump
+ *
+ *  Requests a dump and reads it to the end.
+ *
+ *  @param type   : RTM_GETLINK or RTM_GETADDR
+ *  @param family : AF_BRIDGE for the ports, AF_INET for the addresses
+ *
+ *  @return int : Returns 0 on success, -1 on failure
+ */
+static int dump(int type, int family)
+{
+    struct {
+        struct nlmsghdr nh;
+        struct ifinfomsg ifi;  // Same size as struct ifaddrmsg or larger, family first in both
+    } req;
+    int done = 0;
+
+    memset(&req, 0, sizeof(req));
+    req.nh.nlmsg_len = NLMSG_LENGTH((type == RTM_GETADDR) ? sizeof(struct ifaddrmsg) : sizeof(struct ifinfomsg));
+    req.nh.nlmsg_type = type;
+    req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.nh.nlmsg_seq = ++dump_seq;
+    req.ifi.ifi_family = family;
+
+    if (send(nl_fd, &req, req.nh.nlmsg_len, 0) < 0)
+    {
+        return -1;
+    }
+
+    while (!done)
+    {
+        if (receive_messages(0, &done) != 0)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/** @brief commit_changes
+ *
+ *  Bumps the generation and wakes bridge_health_wait() if the cache is no
+ *  longer what it was. Called with health_lock held.
+ *
+ *  @param before : Cache before the changes
+ *
+ *  @return int : 1 if something changed, 0 if not
+ */
+static int commit_changes(const BridgeHealth *before)
+{
+    if (memcmp(before, &health, sizeof(health)) == 0)
+    {
+        return 0;
+    }
+
+    health.generation = before->generation + 1;
+    pthread_cond_broadcast(&health_changed);
+    return 1;
+}
+
+/** @brief resync_locked
+ *
+ *  bridge_health_resync() with health_lock held.
+ *
+ *  @return int : Returns 0 on success, -1 on failure
+ */
+static int resync_locked(void)
+{
+    BridgeHealth before = health;
+    int ret = 0;
+
+    memset(&health, 0, sizeof(health));
+    health.generation = before.generation;
+    health.bridge_index = if_nametoindex(bridge_name);
+    health.stp_state = read_stp_state();
+
+    /*
+     * One dump at a time on a netlink socket: ports first, then addresses
+     */
+    if (dump(RTM_GETLINK, AF_BRIDGE) != 0 || dump(RTM_GETADDR, AF_INET) != 0)
+    {
+        perror("Bridge health dump failed");
+        ret = -1;
+    }
+
+    commit_changes(&before);
+    return ret;
+}
+
+int bridge_health_resync(void)
+{
+    int ret;
+
+    pthread_mutex_lock(&health_lock);
+    ret = resync_locked();
+    pthread_mutex_unlock(&health_lock);
+
+    return ret;
+}
+
+int bridge_health_open(const char *bridge)
+{
+    struct sockaddr_nl addr;
+    pthread_condattr_t attr;
+    int rcvbuf = 256 * 1024;
+
+    snprintf(bridge_name, sizeof(bridge_name), "%s", bridge);
+
+    /*
+     * bridge_health_wait() times out on the monotonic clock
+     */
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&health_changed, &attr);
+    pthread_condattr_destroy(&attr);
+
+    nl_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (nl_fd < 0)
+    {
+        perror("Netlink socket creation failed");
+        return -1;
+    }
+    setsockopt(nl_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR;
+
+    if (bind(nl_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("Netlink bind failed");
+        close(nl_fd);
+        nl_fd = -1;
+        return -1;
+    }
+
+    bridge_health_resync();
+    return nl_fd;
+}
+
+int bridge_health_process(void)
+{
+    BridgeHealth before;
+    int changed;
+
+    pthread_mutex_lock(&health_lock);
+    before = health;
+
+    if (receive_messages(MSG_DONTWAIT, NULL) != 0)
+    {
+        /*
+         * Socket overflowed, events were lost: start over
+         */
+        printf("Netlink events lost (%s), reloading bridge state\n", strerror(errno));
+        if (resync_locked() != 0)
+        {
+            pthread_mutex_unlock(&health_lock);
+            return -1;
+        }
+    }
+
+    changed = commit_changes(&before);
+    pthread_mutex_unlock(&health_lock);
+
+    return changed;
+}
+
+void bridge_health_get(BridgeHealth *out)
+{
+    BridgeHealth before;
+    int i;
+
+    pthread_mutex_lock(&health_lock);
+
+    /*
+     * Nothing tells when the STP mode changes: read it every time
+     */
+    before = health;
+    health.stp_state = read_stp_state();
+    commit_changes(&before);
+
+    *out = health;
+    pthread_mutex_unlock(&health_lock);
+
+    out->disabled_ports = 0;
+    for (i = 0; i < out->port_count; i++)
+    {
+        if (out->ports[i].state == BR_STATE_DISABLED)
+        {
+            out->disabled_ports++;
+        }
+    }
+}
+
+uint32_t bridge_health_wait(uint32_t generation, int timeout_ms)
+{
+    struct timespec deadline;
+    uint32_t current;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&health_lock);
+    while (health.generation == generation)
+    {
+        if (pthread_cond_timedwait(&health_changed, &health_lock, &deadline) == ETIMEDOUT)
+        {
+            break;
+        }
+    }
+    current = health.generation;
+    pthread_mutex_unlock(&health_lock);
+
+    return current;
+}
+
+const HealthPort *bridge_health_find_port(const BridgeHealth *h, const char *port_id)
+{
+    int i;
+
+    for (i = 0; i < h->port_count; i++)
+    {
+        if (strcmp(h->ports[i].port_id, port_id) == 0)
+        {
+            return &h->ports[i];
+        }
+    }
+
+    return NULL;
+}
+
+const char *bridge_port_state_name(int state)
+{
+    switch (state)
+    {
+        case BR_STATE_DISABLED:   return "disabled";
+        case BR_STATE_LISTENING:  return "listening";
+        case BR_STATE_LEARNING:   return "learning";
+        case BR_STATE_FORWARDING: return "forwarding";
+        case BR_STATE_BLOCKING:   return "blocking";
+        default:                  return "unknown";
+    }
+}
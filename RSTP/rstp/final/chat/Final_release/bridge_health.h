@@ -0,0 +1,134 @@
+/** @file bridge_health.h
+ *  @brief Cached health of the bridge (IP, STP mode, port states) from rtnetlink and sysfs
+ *
+ *  The client used to find out whether the bridge is configured right by
+ *  running ifconfig, brctl show, brctl showstp and mstpctl every second:
+ *  four processes per check. This module keeps everything those commands
+ *  printed in one cache instead:
+ *
+ *    - IPv4 address of the bridge    RTM_NEWADDR / RTM_DELADDR
+ *    - ports and their states        AF_BRIDGE RTM_NEWLINK / RTM_DELLINK
+ *    - bridge created / deleted      RTM_NEWLINK / RTM_DELLINK
+ *    - STP mode                      /sys/class/net/<bridge>/bridge/stp_state
+ *
+ *  The cache is filled by one netlink dump at start (and again if the
+ *  socket overflowed) and after that only changed by netlink events, each
+ *  change bumps a generation number. The STP mode has no netlink event,
+ *  it is one pread() of an open sysfs file per bridge_health_get().
+ *
+ *  stp_state is 0 (off), 1 (STP in the kernel) or 2 (STP in user space,
+ *  mstpd). mstpd runs RSTP unless told otherwise, so 2 is taken as RSTP;
+ *  "force protocol version" is only known to mstpd itself.
+ *
+ *  @author Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#ifndef BRIDGE_HEALTH_H
+#define BRIDGE_HEALTH_H
+
+#include <stdint.h>
+#include <net/if.h>
+
+#define HEALTH_MAX_PORTS 16
+
+#define HEALTH_STP_UNKNOWN -1  // Bridge missing, sysfs not readable
+#define HEALTH_STP_OFF      0
+#define HEALTH_STP_KERNEL   1
+#define HEALTH_STP_USER     2  // mstpd: RSTP
+
+
+/*
+ * One port of the bridge
+ */
+typedef struct {
+    int ifindex;
+    int state;                 // BR_STATE_*
+    char port_id[8];           // As brctl prints it ("8001"), "" if unknown
+    char ifname[IFNAMSIZ];
+} HealthPort;
+
+/*
+ * Snapshot of the cache
+ */
+typedef struct {
+    uint32_t generation;       // Changes whenever anything below changed
+    int bridge_index;          // 0 if the bridge does not exist
+    int has_ip;
+    char ip[16];               // First (primary) IPv4 address
+    int stp_state;             // HEALTH_STP_*
+    int disabled_ports;        // Ports in BR_STATE_DISABLED
+    int port_count;
+    HealthPort ports[HEALTH_MAX_PORTS];
+} BridgeHealth;
+
+
+/** @brief bridge_health_open
+ *
+ *  Opens the netlink socket and fills the cache.
+ *
+ *  @param bridge : Bridge interface name ("br0")
+ *
+ *  @return int : Netlink socket to poll for POLLIN, -1 on failure
+ */
+int bridge_health_open(const char *bridge);
+
+/** @brief bridge_health_process
+ *
+ *  Applies the queued netlink events to the cache, without blocking.
+ *  Call when the socket from bridge_health_open() is readable.
+ *
+ *  @return int : 1 if the cache changed, 0 if not, -1 on failure
+ */
+int bridge_health_process(void);
+
+/** @brief bridge_health_resync
+ *
+ *  Throws the cache away and fills it again from a netlink dump; done
+ *  by bridge_health_process() itself when events were lost.
+ *
+ *  @return int : Returns 0 on success, -1 on failure
+ */
+int bridge_health_resync(void);
+
+/** @brief bridge_health_get
+ *
+ *  Copies the cache and reads the current STP mode.
+ *
+ *  @param health : Receives the snapshot
+ *
+ *  @return void : This function does not return any value.
+ */
+void bridge_health_get(BridgeHealth *health);
+
+/** @brief bridge_health_wait
+ *
+ *  Waits until the generation differs from the given one or the timeout
+ *  expires.
+ *
+ *  @param generation : Generation of the last snapshot
+ *  @param timeout_ms : Longest wait
+ *
+ *  @return uint32_t : Current generation
+ */
+uint32_t bridge_health_wait(uint32_t generation, int timeout_ms);
+
+/** @brief bridge_health_find_port
+ *
+ *  @param health  : Snapshot
+ *  @param port_id : Port ID as brctl prints it ("8001")
+ *
+ *  @return const HealthPort* : The port, NULL if it is not in the bridge
+ */
+const HealthPort *bridge_health_find_port(const BridgeHealth *health, const char *port_id);
+
+/** @brief bridge_port_state_name
+ *
+ *  @param state : BR_STATE_*
+ *
+ *  @return const char* : State name as brctl prints it
+ */
+const char *bridge_port_state_name(int state);
+
+#endif /* BRIDGE_HEALTH_H */
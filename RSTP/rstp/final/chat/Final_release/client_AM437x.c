@@ -21,28 +21,31 @@
 #include <arpa/inet.h>
 #include <pthread.h>
 #include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <linux/if_bridge.h>
+#include "bridge_health.h"
+#include "status_reporter.h"
+#include "status_proto.h"
 
-#define CMD "brctl showstp br0"
 #define MAX_LINE 256
-#define PORT1 "8001"  // eno1
-#define PORT2 "8002"  // enx30de4b49af5e
 #define UDP_PORT_RX 12345
 #define UDP_PORT_TX 1234
 #define BUFFER_SIZE 1024
 #define BRIDGE_INTERFACE "br0"
+#define LED_CHECK_MS 1000      // Longest time between two bridge health checks
+#define STP_CHECK_MS 1000      // Longest time between two STP mode reads in monitor_ports
+#define REPORT_TEXT 0          // 1: send the old text report (debugging, old servers)
 
 
 char BOARD_NAME[50]; 
 char sender_ip[INET_ADDRSTRLEN];
 uint8_t server_connect = 0;
-int flag=0;
 int PINS[] = {122, 123};
 int num_pins = 2;
 
-typedef struct {
-    char port_id[10];
-    char state[20];
-} PortStatus;
+int bridge_health_fd = -1;  // rtnetlink socket of the bridge health cache
 
 
 void write_gpio_value(int, int);
@@ -68,324 +71,199 @@ int get_device_name()
     /* 
      * Read the device name from the file 
      */
-    fgets((char *)BOARD_NAME, 100 , fd);
+    if (fgets((char *)BOARD_NAME, sizeof(BOARD_NAME), fd) == NULL)
+    {
+        BOARD_NAME[0] = '\0';
+    }
 
     /* 
      * Remove new line char 
      */
-    BOARD_NAME[strlen((const char *)BOARD_NAME) - 1] = '\0';
+    BOARD_NAME[strcspn((const char *)BOARD_NAME, "\r\n")] = '\0';
     printf("Device Name %s \r\n", BOARD_NAME);
     fclose(fd);
 
+    return 1;
 }
 
 
-/** @brief get_port_status
+/** @brief bridge_flags
  *
- *  Retrieves the status of two network ports by executing a command
- *  and parsing the output.
+ *  Sums up a bridge health snapshot as the STATUS_BRIDGE_* flags of a report.
  *
- *  @param status1 : Pointer to PortStatus struct for the first port
- *  @param status2 : Pointer to PortStatus struct for the second port
+ *  @param health : Snapshot from bridge_health_get()
  *
- *  @return int : Returns 0 on success, -1 on failure
+ *  @return uint16_t : STATUS_BRIDGE_* flags
  */
-int get_port_status(PortStatus *status1, PortStatus *status2)
+uint16_t bridge_flags(const BridgeHealth *health)
 {
-    FILE *fp;
-    char line[MAX_LINE];
-    int found1 = 0, found2 = 0;
+    uint16_t flags = 0;
 
-    /*
-     * Open command output
-     */
-    fp = popen(CMD, "r");
-    if (!fp)
+    if (health->has_ip && is_valid_ip(health->ip))
     {
-        perror("popen failed");
-        return -1;
+        flags |= STATUS_BRIDGE_IP_VALID;
     }
-
-    /*
-     * Read and parse output
-     */
-    while (fgets(line, sizeof(line), fp) != NULL)
+    if (health->stp_state > HEALTH_STP_OFF)
     {
-        if (strstr(line, "port id"))
-        {
-            char temp_id[10], temp_state[20];
-
-            /*
-             * Extract port ID and state
-             */
-            if (sscanf(line, " port id %s state %s", temp_id, temp_state) == 2)
-            {
-                if (strcmp(temp_id, PORT1) == 0)
-                {
-                    strcpy(status1->port_id, temp_id);
-                    strcpy(status1->state, temp_state);
-                    found1 = 1;
-                }
-                else if (strcmp(temp_id, PORT2) == 0)
-                {
-                    strcpy(status2->port_id, temp_id);
-                    strcpy(status2->state, temp_state);
-                    found2 = 1;
-                }
-            }
-        }
+        flags |= STATUS_BRIDGE_STP;
+    }
+    if (health->stp_state == HEALTH_STP_USER)
+    {
+        flags |= STATUS_BRIDGE_RSTP;
     }
 
     /*
-     * Close the command output
+     * The same test as check_rstp_status_main(): the green LED
      */
-    pclose(fp);
+    if ((flags & STATUS_BRIDGE_IP_VALID) && (flags & STATUS_BRIDGE_RSTP) && health->disabled_ports == 0)
+    {
+        flags |= STATUS_BRIDGE_OK;
+    }
 
-    /*
-     * Return success if both ports were found
-     */
-    return (found1 && found2) ? 0 : -1;
+    return flags;
 }
 
-/** @brief send_port_status
+/** @brief format_port_status
  *
- *  This function sends the status of two ports over UDP to a specified server.
+ *  Builds the report datagram from a StatusReport; called by the reporter for every
+ *  (re)transmission, which is when the sequence number and the time are filled in.
+ *  With REPORT_TEXT set it is the text line older servers read instead of the binary report.
  *
- *  @param sender_ip : The IP address of the server to send the status to.
- *  @param status1   : The status of the first port to be sent.
- *  @param status2   : The status of the second port to be sent.
+ *  @param buffer : Message buffer
+ *  @param size   : Size of the buffer
+ *  @param state  : StatusReport to send
+ *  @param seq    : Sequence number of the report
  *
- *  @return int      : Returns 0 if successful, -1 if there is an error.
+ *  @return int : Message length
  */
-
-int send_port_status(const char *sender_ip, const PortStatus *status1, const PortStatus *status2) 
+int format_port_status(char *buffer, size_t size, const void *state, uint32_t seq)
 {
-    int sockfd;
-    struct sockaddr_in server_addr;
-    char buffer[BUFFER_SIZE];
-    int status = 0;
-    struct timeval timeout;
-    fd_set read_fds;
-    char ack_buffer[MAX_LINE];  // Buffer for ACK response
-    int ret;
-    char current_ip[50];
-    char *ip;
+    StatusReport report = *(const StatusReport *)state;
+    struct timespec now;
+    int len;
 
-    /*
-     * Check if the server is connected
-     */
-    if (server_connect == 0)
-    {
-        printf("Server not connected, retrying...\n");
-        return -1;
-    }
+    clock_gettime(CLOCK_REALTIME, &now);
+    report.seq = seq;
+    report.timestamp_ms = (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
 
-    /*
-     * Create UDP socket
-     */
-    sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sockfd < 0)
+    if (REPORT_TEXT)
     {
-        perror("Socket creation failed");
-        return -1;
+        len = status_render_text(&report, buffer, size - 1);
+        buffer[len++] = '\n';
+        return len;
     }
 
+    return status_encode((uint8_t *)buffer, size, &report);
+}
+
+/** @brief monitor_ports
+ *
+ *  This function monitors the state of the bridge ports, checking if their states have changed.
+ *  If the states change, it hands the updated status to the reporter, which sends it to the server.
+ *  This function runs in a separate thread.
+ *
+ *  Port states are pushed by the kernel over rtnetlink (AF_BRIDGE RTM_NEWLINK with
+ *  IFLA_BRPORT_STATE), so a topology change is seen within milliseconds and nothing
+ *  is polled. Sending and waiting for the ACK happen on the reporter thread, so the
+ *  next change is seen while the server has not answered the last one.
+ *  The STP mode (stp_state in sysfs) sends no event, so the wait times out
+ *  after STP_CHECK_MS and the state is read again.
+ *
+ *  @param arg : Pointer to any argument passed to the thread (not used in this function).
+ *
+ *  @return void* : Returns NULL when the function completes (infinite loop).
+ */
+void *monitor_ports(void *arg) 
+{
+    StatusReport prev, curr;
+    BridgeHealth health;
+    struct pollfd fds[1];
+    int ip_invalid_shown = 0;
+    int i;
+
+    memset(&prev, 0, sizeof(prev));
+
     /*
-     * Configure server address
+     * main() filled the cache; changes come as events from here on
      */
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(UDP_PORT_TX);
-    if (inet_pton(AF_INET, sender_ip, &server_addr.sin_addr) <= 0)
-    {
-        perror("Invalid sender IP address");
-        close(sockfd);
-        return -1;
-    }
+    fds[0].fd = bridge_health_fd;
+    fds[0].events = POLLIN;
 
+    while (1)
+    {
         /*
-         * Get the current IP address of br0
+         * Current state of the bridge, as a report
          */
-        if (get_br0_ip(current_ip) == 0)
+        bridge_health_get(&health);
+
+        memset(&curr, 0, sizeof(curr));
+        snprintf(curr.name, sizeof(curr.name), "%.*s", (int)sizeof(curr.name) - 1, BOARD_NAME);
+        curr.flags = bridge_flags(&health);
+        inet_pton(AF_INET, health.ip, &curr.ipv4);
+        curr.node_id = status_node_id_from_board(curr.name, curr.ipv4);
+        for (i = 0; i < health.port_count && i < STATUS_MAX_PORTS; i++)
         {
-           printf("Current IP of br0: %s\n", current_ip);
-
             /*
-             * Remove the "addr:" prefix
+             * In port ID order (8001, 8002, ...), whatever order the kernel listed them in
              */
-            ip = strchr(current_ip, ':');
-            if (ip != NULL)
-            {
-                ip++; // Move past the colon
-            }
-            else
-            {
-                ip = current_ip; // No "addr:" prefix found, use the whole string
-            }
+            uint16_t port_id = (uint16_t)strtoul(health.ports[i].port_id, NULL, 16);
+            int j = i;
 
-            /*
-             * Check if the current IP is valid
-             */
-            if (is_valid_ip(ip))
+            while (j > 0 && curr.ports[j - 1].port_id > port_id)
             {
-               printf("IP: Valid\n");
+                curr.ports[j] = curr.ports[j - 1];
+                j--;
             }
-            else
-            {
-                printf("IP: Invalid\n");
-                return -1;
-            }
-	 }
-        else
-        {
-            printf("Failed to get IP of br0\n");
-            return -1;
+            curr.ports[j].port_id = port_id;
+            curr.ports[j].state = (uint8_t)health.ports[i].state;
         }
+        curr.port_count = (uint8_t)i;
 
-
-    get_device_name();
-
-    /*
-     * Prepare port status message
-     */
-    snprintf(buffer, sizeof(buffer), "%s IP: %s Port %s - State: %s Port %s - State: %s\n", BOARD_NAME, ip,
-             status1->port_id, status1->state, status2->port_id, status2->state);
-
-    int retries = 1;
-
-    while (1)
-    {
-        if (retries >= 5)
-        {
-            status = -1;
-            break;
-        }
-
-        /*
-         * Send the message
-         */
-        if (sendto(sockfd, buffer, strlen(buffer), 0, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+        if (!(curr.flags & STATUS_BRIDGE_IP_VALID))
         {
-            perror("Send failed");
-            retries++;
-            continue;  // Keep the server running
+            // Once, not on every timeout
+            if (!ip_invalid_shown)
+            {
+                printf("IP: Invalid, status not sent\n");
+                ip_invalid_shown = 1;
+            }
         }
         else
         {
-            printf("Port status sent to %s:%d\n", sender_ip, UDP_PORT_TX);
-        }
-
-        /*
-         * Wait for ACK with timeout (5 seconds)
-         */
-        timeout.tv_sec = 2;
-        timeout.tv_usec = 0;
+            ip_invalid_shown = 0;
 
-        FD_ZERO(&read_fds);
-        FD_SET(sockfd, &read_fds);
-
-        ret = select(sockfd + 1, &read_fds, NULL, NULL, &timeout);
-        if (ret == -1)
-        {
-            perror("Select failed");
-            close(sockfd);
-            return -1;
-        }
-        else if (ret == 0)
-        {
-            printf("Timeout reached, no ACK received. Retrying...\n");
-            // Timeout, resend the message
-            retries++;
-            continue;  // Keep the server running
-        }
-        else
-        {
-            if (FD_ISSET(sockfd, &read_fds))
+            if (memcmp(&curr, &prev, sizeof(curr)) != 0)
             {
-                /*
-                 * Read ACK message
-                 */
-                int ack_len = recvfrom(sockfd, ack_buffer, sizeof(ack_buffer) - 1, 0, NULL, NULL);
-                if (ack_len < 0)
+                for (i = 0; i < curr.port_count; i++)
                 {
-                    perror("Recvfrom failed for ACK");
-                    close(sockfd);
-                    return -1;
+                    printf("Port %04x - State: %s%s", curr.ports[i].port_id,
+                           status_port_state_name(curr.ports[i].state), (i + 1 < curr.port_count) ? ", " : "\n");
                 }
-                ack_buffer[ack_len] = '\0';
 
-                if (strcmp(ack_buffer, "ACK") == 0)
-                {
-                    printf("Received ACK from server\n");
-                    break;
-                }
-                else
-                {
-                    printf("Unexpected message received: %s\n", ack_buffer);
-                    retries++;
-                    continue;  // Keep the server running
-                }
+                /*
+                 * Hand the updated status to the reporter; a report not ACKed yet is replaced
+                 */
+                status_reporter_submit(&curr, sizeof(curr));
+                prev = curr;
             }
         }
-    }
-
-    close(sockfd);
-    return status;
-}
-
-/** @brief monitor_ports
- *
- *  This function monitors the status of two network ports, checking if their states have changed.
- *  If the states change, it sends the updated status to a specified server. This function runs in a separate thread.
- *
- *  @param arg : Pointer to any argument passed to the thread (not used in this function).
- *
- *  @return void* : Returns NULL when the function completes (infinite loop).
- */
-void *monitor_ports(void *arg) 
-{
-    PortStatus prev_status1 = {"", ""}, prev_status2 = {"", ""};
-    PortStatus curr_status1, curr_status2;
-
-    while (1)
-    {
-        sleep(2);  // Monitoring interval
 
         /*
-         * Get current port status
+         * Sleep until the bridge changes, or until the STP mode is due for a read
          */
-        if (get_port_status(&curr_status1, &curr_status2) == 0)
+        if (poll(fds, 1, STP_CHECK_MS) < 0 && errno != EINTR)
         {
-            if (strcmp(curr_status1.state, prev_status1.state) != 0 ||
-                strcmp(curr_status2.state, prev_status2.state) != 0)
-            {
-               // printf("\nPort Status Changed:\n");
-               // printf("Port %s - State: %s\n", curr_status1.port_id, curr_status1.state);
-               // printf("Port %s - State: %s\n", curr_status2.port_id, curr_status2.state);
-
-                /*
-                 * Send updated status to the sender IP
-                 */
-                flag = send_port_status(sender_ip, &curr_status1, &curr_status2);
-
-                /*
-                 * Update previous status
-                 */
-                prev_status1 = curr_status1;
-                prev_status2 = curr_status2;
-            }
-        }
-        else
-        {
-            printf("Error fetching status\n");
+            perror("Poll failed");
+            sleep(1);
+            continue;
         }
 
         /*
-         * Retry sending updated status if there was a failure in the previous attempt
+         * Also wakes the LED thread if the bridge health changed
          */
-        if (flag == -1)
+        if (fds[0].revents & POLLIN)
         {
-            flag = send_port_status(sender_ip, &curr_status1, &curr_status2);
+            bridge_health_process();
         }
     }
 
@@ -458,8 +336,11 @@ void udp_client()
         if (activity == 0)
         {
             printf("No message received in the last 2 seconds.\n");
-            flag = -1;  // Change the flag here
-            server_connect = 0;  // Update the flag if a message is not received
+            if (server_connect)
+            {
+                server_connect = 0;  // Update the flag if a message is not received
+                status_reporter_set_server(NULL);
+            }
         }
         else if (activity < 0)
         {
@@ -486,6 +367,7 @@ void udp_client()
                     inet_ntop(AF_INET, &server_addr.sin_addr, sender_ip, sizeof(sender_ip));
                     printf("Message received from %s:%d\n", sender_ip, UDP_PORT_RX);
                     server_connect = 1;  // Update the flag if a message is received
+                    status_reporter_set_server(sender_ip);  // Nothing happens if it is the same server
                 }
             }
         }
@@ -640,304 +522,128 @@ int is_valid_ip(const char *ip_str)
 
 /** @brief get_br0_ip
  *
- *  This function retrieves the IP address of the `br0` network interface using the `ifconfig` command.
+ *  This function retrieves the IP address of the `br0` network interface from the bridge
+ *  health cache (kept up to date by rtnetlink, no `ifconfig` process).
  *
- *  @param ip : A pointer to a buffer where the `br0` IP address will be stored.
+ *  @param ip : A pointer to a buffer of at least INET_ADDRSTRLEN bytes where the `br0` IP address will be stored.
  *
- *  @return int : Returns 0 on success, -1 if an error occurs (e.g., can't retrieve the IP address).
+ *  @return int : Returns 0 on success, -1 if `br0` has no IPv4 address.
  */
 int get_br0_ip(char *ip) 
 {
-    FILE *fp;
-    char line[256];
-    char *ip_start;
+    BridgeHealth health;
 
-    /*
-     * Open the `ifconfig` command to get the IP of the `br0` interface
-     */
-    fp = popen("ifconfig br0", "r");
-    if (fp == NULL) 
+    bridge_health_get(&health);
+    if (!health.has_ip)
     {
-        perror("Error opening ifconfig command");
         return -1;
     }
 
-    /*
-     * Read the output of the ifconfig command line by line
-     */
-    while (fgets(line, sizeof(line), fp)) 
-    {
-        /*
-         * Look for the line that contains the inet (IPv4) address
-         */
-        if ((ip_start = strstr(line, "inet ")) != NULL) 
-        {
-            /*
-             * Extract the IP address from the line
-             */
-            sscanf(ip_start, "inet %s", ip);
-            fclose(fp);
-            return 0;
-        }
-    }
-
-    fclose(fp);
-    return -1;
+    snprintf(ip, INET_ADDRSTRLEN, "%s", health.ip);
+    return 0;
 }
 
-/** @brief check_stp_status
+/** @brief check_rstp_status_main
+ *
+ *  This function checks the status of the `br0` bridge, including its IP address, STP status, port status and RSTP status,
+ *  all from one snapshot of the bridge health cache, and prints the results.
+ *
+ *  STP is enabled when stp_state is not 0; RSTP when it is 2, i.e. STP runs in mstpd (mstpd uses RSTP by default).
  *
- *  This function checks if Spanning Tree Protocol (STP) is enabled for the `br0` bridge using the `brctl show` command.
+ *  @param health : Snapshot from bridge_health_get()
  *
- *  @return int : Returns 1 if STP is enabled, 0 if STP is not enabled, and -1 if an error occurs or `br0` is not found.
+ *  @return int : Returns 1 if the bridge configuration is OK (valid IP, STP enabled, no disabled ports, and RSTP enabled),
+ *               and 2 if the bridge configuration is not OK.
  */
-int check_stp_status() 
+int check_rstp_status_main(const BridgeHealth *health)
 {
-    FILE *fp;
-    char line[256];
+    int ip_valid = 0;
+    int i;
 
     /*
-     * Open the `brctl show` command to check the STP status for the bridge
+     * Check the IP address of br0
      */
-    fp = popen("brctl show", "r");
-    if (fp == NULL) 
+    if (health->has_ip)
     {
-        perror("Error opening brctl show command");
-        return -1;
-    }
+        printf("Current IP of br0: %s\n", health->ip);
 
-    /*
-     * Read each line to check for the bridge interface and STP status
-     */
-    while (fgets(line, sizeof(line), fp)) 
-    {
-        /*
-         * Check if the line contains the bridge name (br0) and STP status
-         */
-        if (strstr(line, BRIDGE_INTERFACE) != NULL) 
+        ip_valid = is_valid_ip(health->ip);
+        if (ip_valid)
         {
-            /*
-             * Check if STP is enabled by looking for "yes" in the third column
-             */
-            if (strstr(line, "yes") != NULL) 
-            {
-                fclose(fp);
-                return 1;  // STP is enabled
-            }
-            fclose(fp);
-            return 0;  // STP is not enabled
+            printf("IP: Valid\n");
+        }
+        else
+        {
+            printf("IP: Invalid\n");
         }
     }
-
-    fclose(fp);
-    return -1;  // Error or no br0 bridge found
-}
-
-/** @brief check_ports_status
- *
- *  This function checks the status of the ports for the `br0` bridge using the `brctl showstp br0` command.
- *  It checks whether any ports are in a "disabled" state.
- *
- *  @return int : Returns 1 if any port is disabled, 0 if all ports are active, and -1 if an error occurs.
- */
-int check_ports_status() 
-{
-    FILE *fp;
-    char line[256];
-    int disabled_ports = 0;
+    else
+    {
+        printf("Failed to get IP of br0\n");
+    }
 
     /*
-     * Open the `brctl showstp br0` command to check the port status for the bridge
+     * Check the STP status of the br0 bridge
      */
-    fp = popen("brctl showstp br0", "r");
-    if (fp == NULL) 
+    if (health->stp_state == HEALTH_STP_UNKNOWN)
     {
-        perror("Error opening brctl showstp command");
-        return -1;
+        printf("Failed to check STP status\n");
+    }
+    else if (health->stp_state == HEALTH_STP_OFF)
+    {
+        printf("STP: Not Enabled\n");
+    }
+    else
+    {
+        printf("STP: Enabled\n");
     }
 
     /*
-     * Check each port for its state (forwarding, blocking, disabled)
+     * Check the port status of br0
      */
-    while (fgets(line, sizeof(line), fp)) 
+    for (i = 0; i < health->port_count; i++)
     {
-        if (strstr(line, "state")) 
+        if (health->ports[i].state == BR_STATE_DISABLED)
         {
-            /*
-             * Check the state of the port
-             */
-            if (strstr(line, "disabled") != NULL) 
-            {
-                printf("Port state: Disabled (Not OK)\n");
-                disabled_ports = 1;
-            }
+            printf("Port %s (%s) state: Disabled (Not OK)\n", health->ports[i].port_id, health->ports[i].ifname);
         }
     }
-
-    fclose(fp);
-    return disabled_ports;
-}
-
-/** @brief check_rstp_status
- *
- *  This function checks if Rapid Spanning Tree Protocol (RSTP) is enabled on the `br0` bridge using the `mstpctl showbridge br0` command.
- *
- *  @return int : Returns 1 if RSTP is enabled, 0 if RSTP is not enabled, and -1 if an error occurs.
- */
-int check_rstp_status()
-{
-    FILE *fp;
-    char line[256];
+    if (health->disabled_ports == 0)
+    {
+        printf("All ports are in a valid state (Forwarding or Blocking)\n");
+    }
+    else
+    {
+        printf("One or more ports are disabled, Bridge config not OK\n");
+    }
 
     /*
-     * Open the `mstpctl showbridge br0` command to check the RSTP status for the bridge
+     * Check if RSTP is enabled
      */
-    fp = popen("mstpctl showbridge br0", "r");
-    if (fp == NULL)
+    if (health->stp_state == HEALTH_STP_USER)
     {
-        perror("Error opening mstpctl showbridge command");
-        return -1;
+        printf("RSTP: Enabled\n");
+    }
+    else if (health->stp_state == HEALTH_STP_UNKNOWN)
+    {
+        printf("Failed to check RSTP status\n");
+    }
+    else
+    {
+        printf("RSTP: Not Enabled\n");
     }
 
     /*
-     * Search for "force protocol version" and check if it's set to "rstp"
+     * Check if both IP is valid, STP is enabled, no port is disabled, and RSTP is enabled
      */
-    while (fgets(line, sizeof(line), fp))
+    if (ip_valid && health->stp_state == HEALTH_STP_USER && health->disabled_ports == 0)
     {
-        if (strstr(line, "force protocol version") != NULL)
-        {
-            if (strstr(line, "rstp") != NULL)
-            {
-                fclose(fp);
-                return 1;  // RSTP is enabled
-            }
-        }
+        printf("Bridge config OK\n\n");
+        return 1;
     }
 
-    fclose(fp);
-    return 0;  // RSTP is not enabled
-}
-
-/** @brief check_rstp_status_main
- *
- *  This function monitors the status of the `br0` bridge, including checking its IP address, STP status, port status, and RSTP status.
- *  It repeatedly checks these statuses every 3 seconds and prints the results.
- *
- *  @return int : Returns 1 if the bridge configuration is OK (valid IP, STP enabled, no disabled ports, and RSTP enabled),
- *               and 2 if the bridge configuration is not OK.
- */
-int check_rstp_status_main()
-{
-    char current_ip[50];
-    char *ip;
-    int stp_status;
-    int port_status;
-    int rstp_status;
-
-    while (1)
-    {
-        /*
-         * Get the current IP address of br0
-         */
-        if (get_br0_ip(current_ip) == 0)
-        {
-            printf("Current IP of br0: %s\n", current_ip);
-
-            /*
-             * Remove the "addr:" prefix
-             */
-            ip = strchr(current_ip, ':');
-            if (ip != NULL)
-            {
-                ip++; // Move past the colon
-            }
-            else
-            {
-                ip = current_ip; // No "addr:" prefix found, use the whole string
-            }
-
-            /*
-             * Check if the current IP is valid
-             */
-            if (is_valid_ip(ip))
-            {
-                printf("IP: Valid\n");
-            }
-            else
-            {
-                printf("IP: Invalid\n");
-            }
-        }
-        else
-        {
-            printf("Failed to get IP of br0\n");
-        }
-
-        /*
-         * Check the STP status of the br0 bridge
-         */
-        stp_status = check_stp_status();
-        if (stp_status == 1)
-        {
-            printf("STP: Enabled\n");
-        }
-        else if (stp_status == 0)
-        {
-            printf("STP: Not Enabled\n");
-        }
-        else
-        {
-            printf("Failed to check STP status\n");
-        }
-
-        /*
-         * Check the port status of br0
-         */
-        port_status = check_ports_status();
-        if (port_status == 0)
-        {
-            printf("All ports are in a valid state (Forwarding or Blocking)\n");
-        }
-        else
-        {
-            printf("One or more ports are disabled, Bridge config not OK\n");
-        }
-
-        /*
-         * Check if RSTP is enabled
-         */
-        rstp_status = check_rstp_status();
-        if (rstp_status == 1)
-        {
-            printf("RSTP: Enabled\n");
-        }
-        else if (rstp_status == 0)
-        {
-            printf("RSTP: Not Enabled\n");
-        }
-        else
-        {
-            printf("Failed to check RSTP status\n");
-        }
-
-        /*
-         * Check if both IP is valid, STP is enabled, no port is disabled, and RSTP is enabled
-         */
-        if (is_valid_ip(ip) && stp_status == 1 && port_status == 0 && rstp_status == 1)
-        {
-            printf("Bridge config OK\n\n");
-            return 1;
-        }
-        else
-        {
-            printf("Bridge config not OK\n\n");
-            return 2;
-        }
-
-        /*
-         * Sleep for a while before checking again
-         */
-    }
+    printf("Bridge config not OK\n\n");
+    return 2;
 }
 
 /** @brief control_leds
@@ -946,12 +652,20 @@ int check_rstp_status_main()
  *  It uses GPIO pins to turn the LEDs on or off.
  *  The LEDs are controlled by setting the GPIO pins to either high (1) or low (0).
  *
+ *  The status is evaluated again as soon as the bridge health cache changes (netlink
+ *  event), and at least every LED_CHECK_MS for the STP mode, which has no event.
+ *
  *  @param arg : Argument passed to the function (not used here).
  *
  *  @return NULL : The function runs indefinitely until interrupted.
  */
 void *control_leds(void *arg) {
 
+    BridgeHealth health;
+    uint32_t generation = 0;
+    int prev_ret = 0;
+    int ret;
+
     /*
      * Set up SIGINT (Ctrl+C) signal handler for cleanup
      */
@@ -969,11 +683,26 @@ void *control_leds(void *arg) {
     printf("Starting LED blink test. Press Ctrl+C to stop.\n");
 
     /*
-     * Blink the LEDs based on the RSTP status
+     * Set the LEDs based on the RSTP status
      */
     while (1) {
 
-        int ret = check_rstp_status_main(); // Check RSTP status
+        bridge_health_get(&health);
+
+        /*
+         * Nothing changed since the last check: LEDs stay as they are
+         */
+        if (prev_ret != 0 && health.generation == generation) {
+            bridge_health_wait(generation, LED_CHECK_MS);
+            continue;
+        }
+        generation = health.generation;
+
+        ret = check_rstp_status_main(&health); // Check RSTP status
+        if (ret == prev_ret) {
+            continue;
+        }
+        prev_ret = ret;
 
         /*
          * If RSTP is enabled, turn on green LED, turn off red LED
@@ -989,7 +718,6 @@ void *control_leds(void *arg) {
             write_gpio_value(PINS[0], 1);  // Red LED (Not OK)
             write_gpio_value(PINS[1], 0);  // Green LED (Off)
         }
-        sleep(1); // Check every 3 seconds
     }
 
     return NULL;
@@ -1009,6 +737,25 @@ int main()
 {
     pthread_t monitor_thread, led_control_thread;
 
+    /*
+     * Bridge IP, STP mode and port states, kept up to date by rtnetlink
+     */
+    bridge_health_fd = bridge_health_open(BRIDGE_INTERFACE);
+    if (bridge_health_fd < 0) {
+        return EXIT_FAILURE;
+    }
+
+    /*
+     * The identity in every report: read once
+     */
+    get_device_name();
+
+    /*
+     * Sends the reports and tracks their ACKs, so no other thread waits for the server
+     */
+    if (status_reporter_start(UDP_PORT_TX, format_port_status) != 0) {
+        return EXIT_FAILURE;
+    }
 
     /*
      * Start monitoring ports in a separate thread
@@ -0,0 +1,360 @@
+/** @file collector_bench.c
+ *  @brief Reports per second the server sustains, with simulated nodes
+ *
+ *  Every simulated node has its own UDP socket (its own source port) and
+ *  name, and sends binary reports with a rising sequence number to the
+ *  loopback as fast as the sender threads can. The server side is either
+ *
+ *    collector   report_collector.c with the given number of workers
+ *    single      one thread doing recvfrom(), handling and sendto() for
+ *                every datagram, as server.c did before the collector
+ *
+ *  and handles a report the way server.c does: decode, registry update,
+ *  "ACK <seq>" back to the node. Prints the reports handled per second and
+ *  where the rest were lost (socket buffer or worker queue). First it checks
+ *  that boards with the same or no name, reporting from different
+ *  addresses, get their own registry entries.
+ *
+ *    gcc -O2 collector_bench.c report_collector.c device_registry.c timer_wheel.c status_proto.c -o collector_bench -lpthread
+ *    ./collector_bench [nodes] [workers, 0 = single] [seconds]
+ *
+ *  @author Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "status_proto.h"
+#include "device_registry.h"
+#include "report_collector.h"
+
+#define BENCH_PORT 21234
+#define SENDER_THREADS 2
+#define MAX_NODES 4096
+
+
+typedef struct {
+    int fd;
+    uint32_t seq;
+    int len;
+    uint8_t datagram[128];
+} SimNode;
+
+static SimNode sim_nodes[MAX_NODES];
+static int node_count;
+static volatile int running = 1;
+static uint64_t sent[SENDER_THREADS];
+
+/*
+ * single mode counters, one thread
+ */
+static volatile uint64_t single_received;
+static volatile uint64_t single_handled;
+
+
+/** @brief now_ms
+ *
+ *  @return uint64_t : Monotonic time in milliseconds
+ */
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/** @brief handle_report
+ *
+ *  What server.c does for a report, without the printing.
+ *
+ *  @return int : ACK length, 0 if it is not a report
+ */
+static int handle_report(const uint8_t *data, int len, const struct sockaddr_in *from, char *reply, size_t reply_size)
+{
+    StatusView view;
+    StatusReport report;
+
+    if (status_parse(data, (size_t)len, &view) == 0)
+    {
+        status_view_to_report(&view, &report);
+    }
+    else if (status_decode_text((const char *)data, &report) != 0)
+    {
+        return 0;
+    }
+
+    report.node_id = status_node_id_from_board(report.name, from->sin_addr.s_addr);
+    registry_update(&report, now_ms());
+    return snprintf(reply, reply_size, "ACK %u", report.seq);
+}
+
+/** @brief check_shared_names
+ *
+ *  Two boards named "Switch" and two without a name, each pair reporting
+ *  from different addresses, must be four nodes. The entries are removed
+ *  again before the run.
+ *
+ *  @return int : Returns 0 on success, -1 on failure
+ */
+static int check_shared_names(void)
+{
+    static const char *const names[] = { "Switch", "Switch", "", "" };
+    StatusReport report;
+    RegistryStats before, after;
+    struct sockaddr_in from;
+    uint8_t datagram[128];
+    char reply[32];
+    int len;
+    int i;
+
+    registry_stats(&before);
+
+    memset(&from, 0, sizeof(from));
+    from.sin_family = AF_INET;
+
+    for (i = 0; i < 4; i++)
+    {
+        memset(&report, 0, sizeof(report));
+        snprintf(report.name, sizeof(report.name), "%s", names[i]);
+        report.ipv4 = htonl(0xC0A80000 | (uint32_t)(i + 1));
+        report.node_id = status_node_id_from_board(report.name, 0);   // What an older client sends
+        report.seq = 1;
+        report.flags = STATUS_BRIDGE_IP_VALID;
+        report.port_count = 1;
+        report.ports[0].port_id = 0x8001;
+        report.ports[0].state = STATUS_PORT_FORWARDING;
+        len = status_encode(datagram, sizeof(datagram), &report);
+
+        from.sin_addr.s_addr = report.ipv4;
+        handle_report(datagram, len, &from, reply, sizeof(reply));
+    }
+
+    registry_stats(&after);
+
+    for (i = 0; i < 4; i++)
+    {
+        registry_remove_ipv4(htonl(0xC0A80000 | (uint32_t)(i + 1)));
+    }
+
+    printf("same name, different senders: %s\n", (after.nodes - before.nodes == 4) ? "ok" : "WRONG");
+
+    return (after.nodes - before.nodes == 4) ? 0 : -1;
+}
+
+/** @brief single_thread
+ *
+ *  The server before the collector: one datagram at a time.
+ *
+ *  @return void* : Does not return
+ */
+static void *single_thread(void *arg)
+{
+    int fd = *(int *)arg;
+    uint8_t buffer[COLLECTOR_MAX_DATAGRAM + 1];
+    char reply[COLLECTOR_MAX_REPLY];
+    struct sockaddr_in from;
+    socklen_t from_len;
+    int len;
+
+    while (1)
+    {
+        from_len = sizeof(from);
+        len = recvfrom(fd, buffer, COLLECTOR_MAX_DATAGRAM, 0, (struct sockaddr *)&from, &from_len);
+        if (len < 0)
+        {
+            continue;
+        }
+        buffer[len] = '\0';
+        single_received++;
+
+        len = handle_report(buffer, len, &from, reply, sizeof(reply));
+        if (len > 0)
+        {
+            sendto(fd, reply, (size_t)len, 0, (struct sockaddr *)&from, from_len);
+        }
+        single_handled++;
+    }
+
+    return NULL;
+}
+
+/** @brief sender_thread
+ *
+ *  Sends for its share of the nodes, round robin, until stopped.
+ *
+ *  @param arg : Thread number
+ *
+ *  @return void* : NULL
+ */
+static void *sender_thread(void *arg)
+{
+    int id = (int)(long)arg;
+    struct sockaddr_in to;
+    StatusHeader *hdr;
+    SimNode *node;
+    int i;
+
+    memset(&to, 0, sizeof(to));
+    to.sin_family = AF_INET;
+    to.sin_port = htons(BENCH_PORT);
+    to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    while (running)
+    {
+        for (i = id; i < node_count && running; i += SENDER_THREADS)
+        {
+            node = &sim_nodes[i];
+            hdr = (StatusHeader *)node->datagram;
+            hdr->seq = htonl(++node->seq);
+            if (sendto(node->fd, node->datagram, (size_t)node->len, 0, (struct sockaddr *)&to, sizeof(to)) > 0)
+            {
+                sent[id]++;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    int nodes = (argc > 1) ? atoi(argv[1]) : 500;
+    int workers = (argc > 2) ? atoi(argv[2]) : 2;
+    int seconds = (argc > 3) ? atoi(argv[3]) : 5;
+    pthread_t senders[SENDER_THREADS];
+    pthread_t thread;
+    StatusReport report;
+    CollectorStats stats;
+    RegistryStats registry;
+    struct sockaddr_in addr;
+    uint64_t total_sent = 0;
+    uint64_t received;
+    uint64_t handled;
+    uint64_t start;
+    uint64_t elapsed;
+    int size = COLLECTOR_SOCKET_BUFFER;
+    int fd;
+    int i;
+
+    if (nodes < 1 || nodes > MAX_NODES || workers < 0 || workers > COLLECTOR_MAX_WORKERS || seconds < 1)
+    {
+        printf("usage: %s [nodes 1-%d] [workers 0-%d, 0 = single] [seconds]\n", argv[0], MAX_NODES, COLLECTOR_MAX_WORKERS);
+        return EXIT_FAILURE;
+    }
+    node_count = nodes;
+    registry_init(REGISTRY_EXPIRE_MS, now_ms());
+
+    if (check_shared_names() != 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    /*
+     * Server side
+     */
+    if (workers > 0)
+    {
+        if (collector_start(BENCH_PORT, workers, handle_report) != 0)
+        {
+            return EXIT_FAILURE;
+        }
+    }
+    else
+    {
+        fd = socket(AF_INET, SOCK_DGRAM, 0);
+        if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) < 0)
+        {
+            setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+        }
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(BENCH_PORT);
+        addr.sin_addr.s_addr = INADDR_ANY;
+        if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        {
+            perror("Bind failed");
+            return EXIT_FAILURE;
+        }
+        pthread_create(&thread, NULL, single_thread, &fd);
+    }
+
+    /*
+     * Nodes: a socket each, a two-port report each
+     */
+    memset(&report, 0, sizeof(report));
+    report.flags = STATUS_BRIDGE_IP_VALID | STATUS_BRIDGE_STP | STATUS_BRIDGE_RSTP | STATUS_BRIDGE_OK;
+    report.port_count = 2;
+    report.ports[0].port_id = 0x8001;
+    report.ports[0].state = STATUS_PORT_FORWARDING;
+    report.ports[1].port_id = 0x8002;
+    report.ports[1].state = STATUS_PORT_BLOCKING;
+
+    for (i = 0; i < nodes; i++)
+    {
+        sim_nodes[i].fd = socket(AF_INET, SOCK_DGRAM, 0);
+        if (sim_nodes[i].fd < 0)
+        {
+            perror("Socket creation failed");
+            return EXIT_FAILURE;
+        }
+        snprintf(report.name, sizeof(report.name), "Node-%d", i);
+        report.ipv4 = htonl(0x0A000000 | (uint32_t)(i + 1));
+        report.node_id = status_node_id_from_board(report.name, report.ipv4);
+        sim_nodes[i].len = status_encode(sim_nodes[i].datagram, sizeof(sim_nodes[i].datagram), &report);
+    }
+
+    start = now_ms();
+    for (i = 0; i < SENDER_THREADS; i++)
+    {
+        pthread_create(&senders[i], NULL, sender_thread, (void *)(long)i);
+    }
+    sleep((unsigned int)seconds);
+    running = 0;
+    for (i = 0; i < SENDER_THREADS; i++)
+    {
+        pthread_join(senders[i], NULL);
+        total_sent += sent[i];
+    }
+    elapsed = now_ms() - start;
+
+    /*
+     * Let the server finish what is queued
+     */
+    usleep(300000);
+
+    if (workers > 0)
+    {
+        collector_stats(&stats);
+        received = stats.received;
+        handled = stats.handled;
+    }
+    else
+    {
+        memset(&stats, 0, sizeof(stats));
+        received = single_received;
+        handled = single_handled;
+    }
+    registry_stats(&registry);
+
+    printf("%s, %d workers, %d nodes, %.1f s\n", (workers > 0) ? "collector" : "single", workers, nodes, elapsed / 1000.0);
+    printf("sent       %10llu  %9.0f /s\n", (unsigned long long)total_sent, total_sent * 1000.0 / elapsed);
+    printf("handled    %10llu  %9.0f /s\n", (unsigned long long)handled, handled * 1000.0 / elapsed);
+    printf("lost       %10llu  socket buffer\n", (unsigned long long)(total_sent - received));
+    printf("           %10llu  worker queue\n", (unsigned long long)stats.dropped);
+    if (workers > 0)
+    {
+        printf("batches    %10llu  %.1f datagrams per recvmmsg()\n", (unsigned long long)stats.batches,
+               stats.batches ? (double)stats.received / stats.batches : 0.0);
+    }
+    printf("registry   %10d  nodes\n", registry.nodes);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,500 @@
+/** @file device_registry.c
+ *  @brief Nodes known to the server, keyed by node ID, with expiry
+ *
+ *  See device_registry.h.
+ *
+ *  @author Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+#include "timer_wheel.h"
+#include "device_registry.h"
+
+#define SHARD_NODES (REGISTRY_MAX_NODES / REGISTRY_SHARDS)
+#define INDEX_BITS 10                        // 2 index entries per node: load at most 0.5
+#define INDEX_SIZE (1 << INDEX_BITS)
+#define INDEX_MASK (INDEX_SIZE - 1)
+#define NO_NODE (-1)
+
+/*
+ * Indexes: by node ID and by IPv4
+ */
+#define KEY_NODE 0
+#define KEY_IPV4 1
+
+
+typedef struct {
+    TimerEntry expiry;
+    int in_use;
+    int next_free;
+    uint64_t first_seen_ms;
+    uint64_t last_seen_ms;
+    uint32_t reports;
+    StatusReport report;
+} RegistryNode;
+
+typedef struct {
+    pthread_mutex_t lock;
+    TimerWheel wheel;
+    uint16_t index[2][INDEX_SIZE];           // Node within the shard + 1, 0 if empty
+    int free_head;
+    RegistryStats stats;
+} RegistryShard;
+
+static RegistryNode nodes[REGISTRY_MAX_NODES];   // Shard s owns nodes[s * SHARD_NODES ...]
+static RegistryShard shards[REGISTRY_SHARDS];
+static uint32_t expire_after_ms = REGISTRY_EXPIRE_MS;
+
+
+/** @brief mix
+ *
+ *  Spreads the bits of a key (murmur3 finalizer): node IDs are already
+ *  hashes, IPv4 addresses of one subnet differ only in the last byte.
+ *
+ *  @return uint32_t : Hash
+ */
+static uint32_t mix(uint32_t key)
+{
+    key ^= key >> 16;
+    key *= 0x85EBCA6Bu;
+    key ^= key >> 13;
+    key *= 0xC2B2AE35u;
+    key ^= key >> 16;
+
+    return key;
+}
+
+/** @brief shard_of
+ *
+ *  @return RegistryShard* : Shard of a node ID (low bits of the hash)
+ */
+static RegistryShard *shard_of(uint32_t node_id)
+{
+    return &shards[mix(node_id) & (REGISTRY_SHARDS - 1)];
+}
+
+/** @brief home_of
+ *
+ *  @return int : First index position for a key (high bits of the hash)
+ */
+static int home_of(uint32_t key)
+{
+    return (int)(mix(key) >> (32 - INDEX_BITS));
+}
+
+/** @brief node_at
+ *
+ *  @return RegistryNode* : Node n of a shard
+ */
+static RegistryNode *node_at(RegistryShard *shard, int n)
+{
+    return &nodes[(shard - shards) * SHARD_NODES + n];
+}
+
+/** @brief key_of
+ *
+ *  @return uint32_t : The node's key in index which
+ */
+static uint32_t key_of(const RegistryNode *node, int which)
+{
+    return (which == KEY_NODE) ? node->report.node_id : node->report.ipv4;
+}
+
+/** @brief index_find
+ *
+ *  @param shard : Shard, locked
+ *  @param which : KEY_NODE or KEY_IPV4
+ *  @param key   : Key
+ *
+ *  @return int : First node of the shard with that key, NO_NODE if there is none
+ */
+static int index_find(RegistryShard *shard, int which, uint32_t key)
+{
+    const uint16_t *index = shard->index[which];
+    int pos = home_of(key);
+    int n;
+
+    while (index[pos] != 0)
+    {
+        n = index[pos] - 1;
+        if (key_of(node_at(shard, n), which) == key)
+        {
+            return n;
+        }
+        pos = (pos + 1) & INDEX_MASK;
+    }
+
+    return NO_NODE;
+}
+
+/** @brief index_insert
+ *
+ *  @return void : This function does not return any value.
+ */
+static void index_insert(RegistryShard *shard, int which, int n)
+{
+    uint16_t *index = shard->index[which];
+    int pos = home_of(key_of(node_at(shard, n), which));
+
+    while (index[pos] != 0)
+    {
+        pos = (pos + 1) & INDEX_MASK;
+    }
+    index[pos] = (uint16_t)(n + 1);
+}
+
+/** @brief index_remove
+ *
+ *  Removes node n and moves back the entries after it that probed past
+ *  its position, so every lookup still ends at the first empty entry.
+ *
+ *  @return void : This function does not return any value.
+ */
+static void index_remove(RegistryShard *shard, int which, int n)
+{
+    uint16_t *index = shard->index[which];
+    int hole = home_of(key_of(node_at(shard, n), which));
+    int pos;
+    int home;
+
+    while (index[hole] != n + 1)
+    {
+        if (index[hole] == 0)
+        {
+            return;
+        }
+        hole = (hole + 1) & INDEX_MASK;
+    }
+
+    pos = hole;
+    while (1)
+    {
+        pos = (pos + 1) & INDEX_MASK;
+        if (index[pos] == 0)
+        {
+            break;
+        }
+
+        /*
+         * The entry may fill the hole unless its home lies cyclically in (hole, pos]
+         */
+        home = home_of(key_of(node_at(shard, index[pos] - 1), which));
+        if (((pos - home) & INDEX_MASK) >= ((pos - hole) & INDEX_MASK))
+        {
+            index[hole] = index[pos];
+            hole = pos;
+        }
+    }
+    index[hole] = 0;
+}
+
+/** @brief release_node
+ *
+ *  Takes node n out of the indexes and the wheel and frees its slot.
+ *  Called with the shard locked.
+ *
+ *  @return void : This function does not return any value.
+ */
+static void release_node(RegistryShard *shard, int n)
+{
+    RegistryNode *node = node_at(shard, n);
+
+    index_remove(shard, KEY_NODE, n);
+    index_remove(shard, KEY_IPV4, n);
+    timer_wheel_cancel(&shard->wheel, &node->expiry);
+
+    node->in_use = 0;
+    node->next_free = shard->free_head;
+    shard->free_head = n;
+    shard->stats.nodes--;
+}
+
+/** @brief expire_node
+ *
+ *  Expiry timer of a node, run by registry_expire() with its shard locked.
+ *
+ *  @param timer : The node's expiry
+ *
+ *  @return void : This function does not return any value.
+ */
+static void expire_node(TimerEntry *timer)
+{
+    RegistryNode *node = (RegistryNode *)((char *)timer - offsetof(RegistryNode, expiry));
+    int slot = (int)(node - nodes);
+    RegistryShard *shard = &shards[slot / SHARD_NODES];
+
+    shard->stats.expired++;
+    release_node(shard, slot % SHARD_NODES);
+}
+
+/** @brief copy_entry
+ *
+ *  @return void : This function does not return any value.
+ */
+static void copy_entry(const RegistryNode *node, RegistryEntry *entry)
+{
+    entry->slot = (int)(node - nodes);
+    entry->first_seen_ms = node->first_seen_ms;
+    entry->last_seen_ms = node->last_seen_ms;
+    entry->reports = node->reports;
+    entry->report = node->report;
+}
+
+void registry_init(uint32_t expire_ms, uint64_t now_ms)
+{
+    RegistryShard *shard;
+    int s;
+    int n;
+
+    expire_after_ms = expire_ms;
+    memset(nodes, 0, sizeof(nodes));
+
+    for (s = 0; s < REGISTRY_SHARDS; s++)
+    {
+        shard = &shards[s];
+        memset(shard, 0, sizeof(*shard));
+        pthread_mutex_init(&shard->lock, NULL);
+        timer_wheel_init(&shard->wheel, REGISTRY_TICK_MS, now_ms);
+
+        /*
+         * Free list in slot order, so the first nodes get the first slots
+         */
+        for (n = 0; n < SHARD_NODES; n++)
+        {
+            node_at(shard, n)->next_free = (n + 1 < SHARD_NODES) ? n + 1 : NO_NODE;
+            node_at(shard, n)->expiry.fn = expire_node;
+        }
+        shard->free_head = 0;
+    }
+}
+
+int registry_update(const StatusReport *report, uint64_t now_ms)
+{
+    RegistryShard *shard = shard_of(report->node_id);
+    RegistryNode *node;
+    int n;
+
+    pthread_mutex_lock(&shard->lock);
+
+    n = index_find(shard, KEY_NODE, report->node_id);
+    if (n == NO_NODE)
+    {
+        if (shard->free_head == NO_NODE)
+        {
+            shard->stats.dropped++;
+            pthread_mutex_unlock(&shard->lock);
+            return -1;
+        }
+
+        n = shard->free_head;
+        node = node_at(shard, n);
+        shard->free_head = node->next_free;
+
+        node->in_use = 1;
+        node->first_seen_ms = now_ms;
+        node->reports = 0;
+        node->report = *report;
+        index_insert(shard, KEY_NODE, n);
+        index_insert(shard, KEY_IPV4, n);
+        shard->stats.nodes++;
+        shard->stats.added++;
+    }
+    else
+    {
+        node = node_at(shard, n);
+
+        /*
+         * Same node, new address: only the IPv4 index changes
+         */
+        if (node->report.ipv4 != report->ipv4)
+        {
+            index_remove(shard, KEY_IPV4, n);
+            node->report = *report;
+            index_insert(shard, KEY_IPV4, n);
+        }
+        else
+        {
+            node->report = *report;
+        }
+        shard->stats.updated++;
+    }
+
+    node->last_seen_ms = now_ms;
+    node->reports++;
+
+    /*
+     * Text reports come from clients that report only on a change: silence
+     * says nothing about them, so they do not expire
+     */
+    if (report->flags & STATUS_BRIDGE_LEGACY)
+    {
+        timer_wheel_cancel(&shard->wheel, &node->expiry);
+    }
+    else
+    {
+        timer_wheel_add(&shard->wheel, &node->expiry, now_ms + expire_after_ms);
+    }
+
+    pthread_mutex_unlock(&shard->lock);
+
+    return (int)(node - nodes);
+}
+
+int registry_touch_ipv4(uint32_t ipv4, uint64_t now_ms)
+{
+    const uint16_t *index;
+    RegistryShard *shard;
+    RegistryNode *node;
+    int touched = 0;
+    int pos;
+    int s;
+
+    /*
+     * The address says nothing about the shard: ask each one
+     */
+    for (s = 0; s < REGISTRY_SHARDS; s++)
+    {
+        shard = &shards[s];
+        pthread_mutex_lock(&shard->lock);
+
+        index = shard->index[KEY_IPV4];
+        for (pos = home_of(ipv4); index[pos] != 0; pos = (pos + 1) & INDEX_MASK)
+        {
+            node = node_at(shard, index[pos] - 1);
+            if (node->report.ipv4 == ipv4)
+            {
+                if (!(node->report.flags & STATUS_BRIDGE_LEGACY))
+                {
+                    timer_wheel_add(&shard->wheel, &node->expiry, now_ms + expire_after_ms);
+                }
+                touched++;
+            }
+        }
+
+        pthread_mutex_unlock(&shard->lock);
+    }
+
+    return touched;
+}
+
+int registry_remove_ipv4(uint32_t ipv4)
+{
+    RegistryShard *shard;
+    int removed = 0;
+    int n;
+    int s;
+
+    for (s = 0; s < REGISTRY_SHARDS; s++)
+    {
+        shard = &shards[s];
+        pthread_mutex_lock(&shard->lock);
+
+        while ((n = index_find(shard, KEY_IPV4, ipv4)) != NO_NODE)
+        {
+            release_node(shard, n);
+            shard->stats.removed++;
+            removed++;
+        }
+
+        pthread_mutex_unlock(&shard->lock);
+    }
+
+    return removed;
+}
+
+int registry_lookup_node(uint32_t node_id, RegistryEntry *entry)
+{
+    RegistryShard *shard = shard_of(node_id);
+    int n;
+
+    pthread_mutex_lock(&shard->lock);
+    n = index_find(shard, KEY_NODE, node_id);
+    if (n != NO_NODE)
+    {
+        copy_entry(node_at(shard, n), entry);
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    return (n != NO_NODE) ? 0 : -1;
+}
+
+int registry_lookup_ipv4(uint32_t ipv4, RegistryEntry *entry)
+{
+    RegistryShard *shard;
+    int n = NO_NODE;
+    int s;
+
+    for (s = 0; s < REGISTRY_SHARDS && n == NO_NODE; s++)
+    {
+        shard = &shards[s];
+        pthread_mutex_lock(&shard->lock);
+        n = index_find(shard, KEY_IPV4, ipv4);
+        if (n != NO_NODE)
+        {
+            copy_entry(node_at(shard, n), entry);
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+
+    return (n != NO_NODE) ? 0 : -1;
+}
+
+int registry_expire(uint64_t now_ms)
+{
+    int expired = 0;
+    int s;
+
+    for (s = 0; s < REGISTRY_SHARDS; s++)
+    {
+        pthread_mutex_lock(&shards[s].lock);
+        expired += timer_wheel_advance(&shards[s].wheel, now_ms);
+        pthread_mutex_unlock(&shards[s].lock);
+    }
+
+    return expired;
+}
+
+int registry_snapshot(RegistryEntry *entries, int max)
+{
+    int count = 0;
+    int s;
+    int n;
+
+    for (s = 0; s < REGISTRY_SHARDS && count < max; s++)
+    {
+        pthread_mutex_lock(&shards[s].lock);
+        for (n = 0; n < SHARD_NODES && count < max; n++)
+        {
+            if (node_at(&shards[s], n)->in_use)
+            {
+                copy_entry(node_at(&shards[s], n), &entries[count++]);
+            }
+        }
+        pthread_mutex_unlock(&shards[s].lock);
+    }
+
+    return count;
+}
+
+void registry_stats(RegistryStats *out)
+{
+    int s;
+
+    memset(out, 0, sizeof(*out));
+    for (s = 0; s < REGISTRY_SHARDS; s++)
+    {
+        pthread_mutex_lock(&shards[s].lock);
+        out->nodes += shards[s].stats.nodes;
+        out->added += shards[s].stats.added;
+        out->updated += shards[s].stats.updated;
+        out->expired += shards[s].stats.expired;
+        out->removed += shards[s].stats.removed;
+        out->dropped += shards[s].stats.dropped;
+        pthread_mutex_unlock(&shards[s].lock);
+    }
+}
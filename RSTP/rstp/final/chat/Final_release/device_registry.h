@@ -0,0 +1,138 @@
+/** @file device_registry.h
+ *  @brief Nodes known to the server, keyed by node ID, with expiry
+ *
+ *  Every node that reports gets a slot that stays its own until it is
+ *  removed, so a slot number is a stable handle and the table can be
+ *  printed in slot order. Lookups go through open-addressed hash indexes
+ *  (linear probing, backward-shift deletion, so no tombstones pile up
+ *  under churn):
+ *
+ *    - by node ID, the key: a node keeps its slot across IP changes
+ *    - by IPv4 (network byte order), for the prober: may hold the same
+ *      address more than once, e.g. a board that was renamed
+ *
+ *  The registry is split into REGISTRY_SHARDS shards by a hash of the node
+ *  ID, each with its own lock, slots, indexes and timer wheel. An update
+ *  locks one shard for a hash lookup and a copy; a snapshot locks one shard
+ *  at a time, so the receiving thread never waits for a whole table walk.
+ *
+ *  A node that has not reported (or been touched) for the expiry time is
+ *  dropped by registry_expire(), from the shard's timer wheel: refreshing
+ *  a node moves its timer, nothing is scanned. Nodes whose last report was
+ *  a text one (STATUS_BRIDGE_LEGACY) do not expire: those clients report
+ *  only on a change. registry_remove_ipv4() still drops them.
+ *
+ *  @author Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#ifndef DEVICE_REGISTRY_H
+#define DEVICE_REGISTRY_H
+
+#include <stdint.h>
+#include "status_proto.h"
+
+#define REGISTRY_MAX_NODES 8192
+#define REGISTRY_SHARDS 16        // Power of two
+#define REGISTRY_EXPIRE_MS 30000  // Three missed refreshes of a client (REPORT_REFRESH_MS), binary reports only
+#define REGISTRY_TICK_MS 100      // Expiry resolution
+
+/*
+ * A node as returned by the lookups and the snapshot
+ */
+typedef struct {
+    int slot;                     // Stable while the node is registered
+    uint64_t first_seen_ms;       // Clock of the caller's now_ms
+    uint64_t last_seen_ms;
+    uint32_t reports;
+    StatusReport report;          // Last report
+} RegistryEntry;
+
+typedef struct {
+    int nodes;
+    uint32_t added;
+    uint32_t updated;
+    uint32_t expired;
+    uint32_t removed;             // registry_remove_ipv4()
+    uint32_t dropped;             // New node, shard full
+} RegistryStats;
+
+
+/** @brief registry_init
+ *
+ *  @param expire_ms : Time without a report after which a node is dropped
+ *  @param now_ms    : Current time, any monotonic millisecond clock
+ *
+ *  @return void : This function does not return any value.
+ */
+void registry_init(uint32_t expire_ms, uint64_t now_ms);
+
+/** @brief registry_update
+ *
+ *  Stores a report: updates the node with its node ID, or adds it.
+ *
+ *  @param report : Decoded report
+ *  @param now_ms : Receive time
+ *
+ *  @return int : Slot of the node, -1 if it is new and its shard is full
+ */
+int registry_update(const StatusReport *report, uint64_t now_ms);
+
+/** @brief registry_touch_ipv4
+ *
+ *  Restarts the expiry of every node with this address without a report,
+ *  for nodes known to be alive otherwise (they answer the prober). Nodes
+ *  that do not expire are counted but stay that way.
+ *
+ *  @return int : Number of nodes touched
+ */
+int registry_touch_ipv4(uint32_t ipv4, uint64_t now_ms);
+
+/** @brief registry_remove_ipv4
+ *
+ *  Removes every node with this address.
+ *
+ *  @return int : Number of nodes removed
+ */
+int registry_remove_ipv4(uint32_t ipv4);
+
+/** @brief registry_lookup_node
+ *
+ *  @return int : Returns 0 and fills entry if the node is registered, -1 otherwise
+ */
+int registry_lookup_node(uint32_t node_id, RegistryEntry *entry);
+
+/** @brief registry_lookup_ipv4
+ *
+ *  @return int : Returns 0 and fills entry with a node of that address, -1 if there is none
+ */
+int registry_lookup_ipv4(uint32_t ipv4, RegistryEntry *entry);
+
+/** @brief registry_expire
+ *
+ *  Drops the nodes whose expiry time has passed.
+ *
+ *  @return int : Number of nodes dropped
+ */
+int registry_expire(uint64_t now_ms);
+
+/** @brief registry_snapshot
+ *
+ *  Copies the registered nodes in slot order; each shard is consistent in
+ *  itself, the shards are copied one after the other.
+ *
+ *  @param entries : Receives the nodes
+ *  @param max     : Size of entries
+ *
+ *  @return int : Number of nodes copied
+ */
+int registry_snapshot(RegistryEntry *entries, int max);
+
+/** @brief registry_stats
+ *
+ *  @return void : This function does not return any value.
+ */
+void registry_stats(RegistryStats *stats);
+
+#endif /* DEVICE_REGISTRY_H */
@@ -0,0 +1,224 @@
+/** @file health_bench.c
+ *  @brief CPU time of one bridge health evaluation: shell commands against the cache
+ *
+ *  Runs the LED thread's health check in a loop, three ways:
+ *
+ *    popen     ifconfig br0, brctl show, brctl showstp br0, mstpctl showbridge br0
+ *              (what client_AM437x did every second before bridge_health)
+ *    cached    bridge_health_get(): one pread of stp_state, the rest is a copy
+ *    resync    bridge_health_resync() + bridge_health_get(): a full netlink dump
+ *              every time, the cost after the socket overflowed
+ *
+ *  and prints the CPU time (user + system, own and of the child processes)
+ *  and the wall time per evaluation. Needs a br0. The popen run needs
+ *  ifconfig, brctl and mstpctl: without them it would time only the shell
+ *  failing to find them, so it is skipped, and with it the comparison.
+ *
+ *    gcc -O2 health_bench.c bridge_health.c -o health_bench -lpthread
+ *    ./health_bench [popen iterations]
+ *
+ *  @author Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "bridge_health.h"
+
+#define BRIDGE_INTERFACE "br0"
+
+
+/*
+ * The four commands of the old check, output read and matched as before
+ */
+static const char *old_commands[] = {
+    "ifconfig " BRIDGE_INTERFACE " 2>/dev/null",
+    "brctl show 2>/dev/null",
+    "brctl showstp " BRIDGE_INTERFACE " 2>/dev/null",
+    "mstpctl showbridge " BRIDGE_INTERFACE " 2>/dev/null",
+};
+static const char *old_patterns[] = { "inet ", "yes", "disabled", "rstp" };
+static const char *old_tools[] = { "ifconfig", "brctl", "mstpctl" };
+
+static volatile int sink;
+
+
+/** @brief cpu_us
+ *
+ *  @return double : CPU time used so far by the process and its reaped children, in microseconds
+ */
+static double cpu_us(void)
+{
+    struct rusage self, children;
+
+    getrusage(RUSAGE_SELF, &self);
+    getrusage(RUSAGE_CHILDREN, &children);
+
+    return (self.ru_utime.tv_sec + self.ru_stime.tv_sec + children.ru_utime.tv_sec + children.ru_stime.tv_sec) * 1e6 +
+           (self.ru_utime.tv_usec + self.ru_stime.tv_usec + children.ru_utime.tv_usec + children.ru_stime.tv_usec);
+}
+
+/** @brief wall_us
+ *
+ *  @return double : Monotonic time in microseconds
+ */
+static double wall_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/** @brief evaluate_popen
+ *
+ *  One health check the old way.
+ *
+ *  @return int : Number of matching lines, so nothing is optimised away
+ */
+static int evaluate_popen(void)
+{
+    FILE *fp;
+    char line[256];
+    int matches = 0;
+    int i;
+
+    for (i = 0; i < (int)(sizeof(old_commands) / sizeof(old_commands[0])); i++)
+    {
+        fp = popen(old_commands[i], "r");
+        if (fp == NULL)
+        {
+            perror("popen failed");
+            continue;
+        }
+        while (fgets(line, sizeof(line), fp))
+        {
+            if (strstr(line, old_patterns[i]) != NULL)
+            {
+                matches++;
+            }
+        }
+        pclose(fp);
+    }
+
+    return matches;
+}
+
+/** @brief old_tools_missing
+ *
+ *  @return const char* : First command of the old check that is not installed, NULL if none
+ */
+static const char *old_tools_missing(void)
+{
+    char command[64];
+    int i;
+
+    for (i = 0; i < (int)(sizeof(old_tools) / sizeof(old_tools[0])); i++)
+    {
+        snprintf(command, sizeof(command), "command -v %s >/dev/null 2>&1", old_tools[i]);
+        if (system(command) != 0)
+        {
+            return old_tools[i];
+        }
+    }
+
+    return NULL;
+}
+
+/** @brief evaluate_cached
+ *
+ *  One health check from the cache.
+ *
+ *  @return int : Verdict as the LED thread computes it
+ */
+static int evaluate_cached(void)
+{
+    BridgeHealth health;
+
+    bridge_health_get(&health);
+    return health.has_ip && health.stp_state == HEALTH_STP_USER && health.disabled_ports == 0;
+}
+
+/** @brief evaluate_resync
+ *
+ *  One health check after throwing the cache away.
+ *
+ *  @return int : Verdict
+ */
+static int evaluate_resync(void)
+{
+    bridge_health_resync();
+    return evaluate_cached();
+}
+
+/** @brief run
+ *
+ *  Times one way of evaluating and prints the result.
+ *
+ *  @param name       : Label
+ *  @param evaluate   : One evaluation
+ *  @param iterations : Number of evaluations
+ *
+ *  @return double : CPU microseconds per evaluation
+ */
+static double run(const char *name, int (*evaluate)(void), int iterations)
+{
+    double cpu_start = cpu_us();
+    double wall_start = wall_us();
+    double cpu;
+    double wall;
+    int i;
+
+    for (i = 0; i < iterations; i++)
+    {
+        sink += evaluate();
+    }
+
+    cpu = (cpu_us() - cpu_start) / iterations;
+    wall = (wall_us() - wall_start) / iterations;
+    printf("%-8s %7d evaluations  %10.2f us CPU  %10.2f us wall  per evaluation\n", name, iterations, cpu, wall);
+
+    return cpu;
+}
+
+int main(int argc, char *argv[])
+{
+    int iterations = (argc > 1) ? atoi(argv[1]) : 200;
+    BridgeHealth health;
+    const char *missing;
+    double before = 0.0;
+    double after;
+
+    if (iterations < 1 || bridge_health_open(BRIDGE_INTERFACE) < 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    bridge_health_get(&health);
+    printf("%s: index %d, IP %s, stp_state %d, %d ports (%d disabled)\n\n", BRIDGE_INTERFACE, health.bridge_index,
+           health.has_ip ? health.ip : "none", health.stp_state, health.port_count, health.disabled_ports);
+
+    missing = old_tools_missing();
+    if (missing != NULL)
+    {
+        printf("popen    skipped: %s not installed, no baseline for the old check\n", missing);
+    }
+    else
+    {
+        before = run("popen", evaluate_popen, iterations);
+    }
+    after = run("cached", evaluate_cached, iterations * 1000);
+    run("resync", evaluate_resync, iterations * 10);
+
+    if (missing == NULL)
+    {
+        printf("\ncached evaluation uses %.0fx less CPU than the popen one\n", (after > 0) ? before / after : 0.0);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,504 @@
+/** @file icmp_prober.c
+ *  @brief Reachability of the known devices from one ICMP socket, on its own thread
+ *
+ *  See icmp_prober.h.
+ *
+ *  @author Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip_icmp.h>
+#include "icmp_prober.h"
+
+#define INDEX_BITS 10
+#define INDEX_MASK ((1 << INDEX_BITS) - 1)
+#define SWEEP_MASK 0x3F
+#define REPLY_BUFFER_SIZE 1500
+#define SEND_BATCH 64              // Requests sent before the replies so far are read
+#define SOCKET_BUFFER_SIZE (1024 * 1024)
+
+
+typedef struct {
+    ProbeStatus status;
+    struct in_addr addr;
+    uint64_t sent_us;             // Request of the current sweep
+    int answered;                 // Reply of the current sweep seen
+} ProbeTarget;
+
+static pthread_mutex_t prober_lock = PTHREAD_MUTEX_INITIALIZER;
+static ProbeTarget targets[PROBE_MAX_TARGETS];
+static int target_count;
+static ProberStats stats;
+
+static int icmp_fd = -1;
+static int raw_socket;            // 1: raw socket, IP header in front, own ID and checksum
+static uint16_t ident;
+static uint32_t sweep;
+static int sweep_open;
+static int sweep_answered;
+static int sweep_targets;
+static uint64_t sweep_start_us;
+
+
+/** @brief now_us
+ *
+ *  @return uint64_t : Monotonic time in microseconds
+ */
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/** @brief icmp_checksum
+ *
+ *  Internet checksum, only needed on the raw socket.
+ *
+ *  @return uint16_t : Checksum
+ */
+static uint16_t icmp_checksum(const void *data, int len)
+{
+    const uint16_t *word = data;
+    uint32_t sum = 0;
+
+    while (len > 1)
+    {
+        sum += *word++;
+        len -= 2;
+    }
+    if (len == 1)
+    {
+        sum += *(const uint8_t *)word;
+    }
+    sum = (sum >> 16) + (sum & 0xFFFF);
+    sum += sum >> 16;
+
+    return (uint16_t)~sum;
+}
+
+/** @brief open_icmp_socket
+ *
+ *  ICMP datagram socket if the group range allows it, raw socket otherwise.
+ *
+ *  @return int : Returns 0 on success, -1 on failure
+ */
+static int open_icmp_socket(void)
+{
+    struct sockaddr_in local;
+    socklen_t len = sizeof(local);
+    int size = SOCKET_BUFFER_SIZE;
+
+    icmp_fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_ICMP);
+    if (icmp_fd >= 0)
+    {
+        /*
+         * The kernel puts the socket's "port" in the ID of every request
+         */
+        memset(&local, 0, sizeof(local));
+        local.sin_family = AF_INET;
+        if (bind(icmp_fd, (struct sockaddr *)&local, sizeof(local)) == 0 &&
+            getsockname(icmp_fd, (struct sockaddr *)&local, &len) == 0)
+        {
+            ident = ntohs(local.sin_port);
+        }
+        raw_socket = 0;
+    }
+    else
+    {
+        icmp_fd = socket(AF_INET, SOCK_RAW | SOCK_CLOEXEC, IPPROTO_ICMP);
+        if (icmp_fd < 0)
+        {
+            perror("ICMP socket creation failed");
+            return -1;
+        }
+        ident = (uint16_t)getpid();
+        raw_socket = 1;
+    }
+
+    /*
+     * A whole sweep is sent at once and answered at once; past rmem_max if allowed
+     */
+    setsockopt(icmp_fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    if (setsockopt(icmp_fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) < 0)
+    {
+        setsockopt(icmp_fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    }
+
+    return 0;
+}
+
+/** @brief finish_sweep
+ *
+ *  Counts every target that did not answer the sweep as lost. Called with
+ *  prober_lock held.
+ *
+ *  @return void : This function does not return any value.
+ */
+static void finish_sweep(void)
+{
+    ProbeTarget *target;
+    int i;
+
+    if (!sweep_open)
+    {
+        return;
+    }
+    sweep_open = 0;
+
+    for (i = 0; i < sweep_targets; i++)
+    {
+        target = &targets[i];
+        if (!target->answered)
+        {
+            target->status.lost_in_row++;
+            if (target->status.lost_in_row >= PROBE_LOSS_LIMIT)
+            {
+                target->status.reachable = 0;
+            }
+        }
+    }
+
+    stats.sweeps++;
+    stats.last_sweep_us = (uint32_t)(now_us() - sweep_start_us);
+}
+
+/** @brief handle_reply
+ *
+ *  Matches one echo reply to its target.
+ *
+ *  @param packet : ICMP message (after the IP header)
+ *  @param len    : Its length
+ *  @param from   : Source address
+ *  @param at_us  : Receive time
+ *
+ *  @return void : This function does not return any value.
+ */
+static void handle_reply(const uint8_t *packet, int len, struct in_addr from, uint64_t at_us)
+{
+    const struct icmphdr *reply = (const struct icmphdr *)packet;
+    ProbeTarget *target;
+    uint16_t seq;
+    uint32_t rtt;
+    int index;
+
+    if (len < (int)sizeof(*reply) || reply->type != ICMP_ECHOREPLY ||
+        (raw_socket && ntohs(reply->un.echo.id) != ident))
+    {
+        return;
+    }
+
+    seq = ntohs(reply->un.echo.sequence);
+    index = seq & INDEX_MASK;
+
+    pthread_mutex_lock(&prober_lock);
+
+    if (index >= sweep_targets || targets[index].addr.s_addr != from.s_addr)
+    {
+        pthread_mutex_unlock(&prober_lock);
+        return;
+    }
+    target = &targets[index];
+
+    if (!sweep_open || (seq >> INDEX_BITS) != (sweep & SWEEP_MASK) || target->answered)
+    {
+        stats.late_replies++;
+        pthread_mutex_unlock(&prober_lock);
+        return;
+    }
+
+    rtt = (uint32_t)(at_us - target->sent_us);
+    target->answered = 1;
+    target->status.received++;
+    target->status.lost_in_row = 0;
+    target->status.reachable = 1;
+    target->status.rtt_us = rtt;
+    target->status.srtt_us = (target->status.srtt_us == 0) ? rtt :
+                             (uint32_t)(((uint64_t)target->status.srtt_us * 7 + rtt) / 8);
+
+    /*
+     * Everyone answered: the sweep is done before its timeout
+     */
+    if (++sweep_answered == sweep_targets)
+    {
+        finish_sweep();
+    }
+
+    pthread_mutex_unlock(&prober_lock);
+}
+
+/** @brief receive_replies
+ *
+ *  Reads every reply waiting on the socket.
+ *
+ *  @return void : This function does not return any value.
+ */
+static void receive_replies(void)
+{
+    uint8_t buffer[REPLY_BUFFER_SIZE];
+    struct sockaddr_in from;
+    socklen_t from_len;
+    const struct iphdr *ip;
+    int header_len;
+    int len;
+
+    while (1)
+    {
+        from_len = sizeof(from);
+        len = recvfrom(icmp_fd, buffer, sizeof(buffer), MSG_DONTWAIT, (struct sockaddr *)&from, &from_len);
+        if (len < 0)
+        {
+            return;
+        }
+
+        header_len = 0;
+        if (raw_socket)
+        {
+            ip = (const struct iphdr *)buffer;
+            header_len = ip->ihl * 4;
+            if (len < header_len)
+            {
+                continue;
+            }
+        }
+
+        handle_reply(buffer + header_len, len - header_len, from.sin_addr, now_us());
+    }
+}
+
+/** @brief start_sweep
+ *
+ *  Sends one echo request to every target, SEND_BATCH at a time with the
+ *  replies that already came read in between, so they do not pile up in
+ *  the socket.
+ *
+ *  @return void : This function does not return any value.
+ */
+static void start_sweep(void)
+{
+    struct icmphdr request;
+    struct sockaddr_in to;
+    int count;
+    int i;
+
+    pthread_mutex_lock(&prober_lock);
+    sweep++;
+    sweep_open = 1;
+    sweep_answered = 0;
+    sweep_targets = target_count;
+    sweep_start_us = now_us();
+    count = sweep_targets;
+    if (count == 0)
+    {
+        finish_sweep();
+    }
+    pthread_mutex_unlock(&prober_lock);
+
+    memset(&to, 0, sizeof(to));
+    to.sin_family = AF_INET;
+
+    for (i = 0; i < count; i++)
+    {
+        memset(&request, 0, sizeof(request));
+        request.type = ICMP_ECHO;
+        request.un.echo.id = htons(ident);
+        request.un.echo.sequence = htons((uint16_t)(((sweep & SWEEP_MASK) << INDEX_BITS) | i));
+        if (raw_socket)
+        {
+            request.checksum = icmp_checksum(&request, sizeof(request));
+        }
+
+        pthread_mutex_lock(&prober_lock);
+        to.sin_addr = targets[i].addr;
+        targets[i].answered = 0;
+        targets[i].sent_us = now_us();
+        targets[i].status.sent++;
+        pthread_mutex_unlock(&prober_lock);
+
+        /*
+         * No route or no buffer is the same as no reply
+         */
+        sendto(icmp_fd, &request, sizeof(request), 0, (struct sockaddr *)&to, sizeof(to));
+
+        if ((i + 1) % SEND_BATCH == 0)
+        {
+            receive_replies();
+        }
+    }
+}
+
+/** @brief prober_thread
+ *
+ *  Sweeps every PROBE_INTERVAL_MS and reads the replies in between.
+ *
+ *  @param arg : Not used
+ *
+ *  @return void* : Does not return
+ */
+static void *prober_thread(void *arg)
+{
+    struct pollfd fds[1];
+    uint64_t next_sweep_us = now_us();
+    uint64_t deadline_us = 0;
+    uint64_t now;
+    uint64_t wake_us;
+    int open;
+
+    (void)arg;
+
+    fds[0].fd = icmp_fd;
+    fds[0].events = POLLIN;
+
+    while (1)
+    {
+        now = now_us();
+
+        pthread_mutex_lock(&prober_lock);
+        if (sweep_open && now >= deadline_us)
+        {
+            finish_sweep();
+        }
+        pthread_mutex_unlock(&prober_lock);
+
+        if (now >= next_sweep_us)
+        {
+            start_sweep();
+            deadline_us = now + PROBE_TIMEOUT_MS * 1000ULL;
+            next_sweep_us += PROBE_INTERVAL_MS * 1000ULL;
+            if (next_sweep_us <= now)
+            {
+                next_sweep_us = now + PROBE_INTERVAL_MS * 1000ULL;
+            }
+        }
+
+        pthread_mutex_lock(&prober_lock);
+        open = sweep_open;
+        pthread_mutex_unlock(&prober_lock);
+
+        wake_us = (open && deadline_us < next_sweep_us) ? deadline_us : next_sweep_us;
+        now = now_us();
+
+        if (poll(fds, 1, (wake_us > now) ? (int)((wake_us - now + 999) / 1000) : 0) > 0)
+        {
+            receive_replies();
+        }
+    }
+
+    return NULL;
+}
+
+int icmp_prober_add(const char *name, const char *ip)
+{
+    struct in_addr addr;
+    ProbeTarget *target;
+    int index;
+
+    if (inet_pton(AF_INET, ip, &addr) != 1)
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&prober_lock);
+    if (target_count >= PROBE_MAX_TARGETS)
+    {
+        pthread_mutex_unlock(&prober_lock);
+        return -1;
+    }
+
+    index = target_count;
+    target = &targets[index];
+    memset(target, 0, sizeof(*target));
+    target->addr = addr;
+    target->status.reachable = -1;
+    snprintf(target->status.name, sizeof(target->status.name), "%s", name);
+    inet_ntop(AF_INET, &addr, target->status.ip, sizeof(target->status.ip));
+
+    /*
+     * Joins with the next sweep
+     */
+    target_count++;
+    stats.targets = target_count;
+    pthread_mutex_unlock(&prober_lock);
+
+    return index;
+}
+
+int icmp_prober_start(void)
+{
+    pthread_t thread;
+
+    if (open_icmp_socket() != 0)
+    {
+        return -1;
+    }
+
+    if (pthread_create(&thread, NULL, prober_thread, NULL) != 0)
+    {
+        perror("Failed to create prober thread");
+        close(icmp_fd);
+        icmp_fd = -1;
+        return -1;
+    }
+    pthread_detach(thread);
+
+    return 0;
+}
+
+int icmp_prober_status(int index, ProbeStatus *status)
+{
+    pthread_mutex_lock(&prober_lock);
+    if (index < 0 || index >= target_count)
+    {
+        pthread_mutex_unlock(&prober_lock);
+        return -1;
+    }
+    *status = targets[index].status;
+    pthread_mutex_unlock(&prober_lock);
+
+    return 0;
+}
+
+int icmp_prober_find(const char *ip)
+{
+    struct in_addr addr;
+    int index = -1;
+    int i;
+
+    if (inet_pton(AF_INET, ip, &addr) != 1)
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&prober_lock);
+    for (i = 0; i < target_count; i++)
+    {
+        if (targets[i].addr.s_addr == addr.s_addr)
+        {
+            index = i;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&prober_lock);
+
+    return index;
+}
+
+void icmp_prober_stats(ProberStats *out)
+{
+    pthread_mutex_lock(&prober_lock);
+    *out = stats;
+    pthread_mutex_unlock(&prober_lock);
+}
@@ -0,0 +1,98 @@
+/** @file icmp_prober.h
+ *  @brief Reachability of the known devices from one ICMP socket, on its own thread
+ *
+ *  The server used to run "ping -c 1 -W 0.5" once per device for every
+ *  report it received, one after the other. The prober instead sends an
+ *  echo request to every target at once every PROBE_INTERVAL_MS from one
+ *  socket and matches the replies as they come:
+ *
+ *    - ICMP sequence = sweep number (upper 6 bits) | target index (lower 10),
+ *      so a reply names its target and a late reply of an older sweep is
+ *      told apart from a current one; the source address must match too
+ *    - the ICMP ID is the socket's: a datagram ("ping") socket gets only its
+ *      own replies from the kernel, on a raw socket the ID is checked
+ *
+ *  A target is unreachable after PROBE_LOSS_LIMIT sweeps in a row without
+ *  a reply, reachable again with the first reply. RTT is kept as the last
+ *  value and as a smoothed average (1/8 weight, as TCP's SRTT).
+ *
+ *  An unprivileged ICMP datagram socket is used when net.ipv4.ping_group_range
+ *  allows it, a raw socket (root) otherwise.
+ *
+ *  @author Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#ifndef ICMP_PROBER_H
+#define ICMP_PROBER_H
+
+#include <stdint.h>
+
+#define PROBE_MAX_TARGETS 1024    // Index must fit the lower 10 bits of the sequence
+#define PROBE_INTERVAL_MS 1000    // One sweep per interval
+#define PROBE_TIMEOUT_MS 500      // Reply later than this counts as lost
+#define PROBE_LOSS_LIMIT 2        // Lost sweeps in a row before "unreachable"
+
+typedef struct {
+    char name[32];
+    char ip[16];
+    int reachable;                // 1 yes, 0 no, -1 not probed yet
+    uint32_t rtt_us;              // Last reply
+    uint32_t srtt_us;             // Smoothed
+    uint32_t sent;
+    uint32_t received;
+    uint32_t lost_in_row;
+} ProbeStatus;
+
+typedef struct {
+    uint32_t sweeps;
+    uint32_t last_sweep_us;       // First request sent to last reply (or timeout)
+    uint32_t late_replies;        // Replies of an older sweep
+    int targets;
+} ProberStats;
+
+
+/** @brief icmp_prober_add
+ *
+ *  Adds a device to probe; may be called before or after icmp_prober_start().
+ *
+ *  @param name : Device name, for the status only
+ *  @param ip   : IPv4 address
+ *
+ *  @return int : Target index, -1 if the address is invalid or the table is full
+ */
+int icmp_prober_add(const char *name, const char *ip);
+
+/** @brief icmp_prober_start
+ *
+ *  Opens the ICMP socket and starts the probing thread.
+ *
+ *  @return int : Returns 0 on success, -1 on failure
+ */
+int icmp_prober_start(void);
+
+/** @brief icmp_prober_status
+ *
+ *  @param index  : Target index from icmp_prober_add()
+ *  @param status : Receives the target's status
+ *
+ *  @return int : Returns 0 on success, -1 if there is no such target
+ */
+int icmp_prober_status(int index, ProbeStatus *status);
+
+/** @brief icmp_prober_find
+ *
+ *  @param ip : IPv4 address as a string
+ *
+ *  @return int : Target index, -1 if the address is not probed
+ */
+int icmp_prober_find(const char *ip);
+
+/** @brief icmp_prober_stats
+ *
+ *  @return void : This function does not return any value.
+ */
+void icmp_prober_stats(ProberStats *stats);
+
+#endif /* ICMP_PROBER_H */
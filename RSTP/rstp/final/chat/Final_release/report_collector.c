@@ -0,0 +1,389 @@
+/** @file report_collector.c
+ *  @brief UDP report collector: one receiving thread, worker threads for the reports
+ *
+ *  See report_collector.h.
+ *
+ *  @author Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include "report_collector.h"
+
+#define QUEUE_MASK (COLLECTOR_QUEUE - 1)
+
+
+typedef struct {
+    struct sockaddr_in from;
+    int len;
+    uint8_t data[COLLECTOR_MAX_DATAGRAM + 1];
+} QueuedDatagram;
+
+/*
+ * Filled by the receiving thread at head, emptied by the worker at tail.
+ * Entries between tail and head belong to the worker until it moves tail,
+ * so it handles them in place without the lock.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    uint32_t head;
+    uint32_t tail;
+    uint64_t handled;
+    uint64_t replies;
+    QueuedDatagram entries[COLLECTOR_QUEUE];
+} WorkerQueue;
+
+static int collector_fd = -1;
+static int worker_count;
+static CollectorFn handle_fn;
+static WorkerQueue queues[COLLECTOR_MAX_WORKERS];
+
+/*
+ * Receiving thread counters, under stats_lock
+ */
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static CollectorStats receive_stats;
+
+
+/** @brief worker_of
+ *
+ *  @return int : Worker for a sender; the same one for every datagram of it
+ */
+static int worker_of(const struct sockaddr_in *from)
+{
+    uint32_t hash = from->sin_addr.s_addr ^ ((uint32_t)from->sin_port << 16);
+
+    hash *= 0x9E3779B1u;
+    return (int)((hash >> 16) % (uint32_t)worker_count);
+}
+
+/** @brief receive_batch
+ *
+ *  Reads up to COLLECTOR_BATCH datagrams and hands them to the workers,
+ *  locking each worker's queue once.
+ *
+ *  @return int : Number of datagrams read, 0 if the socket is empty
+ */
+static int receive_batch(void)
+{
+    static uint8_t buffers[COLLECTOR_BATCH][COLLECTOR_MAX_DATAGRAM + 1];
+    static struct sockaddr_in from[COLLECTOR_BATCH];
+    static struct mmsghdr msgs[COLLECTOR_BATCH];
+    static struct iovec iov[COLLECTOR_BATCH];
+    int target[COLLECTOR_BATCH];
+    uint32_t dropped = 0;
+    uint32_t truncated = 0;
+    QueuedDatagram *entry;
+    WorkerQueue *queue;
+    int count;
+    int added;
+    int w;
+    int i;
+
+    for (i = 0; i < COLLECTOR_BATCH; i++)
+    {
+        iov[i].iov_base = buffers[i];
+        iov[i].iov_len = COLLECTOR_MAX_DATAGRAM;
+        memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+        msgs[i].msg_hdr.msg_name = &from[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    count = recvmmsg(collector_fd, msgs, COLLECTOR_BATCH, MSG_DONTWAIT, NULL);
+    if (count <= 0)
+    {
+        if (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        {
+            perror("Recvmmsg failed");
+        }
+        return 0;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+        {
+            target[i] = -1;
+            truncated++;
+        }
+        else
+        {
+            target[i] = worker_of(&from[i]);
+        }
+    }
+
+    for (w = 0; w < worker_count; w++)
+    {
+        queue = &queues[w];
+        added = 0;
+
+        pthread_mutex_lock(&queue->lock);
+        for (i = 0; i < count; i++)
+        {
+            if (target[i] != w)
+            {
+                continue;
+            }
+            if (queue->head - queue->tail == COLLECTOR_QUEUE)
+            {
+                dropped++;
+                continue;
+            }
+
+            entry = &queue->entries[queue->head & QUEUE_MASK];
+            entry->from = from[i];
+            entry->len = (int)msgs[i].msg_len;
+            memcpy(entry->data, buffers[i], msgs[i].msg_len);
+            entry->data[entry->len] = '\0';
+            queue->head++;
+            added++;
+        }
+        if (added > 0)
+        {
+            pthread_cond_signal(&queue->ready);
+        }
+        pthread_mutex_unlock(&queue->lock);
+    }
+
+    pthread_mutex_lock(&stats_lock);
+    receive_stats.received += (uint64_t)count;
+    receive_stats.batches++;
+    receive_stats.dropped += dropped;
+    receive_stats.truncated += truncated;
+    pthread_mutex_unlock(&stats_lock);
+
+    return count;
+}
+
+/** @brief receive_thread
+ *
+ *  Waits for the socket and drains it batch by batch.
+ *
+ *  @param arg : Not used
+ *
+ *  @return void* : Does not return
+ */
+static void *receive_thread(void *arg)
+{
+    struct epoll_event event;
+    int epoll_fd;
+
+    (void)arg;
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0)
+    {
+        perror("Epoll creation failed");
+        return NULL;
+    }
+
+    event.events = EPOLLIN;
+    event.data.fd = collector_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, collector_fd, &event) < 0)
+    {
+        perror("Epoll add failed");
+        close(epoll_fd);
+        return NULL;
+    }
+
+    while (1)
+    {
+        if (epoll_wait(epoll_fd, &event, 1, -1) < 0)
+        {
+            if (errno != EINTR)
+            {
+                perror("Epoll wait failed");
+                sleep(1);
+            }
+            continue;
+        }
+
+        /*
+         * A full batch means more may be waiting
+         */
+        while (receive_batch() == COLLECTOR_BATCH)
+        {
+        }
+    }
+
+    return NULL;
+}
+
+/** @brief worker_thread
+ *
+ *  Handles the datagrams of one queue and sends the replies.
+ *
+ *  @param arg : WorkerQueue
+ *
+ *  @return void* : Does not return
+ */
+static void *worker_thread(void *arg)
+{
+    WorkerQueue *queue = arg;
+    char replies[COLLECTOR_BATCH][COLLECTOR_MAX_REPLY];
+    struct mmsghdr msgs[COLLECTOR_BATCH];
+    struct iovec iov[COLLECTOR_BATCH];
+    QueuedDatagram *entry;
+    uint32_t tail;
+    uint32_t count;
+    uint32_t i;
+    int reply_count;
+    int sent;
+    int len;
+
+    while (1)
+    {
+        pthread_mutex_lock(&queue->lock);
+        while (queue->head == queue->tail)
+        {
+            pthread_cond_wait(&queue->ready, &queue->lock);
+        }
+        tail = queue->tail;
+        count = queue->head - tail;
+        pthread_mutex_unlock(&queue->lock);
+
+        if (count > COLLECTOR_BATCH)
+        {
+            count = COLLECTOR_BATCH;
+        }
+
+        reply_count = 0;
+        for (i = 0; i < count; i++)
+        {
+            entry = &queue->entries[(tail + i) & QUEUE_MASK];
+            len = handle_fn(entry->data, entry->len, &entry->from, replies[reply_count], COLLECTOR_MAX_REPLY);
+            if (len > 0)
+            {
+                iov[reply_count].iov_base = replies[reply_count];
+                iov[reply_count].iov_len = (size_t)len;
+                memset(&msgs[reply_count].msg_hdr, 0, sizeof(msgs[reply_count].msg_hdr));
+                msgs[reply_count].msg_hdr.msg_name = &entry->from;
+                msgs[reply_count].msg_hdr.msg_namelen = sizeof(entry->from);
+                msgs[reply_count].msg_hdr.msg_iov = &iov[reply_count];
+                msgs[reply_count].msg_hdr.msg_iovlen = 1;
+                reply_count++;
+            }
+        }
+
+        /*
+         * Replies point into the entries: send before handing them back
+         */
+        sent = 0;
+        if (reply_count > 0)
+        {
+            sent = sendmmsg(collector_fd, msgs, (unsigned int)reply_count, 0);
+            if (sent < 0)
+            {
+                perror("Send ACK failed");
+                sent = 0;
+            }
+        }
+
+        pthread_mutex_lock(&queue->lock);
+        queue->tail = tail + count;
+        queue->handled += count;
+        queue->replies += (uint64_t)sent;
+        pthread_mutex_unlock(&queue->lock);
+    }
+
+    return NULL;
+}
+
+int collector_start(uint16_t port, int workers, CollectorFn handler)
+{
+    struct sockaddr_in addr;
+    pthread_t thread;
+    int size = COLLECTOR_SOCKET_BUFFER;
+    int w;
+
+    if (workers < 1 || workers > COLLECTOR_MAX_WORKERS)
+    {
+        printf("Invalid number of collector workers %d\n", workers);
+        return -1;
+    }
+    worker_count = workers;
+    handle_fn = handler;
+
+    collector_fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (collector_fd < 0)
+    {
+        perror("Socket creation failed");
+        return -1;
+    }
+
+    /*
+     * Room for a burst of reports while the workers are busy; past rmem_max if allowed
+     */
+    if (setsockopt(collector_fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) < 0)
+    {
+        setsockopt(collector_fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = INADDR_ANY;  // Listen on all interfaces
+    if (bind(collector_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("Bind failed");
+        close(collector_fd);
+        collector_fd = -1;
+        return -1;
+    }
+
+    for (w = 0; w < workers; w++)
+    {
+        pthread_mutex_init(&queues[w].lock, NULL);
+        pthread_cond_init(&queues[w].ready, NULL);
+        queues[w].head = 0;
+        queues[w].tail = 0;
+
+        if (pthread_create(&thread, NULL, worker_thread, &queues[w]) != 0)
+        {
+            perror("Failed to create collector worker");
+            return -1;
+        }
+        pthread_detach(thread);
+    }
+
+    if (pthread_create(&thread, NULL, receive_thread, NULL) != 0)
+    {
+        perror("Failed to create collector receive thread");
+        return -1;
+    }
+    pthread_detach(thread);
+
+    return 0;
+}
+
+void collector_stats(CollectorStats *out)
+{
+    int w;
+
+    pthread_mutex_lock(&stats_lock);
+    *out = receive_stats;
+    pthread_mutex_unlock(&stats_lock);
+
+    out->handled = 0;
+    out->replies = 0;
+    out->workers = worker_count;
+    for (w = 0; w < worker_count; w++)
+    {
+        pthread_mutex_lock(&queues[w].lock);
+        out->handled += queues[w].handled;
+        out->replies += queues[w].replies;
+        pthread_mutex_unlock(&queues[w].lock);
+    }
+}
@@ -0,0 +1,77 @@
+/** @file report_collector.h
+ *  @brief UDP report collector: one receiving thread, worker threads for the reports
+ *
+ *  The receiving thread waits in epoll_wait() and drains the socket with
+ *  recvmmsg(), up to COLLECTOR_BATCH datagrams per call. Each datagram goes
+ *  to the queue of one worker, picked by the sender's address, so the
+ *  reports of one node are always handled in order by the same worker. A
+ *  queue is locked once per batch on both sides, not once per datagram;
+ *  when a queue is full the datagram is dropped and counted (the client
+ *  sends it again).
+ *
+ *  Workers call the handler for every datagram and send its replies (the
+ *  ACKs) from the same socket with one sendmmsg() per batch.
+ *
+ *  @author Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#ifndef REPORT_COLLECTOR_H
+#define REPORT_COLLECTOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+#define COLLECTOR_BATCH 64           // Datagrams per recvmmsg() / sendmmsg()
+#define COLLECTOR_QUEUE 1024         // Datagrams per worker queue, power of two
+#define COLLECTOR_MAX_WORKERS 16
+#define COLLECTOR_MAX_DATAGRAM 1024  // Longer ones are dropped
+#define COLLECTOR_MAX_REPLY 64
+#define COLLECTOR_SOCKET_BUFFER (4 * 1024 * 1024)
+
+/*
+ * Handles one datagram on a worker thread
+ *
+ *  data       : Datagram, NUL terminated after len bytes
+ *  len        : Its length
+ *  from       : Sender
+ *  reply      : Buffer for the reply to the sender
+ *  reply_size : Size of reply
+ *
+ *  Returns the reply length, 0 to send none
+ */
+typedef int (*CollectorFn)(const uint8_t *data, int len, const struct sockaddr_in *from,
+                           char *reply, size_t reply_size);
+
+typedef struct {
+    uint64_t received;               // Datagrams read from the socket
+    uint64_t batches;                // recvmmsg() calls that returned datagrams
+    uint64_t dropped;                // Worker queue full
+    uint64_t truncated;              // Longer than COLLECTOR_MAX_DATAGRAM
+    uint64_t handled;
+    uint64_t replies;
+    int workers;
+} CollectorStats;
+
+
+/** @brief collector_start
+ *
+ *  Binds the socket and starts the receiving thread and the workers.
+ *
+ *  @param port    : UDP port to listen on
+ *  @param workers : Number of worker threads, 1 to COLLECTOR_MAX_WORKERS
+ *  @param handler : Called for every datagram
+ *
+ *  @return int : Returns 0 on success, -1 on failure
+ */
+int collector_start(uint16_t port, int workers, CollectorFn handler);
+
+/** @brief collector_stats
+ *
+ *  @return void : This function does not return any value.
+ */
+void collector_stats(CollectorStats *stats);
+
+#endif /* REPORT_COLLECTOR_H */
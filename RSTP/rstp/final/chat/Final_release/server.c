@@ -13,9 +13,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <time.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <arpa/inet.h>
+#include "status_proto.h"
+#include "icmp_prober.h"
+#include "device_registry.h"
+#include "report_collector.h"
 
 #define MAX_LINE 256
 #define BROADCAST_IP "192.168.0.255"
@@ -23,243 +28,240 @@
 #define UDP_PORT_RX 1234
 #define MESSAGE "Broadcast message from the A Device"
 
-#define MAX_DEVICES 10  // Max number of devices to track
-
-// Structure to hold device info
-typedef struct {
-    char device_name[32];
-    char ip_address[16];
-    char port1_state[32];
-    char port2_state[32];
-} Device;
+#define MAX_DEVICES PROBE_MAX_TARGETS  // Max number of devices in client_information.txt
+#define COLLECTOR_WORKERS 2  // Threads parsing reports and updating the registry
+#define DISPLAY_INTERVAL_MS 1000  // Device table refresh
 
 // For storing devices from the file to ping
 typedef struct {
     char dev_name[32];
     char dev_ip[16];
+    uint32_t ipv4;  // dev_ip, network byte order
+    int probe;  // Prober target index, -1 if the address is invalid
 } DeviceInfo;
 
-// Global devices list and first execution flag
-Device devices[MAX_DEVICES];
-int num_devices = 0;
+// Devices that reported are in the registry (device_registry.c)
+RegistryEntry entries[REGISTRY_MAX_NODES];  // Snapshot for printing
 
 DeviceInfo device_list[MAX_DEVICES];
 int num_device_list = 0;
 
-int first = 0;  // Flag to check if the file has been read before
+int debug_reports = 0;  // -d: print every report as text
 
-// Function to print a single device's information with formatted alignment
-void print_device_info(int index, Device *device) {
-    printf("%d> %-13s IP: %-15s Port 8001 - State: %-12s Port 8002 - State: %-12s\n",
-           index, device->device_name, device->ip_address,
-           device->port1_state, device->port2_state);
+// Function to get a monotonic time in milliseconds, the registry's clock
+uint64_t now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
-// Function to ping an IP address
-int ping_device(const char *ip_address) {
-    char command[MAX_LINE];
-    
-    // Use -c 1 to send a single ping and -W 1 to set a timeout of 1 second (can be adjusted to 0.5 seconds)
-    snprintf(command, sizeof(command), "ping -c 1 -W 0.5 %s > /dev/null 2>&1", ip_address);  // Timeout set to 1 second
+// Function to print a single device's information with formatted alignment
+void print_device_info(int index, const RegistryEntry *entry, uint64_t now) {
+    const StatusReport *report = &entry->report;
+    char ip_address[INET_ADDRSTRLEN];
+    ProbeStatus probe;
+
+    inet_ntop(AF_INET, &report->ipv4, ip_address, sizeof(ip_address));
+    printf("%d> %-13s IP: %-15s", index, report->name, ip_address);
+    for (int i = 0; i < report->port_count; i++) {
+        printf(" Port %04x - State: %-12s", report->ports[i].port_id,
+               status_port_state_name(report->ports[i].state));
+    }
+    printf(" Seen: %llus ago", (unsigned long long)(now - entry->last_seen_ms) / 1000);
+    if (icmp_prober_status(icmp_prober_find(ip_address), &probe) == 0 && probe.reachable == 1) {
+        printf(" RTT: %u.%03u ms", probe.srtt_us / 1000, probe.srtt_us % 1000);
+    }
+    printf("\n");
+}
 
-   // printf("\nRunning ping command: %s\n", command);  // Optional: for debugging
+// Function to read a report: binary, or the text format of older clients
+int decode_report(const uint8_t *buffer, int len, StatusReport *report) {
+    StatusView view;
 
-    return system(command);  // Returns 0 if successful, non-zero if failure
-}
+    if (status_parse(buffer, len, &view) == 0) {
+        status_view_to_report(&view, report);
+        return 0;
+    }
 
-#if 0
-// Function to ping an IP address
-int ping_device(const char *ip_address) {
-    char command[MAX_LINE];
-    snprintf(command, sizeof(command), "ping -c 1 %s > /dev/null 2>&1", ip_address);
-    printf("\nanbid %s\n",command);
-    return system(command);  // Returns 0 if successful, non-zero if failure
+    return status_decode_text((const char *)buffer, report);
 }
-#endif 
 
 // Function to read device information from the file
 void file_read() {
     FILE *file = fopen("client_information.txt", "r");
     if (file) {
         char line[MAX_LINE];
-        while (fgets(line, sizeof(line), file)) {
+        while (num_device_list < MAX_DEVICES && fgets(line, sizeof(line), file)) {
             char dev_name[32], dev_ip[16];
-            sscanf(line, "Im %s %s", dev_name, dev_ip);
+            struct in_addr addr;
+            if (sscanf(line, "Im %31s %15s", dev_name, dev_ip) != 2 || inet_pton(AF_INET, dev_ip, &addr) != 1) {
+                continue;
+            }
             strcpy(device_list[num_device_list].dev_name, dev_name);
             strcpy(device_list[num_device_list].dev_ip, dev_ip);
+            device_list[num_device_list].ipv4 = addr.s_addr;
+            // Probed from now on by the prober thread
+            device_list[num_device_list].probe = icmp_prober_add(dev_name, dev_ip);
             num_device_list++;
         }
         fclose(file);
     }
 }
 
-// Monitor ports thread function
-void *monitor_ports(void *arg) {
-    int sockfd;
-    struct sockaddr_in server_addr, client_addr;
-    socklen_t client_len = sizeof(client_addr);
-    char buffer[MAX_LINE];
-    char ack_message[] = "ACK";  // Acknowledgment message
-
-    // Check if it's the first run and read the file
-    if (first == 0) {
-        file_read();  // Read device information from the file
-        first = 1;    // Set the flag to prevent further reads
+// Report handler, run by the collector's worker threads for every datagram
+int handle_report(const uint8_t *buffer, int len, const struct sockaddr_in *from, char *ack_message, size_t ack_size) {
+    char text[STATUS_TEXT_MAX];
+    StatusReport report;
+
+    // The collector NUL terminates the datagram, in case it is a text report
+    if (decode_report(buffer, len, &report) != 0) {
+        printf("Error parsing message: %s\n", (const char *)buffer);
+        return 0;
     }
 
-    /*
-     * Create UDP socket
-     */
-    sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sockfd < 0) {
-        perror("Socket creation failed");
-        pthread_exit(NULL);
+    // Key the node by name and sender address, not the ID the client sent:
+    // boards with the same or no name, and older clients, stay apart
+    report.node_id = status_node_id_from_board(report.name, from->sin_addr.s_addr);
+
+    if (debug_reports) {
+        status_render_text(&report, text, sizeof(text));
+        printf("%s\n", text);
     }
 
-    /*
-     * Configure server address
-     */
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(UDP_PORT_RX);
-    server_addr.sin_addr.s_addr = INADDR_ANY;  // Listen on all interfaces
+    // Update the device, or add it if it is new
+    if (registry_update(&report, now_ms()) < 0) {
+        printf("Warning: device table full, report of %s dropped\n", report.name);
+    }
 
     /*
-     * Bind socket to the address and port
+     * ACK back to client, with the sequence number if the report has one
      */
-    if (bind(sockfd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-        perror("Bind failed");
-        close(sockfd);
-        pthread_exit(NULL);
+    if (report.seq != 0) {
+        return snprintf(ack_message, ack_size, "ACK %u", report.seq);
     }
+    return snprintf(ack_message, ack_size, "ACK");
+}
 
-    printf("\n\tServer listening on port %d\n\n", UDP_PORT_RX);
+// Display thread function: redraws the device table every DISPLAY_INTERVAL_MS
+void *show_devices(void *arg) {
+    CollectorStats collector, last_collector;
+    RegistryStats stats;
+    uint64_t now, last = now_ms();
+    int count;
 
-    while (1) {
-        int len = recvfrom(sockfd, buffer, MAX_LINE, 0, (struct sockaddr*)&client_addr, &client_len);
-        if (len < 0) {
-            perror("Recvfrom failed");
-            continue;  // Keep the server running
-        }
+    (void)arg;
+    collector_stats(&last_collector);
 
-        buffer[len] = '\0';  // Null terminate the received message
-
-        // Extract device info from the message (assuming format is consistent)
-        char device_name[32], ip_address[16], port1_state[32], port2_state[32];
-
-        // We need to extract the device name first, so let's find "IP:" and split the string
-        char *ip_pos = strstr(buffer, "IP:");
-        if (ip_pos != NULL) {
-            // Now extract device name by copying the string before "IP:"
-            int device_name_len = ip_pos - buffer; // Length of the device name
-            if (device_name_len < sizeof(device_name)) {
-                strncpy(device_name, buffer, device_name_len);
-                device_name[device_name_len] = '\0'; // Null terminate
-            } else {
-                printf("Device name too long\n");
+    while (1) {
+        usleep(DISPLAY_INTERVAL_MS * 1000);
+        now = now_ms();
+        registry_expire(now);
+
+        // Reachability of the devices from the file, as the prober last saw it
+        for (int i = 0; i < num_device_list; i++) {
+            ProbeStatus probe;
+            if (icmp_prober_status(device_list[i].probe, &probe) != 0) {
                 continue;
             }
-
-            // Now extract the rest of the message using sscanf
-            int ret = sscanf(ip_pos, "IP: %15s Port 8001 - State: %31s Port 8002 - State: %31s",
-                              ip_address, port1_state, port2_state);
-
-            if (ret != 3) {
-                printf("Error parsing message: %s\n", buffer);
-                continue;
+            if (probe.reachable == 0) {
+                // Remove device from the list if not reachable
+                registry_remove_ipv4(device_list[i].ipv4);
+            } else if (probe.reachable == 1) {
+                // Answers pings: alive, even if it only reports on changes
+                registry_touch_ipv4(device_list[i].ipv4, now);
             }
+        }
 
-            // Check if the device already exists in the list
-            int found = 0;
-            for (int i = 0; i < num_devices; i++) {
-                if (strcmp(devices[i].ip_address, ip_address) == 0) {
-                    // Device exists, update its states
-                    strcpy(devices[i].port1_state, port1_state);
-                    strcpy(devices[i].port2_state, port2_state);
-                    found = 1;
-                    break;
-                }
-            }
+        // Copy the devices first: the workers keep updating while we print
+        count = registry_snapshot(entries, REGISTRY_MAX_NODES);
+        registry_stats(&stats);
+        collector_stats(&collector);
 
-            // If device not found, add it to the list (if space allows)
-            if (!found && num_devices < MAX_DEVICES) {
-                strcpy(devices[num_devices].device_name, device_name);
-                strcpy(devices[num_devices].ip_address, ip_address);
-                strcpy(devices[num_devices].port1_state, port1_state);
-                strcpy(devices[num_devices].port2_state, port2_state);
-                num_devices++;
-            }
+        // Clear the screen (platform-specific, using ANSI escape code for Linux/Mac)
+        printf("\033[H\033[J");
 
-            // Clear the screen (platform-specific, using ANSI escape code for Linux/Mac)
-            printf("\033[H\033[J");
-
-            // Ping devices from the file to check reachability
-            for (int i = 0; i < num_device_list; i++) {
-                int ping_result = ping_device(device_list[i].dev_ip);
-                if (ping_result != 0) {
-                    printf("\nWarning: %s IP: %s is not reachable.\n", device_list[i].dev_name, device_list[i].dev_ip);
-                    // Remove device from the list if not reachable
-                    for (int j = 0; j < num_devices; j++) {
-                        if (strcmp(devices[j].ip_address, device_list[i].dev_ip) == 0) {
-                            // Shift devices to remove the current device
-                            for (int k = j; k < num_devices - 1; k++) {
-                                devices[k] = devices[k + 1];
-                            }
-                            num_devices--;
-                            break;
-                        }
-                    }
-                }
+        for (int i = 0; i < num_device_list; i++) {
+            ProbeStatus probe;
+            if (icmp_prober_status(device_list[i].probe, &probe) == 0 && probe.reachable == 0) {
+                printf("\nWarning: %s IP: %s is not reachable.\n", device_list[i].dev_name, device_list[i].dev_ip);
             }
+        }
 
-            // Print the updated list of devices
-            printf("\nUpdated Device States:\n\n");
-            for (int i = 0; i < num_devices; i++) {
-                print_device_info(i + 1, &devices[i]);
-            }
+        // Print the updated list of devices, in slot order
+        printf("\nUpdated Device States:\n\n");
+        for (int i = 0; i < count; i++) {
+            print_device_info(i + 1, &entries[i], now);
+        }
 
-            /*
-             * Send ACK back to client
-             */
-            if (sendto(sockfd, ack_message, strlen(ack_message), 0, (struct sockaddr *)&client_addr, client_len) < 0) {
-                perror("Send ACK failed");
-            } else {
-                printf("\nSent ACK to client\n");
-            }
-        } else {
-            printf("Error: IP address not found in message: %s\n", buffer);
-            continue;
+        printf("\n%d devices, %.0f reports/s", stats.nodes,
+               (collector.handled - last_collector.handled) * 1000.0 / (double)(now - last + (now == last)));
+        if (stats.dropped > 0 || stats.expired > 0 || collector.dropped > 0) {
+            printf(", %u expired, %u dropped (table full), %llu dropped (queue full)", stats.expired, stats.dropped,
+                   (unsigned long long)collector.dropped);
         }
+        printf("\n");
+        fflush(stdout);
+
+        last_collector = collector;
+        last = now;
     }
 
-    close(sockfd);
-    pthread_exit(NULL);
+    return NULL;
 }
 
 
 /** @brief main
  *
- *  Main function to initialize a monitoring thread and send periodic UDP broadcasts.
+ *  Main function to start the report collector and send periodic UDP broadcasts.
+ *  Run with -d to print every report received as text.
  *
- *  - Creates a thread to monitor UDP ports.
+ *  - Starts the ICMP prober for the devices of client_information.txt.
+ *  - Starts the collector: one thread receiving reports, COLLECTOR_WORKERS handling them.
+ *  - Creates a thread redrawing the device table every DISPLAY_INTERVAL_MS.
  *  - Creates a UDP socket for broadcasting messages.
  *  - Configures broadcast settings and sends messages every second.
  *
  *  @return int : Returns EXIT_SUCCESS or EXIT_FAILURE on error.
  */
-int main()
+int main(int argc, char *argv[])
 {
-    pthread_t monitor_thread;
+    pthread_t display_thread;
     int sockfd;
     struct sockaddr_in broadcast_addr;
     int broadcast_enable = 1;
 
     /*
-     * Create a thread to monitor ports
+     * -d prints every report received as text
+     */
+    if (argc > 1 && strcmp(argv[1], "-d") == 0)
+    {
+        debug_reports = 1;
+    }
+
+    registry_init(REGISTRY_EXPIRE_MS, now_ms());
+
+    /*
+     * Probe the devices of client_information.txt in the background
+     */
+    file_read();
+    if (icmp_prober_start() != 0)
+    {
+        printf("Warning: ICMP prober not started, device reachability is not checked\n");
+    }
+
+    /*
+     * Receive reports, and show them
      */
-    if (pthread_create(&monitor_thread, NULL, monitor_ports, NULL) != 0)
+    if (collector_start(UDP_PORT_RX, COLLECTOR_WORKERS, handle_report) != 0)
+    {
+        return EXIT_FAILURE;
+    }
+    printf("\n\tServer listening on port %d\n\n", UDP_PORT_RX);
+
+    if (pthread_create(&display_thread, NULL, show_devices, NULL) != 0)
     {
-        perror("Failed to create monitor thread");
+        perror("Failed to create display thread");
         return EXIT_FAILURE;
     }
 
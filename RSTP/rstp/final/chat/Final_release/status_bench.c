@@ -0,0 +1,190 @@
+/** @file status_bench.c
+ *  @brief Parse cost of one node report: binary against the text format
+ *
+ *  Decodes the same two-port report in a loop, four ways:
+ *
+ *    view      status_parse() and every field read through the accessors
+ *    copy      status_parse() + status_view_to_report()
+ *    text      status_decode_text(), legacy reports with any number of ports
+ *    old       strstr("IP:") + sscanf() of the fixed two-port format, as
+ *              server.c did before the binary report
+ *
+ *  and prints nanoseconds per report. First it checks that a report comes
+ *  back unchanged through encode/parse and through render/decode.
+ *
+ *    gcc -O2 status_bench.c status_proto.c -o status_bench
+ *    ./status_bench [iterations]
+ *
+ *  @author Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "status_proto.h"
+
+
+static volatile uint32_t sink;
+
+
+/** @brief now_ns
+ *
+ *  @return double : Monotonic time in nanoseconds
+ */
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/** @brief same_report
+ *
+ *  @return int : 1 if the fields both formats carry are equal
+ */
+static int same_report(const StatusReport *a, const StatusReport *b)
+{
+    int i;
+
+    if (a->node_id != b->node_id || a->seq != b->seq || a->ipv4 != b->ipv4 ||
+        a->port_count != b->port_count || strcmp(a->name, b->name) != 0)
+    {
+        return 0;
+    }
+    for (i = 0; i < a->port_count; i++)
+    {
+        if (a->ports[i].port_id != b->ports[i].port_id || a->ports[i].state != b->ports[i].state)
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/** @brief parse_old
+ *
+ *  The text parsing server.c did before, for comparison.
+ *
+ *  @return int : Returns 0 on success, -1 on failure
+ */
+static int parse_old(const char *buffer)
+{
+    char device_name[32], ip_address[16], port1_state[32], port2_state[32];
+    const char *ip_pos = strstr(buffer, "IP:");
+    int device_name_len;
+
+    if (ip_pos == NULL)
+    {
+        return -1;
+    }
+    device_name_len = ip_pos - buffer;
+    if (device_name_len >= (int)sizeof(device_name))
+    {
+        return -1;
+    }
+    strncpy(device_name, buffer, device_name_len);
+    device_name[device_name_len] = '\0';
+
+    if (sscanf(ip_pos, "IP: %15s Port 8001 - State: %31s Port 8002 - State: %31s",
+               ip_address, port1_state, port2_state) != 3)
+    {
+        return -1;
+    }
+
+    sink += device_name[0] + ip_address[0] + port1_state[0] + port2_state[0];
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    long iterations = (argc > 1) ? atol(argv[1]) : 2000000;
+    StatusReport report, back;
+    StatusView view;
+    uint8_t datagram[256];
+    char text[STATUS_TEXT_MAX];
+    double start;
+    int len;
+    long n;
+    int i;
+
+    memset(&report, 0, sizeof(report));
+    strcpy(report.name, "Switch-07");
+    report.seq = 4711;
+    report.timestamp_ms = 1700000000123ULL;
+    inet_pton(AF_INET, "192.168.0.57", &report.ipv4);
+    report.node_id = status_node_id_from_board(report.name, report.ipv4);
+    report.flags = STATUS_BRIDGE_IP_VALID | STATUS_BRIDGE_STP | STATUS_BRIDGE_RSTP | STATUS_BRIDGE_OK;
+    report.port_count = 2;
+    report.ports[0].port_id = 0x8001;
+    report.ports[0].state = STATUS_PORT_FORWARDING;
+    report.ports[1].port_id = 0x8002;
+    report.ports[1].state = STATUS_PORT_BLOCKING;
+
+    len = status_encode(datagram, sizeof(datagram), &report);
+    status_render_text(&report, text, sizeof(text));
+
+    /*
+     * Round trips
+     */
+    if (status_parse(datagram, len, &view) != 0)
+    {
+        printf("binary: parse failed\n");
+        return EXIT_FAILURE;
+    }
+    status_view_to_report(&view, &back);
+    printf("binary %d bytes: %s\n", len, (same_report(&report, &back) && back.timestamp_ms == report.timestamp_ms &&
+                                           back.flags == report.flags) ? "ok" : "WRONG");
+    printf("text %zu bytes: %s\n", strlen(text),
+           (status_decode_text(text, &back) == 0 && same_report(&report, &back)) ? "ok" : "WRONG");
+    printf("old parser on text: %s\n\n", (parse_old(text) == 0) ? "ok" : "WRONG");
+
+    start = now_ns();
+    for (n = 0; n < iterations; n++)
+    {
+        if (status_parse(datagram, len, &view) == 0)
+        {
+            sink += status_node_id(&view) + status_seq(&view) + status_ipv4(&view) + status_flags(&view) +
+                    (uint32_t)status_timestamp_ms(&view);
+            for (i = 0; i < view.port_count; i++)
+            {
+                sink += status_port_id(&view, i) + status_port_state(&view, i);
+            }
+        }
+    }
+    printf("view   %8.1f ns/report\n", (now_ns() - start) / iterations);
+
+    start = now_ns();
+    for (n = 0; n < iterations; n++)
+    {
+        if (status_parse(datagram, len, &view) == 0)
+        {
+            status_view_to_report(&view, &back);
+            sink += back.seq;
+        }
+    }
+    printf("copy   %8.1f ns/report\n", (now_ns() - start) / iterations);
+
+    start = now_ns();
+    for (n = 0; n < iterations; n++)
+    {
+        if (status_decode_text(text, &back) == 0)
+        {
+            sink += back.seq;
+        }
+    }
+    printf("text   %8.1f ns/report\n", (now_ns() - start) / iterations);
+
+    start = now_ns();
+    for (n = 0; n < iterations; n++)
+    {
+        parse_old(text);
+    }
+    printf("old    %8.1f ns/report\n", (now_ns() - start) / iterations);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,237 @@
+/** @file status_proto.c
+ *  @brief Binary node status report, shared by the clients and the server
+ *
+ *  See status_proto.h.
+ *
+ *  @author Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include "status_proto.h"
+
+
+static const char *state_names[] = { "disabled", "listening", "learning", "forwarding", "blocking" };
+
+
+uint32_t status_node_id_from_board(const char *name, uint32_t ipv4)
+{
+    const uint8_t *addr = (const uint8_t *)&ipv4;
+    uint32_t hash = 2166136261u;
+    int i;
+
+    while (*name != '\0')
+    {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619u;
+    }
+
+    for (i = 0; i < 4; i++)
+    {
+        hash ^= addr[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+int status_encode(uint8_t *buf, size_t size, const StatusReport *report)
+{
+    StatusHeader *hdr = (StatusHeader *)buf;
+    StatusPort *port;
+    int count = (report->port_count > STATUS_MAX_PORTS) ? STATUS_MAX_PORTS : report->port_count;
+    size_t len = sizeof(StatusHeader) + (size_t)count * sizeof(StatusPort);
+    int i;
+
+    if (size < len)
+    {
+        return -1;
+    }
+
+    memset(buf, 0, len);
+    hdr->magic = htons(STATUS_MAGIC);
+    hdr->version = STATUS_VERSION;
+    hdr->header_len = sizeof(StatusHeader);
+    hdr->node_id = htonl(report->node_id);
+    hdr->seq = htonl(report->seq);
+    hdr->timestamp_ms = htobe64(report->timestamp_ms);
+    hdr->ipv4 = report->ipv4;
+    hdr->flags = htons(report->flags);
+    hdr->port_count = (uint8_t)count;
+    hdr->port_size = sizeof(StatusPort);
+    strncpy(hdr->name, report->name, sizeof(hdr->name));
+
+    port = (StatusPort *)(buf + sizeof(StatusHeader));
+    for (i = 0; i < count; i++)
+    {
+        port[i].port_id = htons(report->ports[i].port_id);
+        port[i].state = report->ports[i].state;
+    }
+
+    return (int)len;
+}
+
+int status_parse(const uint8_t *buf, size_t len, StatusView *view)
+{
+    const StatusHeader *hdr = (const StatusHeader *)buf;
+
+    /*
+     * Fields from a newer version are skipped, not rejected: only the
+     * lengths have to add up
+     */
+    if (len < sizeof(StatusHeader) || ntohs(hdr->magic) != STATUS_MAGIC || hdr->version < 1 ||
+        hdr->header_len < sizeof(StatusHeader) || hdr->port_size < sizeof(StatusPort) ||
+        (size_t)hdr->header_len + (size_t)hdr->port_count * hdr->port_size > len)
+    {
+        return -1;
+    }
+
+    view->hdr = hdr;
+    view->ports = buf + hdr->header_len;
+    view->port_count = hdr->port_count;
+    view->port_size = hdr->port_size;
+
+    return 0;
+}
+
+void status_view_to_report(const StatusView *view, StatusReport *report)
+{
+    int i;
+
+    report->node_id = status_node_id(view);
+    report->seq = status_seq(view);
+    report->timestamp_ms = status_timestamp_ms(view);
+    report->ipv4 = status_ipv4(view);
+    report->flags = status_flags(view);
+    report->port_count = (view->port_count > STATUS_MAX_PORTS) ? STATUS_MAX_PORTS : view->port_count;
+    memcpy(report->name, view->hdr->name, sizeof(report->name));
+    report->name[sizeof(report->name) - 1] = '\0';
+
+    for (i = 0; i < report->port_count; i++)
+    {
+        report->ports[i].port_id = status_port_id(view, i);
+        report->ports[i].state = status_port_state(view, i);
+    }
+}
+
+int status_decode_text(const char *text, StatusReport *report)
+{
+    const char *ip_pos;
+    const char *pos;
+    char ip[16];
+    char state[32];
+    unsigned int port_id;
+    unsigned int seq;
+    size_t name_len;
+
+    memset(report, 0, sizeof(*report));
+    report->flags = STATUS_BRIDGE_LEGACY;
+
+    /*
+     * The device name is everything before "IP:"
+     */
+    ip_pos = strstr(text, "IP:");
+    if (ip_pos == NULL)
+    {
+        return -1;
+    }
+    name_len = (size_t)(ip_pos - text);
+    while (name_len > 0 && text[name_len - 1] == ' ')
+    {
+        name_len--;
+    }
+    if (name_len >= sizeof(report->name))
+    {
+        name_len = sizeof(report->name) - 1;
+    }
+    memcpy(report->name, text, name_len);
+
+    if (sscanf(ip_pos, "IP: %15s", ip) != 1 || inet_pton(AF_INET, ip, &report->ipv4) != 1)
+    {
+        return -1;
+    }
+    report->node_id = status_node_id_from_board(report->name, report->ipv4);
+    report->flags |= STATUS_BRIDGE_IP_VALID;
+
+    /*
+     * As many ports as the sender listed
+     */
+    for (pos = strstr(ip_pos, "Port "); pos != NULL && report->port_count < STATUS_MAX_PORTS; pos = strstr(pos + 5, "Port "))
+    {
+        if (sscanf(pos, "Port %x - State: %31s", &port_id, state) == 2)
+        {
+            report->ports[report->port_count].port_id = (uint16_t)port_id;
+            report->ports[report->port_count].state = (uint8_t)status_port_state_from_name(state);
+            report->port_count++;
+        }
+    }
+    if (report->port_count == 0)
+    {
+        return -1;
+    }
+
+    pos = strstr(ip_pos, "Seq:");
+    if (pos != NULL && sscanf(pos, "Seq: %u", &seq) == 1)
+    {
+        report->seq = seq;
+    }
+
+    return 0;
+}
+
+int status_render_text(const StatusReport *report, char *buf, size_t size)
+{
+    char ip[INET_ADDRSTRLEN];
+    size_t len;
+    int i;
+
+    if (size == 0)
+    {
+        return 0;
+    }
+
+    inet_ntop(AF_INET, &report->ipv4, ip, sizeof(ip));
+    len = (size_t)snprintf(buf, size, "%s IP: %s", report->name, ip);
+
+    for (i = 0; i < report->port_count && len < size; i++)
+    {
+        len += (size_t)snprintf(buf + len, size - len, " Port %04x - State: %s",
+                                report->ports[i].port_id, status_port_state_name(report->ports[i].state));
+    }
+
+    if (len < size)
+    {
+        len += (size_t)snprintf(buf + len, size - len, " Seq: %u Node: %08x Flags: %04x Time: %llu",
+                                report->seq, report->node_id, report->flags, (unsigned long long)report->timestamp_ms);
+    }
+
+    return (len < size) ? (int)len : (int)size - 1;
+}
+
+const char *status_port_state_name(int state)
+{
+    if (state >= 0 && state < (int)(sizeof(state_names) / sizeof(state_names[0])))
+    {
+        return state_names[state];
+    }
+
+    return "unknown";
+}
+
+int status_port_state_from_name(const char *name)
+{
+    int i;
+
+    for (i = 0; i < (int)(sizeof(state_names) / sizeof(state_names[0])); i++)
+    {
+        if (strcasecmp(name, state_names[i]) == 0)
+        {
+            return i;
+        }
+    }
+
+    return STATUS_PORT_UNKNOWN;
+}
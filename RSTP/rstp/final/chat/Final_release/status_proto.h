@@ -0,0 +1,193 @@
+/** @file status_proto.h
+ *  @brief Binary node status report, shared by the clients and the server
+ *
+ *  One UDP datagram per report, all fields in network byte order:
+ *
+ *      StatusHeader    44 bytes (header_len, more in later versions)
+ *      StatusPort      port_count x port_size bytes (4 in version 1)
+ *
+ *  A parser uses header_len and port_size from the datagram, not its own
+ *  sizeof(), so a newer sender may append fields to either and an older
+ *  server still finds everything it knows. The magic tells a binary report
+ *  from the legacy text one ("<name> IP: <ip> Port 8001 - State: ..."),
+ *  which status_decode_text() still reads.
+ *
+ *  status_parse() does not copy: the StatusView points into the datagram
+ *  and the accessors below convert single fields on demand.
+ *
+ *  @author Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#ifndef STATUS_PROTO_H
+#define STATUS_PROTO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <endian.h>
+#include <arpa/inet.h>
+
+#define STATUS_MAGIC 0x5254         // "RT"
+#define STATUS_VERSION 1
+#define STATUS_MAX_PORTS 16
+#define STATUS_NAME_LEN 16
+#define STATUS_TEXT_MAX 512         // Longest text rendering
+
+/*
+ * Port states: the kernel's BR_STATE_* values
+ */
+#define STATUS_PORT_DISABLED 0
+#define STATUS_PORT_LISTENING 1
+#define STATUS_PORT_LEARNING 2
+#define STATUS_PORT_FORWARDING 3
+#define STATUS_PORT_BLOCKING 4
+#define STATUS_PORT_UNKNOWN 255
+
+/*
+ * Bridge flags
+ */
+#define STATUS_BRIDGE_IP_VALID 0x0001
+#define STATUS_BRIDGE_STP 0x0002    // STP enabled (kernel or mstpd)
+#define STATUS_BRIDGE_RSTP 0x0004   // STP in mstpd
+#define STATUS_BRIDGE_OK 0x0008     // Config OK: the green LED
+#define STATUS_BRIDGE_LEGACY 0x8000 // Decoded from a text report
+
+typedef struct __attribute__((packed)) {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t header_len;             // Offset of the first port
+    uint32_t node_id;
+    uint32_t seq;
+    uint64_t timestamp_ms;          // Sender's wall clock, ms since the epoch
+    uint32_t ipv4;                  // Bridge IP
+    uint16_t flags;                 // STATUS_BRIDGE_*
+    uint8_t port_count;
+    uint8_t port_size;              // Bytes per port entry
+    char name[STATUS_NAME_LEN];     // Board name, NUL padded
+} StatusHeader;
+
+typedef struct __attribute__((packed)) {
+    uint16_t port_id;               // 0x8001
+    uint8_t state;                  // STATUS_PORT_*
+    uint8_t reserved;
+} StatusPort;
+
+/*
+ * A report in host form: what a client encodes, what the server keeps
+ */
+typedef struct {
+    uint32_t node_id;
+    uint32_t seq;
+    uint64_t timestamp_ms;
+    uint32_t ipv4;                  // Network byte order, as in struct in_addr
+    uint16_t flags;
+    uint8_t port_count;
+    char name[STATUS_NAME_LEN];
+    struct {
+        uint16_t port_id;
+        uint8_t state;
+    } ports[STATUS_MAX_PORTS];
+} StatusReport;
+
+/*
+ * A parsed datagram; points into it
+ */
+typedef struct {
+    const StatusHeader *hdr;
+    const uint8_t *ports;
+    int port_count;
+    int port_size;
+} StatusView;
+
+
+static inline uint32_t status_node_id(const StatusView *v)       { return ntohl(v->hdr->node_id); }
+static inline uint32_t status_seq(const StatusView *v)           { return ntohl(v->hdr->seq); }
+static inline uint32_t status_ipv4(const StatusView *v)          { return v->hdr->ipv4; }
+static inline uint16_t status_flags(const StatusView *v)         { return ntohs(v->hdr->flags); }
+
+static inline uint64_t status_timestamp_ms(const StatusView *v)   { return be64toh(v->hdr->timestamp_ms); }
+
+static inline const StatusPort *status_port(const StatusView *v, int i)
+{
+    return (const StatusPort *)(v->ports + (size_t)i * (size_t)v->port_size);
+}
+
+static inline uint16_t status_port_id(const StatusView *v, int i) { return ntohs(status_port(v, i)->port_id); }
+static inline uint8_t status_port_state(const StatusView *v, int i) { return status_port(v, i)->state; }
+
+
+/** @brief status_node_id_from_board
+ *
+ *  Node ID of a board: FNV-1a of its name from dev.txt and its IPv4, so it
+ *  stays the same across restarts, legacy reports get the same one, and two
+ *  boards with the same (or an empty) name are still two nodes. A board that
+ *  moves to a new address is a new node; the old entry expires.
+ *
+ *  @param name : Board name
+ *  @param ipv4 : Board address, network byte order
+ *
+ *  @return uint32_t : Node ID
+ */
+uint32_t status_node_id_from_board(const char *name, uint32_t ipv4);
+
+/** @brief status_encode
+ *
+ *  @param buf    : Datagram buffer
+ *  @param size   : Size of buf
+ *  @param report : Report to encode
+ *
+ *  @return int : Datagram length, -1 if buf is too small
+ */
+int status_encode(uint8_t *buf, size_t size, const StatusReport *report);
+
+/** @brief status_parse
+ *
+ *  Checks a datagram and sets up a view of it, nothing is copied.
+ *
+ *  @return int : Returns 0 on success, -1 if it is not a binary report or is truncated
+ */
+int status_parse(const uint8_t *buf, size_t len, StatusView *view);
+
+/** @brief status_view_to_report
+ *
+ *  Copies a parsed report into host form (ports beyond STATUS_MAX_PORTS are dropped).
+ *
+ *  @return void : This function does not return any value.
+ */
+void status_view_to_report(const StatusView *view, StatusReport *report);
+
+/** @brief status_decode_text
+ *
+ *  Reads a legacy text report: "<name> IP: <ip> Port <id> - State: <state> ..."
+ *  with any number of ports and an optional " Seq: <n>".
+ *
+ *  @param text   : NUL terminated datagram
+ *  @param report : Receives the report, flags STATUS_BRIDGE_LEGACY
+ *
+ *  @return int : Returns 0 on success, -1 if it is not a status report
+ */
+int status_decode_text(const char *text, StatusReport *report);
+
+/** @brief status_render_text
+ *
+ *  Renders a report as one line of text for debugging, in the legacy
+ *  format plus the fields only the binary report has.
+ *
+ *  @return int : Length of the text
+ */
+int status_render_text(const StatusReport *report, char *buf, size_t size);
+
+/** @brief status_port_state_name
+ *
+ *  @return const char* : State name as brctl prints it
+ */
+const char *status_port_state_name(int state);
+
+/** @brief status_port_state_from_name
+ *
+ *  @return int : STATUS_PORT_*, STATUS_PORT_UNKNOWN if the name is not known
+ */
+int status_port_state_from_name(const char *name);
+
+#endif /* STATUS_PROTO_H */
@@ -0,0 +1,438 @@
+/** @file status_reporter.c
+ *  @brief Port status reports to the server with sequence numbers and asynchronous ACKs
+ *
+ *  See status_reporter.h.
+ *
+ *  @author Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include "timer_wheel.h"
+#include "status_reporter.h"
+
+
+/*
+ * Handed over by the other threads, under reporter_lock
+ */
+static pthread_mutex_t reporter_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t inbox_state[REPORT_MAX_STATE];
+static size_t inbox_len;
+static int inbox_new_state;
+static struct sockaddr_in inbox_server;
+static int inbox_has_server;
+static int inbox_server_changed;
+static ReporterStats stats;
+
+/*
+ * Reporter thread only
+ */
+static int sock_fd = -1;
+static int wake_fd = -1;
+static uint16_t server_port;
+static ReportFormatFn format_fn;
+static struct sockaddr_in server;
+static int has_server;
+static uint8_t state[REPORT_MAX_STATE];
+static size_t state_len;
+static uint32_t seq;
+static int unacked;               // state (seq) not ACKed yet
+static uint32_t rto_ms;
+static TimerWheel wheel;
+static TimerEntry retransmit_timer; // Retransmit while unacked, refresh after the ACK
+
+
+/** @brief now_ms
+ *
+ *  @return uint64_t : Monotonic time in milliseconds
+ */
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/** @brief count
+ *
+ *  Bumps one counter of the stats.
+ *
+ *  @param counter : Counter in stats
+ *
+ *  @return void : This function does not return any value.
+ */
+static void count(uint32_t *counter)
+{
+    pthread_mutex_lock(&reporter_lock);
+    (*counter)++;
+    pthread_mutex_unlock(&reporter_lock);
+}
+
+/** @brief send_report
+ *
+ *  Sends the current state and arms the retransmit timer.
+ *
+ *  @param retransmit : 1 if the same sequence number was sent before
+ *
+ *  @return void : This function does not return any value.
+ */
+static void send_report(int retransmit)
+{
+    char buffer[REPORT_MAX_DATAGRAM];
+    char ip[INET_ADDRSTRLEN];
+    int len;
+
+    len = format_fn(buffer, sizeof(buffer), state, seq);
+    if (len <= 0)
+    {
+        unacked = 0;
+        return;
+    }
+
+    inet_ntop(AF_INET, &server.sin_addr, ip, sizeof(ip));
+    if (sendto(sock_fd, buffer, (size_t)len, 0, (struct sockaddr *)&server, sizeof(server)) < 0)
+    {
+        perror("Send failed");
+    }
+    else
+    {
+        printf("Port status sent to %s:%d (seq %u%s)\n", ip, ntohs(server.sin_port), seq, retransmit ? ", retry" : "");
+    }
+    count(retransmit ? &stats.retransmits : &stats.sent);
+
+    timer_wheel_add(&wheel, &retransmit_timer, now_ms() + rto_ms);
+}
+
+/** @brief retransmit
+ *
+ *  Retransmit timer expired: no ACK for the current state yet, or the
+ *  state was ACKed REPORT_REFRESH_MS ago and is sent again as a new report.
+ *
+ *  @param timer : retransmit_timer
+ *
+ *  @return void : This function does not return any value.
+ */
+static void retransmit(TimerEntry *timer)
+{
+    (void)timer;
+
+    if (!has_server || state_len == 0)
+    {
+        return;
+    }
+
+    if (!unacked)
+    {
+        seq++;
+        unacked = 1;
+        rto_ms = REPORT_RTO_MS;
+        count(&stats.refreshes);
+        send_report(0);
+        return;
+    }
+
+    printf("Timeout reached, no ACK received. Retrying...\n");
+    rto_ms = (rto_ms * 2 > REPORT_RTO_MAX_MS) ? REPORT_RTO_MAX_MS : rto_ms * 2;
+    send_report(1);
+}
+
+/** @brief take_inbox
+ *
+ *  Picks up what the other threads handed over and sends if needed.
+ *
+ *  @return void : This function does not return any value.
+ */
+static void take_inbox(void)
+{
+    int send_now = 0;
+
+    pthread_mutex_lock(&reporter_lock);
+
+    if (inbox_server_changed)
+    {
+        inbox_server_changed = 0;
+        server = inbox_server;
+        has_server = inbox_has_server;
+
+        /*
+         * A new server has not seen anything yet
+         */
+        if (has_server && state_len > 0)
+        {
+            unacked = 1;
+            send_now = 1;
+        }
+    }
+
+    if (inbox_new_state)
+    {
+        inbox_new_state = 0;
+        if (unacked && state_len > 0)
+        {
+            stats.superseded++;
+        }
+        memcpy(state, inbox_state, inbox_len);
+        state_len = inbox_len;
+        seq++;
+        unacked = 1;
+        send_now = 1;
+    }
+
+    pthread_mutex_unlock(&reporter_lock);
+
+    if (!has_server)
+    {
+        timer_wheel_cancel(&wheel, &retransmit_timer);
+        if (send_now)
+        {
+            printf("Server not connected, report held until it is\n");
+        }
+        return;
+    }
+
+    if (send_now)
+    {
+        rto_ms = REPORT_RTO_MS;
+        send_report(0);
+    }
+}
+
+/** @brief receive_acks
+ *
+ *  Reads the ACKs waiting on the socket.
+ *
+ *  @return void : This function does not return any value.
+ */
+static void receive_acks(void)
+{
+    char buffer[64];
+    struct sockaddr_in from;
+    socklen_t from_len;
+    unsigned int acked_seq;
+    int len;
+
+    while (1)
+    {
+        from_len = sizeof(from);
+        len = recvfrom(sock_fd, buffer, sizeof(buffer) - 1, MSG_DONTWAIT, (struct sockaddr *)&from, &from_len);
+        if (len < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                perror("Recvfrom failed for ACK");
+            }
+            return;
+        }
+        buffer[len] = '\0';
+
+        if (!has_server || from.sin_addr.s_addr != server.sin_addr.s_addr)
+        {
+            continue;
+        }
+
+        /*
+         * "ACK <seq>"; a plain "ACK" (older server) is taken for the last report
+         */
+        if (strcmp(buffer, "ACK") == 0)
+        {
+            acked_seq = seq;
+        }
+        else if (sscanf(buffer, "ACK %u", &acked_seq) != 1)
+        {
+            printf("Unexpected message received: %s\n", buffer);
+            continue;
+        }
+
+        if (!unacked || acked_seq != seq)
+        {
+            count(&stats.stale_acks);
+            continue;
+        }
+
+        printf("Received ACK from server (seq %u)\n", seq);
+        unacked = 0;
+        timer_wheel_add(&wheel, &retransmit_timer, now_ms() + REPORT_REFRESH_MS);
+        count(&stats.acked);
+    }
+}
+
+/** @brief reporter_thread
+ *
+ *  Sends reports, reads ACKs and runs the retransmit timer; never blocks
+ *  anyone else.
+ *
+ *  @param arg : Not used
+ *
+ *  @return void* : Does not return
+ */
+static void *reporter_thread(void *arg)
+{
+    struct pollfd fds[2];
+    uint64_t wakeups;
+
+    (void)arg;
+
+    fds[0].fd = sock_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = wake_fd;
+    fds[1].events = POLLIN;
+
+    while (1)
+    {
+        if (poll(fds, 2, timer_wheel_next_ms(&wheel, now_ms())) < 0)
+        {
+            if (errno != EINTR)
+            {
+                perror("Reporter poll failed");
+                sleep(1);
+            }
+            continue;
+        }
+
+        if (fds[1].revents & POLLIN)
+        {
+            if (read(wake_fd, &wakeups, sizeof(wakeups)) < 0)
+            {
+                perror("Reporter wake-up read failed");
+            }
+            take_inbox();
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            receive_acks();
+        }
+
+        timer_wheel_advance(&wheel, now_ms());
+    }
+
+    return NULL;
+}
+
+/** @brief wake_reporter
+ *
+ *  @return void : This function does not return any value.
+ */
+static void wake_reporter(void)
+{
+    uint64_t one = 1;
+
+    if (write(wake_fd, &one, sizeof(one)) < 0)
+    {
+        perror("Reporter wake-up failed");
+    }
+}
+
+int status_reporter_start(uint16_t port, ReportFormatFn format)
+{
+    pthread_t thread;
+
+    server_port = port;
+    format_fn = format;
+    timer_wheel_init(&wheel, REPORT_TICK_MS, now_ms());
+    memset(&retransmit_timer, 0, sizeof(retransmit_timer));
+    retransmit_timer.fn = retransmit;
+
+    /*
+     * One socket for every report: the server's ACK comes back to it
+     */
+    sock_fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sock_fd < 0)
+    {
+        perror("Socket creation failed");
+        return -1;
+    }
+
+    wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (wake_fd < 0)
+    {
+        perror("Failed to create reporter eventfd");
+        close(sock_fd);
+        return -1;
+    }
+
+    if (pthread_create(&thread, NULL, reporter_thread, NULL) != 0)
+    {
+        perror("Failed to create reporter thread");
+        close(wake_fd);
+        close(sock_fd);
+        return -1;
+    }
+    pthread_detach(thread);
+
+    return 0;
+}
+
+void status_reporter_set_server(const char *ip)
+{
+    struct sockaddr_in addr;
+    int changed = 0;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(server_port);
+    if (ip != NULL && inet_pton(AF_INET, ip, &addr.sin_addr) != 1)
+    {
+        printf("Invalid sender IP address %s\n", ip);
+        ip = NULL;
+    }
+
+    pthread_mutex_lock(&reporter_lock);
+    if ((ip != NULL) != inbox_has_server ||
+        (ip != NULL && addr.sin_addr.s_addr != inbox_server.sin_addr.s_addr))
+    {
+        inbox_server = addr;
+        inbox_has_server = (ip != NULL);
+        inbox_server_changed = 1;
+        changed = 1;
+    }
+    pthread_mutex_unlock(&reporter_lock);
+
+    if (changed)
+    {
+        wake_reporter();
+    }
+}
+
+int status_reporter_submit(const void *new_state, size_t len)
+{
+    if (len == 0 || len > REPORT_MAX_STATE)
+    {
+        return -1;
+    }
+
+    /*
+     * Overwrites a state the reporter has not picked up yet: only the newest counts
+     */
+    pthread_mutex_lock(&reporter_lock);
+    if (inbox_new_state)
+    {
+        stats.superseded++;
+    }
+    memcpy(inbox_state, new_state, len);
+    inbox_len = len;
+    inbox_new_state = 1;
+    pthread_mutex_unlock(&reporter_lock);
+
+    wake_reporter();
+    return 0;
+}
+
+void status_reporter_stats(ReporterStats *out)
+{
+    pthread_mutex_lock(&reporter_lock);
+    *out = stats;
+    pthread_mutex_unlock(&reporter_lock);
+}
@@ -0,0 +1,100 @@
+/** @file status_reporter.h
+ *  @brief Port status reports to the server with sequence numbers and asynchronous ACKs
+ *
+ *  The reporter thread owns one UDP socket for the lifetime of the client.
+ *  status_reporter_submit() only stores the newest state and wakes the
+ *  thread, it never waits for the server. The thread sends the state with
+ *  a new sequence number; the server answers "ACK <seq>" (a server that
+ *  only answers "ACK" acknowledges whatever was sent last). Until the ACK
+ *  comes the report is sent again on a timer wheel, with the interval
+ *  doubling from REPORT_RTO_MS up to REPORT_RTO_MAX_MS.
+ *
+ *  A state submitted while the previous one is still unacknowledged
+ *  replaces it: only the newest state is ever retransmitted, and an ACK
+ *  for an older sequence number is ignored.
+ *
+ *  An acknowledged state is sent again with a new sequence number every
+ *  REPORT_REFRESH_MS, so the server can tell a quiet node from a gone one.
+ *
+ *  @author Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#ifndef STATUS_REPORTER_H
+#define STATUS_REPORTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define REPORT_MAX_STATE 256      // Largest state passed to status_reporter_submit()
+#define REPORT_MAX_DATAGRAM 1024
+#define REPORT_RTO_MS 500         // First retransmit
+#define REPORT_RTO_MAX_MS 8000
+#define REPORT_TICK_MS 50         // Timer wheel resolution
+#define REPORT_REFRESH_MS 10000   // Unchanged state sent again after its ACK
+
+/*
+ * Builds the datagram for a state
+ *
+ *  buf   : Datagram buffer
+ *  size  : Size of buf
+ *  state : State as passed to status_reporter_submit()
+ *  seq   : Sequence number to put in the report
+ *
+ *  Returns the datagram length, 0 or less to send nothing
+ */
+typedef int (*ReportFormatFn)(char *buf, size_t size, const void *state, uint32_t seq);
+
+typedef struct {
+    uint32_t sent;                // Reports sent the first time
+    uint32_t retransmits;
+    uint32_t acked;
+    uint32_t superseded;          // Replaced by a newer state before their ACK
+    uint32_t stale_acks;          // ACKs for a sequence number no longer current
+    uint32_t refreshes;           // Unchanged state sent again after REPORT_REFRESH_MS
+} ReporterStats;
+
+
+/** @brief status_reporter_start
+ *
+ *  Opens the socket and starts the reporter thread.
+ *
+ *  @param port   : UDP port of the server
+ *  @param format : Builds a datagram from a state
+ *
+ *  @return int : Returns 0 on success, -1 on failure
+ */
+int status_reporter_start(uint16_t port, ReportFormatFn format);
+
+/** @brief status_reporter_set_server
+ *
+ *  Sets the server address, NULL while there is no server. When a server
+ *  appears or changes, the current state is sent to it right away.
+ *
+ *  @param ip : Server IPv4 address as a string, or NULL
+ *
+ *  @return void : This function does not return any value.
+ */
+void status_reporter_set_server(const char *ip);
+
+/** @brief status_reporter_submit
+ *
+ *  Hands a new state to the reporter; returns at once.
+ *
+ *  @param state : State, copied
+ *  @param len   : Length, at most REPORT_MAX_STATE
+ *
+ *  @return int : Returns 0 on success, -1 if the state is too large
+ */
+int status_reporter_submit(const void *state, size_t len);
+
+/** @brief status_reporter_stats
+ *
+ *  @param stats : Receives the counters since status_reporter_start()
+ *
+ *  @return void : This function does not return any value.
+ */
+void status_reporter_stats(ReporterStats *stats);
+
+#endif /* STATUS_REPORTER_H */
@@ -0,0 +1,195 @@
+/** @file timer_wheel.c
+ *  @brief Hashed timer wheel for retransmit and expiry timeouts
+ *
+ *  See timer_wheel.h.
+ *
+ *  @author Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#include <stddef.h>
+#include "timer_wheel.h"
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+
+
+/** @brief list_insert
+ *
+ *  Appends a timer to a slot list.
+ *
+ *  @return void : This function does not return any value.
+ */
+static void list_insert(TimerEntry *head, TimerEntry *timer)
+{
+    timer->next = head;
+    timer->prev = head->prev;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+/** @brief list_remove
+ *
+ *  Takes a timer out of whatever list it is in.
+ *
+ *  @return void : This function does not return any value.
+ */
+static void list_remove(TimerEntry *timer)
+{
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = NULL;
+    timer->prev = NULL;
+}
+
+void timer_wheel_init(TimerWheel *wheel, uint32_t tick_ms, uint64_t now_ms)
+{
+    int i;
+
+    for (i = 0; i < TIMER_WHEEL_SLOTS; i++)
+    {
+        wheel->slots[i].next = &wheel->slots[i];
+        wheel->slots[i].prev = &wheel->slots[i];
+    }
+    wheel->tick_ms = (tick_ms > 0) ? tick_ms : 1;
+    wheel->origin_ms = now_ms;
+    wheel->current = 0;
+    wheel->pending = 0;
+}
+
+void timer_wheel_add(TimerWheel *wheel, TimerEntry *timer, uint64_t expires_ms)
+{
+    uint64_t tick = 0;
+
+    if (timer_pending(timer))
+    {
+        timer_wheel_cancel(wheel, timer);
+    }
+
+    /*
+     * Round up: a timer never runs before its time
+     */
+    if (expires_ms > wheel->origin_ms)
+    {
+        tick = (expires_ms - wheel->origin_ms + wheel->tick_ms - 1) / wheel->tick_ms;
+    }
+    if (tick < wheel->current)
+    {
+        tick = wheel->current;
+    }
+
+    timer->expires = tick;
+    list_insert(&wheel->slots[tick & SLOT_MASK], timer);
+    wheel->pending++;
+}
+
+void timer_wheel_cancel(TimerWheel *wheel, TimerEntry *timer)
+{
+    if (timer_pending(timer))
+    {
+        list_remove(timer);
+        wheel->pending--;
+    }
+}
+
+int timer_wheel_advance(TimerWheel *wheel, uint64_t now_ms)
+{
+    TimerEntry due;
+    TimerEntry *timer;
+    TimerEntry *slot;
+    uint64_t target;
+    uint64_t start;
+    uint64_t ticks;
+    uint64_t i;
+    int fired = 0;
+
+    if (now_ms < wheel->origin_ms)
+    {
+        return 0;
+    }
+    target = (now_ms - wheel->origin_ms) / wheel->tick_ms;
+    if (target < wheel->current)
+    {
+        return 0;
+    }
+
+    /*
+     * Every slot at most once, however long it has been since the last call
+     */
+    start = wheel->current;
+    ticks = target - start + 1;
+    if (ticks > TIMER_WHEEL_SLOTS)
+    {
+        ticks = TIMER_WHEEL_SLOTS;
+    }
+
+    /*
+     * Timers that callbacks add for now or earlier go to the next tick
+     */
+    wheel->current = target + 1;
+
+    for (i = 0; i < ticks && wheel->pending > 0; i++)
+    {
+        slot = &wheel->slots[(start + i) & SLOT_MASK];
+        if (slot->next == slot)
+        {
+            continue;
+        }
+
+        /*
+         * Move the slot to a private list first: callbacks may add timers
+         * to this slot again, those wait for the next call
+         */
+        due.next = slot->next;
+        due.prev = slot->prev;
+        due.next->prev = &due;
+        due.prev->next = &due;
+        slot->next = slot;
+        slot->prev = slot;
+
+        while (due.next != &due)
+        {
+            timer = due.next;
+            list_remove(timer);
+
+            if (timer->expires > target)
+            {
+                /*
+                 * Another turn of the wheel to go
+                 */
+                list_insert(slot, timer);
+                continue;
+            }
+
+            wheel->pending--;
+            timer->fn(timer);
+            fired++;
+        }
+    }
+
+    return fired;
+}
+
+int timer_wheel_next_ms(const TimerWheel *wheel, uint64_t now_ms)
+{
+    const TimerEntry *slot;
+    uint64_t at_ms;
+    uint64_t i;
+
+    if (wheel->pending == 0)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < TIMER_WHEEL_SLOTS; i++)
+    {
+        slot = &wheel->slots[(wheel->current + i) & SLOT_MASK];
+        if (slot->next != slot)
+        {
+            at_ms = wheel->origin_ms + (wheel->current + i) * wheel->tick_ms;
+            return (at_ms > now_ms) ? (int)(at_ms - now_ms) : 0;
+        }
+    }
+
+    return 0;
+}
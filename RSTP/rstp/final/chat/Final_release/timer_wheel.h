@@ -0,0 +1,100 @@
+/** @file timer_wheel.h
+ *  @brief Hashed timer wheel for retransmit and expiry timeouts
+ *
+ *  Time is cut into ticks of tick_ms; a timer goes into the slot of the
+ *  tick it expires in (modulo TIMER_WHEEL_SLOTS), so adding and cancelling
+ *  are O(1) whatever the number of timers. A timer further away than one
+ *  turn of the wheel stays in its slot until its tick comes round. Timers
+ *  are embedded in the caller's own structs, nothing is allocated.
+ *
+ *  Not thread-safe: one thread owns the wheel.
+ *
+ *  @author Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+
+#define TIMER_WHEEL_SLOTS 256  // Power of two
+
+typedef struct TimerEntry TimerEntry;
+typedef void (*TimerFn)(TimerEntry *timer);
+
+/*
+ * One timer, embedded in the struct it belongs to; zero it before the
+ * first timer_wheel_add()
+ */
+struct TimerEntry {
+    TimerEntry *next;
+    TimerEntry *prev;          // NULL when not pending
+    uint64_t expires;          // Tick
+    TimerFn fn;
+};
+
+typedef struct {
+    TimerEntry slots[TIMER_WHEEL_SLOTS];  // List heads
+    uint32_t tick_ms;
+    uint64_t origin_ms;        // Time of tick 0
+    uint64_t current;          // All ticks before this one have run
+    unsigned int pending;
+} TimerWheel;
+
+
+/** @brief timer_wheel_init
+ *
+ *  @param wheel   : Wheel to set up
+ *  @param tick_ms : Resolution
+ *  @param now_ms  : Current time (any monotonic millisecond clock)
+ *
+ *  @return void : This function does not return any value.
+ */
+void timer_wheel_init(TimerWheel *wheel, uint32_t tick_ms, uint64_t now_ms);
+
+/** @brief timer_wheel_add
+ *
+ *  Starts a timer, or moves it if it is already pending. It runs on the
+ *  first timer_wheel_advance() at or after expires_ms (rounded up to a tick).
+ *
+ *  @param wheel      : Wheel
+ *  @param timer      : Timer, fn set by the caller
+ *  @param expires_ms : Expiry time on the clock of timer_wheel_init()
+ *
+ *  @return void : This function does not return any value.
+ */
+void timer_wheel_add(TimerWheel *wheel, TimerEntry *timer, uint64_t expires_ms);
+
+/** @brief timer_wheel_cancel
+ *
+ *  Stops a timer; does nothing if it is not pending.
+ *
+ *  @return void : This function does not return any value.
+ */
+void timer_wheel_cancel(TimerWheel *wheel, TimerEntry *timer);
+
+/** @brief timer_wheel_advance
+ *
+ *  Runs the callbacks of all timers that expired up to now_ms. A callback
+ *  may add or cancel timers, itself included.
+ *
+ *  @return int : Number of timers run
+ */
+int timer_wheel_advance(TimerWheel *wheel, uint64_t now_ms);
+
+/** @brief timer_wheel_next_ms
+ *
+ *  Time until the next slot with a pending timer, for a poll() timeout.
+ *
+ *  @return int : Milliseconds (0 if one is due), -1 if no timer is pending
+ */
+int timer_wheel_next_ms(const TimerWheel *wheel, uint64_t now_ms);
+
+static inline int timer_pending(const TimerEntry *timer)
+{
+    return timer->prev != 0;
+}
+
+#endif /* TIMER_WHEEL_H */
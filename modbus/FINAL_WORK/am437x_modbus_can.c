@@ -9,24 +9,21 @@
 #include <sys/ioctl.h>
 #include <net/if.h>
 #include <sys/socket.h>
+#include "etu_protocol.h"
 
 
+#ifndef CAN_INTERFACE
 #define CAN_INTERFACE   "can0"
+#endif
 //#define CAN_BITRATE     125000
 #define CAN_BITRATE     1000000
 
-#define CAN_REQUEST_ID  0x01200333
-#define CAN_RESPONSE_ID 0x01210333
-#define CAN_ACK_ID      0x01290333
-#define Heartbeat_ID    0x017E0333
-
 /*
- *Polynomial for CRC-16
+ * Read request 0x01200333: Module Address 0, Module ID 2, Data Header 2,
+ * Data ID 0x333. Response and ACK IDs follow from it (see etu_protocol.h).
  */
-#define CRC_POLY        0xA001
-
-#define FRAME_DATA_SIZE 5
-#define TOTAL_FRAMES    12
+#define CAN_REQUEST_ID  etu_id_build(0, 2, 2, ETU_MSG_READ_REQ, 0x333)
+#define Heartbeat_ID    0x017E0333
 
 typedef struct __attribute__((packed)) {
     uint16_t data1;
@@ -64,6 +61,19 @@ void print_error(const char *msg)
 }
 
 
+/*
+ * vcan and other software interfaces have no bitrate
+ */
+int is_virtual_interface(const char *ifname)
+{
+    char path[128];
+
+    snprintf(path, sizeof(path), "/sys/devices/virtual/net/%s", ifname);
+
+    return access(path, F_OK) == 0;
+}
+
+
 /**
  * @brief Sets up the CAN interface with the specified bitrate.
  *
@@ -92,7 +102,7 @@ void setup_can_interface(const char *interface, int bitrate)
      * Configure the CAN interface with the specified bitrate
      */
     snprintf(command, sizeof(command), "ip link set %s up type can bitrate %d", interface, bitrate);
-    if (system(command) != 0)
+    if (!is_virtual_interface(interface) && (system(command) != 0))
     {
         fprintf(stderr, "Failed to configure CAN interface: %s\n", interface);
         exit(EXIT_FAILURE);
@@ -305,125 +315,78 @@ void *heartbeat_thread(void *arg)
     return NULL;
 }
 
-/*  
- * Function to calculate CRC-16 over a given data buffer.  
- * Uses the standard CRC polynomial for error detection.  
- * Returns the computed CRC value.  
- */  
-uint16_t calculate_crc(uint8_t *data, int length) 
-{
-    uint16_t crc = 0xFFFF;
-    
-    for (int i = 0; i < length; i++) 
-    {
-        crc ^= data[i];
-        
-        for (int j = 0; j < 8; j++) 
-        {
-            if (crc & 1) 
-            {
-                crc = (crc >> 1) ^ CRC_POLY;
-            } 
-            else 
-            {
-                crc >>= 1;
-            }
-        }
-    }
-    
-    return crc;
-}
-
 /*  
  * Function to receive a CAN response and reassemble fragmented data.  
- * Verifies CRC for each received frame and sends acknowledgment.  
- * Returns 0 on success, -1 on failure.  
+ * Sends the read request, then checks the CRC of each received fragment
+ * and acknowledges it; the sequence is driven by the etu_protocol state
+ * machine. Returns 0 on success, -1 on failure.
  */  
 int receive_can_response(int socket_fd, BR_DATA *br_data) 
 {
+    struct can_frame 		tx_frame;
     struct can_frame 		frame;
-    struct can_frame 		ack_frame;
-    uint8_t 			received_data[56] = {0};
-    int 			received_bytes = 0;
-    uint8_t 			frame_index;
-    int 			expected_frames = 12;
+    etu_xfer 			xfer;
+    uint32_t 			expect_id;
     uint8_t 			ret = 0;
-    uint16_t 			crc_received;
 
-    for (int i = 0; i < expected_frames; i++) 
+    /*
+     * sizeof(BR_DATA) = 56 bytes = 28 registers, 10 fragments of 6 bytes
+     */
+    etu_read_begin(&xfer, CAN_REQUEST_ID, sizeof(BR_DATA) / 2, (uint8_t *)br_data, sizeof(BR_DATA));
+
+    while (!etu_xfer_done(&xfer)) 
     {
         /*  
-         * Receiving CAN frame from ETU to TCP.  
-         * Each frame contains a part of the data. 
-	 *
-	 * ETU Response 1: 0x01210333 | 0x01 0x01 0x00 0x00 0x00 0x01 0xFF 0xFC | Classic CAN | 8 bytes | RTR Data
-	 *
+         * TCP Request:     0x01200333 | size 0x1C ... CRC  
+         * TCP Frame Ack n: 0x01290333 + n * 3 | 0x00 ... 0xFF 0xFF  
          */ 
+        tx_frame.can_dlc = 8;
+        expect_id = etu_xfer_tx(&xfer, &tx_frame.can_id, tx_frame.data);
 
-        ret = receive_can_message(socket_fd, &frame); 
+        ret = send_can_message(socket_fd, &tx_frame);
         if (0 != ret) 
         {
-            print_error("CAN response receive failed");
+            print_error("CAN send failed");
             return -1;
         }
-	
-	printf("ETU to TCP: Data Read Response received.\n");
 
-        frame_index = frame.data[0] - 1;
-       
-       	crc_received = (frame.data[6] << 8) | frame.data[7];
-
-        /*  
-         * Verify the CRC for the received frame.  
-         * If CRC does not match, discard the frame.  
-         */  
-        if (calculate_crc(frame.data, 6) != crc_received) 
+        if (0 == expect_id)
         {
-            printf("CRC Error on frame %d\n", frame_index);
-            return -1;
+            break;
         }
 
         /*  
-         * Copy valid data from the received frame.  
-         * Data is reassembled based on frame index.  
-         */
-        if(frame_index == 11)
-	{
-         memcpy(&received_data[55], &frame.data[1], 1);
-	}
-       else
-       {
-         memcpy(&received_data[frame_index * 5], &frame.data[1], 5);
-       }	       
-
-        /*  
-         * Prepare and send acknowledgment frame back to ETU.  
-         * Acknowledgment contains frame index and confirmation bytes. 
+         * Receiving CAN frame from ETU to TCP.  
+         * Each frame contains 6 bytes of the data and the CRC. 
 	 *
-	 * TCP Frame Ack 1:0x01290333 | 0x01 0x00 0x00 0x00 0x00 0x00 0xFF 0xFE | Classic CAN | 8 bytes | RTR Data
-         */  
-        ack_frame.can_id = CAN_ACK_ID + (frame_index * 5);
-        ack_frame.can_dlc = 8;
-        memset(ack_frame.data, 0, 8);
-        ack_frame.data[0] = frame_index + 1;
-        ack_frame.data[6] = 0xFF;
-        ack_frame.data[7] = 0xFE - frame_index;
-        
-        printf("TCP to ETU: Data Read Acknowledgment sent.\n");
-        ret = send_can_message(socket_fd, &ack_frame);
-        if (0 != ret) 
+	 * ETU Response n: 0x01210333 + n * 3 | 6 data bytes, CRC | Classic CAN | 8 bytes
+	 *
+         */ 
+        do
+        {
+            ret = receive_can_message(socket_fd, &frame); 
+            if (0 != ret) 
+            {
+                print_error("CAN response receive failed");
+                return -1;
+            }
+
+            ret = etu_xfer_rx(&xfer, frame.can_id & CAN_EFF_MASK, frame.data);
+        } while (ETU_RX_IGNORED == ret);
+
+        if (ETU_RX_CRC == ret)
         {
-            print_error("CAN ACK send failed");
+            printf("CRC Error on frame %d\n", xfer.frag);
             return -1;
         }
-	printf("\n");
+
+	printf("ETU to TCP: Data Read Response %d received.\n", xfer.frag);
     }
     
     /*  
      * Reception complete: All fragmented data has been successfully reassembled.  
      */  
     printf("Reception complete: All fragmented data has been successfully reassembled.\n");
-    memcpy(br_data, received_data, sizeof(BR_DATA));
     return 0;
 }
 
@@ -461,35 +424,15 @@ void print_br_data(const BR_DATA *data)
 int can_send_receive_reassemble_fragment_data(int socket_fd)  
 {  
     BR_DATA br_data;  
-    struct can_frame send_can_request;  
     uint8_t ret = 0;  
 
     memset(&br_data, 0, sizeof(BR_DATA));  
 
-    /*  
-     * Configure the CAN request frame 
-     *
-     * TCP Request: 0x01200333 | --------------------------------------- | Classic CAN | 0 bytes | RTR Remote
-     *
-     */  
-    send_can_request.can_id = CAN_REQUEST_ID; /* CAN ID for the request */  
-    send_can_request.can_dlc = 8; /* Data length */  
-    memset(&send_can_request.data[0], 0, 8); /* Initialize data to zero */  
-
     printf("TCP to ETU: Data Read Request sent.\n");  
 
     /*  
-     * Send the request frame  
-     */  
-    ret = send_can_message(socket_fd, &send_can_request);  
-    if (0 != ret)  
-    {  
-        print_error("CAN request send failed\n");  
-        return -1;  
-    }  
-
-    /*  
-     * Receive the fragmented data response and acknowledge each frame  
+     * Send the request, receive the fragmented data response and
+     * acknowledge each frame  
      */  
     ret = receive_can_response(socket_fd, &br_data); 
     if (0 != ret)  
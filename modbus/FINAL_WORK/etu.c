@@ -1,101 +1,1096 @@
+/**
+ *  @file    etu.c
+ *  @brief   ETU simulator: the CAN side of the Modbus/CAN bridge, for vcan tests
+ *
+ *  Answers the complete ETU protocol (see test_code/etu_protocol.h) for any
+ *  number of module addresses and every data header / Data ID:
+ *
+ *    READ_REQ        fragments of the requested range, one per READ_ACK
+ *    DELTA_READ_REQ  the same with a can_delta stream (test_code/can_delta.h)
+ *    WRITE_REQ       WRITE_GRANT, one WRITE_ACK per WRITE_DATA fragment,
+ *                    WRITE_TERM_ACK after WRITE_TERM; the data is stored
+ *                    and returned by later reads
+ *
+ *  A repeated data fragment or ACK (the bridge retransmits after a timeout)
+ *  is answered with the same frame again; a repeated request restarts the
+ *  transfer, so recovery paths can be exercised. Every transfer is a small state record keyed by its request
+ *  ID; the event loop never blocks on one transfer, several bridges or
+ *  modules can be served at once.
+ *
+ *  Fault and timing model, per frame and reproducible with -s:
+ *
+ *    -l us   response latency        -j us   uniform jitter added to it
+ *    -L %    frame loss, both ways   -C %    payload corruption (CRC kept)
+ *    -u ms,permille  register updates: every ms, each word of every range
+ *                    read so far changes with this probability
+ *
+ *  With -r the binary register map (test_code/regmap_gen) is loaded: only
+ *  Data IDs of its CAN datasets are answered, and ranges whose registers
+ *  are coils / discrete inputs are sent as packed bits (data[0] = bits).
+ *  Without it every request is answered, data[0] counts registers.
+ *
+ *  Build and run next to the bridge on vcan:
+ *
+ *    ip link add dev vcan0 type vcan ; ip link set vcan0 up
+ *    gcc -O2 -I../../test_code etu.c ../../test_code/etu_protocol.c ../../test_code/can_delta.c
+ *        ../../test_code/register_map.c ../../test_code/log_async.c -o etu -lpthread
+ *    ./etu -i vcan0 -m 0,1 -l 300 -j 200 -L 0.5 -C 0.1 -s 1
+ *
+ *  Statistics are printed every -t seconds (default 10) and on exit.
+ *
+ *  @author  Abinash
+ *
+ *  @bug Only classic CAN frames; no heartbeat monitoring of the bridge.
+ */
+
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
 #include <linux/can.h>
 #include <linux/can/raw.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <net/if.h>
+#include "etu_protocol.h"
+#include "can_delta.h"
+#include "register_map.h"
+
+#define CAN_INTERFACE       "can0"
+
+#define ETU_MAX_XFERS       64          /* Transfers in progress              */
+#define ETU_MAX_PENDING     512         /* Frames waiting for their latency   */
+#define ETU_MAX_RANGES      64          /* Ranges remembered for delta/update */
+#define ETU_MAX_BYTES       CAN_DELTA_MAX_BYTES
+#define ETU_RX_BATCH        32
+#define ETU_STATS_SEC       10
+
+
+/*
+ * Register memory of one (module address, module ID, data header)
+ */
+typedef struct {
+    uint8_t     words[65536 * 2];       /* Big endian, indexed by Data ID      */
+    uint8_t     bits[65536];            /* 0 / 1, indexed by Data ID           */
+    uint16_t    update_pass[65536];     /* Last update pass that visited it    */
+} etu_store;
+
+/*
+ * Transfer in progress (ETU side)
+ */
+typedef struct {
+    uint32_t    key;                    /* Request ID with message type 0      */
+    uint8_t     in_use;
+    uint8_t     op;                     /* ETU_XFER_READ / ETU_XFER_WRITE      */
+    uint8_t     delta;
+    uint8_t     committed;              /* Write: data stored                  */
+    uint16_t    len;                    /* Payload bytes                       */
+    uint16_t    frags;
+    uint16_t    acked;                  /* Read: fragments acknowledged        */
+    uint32_t    got_mask[(ETU_MAX_BYTES / ETU_FRAME_PAYLOAD + 32) / 32];
+    uint64_t    last_us;
+    uint8_t     buf[CAN_DELTA_MAX_STREAM];
+} etu_txn;
+
+/*
+ * Read range seen so far: last image sent (delta) and update target
+ */
+typedef struct {
+    uint32_t    key;
+    uint16_t    len;
+    uint8_t     bits;
+    uint8_t     has_sent;
+    uint32_t    sent_version;
+    uint64_t    last_use;
+    uint8_t     sent[ETU_MAX_BYTES];
+} etu_range;
+
+/*
+ * Frame waiting for its response latency
+ */
+typedef struct {
+    uint64_t         due_us;
+    struct can_frame frame;
+} etu_pending;
+
+typedef struct {
+    uint64_t    rx_frames;
+    uint64_t    rx_lost;
+    uint64_t    rx_crc;
+    uint64_t    rx_ignored;
+    uint64_t    reads;
+    uint64_t    delta_reads;
+    uint64_t    writes;
+    uint64_t    repeats;            /* Frames answered again               */
+    uint64_t    unknown;            /* Data ID not in the register map     */
+    uint64_t    tx_frames;
+    uint64_t    tx_lost;
+    uint64_t    tx_corrupt;
+    uint64_t    tx_overflow;
+    uint64_t    delta_status[3];
+} etu_stats;
+
+
+static etu_store       *stores[4][16][8];
+static etu_txn          txns[ETU_MAX_XFERS];
+static etu_range        ranges[ETU_MAX_RANGES];
+static etu_pending      pending[ETU_MAX_PENDING];
+static int              pending_count;
+static etu_stats        stats;
+static uint64_t         use_clock;
+
+static uint8_t          module_mask = 0x1;      /* Module addresses answered */
+static uint32_t         latency_us;
+static uint32_t         jitter_us;
+static uint32_t         loss_ppm;
+static uint32_t         corrupt_ppm;
+static uint32_t         update_ms;
+static uint32_t         update_permille;
+static int              verbose;
+static regmap_t        *map;
+
+static volatile sig_atomic_t stop;
+
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000;
+}
+
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+static uint32_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (uint32_t)(rng_state >> 32);
+}
+
+/**
+ * @return 1 with probability ppm / 1000000
+ */
+static int chance_ppm(uint32_t ppm)
+{
+    return (ppm != 0) && ((rng() % 1000000U) < ppm);
+}
+
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+
+static etu_store *store_get(uint32_t can_id)
+{
+    etu_id      id;
+    etu_store **s;
+    uint32_t    i;
+
+    etu_id_parse(can_id, &id);
+    s = &stores[id.module_addr][id.module_id][id.data_header];
+
+    if (*s == NULL)
+    {
+        *s = calloc(1, sizeof(etu_store));
+        if (*s == NULL)
+        {
+            return NULL;
+        }
+
+        /*
+         * Recognisable start values: register n holds n, coils alternate
+         */
+        for (i = 0; i < 65536; i++)
+        {
+            (*s)->words[i * 2]     = (uint8_t)(i >> 8);
+            (*s)->words[i * 2 + 1] = (uint8_t)i;
+            (*s)->bits[i]          = (uint8_t)(i & 1);
+        }
+    }
+
+    return *s;
+}
+
+
+/**
+ * @brief Check a request against the register map.
+ *
+ * @param bits  Set to 1 if the range holds coils / discrete inputs
+ *
+ * @return 0 if the ETU serves this Data ID, -1 if not
+ */
+static int map_check(uint32_t can_id, uint8_t *bits)
+{
+    etu_id                 id;
+    const regmap_dataset  *ds;
+    const regmap_entry    *e;
+    uint32_t               d;
+    uint32_t               i;
+
+    *bits = 0;
+
+    if (map == NULL)
+    {
+        return 0;
+    }
+
+    etu_id_parse(can_id, &id);
+
+    for (d = 0; d < map->hdr->dataset_count; d++)
+    {
+        ds = &map->datasets[d];
+
+        if ((ds->kind != REGMAP_KIND_CAN) || (ds->data_header != id.data_header) ||
+            (id.data_id < ds->first_addr) || (id.data_id > ds->last_addr))
+        {
+            continue;
+        }
+
+        for (i = 0; i < ds->entry_count; i++)
+        {
+            e = &map->entries[ds->first_entry + i];
+            if (e->addr == id.data_id)
+            {
+                *bits = (e->fun_code[0] == 1) || (e->fun_code[0] == 2);
+                return 0;
+            }
+        }
+    }
+
+    return -1;
+}
 
-#define CAN_INTERFACE    "can0"
-#define TRIGGER_ID       0x01200333 
-#define START_ID         0x01210333 
-#define ACK_BASE_ID      0x01290333 
-#define FRAME_COUNT      12
-#define DATA_SIZE        56
 
-u_int8_t static_data[DATA_SIZE];
+/**
+ * @brief Copy the current values of a range into @p out.
+ */
+static void range_snapshot(etu_store *s, uint16_t data_id, uint8_t size, uint8_t bits, uint8_t *out, uint16_t len)
+{
+    uint16_t i;
 
-void initialize_can_data() {
-        
-	for (int i = 0; i < DATA_SIZE; i++) 
-	{
-            static_data[i] = 0x10 + i;
+    if (!bits)
+    {
+        for (i = 0; i < len; i++)
+        {
+            out[i] = s->words[((uint32_t)data_id * 2 + i) & 0x1FFFF];
         }
+        return;
+    }
+
+    /*
+     * Packed LSB first, as in the Modbus coil / discrete input response
+     */
+    memset(out, 0, len);
+    for (i = 0; i < size; i++)
+    {
+        out[i / 8] |= (uint8_t)(s->bits[(uint16_t)(data_id + i)] << (i % 8));
+    }
 }
 
 
-unsigned short crc16(const unsigned char *data, int length) {
-    unsigned short crc = 0xFFFF;
-    for (int i = 0; i < length; i++) {
-        crc ^= data[i];
-        for (int j = 0; j < 8; j++) {
-            if (crc & 1)
-                crc = (crc >> 1) ^ 0xA001;
+static etu_range *range_get(uint32_t key, uint16_t len, uint8_t bits)
+{
+    etu_range *oldest = &ranges[0];
+    int        i;
+
+    use_clock++;
+
+    for (i = 0; i < ETU_MAX_RANGES; i++)
+    {
+        if ((ranges[i].len != 0) && (ranges[i].key == key) && (ranges[i].len == len))
+        {
+            ranges[i].last_use = use_clock;
+            return &ranges[i];
+        }
+
+        if (ranges[i].last_use < oldest->last_use)
+        {
+            oldest = &ranges[i];
+        }
+    }
+
+    memset(oldest, 0, sizeof(*oldest));
+    oldest->key      = key;
+    oldest->len      = len;
+    oldest->bits     = bits;
+    oldest->last_use = use_clock;
+
+    return oldest;
+}
+
+
+/**
+ * @brief Change random words of every range read so far.
+ */
+static void update_registers(void)
+{
+    static uint16_t pass;
+    etu_store      *s;
+    uint16_t        data_id;
+    uint16_t        a;
+    uint16_t        w;
+    int             i;
+
+    /*
+     * Ranges overlap; each address gets one chance per pass
+     */
+    pass = (uint16_t)(pass + 1) ? (uint16_t)(pass + 1) : 1;
+
+    for (i = 0; i < ETU_MAX_RANGES; i++)
+    {
+        if ((ranges[i].len == 0) || ((s = store_get(ranges[i].key)) == NULL))
+        {
+            continue;
+        }
+
+        data_id = (uint16_t)ranges[i].key;
+
+        for (w = 0; w < (ranges[i].bits ? ranges[i].len * 8 : ranges[i].len / 2); w++)
+        {
+            a = (uint16_t)(data_id + w);
+            if ((s->update_pass[a] == pass) || ((uint32_t)(rng() % 1000) >= update_permille))
+            {
+                s->update_pass[a] = pass;
+                continue;
+            }
+            s->update_pass[a] = pass;
+
+            if (ranges[i].bits)
+            {
+                s->bits[a] ^= 1;
+            }
             else
-                crc >>= 1;
+            {
+                s->words[(uint32_t)a * 2 + 1] += (uint8_t)(1 + rng() % 255);
+            }
         }
     }
-    return crc;
 }
 
-void send_can_frame(int sock, int id, unsigned char *data) {
-    struct can_frame frame;
-    frame.can_id = id | CAN_EFF_FLAG;
-    frame.can_dlc = 8;
-    memcpy(frame.data, data, 8);
-    write(sock, &frame, sizeof(struct can_frame));
-    printf("Sent frame ID: 0x%X, Data: ", id);
-    for (int i = 0; i < 8; i++) printf("%02X ", frame.data[i]);
+
+static etu_txn *txn_find(uint32_t key)
+{
+    int i;
+
+    for (i = 0; i < ETU_MAX_XFERS; i++)
+    {
+        if (txns[i].in_use && (txns[i].key == key))
+        {
+            return &txns[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief Transfer slot for @p key: a free one, else the least recently active.
+ */
+static etu_txn *txn_new(uint32_t key)
+{
+    etu_txn *t = txn_find(key);
+    int      i;
+
+    if (t == NULL)
+    {
+        t = &txns[0];
+        for (i = 0; i < ETU_MAX_XFERS; i++)
+        {
+            if (!txns[i].in_use)
+            {
+                t = &txns[i];
+                break;
+            }
+            if (txns[i].last_us < t->last_us)
+            {
+                t = &txns[i];
+            }
+        }
+    }
+
+    memset(t, 0, offsetof(etu_txn, buf));
+    t->key    = key;
+    t->in_use = 1;
+    t->last_us = now_us();
+
+    return t;
+}
+
+
+static void print_frame(const char *dir, const struct can_frame *f)
+{
+    int i;
+
+    printf("%s 0x%08X %-14s", dir, f->can_id & CAN_EFF_MASK, etu_msg_name(etu_id_type(f->can_id & CAN_EFF_MASK)));
+    for (i = 0; i < f->can_dlc; i++)
+    {
+        printf(" %02X", f->data[i]);
+    }
     printf("\n");
 }
 
-int main() {
-    int sock = socket(PF_CAN, SOCK_RAW, CAN_RAW);
-    struct ifreq ifr;
+
+/**
+ * @brief Queue a frame for transmission after the response latency.
+ */
+static void queue_frame(uint32_t can_id, const uint8_t data[ETU_FRAME_LEN])
+{
+    etu_pending *p;
+    uint64_t     delay = latency_us + (jitter_us ? rng() % (jitter_us + 1) : 0);
+
+    if (pending_count >= ETU_MAX_PENDING)
+    {
+        stats.tx_overflow++;
+        return;
+    }
+
+    p = &pending[pending_count++];
+    p->due_us          = now_us() + delay;
+    memset(&p->frame, 0, sizeof(p->frame));
+    p->frame.can_id    = can_id | CAN_EFF_FLAG;
+    p->frame.can_dlc   = ETU_FRAME_LEN;
+    memcpy(p->frame.data, data, ETU_FRAME_LEN);
+}
+
+
+/**
+ * @brief Send every queued frame that is due, applying loss and corruption.
+ *
+ * @return Microseconds until the next frame is due, -1 if none is queued
+ */
+static int64_t flush_due(int sock)
+{
+    uint64_t     now  = now_us();
+    int64_t      next = -1;
+    int64_t      wait;
+    etu_pending  p;
+    int          i = 0;
+
+    while (i < pending_count)
+    {
+        if (pending[i].due_us > now)
+        {
+            wait = (int64_t)(pending[i].due_us - now);
+            if ((next < 0) || (wait < next))
+            {
+                next = wait;
+            }
+            i++;
+            continue;
+        }
+
+        /*
+         * Keep the order of frames that are due at the same time
+         */
+        p = pending[i];
+        memmove(&pending[i], &pending[i + 1], (size_t)(pending_count - i - 1) * sizeof(pending[0]));
+        pending_count--;
+
+        if (chance_ppm(loss_ppm))
+        {
+            stats.tx_lost++;
+            continue;
+        }
+
+        if (chance_ppm(corrupt_ppm))
+        {
+            p.frame.data[rng() % ETU_FRAME_PAYLOAD] ^= (uint8_t)(1 << (rng() % 8));
+            stats.tx_corrupt++;
+        }
+
+        if (write(sock, &p.frame, sizeof(p.frame)) != sizeof(p.frame))
+        {
+            stats.tx_lost++;
+            continue;
+        }
+
+        stats.tx_frames++;
+        if (verbose)
+        {
+            print_frame("TX", &p.frame);
+        }
+    }
+
+    return next;
+}
+
+
+static void send_read_fragment(etu_txn *t, uint16_t index)
+{
+    uint8_t data[ETU_FRAME_LEN];
+
+    etu_frame_fragment(data, t->buf, t->len, index);
+    queue_frame(etu_frag_id(t->key, ETU_MSG_READ_RESP, index), data);
+}
+
+
+/**
+ * @brief READ_REQ / DELTA_READ_REQ: snapshot the range, send fragment 0.
+ */
+static void handle_read_request(uint32_t can_id, const uint8_t data[ETU_FRAME_LEN], int delta)
+{
+    uint32_t    key = etu_id_with_type(can_id, ETU_MSG_READ_REQ);
+    etu_txn    *t   = txn_find(key);
+    etu_store  *s;
+    etu_range  *r;
+    uint8_t     image[ETU_MAX_BYTES];
+    uint8_t     bits;
+    uint16_t    len;
+    uint32_t    requested;
+    int         n;
+
+    /*
+     * A repeated request (fragment 0 lost) cannot be told apart from the
+     * next poll after a lost final ACK, so every request starts a new
+     * snapshot: the bridge restarts from fragment 0 either way
+     */
+    if ((t != NULL) && (t->op == ETU_XFER_READ) && (t->acked < t->frags))
+    {
+        stats.repeats++;
+    }
+
+    if ((map_check(can_id, &bits) != 0) || ((s = store_get(can_id)) == NULL))
+    {
+        stats.unknown++;
+        return;
+    }
+
+    len = bits ? (uint16_t)((data[0] + 7) / 8) : (uint16_t)(data[0] * 2);
+    if ((len == 0) || (len > ETU_MAX_BYTES))
+    {
+        stats.unknown++;
+        return;
+    }
+
+    range_snapshot(s, (uint16_t)can_id, data[0], bits, image, len);
+    r = range_get(key, len, bits);
+
+    t        = txn_new(key);
+    t->op    = ETU_XFER_READ;
+    t->delta = (uint8_t)delta;
+
+    if (delta)
+    {
+        requested = ((uint32_t)data[1] << 24) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 8) | data[4];
+        n = can_delta_encode(r->has_sent ? r->sent : NULL, r->sent_version, image, len, requested, t->buf);
+        t->len = (uint16_t)n;
+        stats.delta_reads++;
+        stats.delta_status[t->buf[0]]++;
+    }
+    else
+    {
+        memcpy(t->buf, image, len);
+        t->len = len;
+        stats.reads++;
+    }
+
+    /*
+     * What the bridge will hold once this response is through
+     */
+    memcpy(r->sent, image, len);
+    r->sent_version = can_delta_version(image, len);
+    r->has_sent     = 1;
+
+    t->frags = etu_frag_count(t->len);
+    send_read_fragment(t, 0);
+}
+
+
+/**
+ * @brief Transfer of type @p op whose fragment IDs of @p msg_type contain @p can_id.
+ *
+ * Fragment IDs of reads at nearby Data IDs overlap (the ID steps by 3), so
+ * the transfer waiting for exactly this fragment wins, then the most
+ * recently active one.
+ *
+ * @param index  Set to the fragment number
+ *
+ * @return Transfer or NULL
+ */
+static etu_txn *txn_for_fragment(uint32_t can_id, uint8_t op, uint8_t msg_type, uint16_t *index)
+{
+    etu_txn  *best = NULL;
+    etu_txn  *t;
+    uint32_t  first;
+    uint32_t  k;
+    uint32_t  expect;
+    int       i;
+
+    for (i = 0; i < ETU_MAX_XFERS; i++)
+    {
+        t = &txns[i];
+        if (!t->in_use || (t->op != op))
+        {
+            continue;
+        }
+
+        first = etu_frag_id(t->key, msg_type, 0);
+        if ((can_id < first) || (((can_id - first) % ETU_FRAG_ID_STEP) != 0))
+        {
+            continue;
+        }
+
+        k = (can_id - first) / ETU_FRAG_ID_STEP;
+        if (k > t->frags)
+        {
+            continue;
+        }
+
+        expect = (op == ETU_XFER_READ) ? t->acked : 0;
+        if ((op == ETU_XFER_READ) && (k == expect))
+        {
+            *index = (uint16_t)k;
+            return t;
+        }
+
+        if ((best == NULL) || (t->last_us > best->last_us))
+        {
+            best   = t;
+            *index = (uint16_t)k;
+        }
+    }
+
+    return best;
+}
+
+
+/**
+ * @brief READ_ACK #k: send fragment k+1. A repeated ACK repeats it.
+ */
+static void handle_read_ack(uint32_t can_id)
+{
+    etu_txn  *t;
+    uint16_t  index;
+
+    t = txn_for_fragment(can_id, ETU_XFER_READ, ETU_MSG_READ_ACK, &index);
+    if ((t == NULL) || (index >= t->frags))
+    {
+        stats.rx_ignored++;
+        return;
+    }
+
+    t->last_us = now_us();
+
+    if (index < t->acked)
+    {
+        stats.repeats++;
+    }
+    else
+    {
+        t->acked = (uint16_t)(index + 1);
+    }
+
+    /*
+     * No answer to the last ACK; the slot stays for a repeated one
+     */
+    if (index + 1 < t->frags)
+    {
+        send_read_fragment(t, (uint16_t)(index + 1));
+    }
+}
+
+
+static void handle_write_request(uint32_t can_id, const uint8_t data[ETU_FRAME_LEN])
+{
+    uint32_t  key = etu_id_with_type(can_id, ETU_MSG_READ_REQ);
+    etu_txn  *t   = txn_find(key);
+    uint8_t   empty[ETU_FRAME_LEN];
+    uint8_t   bits;
+
+    /*
+     * Grant lost: the bridge asks again, grant again with a fresh transfer
+     */
+    if ((t != NULL) && (t->op == ETU_XFER_WRITE) && !t->committed)
+    {
+        stats.repeats++;
+    }
+
+    if ((map_check(can_id, &bits) != 0) || (data[0] == 0) || (data[0] * 2 > ETU_MAX_BYTES))
+    {
+        stats.unknown++;
+        return;
+    }
+
+    t        = txn_new(key);
+    t->op    = ETU_XFER_WRITE;
+    t->len   = (uint16_t)(data[0] * 2);
+    t->frags = etu_frag_count(t->len);
+    stats.writes++;
+
+    etu_frame_empty(empty);
+    queue_frame(etu_id_with_type(can_id, ETU_MSG_WRITE_GRANT), empty);
+}
+
+
+static void handle_write_data(uint32_t can_id, const uint8_t data[ETU_FRAME_LEN])
+{
+    etu_txn  *t;
+    uint16_t  index;
+    uint16_t  offset;
+    uint16_t  n;
+    uint8_t   empty[ETU_FRAME_LEN];
+
+    t = txn_for_fragment(can_id, ETU_XFER_WRITE, ETU_MSG_WRITE_DATA, &index);
+    if ((t == NULL) || (index >= t->frags))
+    {
+        stats.rx_ignored++;
+        return;
+    }
+
+    t->last_us = now_us();
+
+    if (t->got_mask[index / 32] & (1U << (index % 32)))
+    {
+        stats.repeats++;
+    }
+    else
+    {
+        offset = (uint16_t)(index * ETU_FRAME_PAYLOAD);
+        n      = (t->len - offset >= ETU_FRAME_PAYLOAD) ? ETU_FRAME_PAYLOAD : (uint16_t)(t->len - offset);
+        memcpy(t->buf + offset, data, n);
+        t->got_mask[index / 32] |= 1U << (index % 32);
+    }
+
+    etu_frame_empty(empty);
+    queue_frame(etu_frag_id(t->key, ETU_MSG_WRITE_ACK, index), empty);
+}
+
+
+static void handle_write_term(uint32_t can_id)
+{
+    etu_txn   *t;
+    etu_store *s;
+    uint16_t   index;
+    uint16_t   i;
+    uint8_t    empty[ETU_FRAME_LEN];
+
+    t = txn_for_fragment(can_id, ETU_XFER_WRITE, ETU_MSG_WRITE_TERM, &index);
+    if ((t == NULL) || (index != t->frags))
+    {
+        stats.rx_ignored++;
+        return;
+    }
+
+    t->last_us = now_us();
+
+    for (i = 0; i < t->frags; i++)
+    {
+        if (!(t->got_mask[i / 32] & (1U << (i % 32))))
+        {
+            /*
+             * Incomplete: no termination ACK, the bridge times out
+             */
+            stats.rx_ignored++;
+            return;
+        }
+    }
+
+    if (t->committed)
+    {
+        stats.repeats++;
+    }
+    else if ((s = store_get(t->key)) != NULL)
+    {
+        for (i = 0; i < t->len; i++)
+        {
+            s->words[((uint32_t)(uint16_t)t->key * 2 + i) & 0x1FFFF] = t->buf[i];
+        }
+        t->committed = 1;
+    }
+
+    etu_frame_empty(empty);
+    queue_frame(etu_frag_id(t->key, ETU_MSG_WRITE_TERM_ACK, t->frags), empty);
+}
+
+
+static void handle_frame(const struct can_frame *f)
+{
+    uint32_t can_id = f->can_id & CAN_EFF_MASK;
+    etu_id   id;
+
+    if (!(f->can_id & CAN_EFF_FLAG) || (f->can_id & (CAN_RTR_FLAG | CAN_ERR_FLAG)) || (f->can_dlc != ETU_FRAME_LEN))
+    {
+        return;
+    }
+
+    etu_id_parse(can_id, &id);
+    if (!(module_mask & (1U << id.module_addr)))
+    {
+        return;
+    }
+
+    switch (id.msg_type)
+    {
+        case ETU_MSG_READ_REQ:
+        case ETU_MSG_DELTA_READ_REQ:
+        case ETU_MSG_READ_ACK:
+        case ETU_MSG_WRITE_REQ:
+        case ETU_MSG_WRITE_DATA:
+        case ETU_MSG_WRITE_TERM:
+            break;
+        default:
+            return;     /* Our own answers, heartbeat, other nodes */
+    }
+
+    stats.rx_frames++;
+    if (verbose)
+    {
+        print_frame("RX", f);
+    }
+
+    if (chance_ppm(loss_ppm))
+    {
+        stats.rx_lost++;
+        return;
+    }
+
+    if (!etu_frame_check(f->data))
+    {
+        stats.rx_crc++;
+        return;
+    }
+
+    switch (id.msg_type)
+    {
+        case ETU_MSG_READ_REQ:       handle_read_request(can_id, f->data, 0); break;
+        case ETU_MSG_DELTA_READ_REQ: handle_read_request(can_id, f->data, 1); break;
+        case ETU_MSG_READ_ACK:       handle_read_ack(can_id);                 break;
+        case ETU_MSG_WRITE_REQ:      handle_write_request(can_id, f->data);   break;
+        case ETU_MSG_WRITE_DATA:     handle_write_data(can_id, f->data);      break;
+        case ETU_MSG_WRITE_TERM:     handle_write_term(can_id);               break;
+    }
+}
+
+
+static void print_stats(void)
+{
+    printf("rx %llu (lost %llu, crc %llu, ignored %llu) | reads %llu, delta %llu "
+           "(unch %llu / chg %llu / full %llu), writes %llu | repeats %llu, unknown %llu | "
+           "tx %llu (lost %llu, corrupt %llu, overflow %llu)\n",
+           (unsigned long long)stats.rx_frames, (unsigned long long)stats.rx_lost,
+           (unsigned long long)stats.rx_crc, (unsigned long long)stats.rx_ignored,
+           (unsigned long long)stats.reads, (unsigned long long)stats.delta_reads,
+           (unsigned long long)stats.delta_status[CAN_DELTA_UNCHANGED],
+           (unsigned long long)stats.delta_status[CAN_DELTA_CHANGES],
+           (unsigned long long)stats.delta_status[CAN_DELTA_FULL],
+           (unsigned long long)stats.writes, (unsigned long long)stats.repeats,
+           (unsigned long long)stats.unknown, (unsigned long long)stats.tx_frames,
+           (unsigned long long)stats.tx_lost, (unsigned long long)stats.tx_corrupt,
+           (unsigned long long)stats.tx_overflow);
+    fflush(stdout);
+}
+
+
+static int parse_modules(const char *list)
+{
+    const char *p = list;
+    char       *end;
+    long        v;
+
+    module_mask = 0;
+
+    while (*p)
+    {
+        v = strtol(p, &end, 0);
+        if ((end == p) || (v < 0) || (v > 3))
+        {
+            return -1;
+        }
+        module_mask |= (uint8_t)(1U << v);
+        p = (*end == ',') ? end + 1 : end;
+        if ((*end != ',') && (*end != '\0'))
+        {
+            return -1;
+        }
+    }
+
+    return module_mask ? 0 : -1;
+}
+
+
+static int open_can(const char *interface)
+{
     struct sockaddr_can addr;
-    struct can_frame frame;
-    int i;
-   
-    initialize_can_data();
-    
-    strcpy(ifr.ifr_name, CAN_INTERFACE);
-    ioctl(sock, SIOCGIFINDEX, &ifr);
-    addr.can_family = AF_CAN;
+    struct ifreq        ifr;
+    int                 sock;
+
+    sock = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+    if (sock < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, interface, IFNAMSIZ - 1);
+    if (ioctl(sock, SIOCGIFINDEX, &ifr) < 0)
+    {
+        fprintf(stderr, "CAN interface %s: %s\n", interface, strerror(errno));
+        close(sock);
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.can_family  = AF_CAN;
     addr.can_ifindex = ifr.ifr_ifindex;
-    bind(sock, (struct sockaddr *)&addr, sizeof(addr));
-    
-    printf("Listening for CAN frame 0x%X...\n", TRIGGER_ID);
-    while (1) {
-        if (read(sock, &frame, sizeof(struct can_frame)) > 0) {
-            if (frame.can_id == (TRIGGER_ID | CAN_EFF_FLAG) ) 
-	    {
-                printf("Trigger frame received! Starting transmission...\n");
-                
-                for (i = 0; i < FRAME_COUNT; i++) {
-                    unsigned char send_data[8] = {0};
-                    send_data[0] = i + 1; // Frame number
-                    memcpy(&send_data[1], &static_data[i * 5], 5);
-                    unsigned short crc = crc16(send_data, 6);
-                    send_data[6] = (crc >> 8) & 0xFF;
-                    send_data[7] = crc & 0xFF;
-                    
-                    int frame_id = START_ID + (i * 5);
-                    send_can_frame(sock, frame_id, send_data);
-                    
-                    while (1) {
-                        if ( (read(sock, &frame, sizeof(struct can_frame)) > 0) &&  (frame.can_id == ((ACK_BASE_ID | CAN_EFF_FLAG) + (i * 5))) ) {
-                            printf("Received ACK for frame %d\n", i + 1);
-                            break;
-                        }
-                    }
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("bind");
+        close(sock);
+        return -1;
+    }
+
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+
+    return sock;
+}
+
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-i interface] [-m addr[,addr..]] [-l latency_us] [-j jitter_us]\n"
+            "          [-L loss_%%] [-C corrupt_%%] [-u ms,permille] [-r regmap.bin]\n"
+            "          [-s seed] [-t stats_sec] [-v]\n", prog);
+}
+
+
+int main(int argc, char *argv[])
+{
+    const char      *interface = CAN_INTERFACE;
+    const char      *map_path  = NULL;
+    struct can_frame frames[ETU_RX_BATCH];
+    struct pollfd    pfd;
+    uint64_t         next_update = 0;
+    uint64_t         next_stats;
+    uint32_t         stats_sec = ETU_STATS_SEC;
+    struct timespec  ts;
+    int64_t          wait_us;
+    int              sock;
+    int              opt;
+    int              n;
+
+    while ((opt = getopt(argc, argv, "i:m:l:j:L:C:u:r:s:t:v")) != -1)
+    {
+        switch (opt)
+        {
+            case 'i': interface  = optarg; break;
+            case 'l': latency_us = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'j': jitter_us  = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'L': loss_ppm    = (uint32_t)(strtod(optarg, NULL) * 10000.0); break;
+            case 'C': corrupt_ppm = (uint32_t)(strtod(optarg, NULL) * 10000.0); break;
+            case 'r': map_path   = optarg; break;
+            case 's': rng_state  = strtoull(optarg, NULL, 0) * 0x9E3779B97F4A7C15ULL + 1; break;
+            case 't': stats_sec  = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'v': verbose    = 1; break;
+            case 'm':
+                if (parse_modules(optarg) != 0)
+                {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'u':
+                if (sscanf(optarg, "%u,%u", &update_ms, &update_permille) != 2)
+                {
+                    usage(argv[0]);
+                    return 1;
                 }
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (map_path != NULL)
+    {
+        map = regmap_open(map_path);
+        if (map == NULL)
+        {
+            fprintf(stderr, "Register map %s: %s\n", map_path, strerror(errno));
+            return 1;
+        }
+    }
+
+    sock = open_can(interface);
+    if (sock < 0)
+    {
+        return 1;
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    printf("ETU simulator on %s, module addresses 0x%X, latency %u+%u us, loss %.2f %%, corrupt %.2f %%%s\n",
+           interface, module_mask, latency_us, jitter_us, loss_ppm / 10000.0, corrupt_ppm / 10000.0,
+           map ? ", register map loaded" : "");
+
+    pfd.fd     = sock;
+    pfd.events = POLLIN;
+    next_stats = now_us() + (uint64_t)stats_sec * 1000000ULL;
+    if (update_ms)
+    {
+        next_update = now_us() + (uint64_t)update_ms * 1000ULL;
+    }
+
+    while (!stop)
+    {
+        wait_us = flush_due(sock);
+
+        /*
+         * Wake up for the next queued frame (microsecond latencies)
+         */
+        if ((wait_us < 0) || (wait_us > 100000))
+        {
+            wait_us = 100000;
+        }
+        ts.tv_sec  = 0;
+        ts.tv_nsec = (long)wait_us * 1000;
+
+        if (ppoll(&pfd, 1, &ts, NULL) > 0)
+        {
+            for (n = 0; n < ETU_RX_BATCH; n++)
+            {
+                if (read(sock, &frames[n], sizeof(frames[n])) != sizeof(frames[n]))
+                {
+                    break;
+                }
+                handle_frame(&frames[n]);
             }
         }
+
+        if (update_ms && (now_us() >= next_update))
+        {
+            update_registers();
+            next_update += (uint64_t)update_ms * 1000ULL;
+        }
+
+        if (stats_sec && (now_us() >= next_stats))
+        {
+            print_stats();
+            next_stats += (uint64_t)stats_sec * 1000000ULL;
+        }
     }
+
+    print_stats();
     close(sock);
+
     return 0;
 }
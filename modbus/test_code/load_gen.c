@@ -0,0 +1,1090 @@
+/**
+ *  @file    load_gen.c
+ *  @brief   Modbus TCP load generator: N connections, open-loop poll lists, latency percentiles
+ *
+ *  Opens N connections to a Modbus TCP server (the bridge, or slave_sim.c)
+ *  and replays a poll list. Each item is one request type with its total
+ *  rate over all connections:
+ *
+ *      # name        fc  address  count  rate/s
+ *      metering       3        1     64     200
+ *      status         4        1     20      50
+ *      coils          1        1     16      10
+ *
+ *  address is the 1-based register address as in register_details.h (the
+ *  PDU carries address - 1). Write function codes (5, 6, 15, 16, 23) are
+ *  supported too, see encode_request(). With -r the list is drawn from the binary
+ *  register map instead: one item per dataset, function code of its first
+ *  register, whole dataset (max. 125 registers / 2000 bits), and the rate
+ *  given with -R split evenly.
+ *
+ *  Open loop (default): requests are scheduled at their rate (fixed
+ *  interval, or Poisson arrivals with -P) whether or not earlier answers
+ *  came back. A request waiting behind a slow one on the same connection is
+ *  timed from its scheduled time, so server stalls show up in the tail
+ *  instead of lowering the offered load (no coordinated omission).
+ *  Closed loop (-c): every connection sends its next item as soon as the
+ *  previous answer arrived; rates are used as weights.
+ *
+ *  Latencies go into log-linear histograms (32 sub-buckets per power of
+ *  two, about 3 % resolution, 1 us .. 67 s), one per item and thread,
+ *  merged at the end. Reported per item and in total: throughput,
+ *  p50/p90/p99/p99.9/p99.99/max, exceptions per code, timeouts, and
+ *  requests that did not fit the per-connection backlog.
+ *
+ *    gcc -O2 -I../../test_code load_gen.c ../../test_code/register_map.c
+ *        ../../test_code/log_async.c -o load_gen -lpthread -lm
+ *    ./load_gen -H 192.168.0.141 -p 502 -n 64 -T 4 -d 60 -W 5 polls.txt
+ *    ./load_gen -H 127.0.0.1 -n 16 -r regmap.bin -R 2000 -P
+ *
+ *  @author  Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include "register_map.h"
+
+
+#define LG_MAX_ITEMS            64
+#define LG_MAX_THREADS          64
+#define LG_MAX_CONNS            4096
+#define LG_BACKLOG              256         /* Scheduled, not yet sent, per connection */
+#define LG_WINDOW_MAX           16          /* Outstanding requests per connection     */
+#define LG_FRAME_MAX            260         /* MBAP + largest PDU                      */
+
+#define LG_HIST_SUB_BITS        5
+#define LG_HIST_SUB             (1 << LG_HIST_SUB_BITS)
+#define LG_HIST_POWERS          27          /* Up to 2^26 us = 67 s                    */
+#define LG_HIST_BUCKETS         (LG_HIST_POWERS * LG_HIST_SUB)
+
+#define LG_EXC_MAX              12          /* Modbus exception codes 1..11            */
+
+
+/*
+ * One request type of the poll list
+ */
+typedef struct {
+    char        name[32];
+    uint8_t     fc;
+    uint16_t    addr;               /* 1-based, as in the register tables */
+    uint16_t    count;
+    double      rate;               /* Requests per second, all connections */
+} lg_item;
+
+/*
+ * Results of one item (per thread, merged at the end)
+ */
+typedef struct {
+    uint64_t    sent;
+    uint64_t    ok;
+    uint64_t    exceptions[LG_EXC_MAX];
+    uint64_t    timeouts;
+    uint64_t    errors;             /* Malformed answer, connection lost   */
+    uint64_t    dropped;            /* Backlog full, never sent            */
+    uint64_t    hist[LG_HIST_BUCKETS];
+    uint64_t    max_us;
+} lg_result;
+
+/*
+ * Request scheduled on a connection
+ */
+typedef struct {
+    uint64_t    due_us;             /* Intended send time                  */
+    uint64_t    sent_us;            /* Actual send time (timeout)          */
+    uint16_t    tid;                /* MBAP transaction ID once sent       */
+    uint8_t     item;
+} lg_req;
+
+typedef struct {
+    int         fd;
+    int         connected;
+    uint16_t    next_tid;
+    lg_req      backlog[LG_BACKLOG];
+    int         bl_head;
+    int         bl_count;
+    lg_req      inflight[LG_WINDOW_MAX];
+    int         if_count;
+    uint8_t     rx[LG_FRAME_MAX];
+    int         rx_len;
+    uint8_t     tx[LG_FRAME_MAX * LG_WINDOW_MAX];
+    int         tx_len;
+    int         next_item;          /* Closed loop: weighted round robin   */
+    uint64_t    reconnect_us;
+} lg_conn;
+
+typedef struct {
+    int         index;
+    pthread_t   thread;
+    int         epfd;
+    lg_conn    *conns;
+    int         conn_count;
+    int         rr;                 /* Next connection for a new request   */
+    uint64_t    next_due[LG_MAX_ITEMS];
+    lg_result   results[LG_MAX_ITEMS];
+    uint64_t    rng;
+} lg_thread;
+
+
+static lg_item              items[LG_MAX_ITEMS];
+static int                  item_count;
+static struct sockaddr_in   server;
+static int                  conn_total    = 8;
+static int                  thread_count  = 1;
+static int                  window        = 1;
+static int                  closed_loop;
+static int                  poisson;
+static uint32_t             timeout_ms    = 1000;
+static uint8_t              unit_id       = 1;
+static uint64_t             start_us;
+static uint64_t             measure_us;          /* End of warm-up          */
+static uint64_t             end_us;
+static uint8_t             *closed_order;         /* Closed loop item cycle  */
+static int                  closed_len;
+
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000;
+}
+
+
+static double rng_unit(lg_thread *t)
+{
+    t->rng ^= t->rng << 13;
+    t->rng ^= t->rng >> 7;
+    t->rng ^= t->rng << 17;
+    return (double)(t->rng >> 11) / 9007199254740992.0;
+}
+
+
+/***************************************************************
+ *  Histogram
+ ***************************************************************/
+
+static int hist_bucket(uint64_t us)
+{
+    int power;
+
+    if (us < LG_HIST_SUB)
+    {
+        return (int)us;
+    }
+
+    power = 63 - __builtin_clzll(us);                 /* >= LG_HIST_SUB_BITS */
+    if (power - LG_HIST_SUB_BITS + 1 >= LG_HIST_POWERS)
+    {
+        return LG_HIST_BUCKETS - 1;
+    }
+
+    return (power - LG_HIST_SUB_BITS + 1) * LG_HIST_SUB +
+           (int)((us >> (power - LG_HIST_SUB_BITS)) - LG_HIST_SUB);
+}
+
+/**
+ * @brief Upper bound of a bucket in microseconds.
+ */
+static uint64_t hist_value(int bucket)
+{
+    int power = bucket / LG_HIST_SUB;
+    int sub   = bucket % LG_HIST_SUB;
+
+    if (power == 0)
+    {
+        return (uint64_t)sub;
+    }
+
+    return ((uint64_t)(LG_HIST_SUB + sub + 1) << (power - 1)) - 1;
+}
+
+static uint64_t hist_percentile(const lg_result *r, double pct)
+{
+    uint64_t total = 0;
+    uint64_t want;
+    uint64_t seen  = 0;
+    int      b;
+
+    for (b = 0; b < LG_HIST_BUCKETS; b++)
+    {
+        total += r->hist[b];
+    }
+    if (total == 0)
+    {
+        return 0;
+    }
+
+    want = (uint64_t)ceil(pct / 100.0 * (double)total);
+    if (want == 0)
+    {
+        want = 1;
+    }
+
+    for (b = 0; b < LG_HIST_BUCKETS; b++)
+    {
+        seen += r->hist[b];
+        if (seen >= want)
+        {
+            return (hist_value(b) < r->max_us) ? hist_value(b) : r->max_us;
+        }
+    }
+
+    return r->max_us;
+}
+
+
+/***************************************************************
+ *  Poll list
+ ***************************************************************/
+
+static int load_poll_list(const char *path)
+{
+    FILE    *f = fopen(path, "r");
+    char     line[256];
+    lg_item *it;
+    unsigned fc;
+    unsigned addr;
+    unsigned count;
+
+    if (f == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        if ((line[0] == '#') || (line[0] == '\n'))
+        {
+            continue;
+        }
+        if (item_count >= LG_MAX_ITEMS)
+        {
+            fprintf(stderr, "%s: more than %d items\n", path, LG_MAX_ITEMS);
+            break;
+        }
+
+        it = &items[item_count];
+        if (sscanf(line, "%31s %u %u %u %lf", it->name, &fc, &addr, &count, &it->rate) != 5)
+        {
+            fprintf(stderr, "%s: bad line: %s", path, line);
+            fclose(f);
+            return -1;
+        }
+
+        it->fc    = (uint8_t)fc;
+        it->addr  = (uint16_t)addr;
+        it->count = (uint16_t)count;
+        item_count++;
+    }
+
+    fclose(f);
+    return item_count ? 0 : -1;
+}
+
+
+/**
+ * @brief One item per dataset of the binary register map.
+ */
+static int load_register_map(const char *path, double total_rate)
+{
+    regmap_t              *map = regmap_open(path);
+    const regmap_dataset  *ds;
+    const regmap_entry    *e;
+    lg_item               *it;
+    uint32_t               d;
+    uint32_t               span;
+
+    if (map == NULL)
+    {
+        fprintf(stderr, "Register map %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    for (d = 0; (d < map->hdr->dataset_count) && (item_count < LG_MAX_ITEMS); d++)
+    {
+        ds = &map->datasets[d];
+        if (ds->entry_count == 0)
+        {
+            continue;
+        }
+
+        e  = &map->entries[ds->first_entry];
+        it = &items[item_count++];
+
+        snprintf(it->name, sizeof(it->name), "%s", regmap_string(map, ds->name_off));
+        it->fc    = e->fun_code[0] ? e->fun_code[0] : 3;
+        it->addr  = ds->first_addr;
+        span      = (uint32_t)(ds->last_addr - ds->first_addr + 1);
+        if ((it->fc == 1) || (it->fc == 2))
+        {
+            it->count = (uint16_t)((span > 2000) ? 2000 : span);
+        }
+        else
+        {
+            it->count = (uint16_t)((span > 125) ? 125 : span);
+        }
+    }
+
+    for (d = 0; d < (uint32_t)item_count; d++)
+    {
+        items[d].rate = total_rate / item_count;
+    }
+
+    regmap_close(map);
+    return item_count ? 0 : -1;
+}
+
+
+/***************************************************************
+ *  Connections
+ ***************************************************************/
+
+static void conn_open(lg_thread *t, lg_conn *c)
+{
+    struct epoll_event ev;
+    int                one = 1;
+
+    c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (c->fd < 0)
+    {
+        c->reconnect_us = now_us() + 100000;
+        return;
+    }
+
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if ((connect(c->fd, (struct sockaddr *)&server, sizeof(server)) < 0) && (errno != EINPROGRESS))
+    {
+        close(c->fd);
+        c->fd = -1;
+        c->reconnect_us = now_us() + 100000;
+        return;
+    }
+
+    c->connected = 0;
+    c->rx_len    = 0;
+    c->tx_len    = 0;
+
+    ev.events   = EPOLLIN | EPOLLOUT;
+    ev.data.ptr = c;
+    epoll_ctl(t->epfd, EPOLL_CTL_ADD, c->fd, &ev);
+}
+
+
+/**
+ * @brief Drop the connection; requests in flight count as errors, a new
+ *        connection is opened after a short pause.
+ */
+static void conn_fail(lg_thread *t, lg_conn *c, int timed_out)
+{
+    int i;
+
+    for (i = 0; i < c->if_count; i++)
+    {
+        if (c->inflight[i].due_us >= measure_us)
+        {
+            if (timed_out)
+            {
+                t->results[c->inflight[i].item].timeouts++;
+            }
+            else
+            {
+                t->results[c->inflight[i].item].errors++;
+            }
+        }
+        timed_out = 0;      /* Only the oldest one timed out */
+    }
+    c->if_count = 0;
+
+    if (c->fd >= 0)
+    {
+        epoll_ctl(t->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+        close(c->fd);
+    }
+    c->fd           = -1;
+    c->connected    = 0;
+    c->reconnect_us = now_us() + 100000;
+}
+
+
+static void conn_want_write(lg_thread *t, lg_conn *c, int on)
+{
+    struct epoll_event ev;
+
+    ev.events   = EPOLLIN | (on ? EPOLLOUT : 0);
+    ev.data.ptr = c;
+    epoll_ctl(t->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+
+/**
+ * @brief Request ADU for an item.
+ *
+ * Reads (1-4) ask for count registers / bits. FC 5/6 write count as the
+ * value (5: non-zero = ON), FC 15/16 write count coils / registers, and
+ * FC 23 writes the range it reads (max. 121 registers); written values
+ * are derived from the transaction ID.
+ *
+ * @return ADU length
+ */
+static int encode_request(const lg_item *it, uint16_t tid, uint8_t *out)
+{
+    uint16_t addr  = (uint16_t)(it->addr - 1);
+    uint16_t count = it->count;
+    int      len   = 12;
+    int      n;
+    int      i;
+
+    out[0]  = (uint8_t)(tid >> 8);
+    out[1]  = (uint8_t)tid;
+    out[2]  = 0;
+    out[3]  = 0;
+    out[6]  = unit_id;
+    out[7]  = it->fc;
+    out[8]  = (uint8_t)(addr >> 8);
+    out[9]  = (uint8_t)addr;
+
+    if ((it->fc == 5) && count)
+    {
+        count = 0xFF00;
+    }
+    out[10] = (uint8_t)(count >> 8);
+    out[11] = (uint8_t)count;
+
+    switch (it->fc)
+    {
+        case 15:
+        case 16:
+            n = (it->fc == 15) ? (count + 7) / 8 : count * 2;
+            out[12] = (uint8_t)n;
+            for (i = 0; i < n; i++)
+            {
+                out[13 + i] = (uint8_t)(tid + i);
+            }
+            len = 13 + n;
+            break;
+
+        case 23:
+            if (count > 121)
+            {
+                count = 121;
+            }
+            out[12] = (uint8_t)(addr >> 8);
+            out[13] = (uint8_t)addr;
+            out[14] = (uint8_t)(count >> 8);
+            out[15] = (uint8_t)count;
+            out[16] = (uint8_t)(count * 2);
+            for (i = 0; i < count * 2; i++)
+            {
+                out[17 + i] = (uint8_t)(tid + i);
+            }
+            len = 17 + count * 2;
+            break;
+
+        default:
+            break;
+    }
+
+    out[4] = (uint8_t)((len - 6) >> 8);
+    out[5] = (uint8_t)(len - 6);
+
+    return len;
+}
+
+
+/**
+ * @brief Move backlog entries into the send buffer while the window allows.
+ */
+static void conn_fill(lg_thread *t, lg_conn *c)
+{
+    lg_req *r;
+
+    if (!c->connected)
+    {
+        return;
+    }
+
+    while ((c->bl_count > 0) && (c->if_count < window) &&
+           (c->tx_len + LG_FRAME_MAX <= (int)sizeof(c->tx)))
+    {
+        r = &c->backlog[c->bl_head];
+        c->bl_head = (c->bl_head + 1) % LG_BACKLOG;
+        c->bl_count--;
+
+        r->tid     = c->next_tid++;
+        r->sent_us = now_us();
+        c->tx_len += encode_request(&items[r->item], r->tid, c->tx + c->tx_len);
+        c->inflight[c->if_count++] = *r;
+
+        if (r->due_us >= measure_us)
+        {
+            t->results[r->item].sent++;
+        }
+    }
+
+    if (c->tx_len > 0)
+    {
+        conn_want_write(t, c, 1);
+    }
+}
+
+
+static void conn_flush(lg_thread *t, lg_conn *c)
+{
+    ssize_t n;
+
+    while (c->tx_len > 0)
+    {
+        n = send(c->fd, c->tx, (size_t)c->tx_len, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                return;
+            }
+            conn_fail(t, c, 0);
+            return;
+        }
+
+        memmove(c->tx, c->tx + n, (size_t)(c->tx_len - n));
+        c->tx_len -= (int)n;
+    }
+
+    conn_want_write(t, c, 0);
+}
+
+
+static void schedule(lg_thread *t, lg_conn *c, int item, uint64_t due_us)
+{
+    if (c->bl_count >= LG_BACKLOG)
+    {
+        if (due_us >= measure_us)
+        {
+            t->results[item].dropped++;
+        }
+        return;
+    }
+
+    c->backlog[(c->bl_head + c->bl_count) % LG_BACKLOG].due_us = due_us;
+    c->backlog[(c->bl_head + c->bl_count) % LG_BACKLOG].item   = (uint8_t)item;
+    c->bl_count++;
+}
+
+
+/**
+ * @brief Closed loop: queue the connection's next item, due now.
+ */
+static void closed_next(lg_thread *t, lg_conn *c)
+{
+    if (now_us() >= end_us)
+    {
+        return;
+    }
+
+    schedule(t, c, closed_order[c->next_item], now_us());
+    c->next_item = (c->next_item + 1) % closed_len;
+}
+
+
+/**
+ * @brief Complete answers in the receive buffer.
+ */
+static void conn_parse(lg_thread *t, lg_conn *c)
+{
+    lg_result *res;
+    lg_req     req;
+    uint16_t   tid;
+    uint64_t   lat;
+    int        frame_len;
+    int        i;
+
+    while (c->rx_len >= 7)
+    {
+        frame_len = 6 + ((c->rx[4] << 8) | c->rx[5]);
+        if ((frame_len < 8) || (frame_len > LG_FRAME_MAX))
+        {
+            conn_fail(t, c, 0);
+            return;
+        }
+        if (c->rx_len < frame_len)
+        {
+            return;
+        }
+
+        tid = (uint16_t)((c->rx[0] << 8) | c->rx[1]);
+        for (i = 0; i < c->if_count; i++)
+        {
+            if (c->inflight[i].tid == tid)
+            {
+                break;
+            }
+        }
+
+        if (i == c->if_count)
+        {
+            /*
+             * Unknown transaction ID: the stream is out of step
+             */
+            conn_fail(t, c, 0);
+            return;
+        }
+
+        req = c->inflight[i];
+        memmove(&c->inflight[i], &c->inflight[i + 1], (size_t)(c->if_count - i - 1) * sizeof(lg_req));
+        c->if_count--;
+
+        if (req.due_us >= measure_us)
+        {
+            res = &t->results[req.item];
+            lat = now_us() - req.due_us;
+
+            if (c->rx[7] & 0x80)
+            {
+                res->exceptions[(c->rx[8] < LG_EXC_MAX) ? c->rx[8] : 0]++;
+            }
+            else if (c->rx[7] != items[req.item].fc)
+            {
+                res->errors++;
+            }
+            else
+            {
+                res->ok++;
+                res->hist[hist_bucket(lat)]++;
+                if (lat > res->max_us)
+                {
+                    res->max_us = lat;
+                }
+            }
+        }
+
+        memmove(c->rx, c->rx + frame_len, (size_t)(c->rx_len - frame_len));
+        c->rx_len -= frame_len;
+
+        if (closed_loop)
+        {
+            closed_next(t, c);
+        }
+    }
+}
+
+
+static void conn_event(lg_thread *t, lg_conn *c, uint32_t events)
+{
+    ssize_t n;
+    int     err   = 0;
+    socklen_t len = sizeof(err);
+
+    if (!c->connected && (events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+    {
+        getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err != 0)
+        {
+            conn_fail(t, c, 0);
+            return;
+        }
+        c->connected = 1;
+        conn_want_write(t, c, 0);
+
+        if (closed_loop && (c->bl_count == 0) && (c->if_count == 0))
+        {
+            closed_next(t, c);
+        }
+        conn_fill(t, c);
+    }
+
+    if (events & EPOLLIN)
+    {
+        n = recv(c->fd, c->rx + c->rx_len, sizeof(c->rx) - (size_t)c->rx_len, 0);
+        if ((n == 0) || ((n < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK)))
+        {
+            conn_fail(t, c, 0);
+            return;
+        }
+        if (n > 0)
+        {
+            c->rx_len += (int)n;
+            conn_parse(t, c);
+            if (c->fd < 0)
+            {
+                return;
+            }
+            conn_fill(t, c);
+        }
+    }
+
+    if ((c->fd >= 0) && c->connected && (events & EPOLLOUT))
+    {
+        conn_flush(t, c);
+    }
+}
+
+
+/***************************************************************
+ *  Worker thread
+ ***************************************************************/
+
+static uint64_t interval_us(lg_thread *t, int item)
+{
+    double mean = 1e6 * thread_count / items[item].rate;
+
+    if (poisson)
+    {
+        return (uint64_t)(-log(1.0 - rng_unit(t)) * mean) + 1;
+    }
+
+    return (uint64_t)mean ? (uint64_t)mean : 1;
+}
+
+
+static void *worker(void *arg)
+{
+    lg_thread          *t = arg;
+    struct epoll_event  events[64];
+    lg_conn            *c;
+    uint64_t            now;
+    uint64_t            next;
+    int                 timeout;
+    int                 n;
+    int                 i;
+
+    t->epfd = epoll_create1(0);
+
+    for (i = 0; i < t->conn_count; i++)
+    {
+        t->conns[i].fd = -1;
+        conn_open(t, &t->conns[i]);
+    }
+
+    for (i = 0; i < item_count; i++)
+    {
+        /*
+         * Spread the threads' first arrivals over one interval
+         */
+        t->next_due[i] = start_us + (uint64_t)(rng_unit(t) * (double)interval_us(t, i));
+    }
+
+    while ((now = now_us()) < end_us)
+    {
+        next = now + 100000;
+
+        if (!closed_loop)
+        {
+            for (i = 0; i < item_count; i++)
+            {
+                if (items[i].rate <= 0)
+                {
+                    continue;
+                }
+
+                while (t->next_due[i] <= now)
+                {
+                    c = &t->conns[t->rr];
+                    t->rr = (t->rr + 1) % t->conn_count;
+                    schedule(t, c, i, t->next_due[i]);
+                    conn_fill(t, c);
+                    t->next_due[i] += interval_us(t, i);
+                }
+
+                if (t->next_due[i] < next)
+                {
+                    next = t->next_due[i];
+                }
+            }
+        }
+
+        /*
+         * Timeouts and reconnects (requests were sent after "now" was taken)
+         */
+        now = now_us();
+        for (i = 0; i < t->conn_count; i++)
+        {
+            c = &t->conns[i];
+            if (c->fd < 0)
+            {
+                if (now >= c->reconnect_us)
+                {
+                    conn_open(t, c);
+                }
+                continue;
+            }
+
+            if ((c->if_count > 0) && (now - c->inflight[0].sent_us > (uint64_t)timeout_ms * 1000))
+            {
+                conn_fail(t, c, 1);
+            }
+        }
+
+        timeout = (next > now) ? (int)((next - now + 999) / 1000) : 0;
+        n = epoll_wait(t->epfd, events, 64, timeout);
+
+        for (i = 0; i < n; i++)
+        {
+            c = events[i].data.ptr;
+            if (c->fd >= 0)
+            {
+                conn_event(t, c, events[i].events);
+            }
+        }
+    }
+
+    for (i = 0; i < t->conn_count; i++)
+    {
+        if (t->conns[i].fd >= 0)
+        {
+            close(t->conns[i].fd);
+        }
+    }
+    close(t->epfd);
+
+    return NULL;
+}
+
+
+/***************************************************************
+ *  Report
+ ***************************************************************/
+
+static void merge(lg_result *into, const lg_result *r)
+{
+    int b;
+
+    into->sent     += r->sent;
+    into->ok       += r->ok;
+    into->timeouts += r->timeouts;
+    into->errors   += r->errors;
+    into->dropped  += r->dropped;
+    for (b = 0; b < LG_EXC_MAX; b++)
+    {
+        into->exceptions[b] += r->exceptions[b];
+    }
+    for (b = 0; b < LG_HIST_BUCKETS; b++)
+    {
+        into->hist[b] += r->hist[b];
+    }
+    if (r->max_us > into->max_us)
+    {
+        into->max_us = r->max_us;
+    }
+}
+
+
+static void print_result(const char *name, const lg_result *r, double seconds)
+{
+    uint64_t exc = 0;
+    int      b;
+
+    for (b = 0; b < LG_EXC_MAX; b++)
+    {
+        exc += r->exceptions[b];
+    }
+
+    printf("%-20s %9.1f %8llu %8llu %8llu %8llu %8llu %8llu %8llu %8llu %6llu %6llu %6llu\n", name,
+           (double)r->ok / seconds,
+           (unsigned long long)hist_percentile(r, 50.0), (unsigned long long)hist_percentile(r, 90.0),
+           (unsigned long long)hist_percentile(r, 99.0), (unsigned long long)hist_percentile(r, 99.9),
+           (unsigned long long)hist_percentile(r, 99.99), (unsigned long long)r->max_us,
+           (unsigned long long)r->sent, (unsigned long long)exc,
+           (unsigned long long)r->timeouts, (unsigned long long)r->errors,
+           (unsigned long long)r->dropped);
+
+    if (exc)
+    {
+        printf("%-20s   exceptions:", "");
+        for (b = 0; b < LG_EXC_MAX; b++)
+        {
+            if (r->exceptions[b])
+            {
+                printf(" 0x%02X=%llu", b, (unsigned long long)r->exceptions[b]);
+            }
+        }
+        printf("\n");
+    }
+}
+
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-H host] [-p port] [-u unit] [-n connections] [-T threads] [-w window]\n"
+            "          [-d seconds] [-W warmup_s] [-t timeout_ms] [-c] [-P] [-s seed]\n"
+            "          (<poll list> | -r regmap.bin -R total_rate)\n", prog);
+}
+
+
+int main(int argc, char *argv[])
+{
+    static lg_result  total_item[LG_MAX_ITEMS];
+    static lg_result  all;
+    lg_thread        *threads;
+    lg_conn          *conns;
+    const char       *host      = "127.0.0.1";
+    const char       *map_path  = NULL;
+    double            map_rate  = 100.0;
+    uint32_t          duration  = 10;
+    uint32_t          warmup    = 0;
+    uint64_t          seed      = 1;
+    int               port      = 502;
+    int               per;
+    int               opt;
+    int               i;
+    int               k;
+    double            weight_min;
+
+    while ((opt = getopt(argc, argv, "H:p:u:n:T:w:d:W:t:cPs:r:R:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'H': host         = optarg; break;
+            case 'p': port         = atoi(optarg); break;
+            case 'u': unit_id      = (uint8_t)atoi(optarg); break;
+            case 'n': conn_total   = atoi(optarg); break;
+            case 'T': thread_count = atoi(optarg); break;
+            case 'w': window       = atoi(optarg); break;
+            case 'd': duration     = (uint32_t)atoi(optarg); break;
+            case 'W': warmup       = (uint32_t)atoi(optarg); break;
+            case 't': timeout_ms   = (uint32_t)atoi(optarg); break;
+            case 'c': closed_loop  = 1; break;
+            case 'P': poisson      = 1; break;
+            case 's': seed         = strtoull(optarg, NULL, 0); break;
+            case 'r': map_path     = optarg; break;
+            case 'R': map_rate     = atof(optarg); break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if ((conn_total < 1) || (conn_total > LG_MAX_CONNS) || (thread_count < 1) ||
+        (thread_count > LG_MAX_THREADS) || (window < 1) || (window > LG_WINDOW_MAX))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (thread_count > conn_total)
+    {
+        thread_count = conn_total;
+    }
+
+    if (map_path != NULL)
+    {
+        if (load_register_map(map_path, map_rate) != 0)
+        {
+            return 1;
+        }
+    }
+    else if ((optind >= argc) || (load_poll_list(argv[optind]) != 0))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_port   = htons((uint16_t)port);
+    if (inet_pton(AF_INET, host, &server.sin_addr) != 1)
+    {
+        fprintf(stderr, "Bad IPv4 address %s\n", host);
+        return 1;
+    }
+
+    /*
+     * Closed loop: cycle through the items in proportion to their rates
+     */
+    weight_min = 0;
+    for (i = 0; i < item_count; i++)
+    {
+        if ((items[i].rate > 0) && ((weight_min == 0) || (items[i].rate < weight_min)))
+        {
+            weight_min = items[i].rate;
+        }
+    }
+    closed_order = malloc(1024);
+    for (i = 0; (i < item_count) && (closed_len < 1024); i++)
+    {
+        for (k = 0; (weight_min > 0) && (k < (int)(items[i].rate / weight_min + 0.5)) && (closed_len < 1024); k++)
+        {
+            closed_order[closed_len++] = (uint8_t)i;
+        }
+    }
+    if (closed_len == 0)
+    {
+        fprintf(stderr, "No item with a rate > 0\n");
+        return 1;
+    }
+
+    threads = calloc((size_t)thread_count, sizeof(lg_thread));
+    conns   = calloc((size_t)conn_total, sizeof(lg_conn));
+    if ((threads == NULL) || (conns == NULL))
+    {
+        perror("calloc");
+        return 1;
+    }
+
+    start_us   = now_us();
+    measure_us = start_us + (uint64_t)warmup * 1000000ULL;
+    end_us     = measure_us + (uint64_t)duration * 1000000ULL;
+
+    printf("%d connections to %s:%d, %d threads, window %d, %s%s, %d items, %us (+%us warm-up)\n",
+           conn_total, host, port, thread_count, window, closed_loop ? "closed loop" : "open loop",
+           (!closed_loop && poisson) ? " (Poisson)" : "", item_count, duration, warmup);
+
+    for (i = 0, k = 0; i < thread_count; i++)
+    {
+        per = conn_total / thread_count + (i < conn_total % thread_count);
+
+        threads[i].index      = i;
+        threads[i].conns      = &conns[k];
+        threads[i].conn_count = per;
+        threads[i].rng        = (seed + (uint64_t)i + 1) * 0x9E3779B97F4A7C15ULL;
+        for (opt = 0; opt < per; opt++)
+        {
+            conns[k + opt].next_item = (k + opt) % closed_len;
+        }
+        k += per;
+
+        pthread_create(&threads[i].thread, NULL, worker, &threads[i]);
+    }
+
+    for (i = 0; i < thread_count; i++)
+    {
+        pthread_join(threads[i].thread, NULL);
+        for (k = 0; k < item_count; k++)
+        {
+            merge(&total_item[k], &threads[i].results[k]);
+        }
+    }
+
+    printf("\n%-20s %9s %8s %8s %8s %8s %8s %8s %8s %8s %6s %6s %6s\n", "item (latency in us)",
+           "ok/s", "p50", "p90", "p99", "p99.9", "p99.99", "max", "sent", "exc", "tmo", "err", "drop");
+
+    for (k = 0; k < item_count; k++)
+    {
+        print_result(items[k].name, &total_item[k], (double)duration);
+        merge(&all, &total_item[k]);
+    }
+    print_result("total", &all, (double)duration);
+
+    free(threads);
+    free(conns);
+    free(closed_order);
+
+    return 0;
+}
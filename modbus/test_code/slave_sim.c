@@ -0,0 +1,931 @@
+/**
+ *  @file    slave_sim.c
+ *  @brief   Modbus TCP slave simulator: many concurrent clients, live values, processing delay
+ *
+ *  Stands in for the bridge (or any field device) when benchmarking
+ *  SCADA-side polling and load_gen.c. T threads each run an epoll loop on
+ *  their own SO_REUSEPORT listener, so the kernel spreads connections over
+ *  the threads; a connection stays on one thread and needs no locks.
+ *
+ *  Served: FC 1, 2, 3, 4, 5, 6, 15, 16 and 23 on 65536 coils, discrete
+ *  inputs, holding and input registers. Pipelined requests on a connection
+ *  are answered in order.
+ *
+ *  With -r the binary register map (test_code/regmap_gen) defines which
+ *  addresses exist: a request touching an address outside every dataset
+ *  gets exception 0x02, one with a function code the register does not
+ *  support gets 0x01. Without it everything exists.
+ *
+ *  Values are live: every -u ms an updater thread changes each input
+ *  register / discrete input (and, with -U, holding register / coil) with
+ *  probability permille/1000. Single 16-bit stores, so a read may mix two
+ *  update passes but never sees a torn register.
+ *
+ *  Processing delay: every answer is held for -D us plus uniform jitter
+ *  -J us after its request arrived (epoll timeout, millisecond resolution;
+ *  the loop keeps serving other connections meanwhile), to mimic the CAN
+ *  round trip of the real bridge.
+ *
+ *    gcc -O2 -I../../test_code slave_sim.c ../../test_code/register_map.c
+ *        ../../test_code/log_async.c -o slave_sim -lpthread
+ *    ./slave_sim -p 1502 -T 4 -D 2000 -J 3000 -u 100,50 -r regmap.bin
+ *
+ *  Counters (connections, requests, exceptions per second) are printed
+ *  every -t seconds.
+ *
+ *  @author  Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include "register_map.h"
+
+
+#define SIM_MAX_THREADS         64
+#define SIM_FRAME_MAX           260         /* MBAP + largest PDU                   */
+#define SIM_QUEUE               32          /* Delayed answers per connection       */
+#define SIM_STATS_SEC           10
+
+#define EXC_ILLEGAL_FUNCTION    0x01
+#define EXC_ILLEGAL_ADDRESS     0x02
+#define EXC_ILLEGAL_VALUE       0x03
+
+
+/*
+ * Answer waiting for its processing delay
+ */
+typedef struct {
+    uint64_t    due_us;
+    uint16_t    len;
+    uint8_t     adu[SIM_FRAME_MAX];
+} sim_answer;
+
+typedef struct sim_conn {
+    int              fd;
+    uint8_t          rx[SIM_FRAME_MAX * 4];
+    int              rx_len;
+    uint8_t          tx[SIM_FRAME_MAX * SIM_QUEUE];
+    int              tx_len;
+    sim_answer       queue[SIM_QUEUE];
+    int              q_head;
+    int              q_count;
+    struct sim_conn *next;              /* Thread's connection list           */
+} sim_conn;
+
+typedef struct {
+    atomic_ullong   connections;
+    atomic_ullong   requests;
+    atomic_ullong   exceptions;
+    atomic_ullong   dropped;            /* Connection closed: queue overflow  */
+} sim_stats;
+
+typedef struct {
+    int             index;
+    pthread_t       thread;
+    int             listen_fd;
+    int             epfd;
+    sim_conn       *conns;
+    uint64_t        rng;
+    sim_stats       stats;
+} sim_thread;
+
+
+static uint16_t             holding[65536];
+static uint16_t             input[65536];
+static uint8_t              coils[65536];
+static uint8_t              discrete[65536];
+
+/*
+ * With a register map: function codes accepted per address, bit n = FC n
+ */
+static uint32_t            *fc_allowed;
+
+static int                  port          = 502;
+static int                  thread_count  = 1;
+static uint32_t             delay_us;
+static uint32_t             jitter_us;
+static uint32_t             update_ms;
+static uint32_t             update_permille;
+static int                  update_writable;
+static volatile sig_atomic_t stop;
+
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000;
+}
+
+
+static uint32_t rng(uint64_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return (uint32_t)(*state >> 32);
+}
+
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+
+/***************************************************************
+ *  Register tables
+ ***************************************************************/
+
+static uint16_t reg_get(const uint16_t *table, uint16_t addr)
+{
+    return __atomic_load_n(&table[addr], __ATOMIC_RELAXED);
+}
+
+static void reg_set(uint16_t *table, uint16_t addr, uint16_t value)
+{
+    __atomic_store_n(&table[addr], value, __ATOMIC_RELAXED);
+}
+
+static uint8_t bit_get(const uint8_t *table, uint16_t addr)
+{
+    return __atomic_load_n(&table[addr], __ATOMIC_RELAXED);
+}
+
+static void bit_set(uint8_t *table, uint16_t addr, uint8_t value)
+{
+    __atomic_store_n(&table[addr], value, __ATOMIC_RELAXED);
+}
+
+
+/**
+ * @brief Check that every address of a request exists and supports @p fc.
+ *
+ * @return 0, or the Modbus exception code
+ */
+static int range_check(uint8_t fc, uint16_t addr, uint16_t count)
+{
+    uint32_t a;
+
+    if ((uint32_t)addr + count > 65536)
+    {
+        return EXC_ILLEGAL_ADDRESS;
+    }
+
+    if (fc_allowed == NULL)
+    {
+        return 0;
+    }
+
+    for (a = addr; a < (uint32_t)addr + count; a++)
+    {
+        if (fc_allowed[a] == 0)
+        {
+            return EXC_ILLEGAL_ADDRESS;
+        }
+        if (!(fc_allowed[a] & (1U << fc)))
+        {
+            return EXC_ILLEGAL_FUNCTION;
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief Function codes per PDU address from the register map.
+ *
+ * Register address % 10000 is 1-based, the PDU address is that - 1.
+ * A register of several words (size) covers the following addresses too.
+ */
+static int load_register_map(const char *path)
+{
+    regmap_t           *map = regmap_open(path);
+    const regmap_entry *e;
+    uint32_t            i;
+    uint32_t            w;
+    uint32_t            words;
+    uint32_t            mask;
+    int                 f;
+
+    if (map == NULL)
+    {
+        fprintf(stderr, "Register map %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    fc_allowed = calloc(65536, sizeof(uint32_t));
+    if (fc_allowed == NULL)
+    {
+        regmap_close(map);
+        return -1;
+    }
+
+    for (i = 0; i < map->hdr->entry_count; i++)
+    {
+        e    = &map->entries[i];
+        mask = 0;
+        for (f = 0; f < 3; f++)
+        {
+            if (e->fun_code[f])
+            {
+                mask |= 1U << e->fun_code[f];
+                if (e->fun_code[f] == 3)
+                {
+                    mask |= 1U << 23;       /* Read/write multiple */
+                }
+            }
+        }
+
+        words = (e->size > 2) ? (e->size + 1) / 2 : 1;
+        for (w = 0; (w < words) && (e->addr + w >= 1) && (e->addr - 1 + w < 65536); w++)
+        {
+            fc_allowed[e->addr - 1 + w] |= mask;
+        }
+    }
+
+    printf("Register map %s: %u registers\n", path, map->hdr->entry_count);
+    regmap_close(map);
+
+    return 0;
+}
+
+
+static void *updater(void *arg)
+{
+    uint64_t  state = 0x2545F4914F6CDD1DULL;
+    uint32_t  a;
+
+    (void)arg;
+
+    while (!stop)
+    {
+        usleep(update_ms * 1000);
+
+        for (a = 0; a < 65536; a++)
+        {
+            if ((fc_allowed != NULL) && (fc_allowed[a] == 0))
+            {
+                continue;
+            }
+
+            if (rng(&state) % 1000 < update_permille)
+            {
+                reg_set(input, (uint16_t)a, (uint16_t)(reg_get(input, (uint16_t)a) + 1 + rng(&state) % 100));
+                bit_set(discrete, (uint16_t)a, (uint8_t)!bit_get(discrete, (uint16_t)a));
+
+                if (update_writable)
+                {
+                    reg_set(holding, (uint16_t)a, (uint16_t)(reg_get(holding, (uint16_t)a) + 1));
+                    bit_set(coils, (uint16_t)a, (uint8_t)!bit_get(coils, (uint16_t)a));
+                }
+            }
+        }
+    }
+
+    return NULL;
+}
+
+
+/***************************************************************
+ *  Request processing
+ ***************************************************************/
+
+static int pack_bits(const uint8_t *table, uint16_t addr, uint16_t count, uint8_t *out)
+{
+    int bytes = (count + 7) / 8;
+    int i;
+
+    memset(out, 0, (size_t)bytes);
+    for (i = 0; i < count; i++)
+    {
+        out[i / 8] |= (uint8_t)(bit_get(table, (uint16_t)(addr + i)) << (i % 8));
+    }
+
+    return bytes;
+}
+
+
+/**
+ * @brief Build the answer PDU for one request PDU.
+ *
+ * @param pdu      Request PDU (function code first)
+ * @param pdu_len  Its length
+ * @param out      Answer PDU, at least 254 bytes
+ *
+ * @return Answer PDU length (an exception answer is 2 bytes)
+ */
+static int process_pdu(const uint8_t *pdu, int pdu_len, uint8_t *out)
+{
+    uint8_t  fc    = pdu[0];
+    uint16_t addr  = (pdu_len >= 5) ? (uint16_t)((pdu[1] << 8) | pdu[2]) : 0;
+    uint16_t count = (pdu_len >= 5) ? (uint16_t)((pdu[3] << 8) | pdu[4]) : 0;
+    uint16_t waddr;
+    uint16_t wcount;
+    int      exc;
+    int      i;
+
+    switch (fc)
+    {
+        case 1:
+        case 2:
+            if ((pdu_len != 5) || (count < 1) || (count > 2000))
+            {
+                exc = EXC_ILLEGAL_VALUE;
+                break;
+            }
+            if ((exc = range_check(fc, addr, count)) != 0)
+            {
+                break;
+            }
+            out[0] = fc;
+            out[1] = (uint8_t)pack_bits((fc == 1) ? coils : discrete, addr, count, &out[2]);
+            return 2 + out[1];
+
+        case 3:
+        case 4:
+            if ((pdu_len != 5) || (count < 1) || (count > 125))
+            {
+                exc = EXC_ILLEGAL_VALUE;
+                break;
+            }
+            if ((exc = range_check(fc, addr, count)) != 0)
+            {
+                break;
+            }
+            out[0] = fc;
+            out[1] = (uint8_t)(count * 2);
+            for (i = 0; i < count; i++)
+            {
+                uint16_t v = reg_get((fc == 3) ? holding : input, (uint16_t)(addr + i));
+                out[2 + i * 2] = (uint8_t)(v >> 8);
+                out[3 + i * 2] = (uint8_t)v;
+            }
+            return 2 + out[1];
+
+        case 5:
+        case 6:
+            if ((pdu_len != 5) || ((fc == 5) && (count != 0xFF00) && (count != 0)))
+            {
+                exc = EXC_ILLEGAL_VALUE;
+                break;
+            }
+            if ((exc = range_check(fc, addr, 1)) != 0)
+            {
+                break;
+            }
+            if (fc == 5)
+            {
+                bit_set(coils, addr, count ? 1 : 0);
+            }
+            else
+            {
+                reg_set(holding, addr, count);
+            }
+            memcpy(out, pdu, 5);
+            return 5;
+
+        case 15:
+        case 16:
+            if ((pdu_len < 6) || (count < 1) || (count > ((fc == 15) ? 1968 : 123)) ||
+                (pdu[5] != ((fc == 15) ? (count + 7) / 8 : count * 2)) || (pdu_len != 6 + pdu[5]))
+            {
+                exc = EXC_ILLEGAL_VALUE;
+                break;
+            }
+            if ((exc = range_check(fc, addr, count)) != 0)
+            {
+                break;
+            }
+            for (i = 0; i < count; i++)
+            {
+                if (fc == 15)
+                {
+                    bit_set(coils, (uint16_t)(addr + i), (pdu[6 + i / 8] >> (i % 8)) & 1);
+                }
+                else
+                {
+                    reg_set(holding, (uint16_t)(addr + i), (uint16_t)((pdu[6 + i * 2] << 8) | pdu[7 + i * 2]));
+                }
+            }
+            memcpy(out, pdu, 5);
+            return 5;
+
+        case 23:
+            /*
+             * read addr/count, write addr/count, byte count, values; write first
+             */
+            if (pdu_len < 10)
+            {
+                exc = EXC_ILLEGAL_VALUE;
+                break;
+            }
+            waddr  = (uint16_t)((pdu[5] << 8) | pdu[6]);
+            wcount = (uint16_t)((pdu[7] << 8) | pdu[8]);
+            if ((count < 1) || (count > 125) || (wcount < 1) || (wcount > 121) ||
+                (pdu[9] != wcount * 2) || (pdu_len != 10 + pdu[9]))
+            {
+                exc = EXC_ILLEGAL_VALUE;
+                break;
+            }
+            if (((exc = range_check(fc, waddr, wcount)) != 0) || ((exc = range_check(fc, addr, count)) != 0))
+            {
+                break;
+            }
+            for (i = 0; i < wcount; i++)
+            {
+                reg_set(holding, (uint16_t)(waddr + i), (uint16_t)((pdu[10 + i * 2] << 8) | pdu[11 + i * 2]));
+            }
+            out[0] = fc;
+            out[1] = (uint8_t)(count * 2);
+            for (i = 0; i < count; i++)
+            {
+                uint16_t v = reg_get(holding, (uint16_t)(addr + i));
+                out[2 + i * 2] = (uint8_t)(v >> 8);
+                out[3 + i * 2] = (uint8_t)v;
+            }
+            return 2 + out[1];
+
+        default:
+            exc = EXC_ILLEGAL_FUNCTION;
+            break;
+    }
+
+    out[0] = (uint8_t)(fc | 0x80);
+    out[1] = (uint8_t)exc;
+    return 2;
+}
+
+
+/***************************************************************
+ *  Connections
+ ***************************************************************/
+
+static void conn_close(sim_thread *t, sim_conn *c)
+{
+    sim_conn **p;
+
+    epoll_ctl(t->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+
+    for (p = &t->conns; *p != NULL; p = &(*p)->next)
+    {
+        if (*p == c)
+        {
+            *p = c->next;
+            break;
+        }
+    }
+
+    free(c);
+    atomic_fetch_sub(&t->stats.connections, 1);
+}
+
+
+static void conn_want_write(sim_thread *t, sim_conn *c, int on)
+{
+    struct epoll_event ev;
+
+    ev.events   = EPOLLIN | (on ? EPOLLOUT : 0);
+    ev.data.ptr = c;
+    epoll_ctl(t->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+
+/**
+ * @return 0, or -1 if the connection was closed
+ */
+static int conn_flush(sim_thread *t, sim_conn *c)
+{
+    ssize_t n;
+
+    while (c->tx_len > 0)
+    {
+        n = send(c->fd, c->tx, (size_t)c->tx_len, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                conn_want_write(t, c, 1);
+                return 0;
+            }
+            conn_close(t, c);
+            return -1;
+        }
+
+        memmove(c->tx, c->tx + n, (size_t)(c->tx_len - n));
+        c->tx_len -= (int)n;
+    }
+
+    conn_want_write(t, c, 0);
+    return 0;
+}
+
+
+/**
+ * @brief Move due answers (in request order) to the send buffer.
+ *
+ * @return Microseconds until the next answer is due, -1 if none is queued
+ */
+static int64_t conn_release(sim_thread *t, sim_conn *c, uint64_t now)
+{
+    sim_answer *a;
+    int         moved = 0;
+
+    while (c->q_count > 0)
+    {
+        a = &c->queue[c->q_head];
+        if (a->due_us > now)
+        {
+            break;
+        }
+        if (c->tx_len + a->len > (int)sizeof(c->tx))
+        {
+            break;
+        }
+
+        memcpy(c->tx + c->tx_len, a->adu, a->len);
+        c->tx_len += a->len;
+        c->q_head = (c->q_head + 1) % SIM_QUEUE;
+        c->q_count--;
+        moved = 1;
+    }
+
+    if (moved && (conn_flush(t, c) != 0))
+    {
+        return -2;
+    }
+
+    if (c->q_count == 0)
+    {
+        return -1;
+    }
+
+    return (c->queue[c->q_head].due_us > now) ? (int64_t)(c->queue[c->q_head].due_us - now) : 0;
+}
+
+
+/**
+ * @return 0, or -1 if the connection was closed
+ */
+static int conn_read(sim_thread *t, sim_conn *c)
+{
+    sim_answer *a;
+    ssize_t     n;
+    int         frame_len;
+    int         pdu_len;
+    uint64_t    due;
+
+    n = recv(c->fd, c->rx + c->rx_len, sizeof(c->rx) - (size_t)c->rx_len, 0);
+    if ((n == 0) || ((n < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK)))
+    {
+        conn_close(t, c);
+        return -1;
+    }
+    if (n < 0)
+    {
+        return 0;
+    }
+    c->rx_len += (int)n;
+
+    while (c->rx_len >= 8)
+    {
+        frame_len = 6 + ((c->rx[4] << 8) | c->rx[5]);
+        if ((c->rx[2] != 0) || (c->rx[3] != 0) || (frame_len < 8) || (frame_len > SIM_FRAME_MAX))
+        {
+            conn_close(t, c);
+            return -1;
+        }
+        if (c->rx_len < frame_len)
+        {
+            break;
+        }
+
+        if (c->q_count >= SIM_QUEUE)
+        {
+            /*
+             * Client pipelines faster than the delay lets us answer
+             */
+            atomic_fetch_add(&t->stats.dropped, 1);
+            conn_close(t, c);
+            return -1;
+        }
+
+        due = now_us() + delay_us + (jitter_us ? rng(&t->rng) % (jitter_us + 1) : 0);
+        a   = &c->queue[(c->q_head + c->q_count) % SIM_QUEUE];
+
+        /*
+         * Answers leave in request order: never due before the one ahead
+         */
+        if ((c->q_count > 0) && (due < c->queue[(c->q_head + c->q_count - 1) % SIM_QUEUE].due_us))
+        {
+            due = c->queue[(c->q_head + c->q_count - 1) % SIM_QUEUE].due_us;
+        }
+
+        memcpy(a->adu, c->rx, 7);
+        pdu_len = process_pdu(c->rx + 7, frame_len - 7, a->adu + 7);
+        a->adu[4] = (uint8_t)((pdu_len + 1) >> 8);
+        a->adu[5] = (uint8_t)(pdu_len + 1);
+        a->len    = (uint16_t)(7 + pdu_len);
+        a->due_us = due;
+        c->q_count++;
+
+        atomic_fetch_add(&t->stats.requests, 1);
+        if (a->adu[7] & 0x80)
+        {
+            atomic_fetch_add(&t->stats.exceptions, 1);
+        }
+
+        memmove(c->rx, c->rx + frame_len, (size_t)(c->rx_len - frame_len));
+        c->rx_len -= frame_len;
+    }
+
+    return 0;
+}
+
+
+static void conn_accept(sim_thread *t)
+{
+    struct epoll_event ev;
+    sim_conn          *c;
+    int                fd;
+    int                one = 1;
+
+    while ((fd = accept4(t->listen_fd, NULL, NULL, SOCK_NONBLOCK)) >= 0)
+    {
+        c = calloc(1, sizeof(*c));
+        if (c == NULL)
+        {
+            close(fd);
+            continue;
+        }
+
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        c->fd       = fd;
+        c->next     = t->conns;
+        t->conns    = c;
+        ev.events   = EPOLLIN;
+        ev.data.ptr = c;
+        epoll_ctl(t->epfd, EPOLL_CTL_ADD, fd, &ev);
+
+        atomic_fetch_add(&t->stats.connections, 1);
+    }
+}
+
+
+static int open_listener(void)
+{
+    struct sockaddr_in addr;
+    int                fd;
+    int                one = 1;
+
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons((uint16_t)port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    if ((bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) || (listen(fd, 1024) < 0))
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+static void *worker(void *arg)
+{
+    sim_thread         *t = arg;
+    struct epoll_event  events[64];
+    struct epoll_event  ev;
+    sim_conn           *c;
+    sim_conn           *next;
+    int64_t             wait;
+    int64_t             soonest;
+    int                 timeout;
+    int                 n;
+    int                 i;
+
+    t->epfd     = epoll_create1(0);
+    ev.events   = EPOLLIN;
+    ev.data.ptr = NULL;
+    epoll_ctl(t->epfd, EPOLL_CTL_ADD, t->listen_fd, &ev);
+
+    while (!stop)
+    {
+        /*
+         * Release due answers, find the next deadline
+         */
+        soonest = 100000;
+        for (c = t->conns; c != NULL; c = next)
+        {
+            next = c->next;
+            if (c->q_count == 0)
+            {
+                continue;
+            }
+            wait = conn_release(t, c, now_us());
+            if ((wait >= 0) && (wait < soonest))
+            {
+                soonest = wait;
+            }
+        }
+
+        timeout = (int)((soonest + 999) / 1000);
+        n = epoll_wait(t->epfd, events, 64, timeout);
+
+        for (i = 0; i < n; i++)
+        {
+            c = events[i].data.ptr;
+            if (c == NULL)
+            {
+                conn_accept(t);
+                continue;
+            }
+
+            if (events[i].events & (EPOLLERR | EPOLLHUP))
+            {
+                conn_close(t, c);
+                continue;
+            }
+
+            if ((events[i].events & EPOLLOUT) && (conn_flush(t, c) != 0))
+            {
+                continue;
+            }
+
+            if ((events[i].events & EPOLLIN) && (conn_read(t, c) == 0) && (delay_us == 0) && (jitter_us == 0))
+            {
+                conn_release(t, c, now_us());
+            }
+        }
+    }
+
+    while (t->conns != NULL)
+    {
+        conn_close(t, t->conns);
+    }
+    close(t->epfd);
+
+    return NULL;
+}
+
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-p port] [-T threads] [-D delay_us] [-J jitter_us] [-u ms,permille] [-U]\n"
+            "          [-r regmap.bin] [-t stats_sec]\n", prog);
+}
+
+
+int main(int argc, char *argv[])
+{
+    static sim_thread threads[SIM_MAX_THREADS];
+    const char       *map_path  = NULL;
+    pthread_t         upd;
+    uint32_t          stats_sec = SIM_STATS_SEC;
+    uint64_t          last_req  = 0;
+    uint64_t          req;
+    uint64_t          exc;
+    uint64_t          conns;
+    uint64_t          dropped;
+    uint32_t          a;
+    uint32_t          elapsed   = 0;
+    int               opt;
+    int               i;
+
+    while ((opt = getopt(argc, argv, "p:T:D:J:u:Ur:t:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'p': port            = atoi(optarg); break;
+            case 'T': thread_count    = atoi(optarg); break;
+            case 'D': delay_us        = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'J': jitter_us       = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'U': update_writable = 1; break;
+            case 'r': map_path        = optarg; break;
+            case 't': stats_sec       = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'u':
+                if (sscanf(optarg, "%u,%u", &update_ms, &update_permille) != 2)
+                {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if ((thread_count < 1) || (thread_count > SIM_MAX_THREADS))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if ((map_path != NULL) && (load_register_map(map_path) != 0))
+    {
+        return 1;
+    }
+
+    /*
+     * Recognisable start values: register n holds n
+     */
+    for (a = 0; a < 65536; a++)
+    {
+        holding[a]  = (uint16_t)a;
+        input[a]    = (uint16_t)a;
+        coils[a]    = (uint8_t)(a & 1);
+        discrete[a] = (uint8_t)((a >> 1) & 1);
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    for (i = 0; i < thread_count; i++)
+    {
+        threads[i].index     = i;
+        threads[i].rng       = (uint64_t)(i + 1) * 0x9E3779B97F4A7C15ULL;
+        threads[i].listen_fd = open_listener();
+        if (threads[i].listen_fd < 0)
+        {
+            fprintf(stderr, "Port %d: %s\n", port, strerror(errno));
+            return 1;
+        }
+        pthread_create(&threads[i].thread, NULL, worker, &threads[i]);
+    }
+
+    if (update_ms && update_permille)
+    {
+        pthread_create(&upd, NULL, updater, NULL);
+        pthread_detach(upd);
+    }
+
+    printf("Modbus slave simulator on port %d, %d threads, delay %u+%u us, updates %u ms / %u permille\n",
+           port, thread_count, delay_us, jitter_us, update_ms, update_permille);
+
+    while (!stop)
+    {
+        sleep(1);
+        if ((stats_sec == 0) || (++elapsed % stats_sec != 0))
+        {
+            continue;
+        }
+
+        req = exc = conns = dropped = 0;
+        for (i = 0; i < thread_count; i++)
+        {
+            req     += atomic_load(&threads[i].stats.requests);
+            exc     += atomic_load(&threads[i].stats.exceptions);
+            conns   += atomic_load(&threads[i].stats.connections);
+            dropped += atomic_load(&threads[i].stats.dropped);
+        }
+
+        printf("connections %llu, requests %llu (%.0f/s), exceptions %llu, overflow closes %llu\n",
+               (unsigned long long)conns, (unsigned long long)req, (double)(req - last_req) / stats_sec,
+               (unsigned long long)exc, (unsigned long long)dropped);
+        fflush(stdout);
+        last_req = req;
+    }
+
+    for (i = 0; i < thread_count; i++)
+    {
+        pthread_join(threads[i].thread, NULL);
+        close(threads[i].listen_fd);
+    }
+
+    return 0;
+}
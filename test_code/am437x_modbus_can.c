@@ -42,45 +42,44 @@
 #include <modbus/modbus.h>
 #include <errno.h>
 #include <arpa/inet.h>
-#include <netdb.h>
-#include <ifaddrs.h>
 #include <net/if.h>
 #include <fcntl.h>
+#include <stdatomic.h>
+#include <signal.h>
+#include <stddef.h>
+#include <sys/un.h>
 #include "register_details.h"
+#include "register_tables.h"
 #include "log.h"
+#include "shm_register_image.h"
+#include "can_rtt.h"
+#include "can_scheduler.h"
+#include "can_delta.h"
+#include "etu_protocol.h"
+#include "discovery.h"
+#include "metrics.h"
+#include "rtu_framer.h"
 
 
-#define BROADCAST_PORT 12345
-#define BUF_SIZE 1024
-#define NEED_IP_MSG "NEED_IP"
 
 
 
-#define CAN_INTERFACE       "can0"
+#ifndef CAN_INTERFACE
+#define CAN_INTERFACE       "can0"     /* -DCAN_INTERFACE=\"vcan0\" for the replay harness */
+#endif
 #define CAN_BITRATE         1000000
 #define Heartbeat_ID        0x017E0333
+#define CAN_MODULE_ADDR     0          /* Module Address of the ETU in request IDs */
+#define CAN_MODULE_ID       1          /* Module ID of the ETU in request IDs      */
 
 #define MAX_RETRIES         3
-
-
-/* CAN Message IDs */
-#define CAN_READ_REQ_MSG_ID            0  /* CAN: Read Request from Host */
-#define CAN_RESPONSE_MSG_ID            1  /* CAN: Response to Read Request */
-#define CAN_READ_ACK_MSG_ID            9  /* CAN: Acknowledgement for Read */
-
-/* TCP ↔ ETU Write Operation Message IDs */
-#define TCP_TO_ETU_WRITE_REQ_ID        2  /* TCP to ETU: Write Request */
-#define ETU_TO_TCP_WRITE_GRANT_ID      3  /* ETU to TCP: Grant Write Request */
-#define TCP_TO_ETU_WRITE_CMD_ID        4  /* TCP to ETU: Write Command with Data */
-#define ETU_TO_TCP_WRITE_ACK_ID        5  /* ETU to TCP: Acknowledgement for Write */
-#define TCP_TO_ETU_WRITE_TERM_ID       6  /* TCP to ETU: Write Termination */
-#define ETU_TO_TCP_WRITE_TERM_ID       7  /* ETU to TCP: Write Termination Acknowledgement */
+#define CAN_INIT_RETRY_MS   2000   /* Delay between CAN bring-up rounds, the bridge never exits on CAN errors */
 
 
 #define CAN_DATA_LEN 8
 
 
-#define CAN_READ_TIME          2
+#define CAN_TX_TIMEOUT_MS      100   /* Wait for room in the CAN TX queue */
 #define CAN_MAX_BYTE_SIZE      6
 
 #define BYTE1    8
@@ -120,8 +119,37 @@ void debug_print(const char *func, int line) {
  *  Modbus & CAN Configuration
  ***************************************************************/
 
+#ifndef SERVER_PORT
 #define SERVER_PORT         502
+#endif
 #define MAX_ADU_LENGTH      50
+#define BRIDGE_MAX_CLIENTS  8      /* Concurrent Modbus TCP connections */
+
+/*
+ * Modbus RTU slave on the RS-485 port, served by the same dispatcher and
+ * CAN scheduler as the TCP clients. Off unless the build names the port,
+ * not every board has the RS-485 transceiver fitted.
+ */
+#ifndef RTU_DEVICE
+#define RTU_DEVICE          ""             /* e.g. -DRTU_DEVICE=\"/dev/ttyS1\"           */
+#endif
+#ifndef RTU_BAUD
+#define RTU_BAUD            19200
+#endif
+#ifndef RTU_UNIT_ID
+#define RTU_UNIT_ID         1
+#endif
+#define RTU_PARITY          'E'            /* Modbus default 8E1                         */
+#define RTU_RS485           1              /* Kernel RS-485 direction control            */
+#define RTU_RETRY_MS        2000           /* Reopen delay after a port error            */
+#define RTU_CLIENT_ID       0xFFFFFFFEU    /* Scheduler identity, never an IPv4 peer     */
+
+#ifndef METRICS_SOCKET
+#define METRICS_SOCKET      "/run/modbus_can_metrics.sock"
+#endif
+#ifndef METRICS_HTTP_PORT
+#define METRICS_HTTP_PORT   9502       /* 127.0.0.1 only, 0 = no HTTP endpoint */
+#endif
 
 
 /*  
@@ -141,6 +169,7 @@ void debug_print(const char *func, int line) {
 #define MODBUS_FUNC_GET_COM_EVENT_LOG            12  /* Get Comm Event Log – Optional */
 #define MODBUS_FUNC_WRITE_MULTIPLE_COILS         15  /* Write Multiple Coils -> mb_mapping->tab_bits */
 #define MODBUS_FUNC_WRITE_MULTIPLE_REGISTERS     16  /* Write Multiple Registers -> mb_mapping->tab_registers */
+#define MODBUS_FUNC_WRITE_READ_REGISTERS         23  /* Read/Write Multiple Registers -> mb_mapping->tab_registers */
 
 /* Notes:  
  * Function codes 9, 10, 13, and 14 are skipped as they are reserved or rarely used.
@@ -156,116 +185,48 @@ void debug_print(const char *func, int line) {
 
 
 
-/**************************************************************
- * Dataset Category to Index Mapping
- *
- * Category                              | Index
- * --------------------------------------|-------
- * Commands                              | 0
- * Event Data Transmit                   | 1
- * Settings                              | 2
- * Metering                              | 3
- * Breaker Status                        | 4
- * Records (Trip, Events, Maintenance)   | 5
- * HeartBeat                             | 6
- **************************************************************/
-
-/**************************************************************
- * Dataset to Category Mapping
- *
- * Dataset Name           | Category
- * ------------------------|------------------------
- * Status                 | Breaker Status
- * Monitoring Data        | Metering
- * Breaker Data           | Breaker Status
- * Protection Settings    | Settings
- * General Settings       | Settings
- * Module Settings        | Settings
- * Commands               | Commands
- * Data Records           | Records
- * Product Info RS-485    | Breaker Status
- * Module Data            | Breaker Status
- * User defined Map       | Breaker Status
- **************************************************************/
-
-
-#define CMD_COMMANDS                0
-#define CMD_BREAKER_STATUS          2 
-#define CMD_METERING                3
-#define CMD_SETTINGS                1
-#define CMD_Trip_ECORDS             4
-#define CMD_Events_RECORDS          5
-#define CMD_Maintainence_RECORD     6
-#define CMD_HEARTBEAT               7
-
-
-device_data *tcp_data[] = {
-    module_data_TCP,
-    module_settings_TCP,
-};
-
-const int tcp_dataset_counts[] = {
-    sizeof(module_data_TCP) / sizeof(module_data_TCP[0]),
-    sizeof(module_settings_TCP) / sizeof(module_settings_TCP[0])
-};
-
-device_data *all_datasets[] = {
-    status,
-    monitoring_data,
-    breaker_data,
-    protection_settings,
-    general_settings,
-    module_settings,
-    module_data,
-    commands,
-    data_records,
-    Product_Info_RS_485,
-    Product_Info_PC_HMI,
-    User_Defined_Map
-};
-
-const int dataset_counts[] = {
-    sizeof(status) / sizeof(status[0]),
-    sizeof(monitoring_data) / sizeof(monitoring_data[0]),
-    sizeof(breaker_data) / sizeof(breaker_data[0]),
-    sizeof(protection_settings) / sizeof(protection_settings[0]),
-    sizeof(general_settings) / sizeof(general_settings[0]),
-    sizeof(module_settings) / sizeof(module_settings[0]),
-    sizeof(module_data) / sizeof(module_data[0]),
-    sizeof(commands) / sizeof(commands[0]),
-    sizeof(data_records) / sizeof(data_records[0]),
-    sizeof(Product_Info_RS_485) / sizeof(Product_Info_RS_485[0]),
-    sizeof(Product_Info_PC_HMI) / sizeof(Product_Info_PC_HMI[0]),
-    sizeof(User_Defined_Map) / sizeof(User_Defined_Map[0])
-};
-
-
-typedef struct {
-    const char *dataset_name;  // Dataset name like "monitoring_data"
-    int data_header;           // Mapped command category
-} dataheater_mapping;
-
-static dataheater_mapping header[] = {
-    { "status",              CMD_BREAKER_STATUS },
-    { "monitoring_data",     CMD_METERING },
-    { "breaker_data",        CMD_BREAKER_STATUS },
-    { "protection_settings", CMD_SETTINGS },
-    { "general_settings",    CMD_SETTINGS },
-    { "module_settings",     CMD_SETTINGS },
-    { "module_data",         CMD_BREAKER_STATUS },
-    { "commands",            CMD_COMMANDS },
-    { "data_records",        CMD_Trip_ECORDS },
-    { "Product_Info_RS_485", CMD_BREAKER_STATUS },
-    { "Product_Info_PC_HMI", CMD_BREAKER_STATUS },
-    { "User_Defined_Map",    CMD_BREAKER_STATUS }
-};
-
-
 /***************************************************************
  *  Application Buffers & Constants
  ***************************************************************/
 uint8_t received_data[500] = {0};
 
+/*
+ * Shared-memory copy of the register image for local consumers (historian, HMI).
+ * NULL if the segment could not be created; the bridge works without it.
+ */
+shm_image_t *register_image = NULL;
+
+/*
+ * Shared by all client threads
+ */
+int          can_socket_fd  = -1;   /* Used only by the CAN scheduler thread        */
+int          eeprom_fd      = -1;   /* pread/pwrite only, no shared file offset     */
+atomic_int   active_clients;        /* Connected Modbus TCP clients                 */
+atomic_int   can_ready;             /* CAN interface, socket and scheduler running  */
+uint64_t     startup_us;            /* Monotonic time main() started                */
+
+/*
+ * One connected Modbus TCP client, owned by its thread
+ */
+typedef struct {
+    modbus_t   *ctx;
+    int         socket;
+    uint32_t    client_id;          /* IPv4 address, host byte order */
+} bridge_client;
+
+/*
+ * One CAN transaction handed to the CAN scheduler
+ */
+typedef struct can_request {
+    uint32_t             can_id;
+    uint32_t             fun_code;
+    uint16_t             length;    /* Registers / bits requested            */
+    uint8_t             *data;      /* Write source or read target           */
+    uint32_t             data_len;  /* Bytes to copy on read                 */
+    int                  write;
+    struct can_request  *next;      /* Run right after this one, same job    */
+} can_request;
+
 /*  
  * Check CAN interface up or not  
  */
@@ -308,6 +269,19 @@ int is_interface_up(const char *ifname)
 }
 
 
+/*
+ * vcan and other software interfaces have no bitrate and no bus state
+ */
+int is_virtual_interface(const char *ifname)
+{
+    char path[128];
+
+    snprintf(path, sizeof(path), "/sys/devices/virtual/net/%s", ifname);
+
+    return access(path, F_OK) == 0;
+}
+
+
 /*  
  * Check CAN state is ERROR-ACTIVE  
  */
@@ -355,13 +329,16 @@ int is_can_state_ok(const char *ifname)
  *
  * @param interface The name of the CAN interface (e.g., "can0").
  * @param bitrate   The bitrate to configure for the CAN interface (e.g., 500000).
+ *
+ * @return 0 on success, -1 if the interface could not be brought up
  */
 
-void setup_can_interface(const char *interface, int bitrate)
+int setup_can_interface(const char *interface, int bitrate)
 {
     char command[256];
     int attempt = 0;
     int ret;
+    int virtual_if = is_virtual_interface(interface);
 
     while (attempt < MAX_RETRIES)
     {
@@ -374,17 +351,17 @@ void setup_can_interface(const char *interface, int bitrate)
         if (system(command) != 0)
         {
             LOG_ERROR("Failed to bring down CAN interface: %s\n", interface);
-            exit(EXIT_FAILURE);
+            return -1;
         }
 
         /*
          * Step 2: Set bitrate
          */
         snprintf(command, sizeof(command), "ip link set %s type can bitrate %d", interface, bitrate);
-        if (system(command) != 0)
+        if (!virtual_if && (system(command) != 0))
         {
             LOG_ERROR("Failed to configure CAN bitrate on interface: %s\n", interface);
-            exit(EXIT_FAILURE);
+            return -1;
         }
 
         /*
@@ -413,7 +390,7 @@ void setup_can_interface(const char *interface, int bitrate)
         /*
          * Step 5: Check CAN state
          */
-        if (!is_can_state_ok(interface))
+        if (!virtual_if && !is_can_state_ok(interface))
         {
             LOG_ERROR("CAN interface %s is not in ERROR-ACTIVE state\n", interface);
             attempt++;
@@ -421,11 +398,11 @@ void setup_can_interface(const char *interface, int bitrate)
         }
 
         LOG_DEBUG("Successfully brought up CAN interface: %s with bitrate %d\n\n", interface, bitrate);
-        return; // success
+        return 0; // success
     }
 
-    LOG_ERROR("CAN interface %s failed to initialize after %d attempts. Exiting.\n", interface, MAX_RETRIES);
-    exit(EXIT_FAILURE);
+    LOG_ERROR("CAN interface %s failed to initialize after %d attempts.\n", interface, MAX_RETRIES);
+    return -1;
 }
 
 
@@ -446,7 +423,6 @@ int send_can_message(int socket_fd, struct can_frame *frame)
     fd_set                write_fds;
     struct timeval        timeout;
     int                   ret;
-    uint8_t               i;
 
     /*
      * 29-bit ID
@@ -458,16 +434,18 @@ int send_can_message(int socket_fd, struct can_frame *frame)
      */
     FD_ZERO(&write_fds);
     FD_SET(socket_fd, &write_fds);
-    timeout.tv_sec = 1;
-    timeout.tv_usec = 0;
+    timeout.tv_sec = 0;
+    timeout.tv_usec = CAN_TX_TIMEOUT_MS * 1000;
 
     /*
-     * Use select to check if socket is ready for writing
+     * Use select to check if socket is ready for writing.
+     * A full TX queue for this long means the bus is off or saturated.
      */
     ret = select(socket_fd + 1, NULL, &write_fds, NULL, &timeout);
     if (ret <= 0)
     {
-        LOG_ERROR("Timeout: Unable to send CAN message within 2 seconds\n");
+        LOG_ERROR("Timeout: Unable to send CAN message within %d ms\n", CAN_TX_TIMEOUT_MS);
+        metrics_inc(METRIC_CAN_TX_ERRORS);
         return -1;
     }
 
@@ -477,9 +455,12 @@ int send_can_message(int socket_fd, struct can_frame *frame)
     if (write(socket_fd, frame, sizeof(struct can_frame)) != sizeof(struct can_frame))
     {
         LOG_ERROR("Error sending CAN frame\n");
+        metrics_inc(METRIC_CAN_TX_ERRORS);
         return -1;
     }
 
+    metrics_inc(METRIC_CAN_TX_FRAMES);
+
     /*
      * Allow heartbeat messages to print only once
      */
@@ -493,37 +474,33 @@ int send_can_message(int socket_fd, struct can_frame *frame)
         one_time = 1;
     }
 
-    LOG_DEBUG("CAN frame sent: ID=0x%X DLC=%d Data=", frame->can_id, frame->can_dlc);
-    for (i = 0; i < frame->can_dlc; i++)
-    {
-        log("%02X ", frame->data[i]);
-    }
-    log("\n");
+    LOG_HEX(frame->data, frame->can_dlc, "CAN frame sent: ID=0x%X DLC=%d Data=", frame->can_id, frame->can_dlc);
 
     return 0;
 }
 
 
 /**
- * @brief Receive a specific CAN message within 2 seconds
+ * @brief Receive a specific CAN message within the given timeout
  *
- * This function waits up to 2 seconds to receive a CAN frame matching a specific CAN ID.
+ * This function waits up to timeout_ms to receive a CAN frame matching a specific CAN ID.
  * It filters incoming messages until the expected ID is received or times out.
  *
  * @param socket_fd   File descriptor of the CAN socket
  * @param frame       Pointer to store the received CAN frame
  * @param can_req_id  Expected CAN ID to match
+ * @param timeout_ms  Maximum wait in milliseconds (per-module RTO, see can_rtt.h)
  *
  * @return 0 on success, -1 on failure (timeout or error)
  */
-int receive_can_message_with_filter(int socket_fd, struct can_frame *frame, int can_resp_id)
+int receive_can_message_with_filter(int socket_fd, struct can_frame *frame, int can_resp_id, uint32_t timeout_ms)
 {
     fd_set              read_fds;
     struct timeval      timeout;
-    time_t              start_time;
+    uint64_t            deadline_us;
+    uint64_t            now_us;
     ssize_t             nbytes;
     int                 ret;
-    uint8_t             i;
 
 
 #if 0
@@ -554,24 +531,24 @@ int receive_can_message_with_filter(int socket_fd, struct can_frame *frame, int
 
 
     /*
-     * Record the start time for timeout tracking
+     * Absolute deadline on the monotonic clock, so frames for other IDs
+     * do not extend the wait
      */
-    start_time = time(NULL);
+    deadline_us = can_rtt_now_us() + (uint64_t)timeout_ms * 1000;
 
     /*
-     * Loop for up to 2 seconds, polling for the expected CAN ID
+     * Loop until the deadline, polling for the expected CAN ID
      */
-    while ((time(NULL) - start_time) < CAN_READ_TIME)
+    while ((now_us = can_rtt_now_us()) < deadline_us)
     {
         FD_ZERO(&read_fds);
         FD_SET(socket_fd, &read_fds);
 
-
         /*
-         * Poll every 200 milliseconds
+         * Wait only for the time left before the deadline
          */
-        timeout.tv_sec = CAN_READ_TIME;
-        timeout.tv_usec = 0;
+        timeout.tv_sec  = (deadline_us - now_us) / 1000000;
+        timeout.tv_usec = (deadline_us - now_us) % 1000000;
 
         ret = select(socket_fd + 1, &read_fds, NULL, NULL, &timeout);
         if (ret < 0)
@@ -602,12 +579,8 @@ int receive_can_message_with_filter(int socket_fd, struct can_frame *frame, int
          */
         if (frame->can_id == (can_resp_id | CAN_EFF_FLAG))
         {
-            LOG_DEBUG("Received expected CAN frame: ID=0x%X DLC=%d Data=", frame->can_id, frame->can_dlc);
-            for (i = 0; i < frame->can_dlc; i++)
-            {
-                log("%02X ", frame->data[i]);
-            }
-            log("\n");
+            LOG_HEX(frame->data, frame->can_dlc, "Received expected CAN frame: ID=0x%X DLC=%d Data=", frame->can_id, frame->can_dlc);
+            metrics_inc(METRIC_CAN_RX_FRAMES);
             return 0;
         }
     }
@@ -615,7 +588,7 @@ int receive_can_message_with_filter(int socket_fd, struct can_frame *frame, int
     /*
      * Timeout occurred before receiving the expected CAN ID
      */
-    LOG_ERROR("Timeout: CAN frame with ID 0x%X not received within 2 seconds\n", can_resp_id | CAN_EFF_FLAG);
+    LOG_WARN("Timeout: CAN frame with ID 0x%X not received within %u ms\n", can_resp_id | CAN_EFF_FLAG, timeout_ms);
     return -1;
 }
 
@@ -666,12 +639,7 @@ int receive_can_message(int socket_fd, struct can_frame *frame)
         return -1;
     }
 
-    LOG_DEBUG("Received CAN frame: ID=0x%X DLC=%d Data=", frame->can_id, frame->can_dlc);
-    for (int i = 0; i < frame->can_dlc; i++) 
-    {
-        LOG_DEBUG("%02X ", frame->data[i]);
-    }
-    LOG_DEBUG("\n");
+    LOG_HEX(frame->data, frame->can_dlc, "Received CAN frame: ID=0x%X DLC=%d Data=", frame->can_id, frame->can_dlc);
 
     return 0;
 }
@@ -739,146 +707,257 @@ void *heartbeat_thread(void *arg)
     return NULL;
 }
 
-/**************************************************************************************************/
-/* Function Name : GenerateCRC			   	      			                  */
-/* Description   : Calculates general-purpose CRC for given data.                                 */
-/*                                                                                                */
-/* Parameters    : ui8_data: The pointer to data for CRC calculati                                */
-/*                 ui16_size : Data Length for calculation.                                       */
-/*                 ui16_crc_start : Start data index for CRC calculation.                         */
-/*                                                                                                */
-/* Return        : Calculated CRC. 			                                          */
-/*                                                                                                */
-/**************************************************************************************************/
-uint16_t GenerateCRC(uint8_t * ui8_data, uint16_t ui16_size)
+/**
+ * @brief Send a frame and wait for its response, retransmitting on loss.
+ *
+ * One fragment exchange of the ETU protocol: the request (or the ACK of the
+ * previous fragment) is sent and the response with ID rx_id is awaited for
+ * the module's current RTO. On timeout or CRC error the same frame is sent
+ * again, up to CAN_FRAG_MAX_RETRIES times; the ETU answers a repeated
+ * request/ACK by repeating the corresponding response.
+ *
+ * Only exchanges that succeed on the first transmission feed the RTT
+ * estimator (Karn's rule).
+ *
+ * @param socket_fd  File descriptor of the CAN socket
+ * @param tx_frame   Frame to send (kept intact for retransmission)
+ * @param rx_id      Expected response CAN ID
+ * @param rx_frame   Pointer to store the received, CRC-checked frame
+ *
+ * @return 0 on success, -1 when all retransmissions failed
+ */
+int can_exchange(int socket_fd, struct can_frame *tx_frame, uint32_t rx_id, struct can_frame *rx_frame)
 {
-	uint16_t  ui16_loopCount = 0U;
-	uint16_t  ui16_calc_crc = 0;
+    uint64_t              sent_us;
+    int                   attempt;
+
+    for (attempt = 0; attempt <= CAN_FRAG_MAX_RETRIES; attempt++)
+    {
+        if (attempt > 0)
+        {
+            can_rtt_retransmit(rx_id);
+            metrics_inc(METRIC_CAN_RETRANSMITS);
+            LOG_WARN("Retransmitting CAN frame ID=0x%X (retry %d of %d)\n",
+                     tx_frame->can_id, attempt, CAN_FRAG_MAX_RETRIES);
+        }
 
-	for(ui16_loopCount = 0; ui16_loopCount < ui16_size; ui16_loopCount++)
-	{
-		ui16_calc_crc += ui8_data[ui16_loopCount];		/* Set calculation data for CRC */
-	}
+        if (send_can_message(socket_fd, tx_frame) != 0)
+        {
+            continue;
+        }
 
-	ui16_calc_crc = ~ui16_calc_crc;
+        sent_us = can_rtt_now_us();
 
-	return ui16_calc_crc;
+        if (receive_can_message_with_filter(socket_fd, rx_frame, rx_id, can_rtt_timeout_ms(rx_id)) != 0)
+        {
+            can_rtt_timeout(rx_id);
+            metrics_inc(METRIC_CAN_TIMEOUTS);
+            continue;
+        }
 
-}
+        /*
+         * Every ETU response carries a CRC over the first 6 bytes
+         */
+        if (!etu_frame_check(rx_frame->data))
+        {
+            LOG_ERROR("CRC Error on CAN frame ID=0x%X\n", rx_frame->can_id);
+            can_rtt_crc_error(rx_id);
+            metrics_inc(METRIC_CAN_CRC_ERRORS);
+            continue;
+        }
 
+        metrics_observe(METRIC_H_CAN_FRAME_RTT, can_rtt_now_us() - sent_us);
 
-/*  
- * Function to receive a CAN response and reassemble fragmented data.  
- * Verifies CRC for each received frame and sends acknowledgment.  
- * Returns 0 on success, -1 on failure.  
- */  
+        if (attempt == 0)
+        {
+            can_rtt_sample(rx_id, (uint32_t)(can_rtt_now_us() - sent_us));
+        }
 
-int receive_can_response(int socket_fd, int canid, int size) 
-{
-    struct can_frame       frame;                    /* Frame to receive CAN data */
-    struct can_frame       ack_frame;                /* Frame to send CAN acknowledgment */
-    uint8_t                ret = 0;                  /* Return value for send/receive functions */
-    uint16_t               crc_received = 0;         /* CRC value extracted from CAN frame */
-    int                    remaining_size = size;    /* Track remaining bytes to be received */
-    int                    frame_index = 0;          /* Frame sequence index */
-    int                    bytes_to_copy = 0;        /* Number of data bytes to copy */
-    int                    byte_index = 0;           /* Index used in copy loop */
-    static int             received_data_index = 0;  /* Buffer index for reassembled data */
-    int                    can_res_id = canid;       /* CAN response ID */
-    int                    can_ack_id = canid;       /* CAN acknowledgment ID */
+        return 0;
+    }
 
-    /*  
-     * Set bits 16-19 of CAN ID to indicate "Read Response"
-     * Make the response ID
-     */
-    can_res_id &= ~(0xF << 16);   
-    can_res_id |=  (CAN_RESPONSE_MSG_ID << 16);      
+    return -1;
+}
 
-    /*  
-     * Set bits 16-19 of CAN ID to indicate "Read ACK"
-     */
-    can_ack_id &= ~(0xF << 16);    
-    can_ack_id |=  (CAN_READ_ACK_MSG_ID << 16);       
 
-    received_data_index = 0;	
+/**
+ * @brief Drive one ETU transfer to completion.
+ *
+ * Sends the frame of the current state and waits for the answer the state
+ * machine expects, through can_exchange() (RTO, retransmission, CRC check).
+ * The final read ACK has no answer and is only sent.
+ *
+ * @param socket_fd  File descriptor of the CAN socket
+ * @param xfer       Transfer started with etu_read_begin()/etu_write_begin()
+ * @param on_frame   Optional, called after every accepted frame (delta reads
+ *                   use it to learn the stream length); non-zero aborts
+ * @param ctx        Passed to on_frame
+ *
+ * @return 0 on success, -1 on failure
+ */
+int can_run_xfer(int socket_fd, etu_xfer *xfer, int (*on_frame)(etu_xfer *xfer, const struct can_frame *frame, void *ctx), void *ctx)
+{
+    struct can_frame       tx_frame;
+    struct can_frame       rx_frame;
+    uint32_t               expect_id;
 
-    while (remaining_size > 0) 
+    while (!etu_xfer_done(xfer))
     {
-        /*  
-         * Receiving CAN frame from ETU to TCP.  
-         * Each frame contains a part of the data.  
-         */
+        memset(&tx_frame, 0, sizeof(tx_frame));
+        tx_frame.can_dlc = CAN_DATA_LEN;
+        expect_id = etu_xfer_tx(xfer, &tx_frame.can_id, tx_frame.data);
 
-        ret = receive_can_message_with_filter(socket_fd, &frame, can_res_id);
-        if (ret != 0) 
+        if (expect_id == 0)
         {
-            LOG_ERROR("CAN response receive failed\n");
-            return -1;
+            /*
+             * Final ACK, nothing comes back
+             */
+            if (send_can_message(socket_fd, &tx_frame) != 0)
+            {
+                LOG_ERROR("CAN ACK send failed\n");
+                return -1;
+            }
+            break;
         }
 
-        LOG_DEBUG("ETU to TCP: Data Read Response received.\n");
-
-        crc_received  = (frame.data[6] << 8) | frame.data[7];
+        if (can_exchange(socket_fd, &tx_frame, expect_id, &rx_frame) != 0)
+        {
+            LOG_ERROR("No %s (ID 0x%X) from ETU, fragment %u\n",
+                      etu_msg_name(etu_id_type(expect_id)), expect_id, xfer->frag);
+            return -1;
+        }
 
-        /*  
-         * Verify CRC for received frame  
-         */
-        if (GenerateCRC(frame.data, 6) != crc_received) 
+        if (etu_xfer_rx(xfer, expect_id, rx_frame.data) != ETU_RX_OK)
         {
-            LOG_ERROR("CRC Error on frame %d\n", frame_index);
             return -1;
         }
 
-        /*  
-         * Determine how many bytes to copy from this frame  
-         */
-        bytes_to_copy = (remaining_size >= CAN_MAX_BYTE_SIZE) ? CAN_MAX_BYTE_SIZE : remaining_size;
+        LOG_DEBUG("ETU to TCP: %s received (ID 0x%X)\n", etu_msg_name(etu_id_type(expect_id)), expect_id);
 
-        for (byte_index = 0; byte_index < bytes_to_copy; byte_index++) 
+        if (on_frame && on_frame(xfer, &rx_frame, ctx) != 0)
         {
-            received_data[received_data_index++] = frame.data[byte_index];
+            return -1;
         }
+    }
+
+    return 0;
+}
 
-        remaining_size -= bytes_to_copy;
 
-        /*  
-         * Prepare and send acknowledgment frame  
-         */
-        ack_frame.can_id    = can_ack_id;            /* Data Read Acknowledgment ID */
-        ack_frame.can_dlc   = CAN_DATA_LEN;
-        memset(ack_frame.data, 0, CAN_DATA_LEN);
-        ack_frame.data[6]   = 0xff;
-        ack_frame.data[7]   = 0xff;
+/*  
+ * Function to receive a CAN response and reassemble fragmented data.  
+ * Sends the read request, then acknowledges each fragment; a lost or
+ * corrupted fragment is recovered by repeating the previous frame
+ * (see can_exchange()). The data is reassembled into received_data.
+ * Returns 0 on success, -1 on failure.
+ */  
 
+int receive_can_response(int socket_fd, uint32_t canid, uint8_t size_field, int size) 
+{
+    etu_xfer               xfer;
 
-        ret = send_can_message(socket_fd, &ack_frame);
-        if (ret != 0) 
-        {
-            LOG_ERROR("CAN ACK send failed\n");
-            return -1;
-        }
+    etu_read_begin(&xfer, canid, size_field, received_data, (uint16_t)size);
 
-        LOG_DEBUG("TCP to ETU: Data Read Acknowledgment sent.\n");
-        can_res_id += 3;
-        can_ack_id += 3;
-        LOG_DEBUG("\n\n");
+    if (can_run_xfer(socket_fd, &xfer, NULL, NULL) != 0)
+    {
+        return -1;
     }
 
-    /*  
-     * Reception complete, store received data  
-     */
     LOG_DEBUG("Reception complete: All fragmented data has been successfully reassembled.\n");
 
     return 0;
 }
 
 
+/**
+ * @brief Fragment 0 of a delta response announces the stream length.
+ */
+int delta_on_frame(etu_xfer *xfer, const struct can_frame *frame, void *ctx)
+{
+    int size = *(int *)ctx;
+    int stream_len;
+
+    if (xfer->frag != 1)
+    {
+        return 0;
+    }
+
+    stream_len = can_delta_stream_length(frame->data, (uint16_t)size);
+    if (stream_len < 0)
+    {
+        LOG_ERROR("Invalid delta response header from CAN ID 0x%X\n", frame->can_id & CAN_EFF_MASK);
+        return -1;
+    }
+
+    etu_read_set_length(xfer, (uint16_t)stream_len);
+
+    return 0;
+}
+
+
+/**
+ * @brief Delta read: send the cached version, receive and merge only the changes.
+ *
+ * Same fragment/ACK sequence as receive_can_response(), but the stream
+ * length is announced by the first fragment (see can_delta.h). The merged
+ * copy is checked against the ETU's version; if it does not match, the
+ * cache entry is dropped and the range is read once more in full.
+ *
+ * @param socket_fd  File descriptor of the CAN socket
+ * @param canid      CAN ID of the normal read request
+ * @param size_field data[0] of the read request
+ * @param size       Number of bytes to read
+ *
+ * @return 0 on success (received_data holds the range), -1 on failure
+ */
+int receive_can_delta_response(int socket_fd, uint32_t canid, uint8_t size_field, int size)
+{
+    static uint8_t         stream[CAN_DELTA_MAX_STREAM]; /* CAN scheduler thread only */
+    etu_xfer               xfer;
+    can_delta_slot        *slot;
+    int                    attempt;
+
+    slot = can_delta_slot_get(canid, size);
+
+    for (attempt = 0; attempt < 2; attempt++)
+    {
+        /*
+         * Delta Read Request: message type 8, cached version in data[1..4]
+         */
+        etu_read_begin(&xfer, etu_id_with_type(canid, ETU_MSG_DELTA_READ_REQ), size_field,
+                       stream, CAN_DELTA_HEADER_LEN);
+        xfer.req_version = slot->version;
+
+        if (can_run_xfer(socket_fd, &xfer, delta_on_frame, &size) != 0)
+        {
+            LOG_ERROR("CAN delta response receive failed on frame %u\n", xfer.frag);
+            slot->version = 0;
+            return -1;
+        }
+
+        can_delta_account(stream[0], xfer.frags, (uint16_t)size);
+
+        if (can_delta_apply(slot, stream, xfer.len) == 0)
+        {
+            memcpy(received_data, slot->data, size);
+            LOG_DEBUG("Delta read 0x%X: status %d, %u frames for %d bytes\n", canid, stream[0], xfer.frags, size);
+            return 0;
+        }
+
+        LOG_WARN("Delta read 0x%X: merged data does not match ETU version, reading in full\n", canid);
+    }
+
+    return -1;
+}
+
+
 /**  
  * @brief Sends a CAN request, receives fragmented data, and reassembles it.  
  *  
  * This function sends a data read request over CAN, receives the fragmented  
  * response, reassembles the data, and prints the structured information.  
  * It ensures the received data is validated and correctly processed.  
+ * Requests to a module whose circuit breaker is open fail immediately.
  *  
  * @param socket_fd: The CAN socket file descriptor.  
  *  
@@ -886,43 +965,19 @@ int receive_can_response(int socket_fd, int canid, int size)
  */  
 int can_txrx_reassemble_frag_data_read(int socket_fd,int canid,int size,uint8_t fun_code)  
 {  
-    struct can_frame send_can_request;  
-    uint8_t ret = 0;  
-    unsigned short crc=0;
-
-    LOG_DEBUG("CAN Read communication will start: Preparing to send read request to CAN ID = %d (0x%X)\n\n", canid, canid);
-
-    /*  
-     * Configure the CAN request frame 
-     *
-     * TCP Request: 0x01200333 | --------------------------------------- | Classic CAN | 0 bytes | RTR Remote
-     *
-     */  
-    send_can_request.can_id = canid;                        /* CAN ID for the request */  
-    send_can_request.can_dlc = CAN_DATA_LEN;                /* Data length */  
-    memset(&send_can_request.data[0], 0, CAN_DATA_LEN);     /* Initialize data to zero */ 
-
-    send_can_request.data[0]=size; 
+    uint8_t  size_field = (uint8_t)size;
+    uint8_t  ret = 0;  
+    uint64_t start_us;
 
     /*
-     * Construct the CRC
+     * The request carries the count in one byte. Rejected before the
+     * breaker: a request that never reaches the bus has no result to report.
      */
-    crc = GenerateCRC(send_can_request.data, 6);
-
-    send_can_request.data[6] = (crc >> 8) & 0xFF;
-    send_can_request.data[7] = crc & 0xFF;
-
-    /*  
-     * Send the request frame  
-     */  
-    ret = send_can_message(socket_fd, &send_can_request);  
-    if (0 != ret)  
-    {  
-        LOG_ERROR("CAN request send failed\n");  
-        return -1;  
-    }  
-    
-    LOG_DEBUG("TCP to ETU: Data Read Request sent.\n\n");  
+    if ((size < 0) || (size > UINT8_MAX))
+    {
+        LOG_ERROR("Read of %d registers/bits does not fit the request size field\n", size);
+        return -1;
+    }
 
    /*
     * For Function Code 1 (Read Coils) and Function Code 2 (Read Discrete Inputs),
@@ -956,18 +1011,48 @@ int can_txrx_reassemble_frag_data_read(int socket_fd,int canid,int size,uint8_t
        size = size * 2;
      }  
 
-     
+    if (size > (int)sizeof(received_data))
+    {
+        LOG_ERROR("Read of %d bytes exceeds the receive buffer\n", size);
+        return -1;
+    }
+
+    /*
+     * Fast-fail if the module is known to be down
+     */
+    if (!can_breaker_allow(canid))
+    {
+        LOG_WARN("CAN module 0x%02X is down: read request 0x%X rejected by circuit breaker\n",
+                 CAN_MODULE_INDEX(canid), canid);
+        return -1;
+    }
+
+    LOG_DEBUG("CAN Read communication will start: Preparing to send read request to CAN ID = %d (0x%X)\n\n", canid, canid);
+
     /*  
-     * Receive the fragmented data response and acknowledge each frame  
+     * Send the request (TCP Request: 0x01200333 | size | ... | CRC), receive
+     * the fragmented data response and acknowledge each frame  
      */ 
-  
-    ret = receive_can_response(socket_fd , canid , size); 
+    start_us = can_rtt_now_us();
+    if (CAN_DELTA_READ)
+    {
+        ret = receive_can_delta_response(socket_fd, canid, size_field, size);
+    }
+    else
+    {
+        ret = receive_can_response(socket_fd, canid, size_field, size);
+    }
     if (0 != ret)  
     {  
         LOG_ERROR("ETU Response failed!\n");  
+        can_breaker_result(canid, 0);
+        metrics_inc(METRIC_CAN_XFER_ERRORS);
         return -1;  
     }  
 
+    can_breaker_result(canid, 1);
+    metrics_observe(METRIC_H_CAN_READ, can_rtt_now_us() - start_us);
+
     LOG_DEBUG("ETU Response: Displaying all received data.\n");  
 
     LOG_DEBUG("\n\n");  
@@ -983,6 +1068,9 @@ int can_txrx_reassemble_frag_data_read(int socket_fd,int canid,int size,uint8_t
  * by checking CRC for every sent and received frame. A final termination frame
  * is also sent to complete the transaction cleanly.
  *
+ * Each step is one can_exchange(), so a lost grant, data ACK or termination
+ * ACK only repeats that single frame instead of failing the whole write.
+ *
  * @param socket_fd   Socket file descriptor for CAN communication
  * @param can_req_id  CAN ID to initiate write request
  * @param data        Pointer to data buffer to write
@@ -993,303 +1081,280 @@ int can_txrx_reassemble_frag_data_read(int socket_fd,int canid,int size,uint8_t
 
 int can_txrx_reassemble_frag_data_write(int socket_fd, uint32_t can_req_id, uint8_t *data, uint16_t length)
 {
-    struct can_frame       frame;
-    int                    ret             = 0;
-    unsigned short         crc             = 0;
-    uint32_t               can_res_id      = can_req_id;
-    uint32_t               can_tx_id       = can_req_id;
-    uint32_t               can_tx_ack_id   = can_req_id;
-    uint16_t               remaining_size  = length * 2;
-    uint16_t               bytes_to_copy   = 0;
-    uint16_t               send_data_index = 0;
-    uint16_t               byte_index      = 0;
-    uint8_t                frame_count     = 0;
-
-    LOG_DEBUG("CAN Write communication will start: Preparing to send write request to CAN ID = %d (0x%X)\n\n", can_req_id, can_req_id);
-
-    /*  
-     * Configure the CAN Write Request frame
-     *
-     * TCP to ETU Write Request: 0x01200233 | ------------------------- | Classic CAN | 8 bytes | Data Frame
-     * Payload Format: [Length][0][0][0][0][0][CRC_H][CRC_L]
-     * MsgType = 0x2 (TCP_TO_ETU_WRITE_REQ_ID)
-     */
-
-    frame.can_id  = can_req_id;              /* CAN ID for TCP→ETU Write Request */
-    frame.can_dlc = CAN_DATA_LEN;            /* Full CAN frame (8 bytes) */
-    memset(&frame.data[0], 0, CAN_DATA_LEN); /* Initialize data buffer */
-
-    frame.data[0] = length;                  /* First byte = data length */
+    etu_xfer               xfer;
+    uint64_t               start_us;
 
-    crc = GenerateCRC(frame.data, 6);        /* CRC over first 6 bytes */
-    frame.data[6] = (crc >> 8) & 0xFF;       /* CRC High byte */
-    frame.data[7] = crc & 0xFF;              /* CRC Low byte */
-
-    ret = send_can_message(socket_fd, &frame); /* Send Write Request */
-    if (ret != 0)
+    if (length > UINT8_MAX)
     {
-        LOG_ERROR("TCP to ETU: Write Request frame send failed\n");
+        LOG_ERROR("Write of %u registers does not fit the request size field\n", length);
         return -1;
     }
 
-    LOG_DEBUG("TCP to ETU: Write Request frame sent\n");
-
     /*
-     * ------------------- ETU to TCP Write Grant -------------------
-     * Expecting response with MsgType = 3 (ETU_TO_TCP_WRITE_GRANT_ID)
+     * Fast-fail if the module is known to be down
      */
-    can_res_id &= ~(0xF << 16);                          /* Clear bits 16–19 (MsgType field) */
-    can_res_id |= (ETU_TO_TCP_WRITE_GRANT_ID << 16);     /* Set MsgType = 3 for grant */
-
-    ret = receive_can_message_with_filter(socket_fd, &frame, can_res_id);
-    if (ret != 0)
+    if (!can_breaker_allow(can_req_id))
     {
-        LOG_ERROR("ETU to TCP: Write Grant frame receive failed\n");
+        LOG_WARN("CAN module 0x%02X is down: write request 0x%X rejected by circuit breaker\n",
+                 CAN_MODULE_INDEX(can_req_id), can_req_id);
         return -1;
     }
 
-    LOG_DEBUG("ETU to TCP: Write Grant frame received\n\n");
+    LOG_DEBUG("CAN Write communication will start: Preparing to send write request to CAN ID = %d (0x%X)\n\n", can_req_id, can_req_id);
+
+    /*
+     * Write Request [length][0..][CRC] -> Grant, then Data/ACK per fragment,
+     * then Termination -> Termination ACK
+     */
+    etu_write_begin(&xfer, can_req_id, (uint8_t)length, data, (uint16_t)(length * 2));
+    start_us = can_rtt_now_us();
 
-    crc = (frame.data[6] << 8) | frame.data[7]; /* Extract CRC */
-    if (GenerateCRC(frame.data, 6) != crc)
+    if (can_run_xfer(socket_fd, &xfer, NULL, NULL) != 0)
     {
-        LOG_ERROR("CRC mismatch in Write Grant frame\n");
+        LOG_ERROR("ETU write transaction 0x%X failed\n", can_req_id);
+        can_breaker_result(can_req_id, 0);
+        metrics_inc(METRIC_CAN_XFER_ERRORS);
         return -1;
     }
 
-    /*
-     * ------------------- TCP to ETU Write Data Frames -------------------
-     */
-    can_tx_id     &= ~(0xF << 16);
-    can_tx_id     |= (TCP_TO_ETU_WRITE_CMD_ID << 16);
-
-    can_tx_ack_id &= ~(0xF << 16);
-    can_tx_ack_id |= (ETU_TO_TCP_WRITE_ACK_ID << 16);
+    can_breaker_result(can_req_id, 1);
+    metrics_observe(METRIC_H_CAN_WRITE, can_rtt_now_us() - start_us);
 
-    while (remaining_size > 0)
-    {
-        frame.can_id  = can_tx_id;
-        frame.can_dlc = CAN_DATA_LEN;
-        memset(&frame.data[0], 0, CAN_DATA_LEN);
+    LOG_DEBUG("Write operation successful without errors\n");
 
-        bytes_to_copy = (remaining_size >= CAN_MAX_BYTE_SIZE) ? CAN_MAX_BYTE_SIZE : remaining_size;
+    return 0;
+}
 
-        for (byte_index = 0; byte_index < bytes_to_copy; byte_index++)
-        {
-            frame.data[byte_index] = data[send_data_index++];
-        }
+/**
+ * @brief Status part of the discovery reply (discovery responder thread).
+ */
+void discovery_status_fill(discovery_status *out)
+{
+    const regmap_t *map;
 
-        remaining_size -= bytes_to_copy;
+    out->flags = 0;
+    if (can_ready)
+    {
+        out->flags |= DISC_FLAG_CAN_READY;
+    }
+    if (CAN_DELTA_READ)
+    {
+        out->flags |= DISC_FLAG_DELTA_READ;
+    }
 
-        crc = GenerateCRC(frame.data, 6);
-        frame.data[6] = (crc >> 8) & 0xFF;
-        frame.data[7] = crc & 0xFF;
+    map = regmap_read_lock();
+    out->map_version   = map->hdr->map_version;
+    out->dataset_count = (uint16_t)map->hdr->dataset_count;
+    if (map->mapped)
+    {
+        out->flags |= DISC_FLAG_MAP_FILE;
+    }
+    regmap_read_unlock();
+}
 
-        ret = send_can_message(socket_fd, &frame);
-        if (ret != 0)
-        {
-            LOG_ERROR("TCP to ETU: Data frame %d send failed\n", frame_count + 1);
-            return -1;
-        }
 
-        LOG_DEBUG("TCP to ETU: Data frame %d sent\n", ++frame_count);
+/**
+ * @brief Values other modules keep themselves, appended to every metrics scrape.
+ */
+void metrics_collect_bridge(metrics_out *out, void *ctx)
+{
+    static const char *const log_sev_labels[] = { "raw", "error", "warn", "info", "debug" };
+    can_sched_class_stats   sched;
+    can_delta_stats         delta;
+    discovery_stats         disc;
+    discovery_status        status;
+    int                     c;
 
-        ret = receive_can_message_with_filter(socket_fd, &frame, can_tx_ack_id);
-        if (ret != 0)
-        {
-            LOG_ERROR("ETU to TCP: Data frame %d ACK receive failed\n", frame_count);
-            return -1;
-        }
+    (void)ctx;
 
-        LOG_DEBUG("ETU to TCP: Data frame %d ACK received\n", frame_count);
+    discovery_status_fill(&status);
 
-        crc = (frame.data[6] << 8) | frame.data[7];
-        if (GenerateCRC(frame.data, 6) != crc)
-        {
-            LOG_ERROR("CRC mismatch in ACK for frame %d\n", frame_count);
-            return -1;
-        }
+    metrics_printf(out, "# TYPE modbus_can_can_ready gauge\nmodbus_can_can_ready %d\n", can_ready ? 1 : 0);
+    metrics_printf(out, "# TYPE modbus_can_uptime_seconds gauge\nmodbus_can_uptime_seconds %llu\n",
+                   (unsigned long long)((can_rtt_now_us() - startup_us) / 1000000));
+    metrics_printf(out, "# TYPE modbus_can_clients gauge\nmodbus_can_clients %d\n", (int)active_clients);
+    metrics_printf(out, "# TYPE modbus_can_map_version gauge\nmodbus_can_map_version %u\n", status.map_version);
 
-        can_tx_id     += 3;
-        can_tx_ack_id += 3;
+    metrics_printf(out, "# TYPE modbus_can_log_dropped_total counter\n");
+    for (c = LOG_SEV_NONE; c <= LOG_SEV_DEBUG; c++)
+    {
+        metrics_printf(out, "modbus_can_log_dropped_total{severity=\"%s\"} %llu\n",
+                       log_sev_labels[c], (unsigned long long)log_async_dropped_sev(c));
     }
 
-    /*
-     * ------------------- TCP to ETU Write Termination -------------------
-     */
-    can_tx_id     &= ~(0xF << 16);
-    can_tx_id     |= (TCP_TO_ETU_WRITE_TERM_ID << 16);
-
-    can_tx_ack_id &= ~(0xF << 16);
-    can_tx_ack_id |= (ETU_TO_TCP_WRITE_TERM_ID << 16);
-
-    frame.can_id  = can_tx_id;
-    frame.can_dlc = CAN_DATA_LEN;
-    memset(&frame.data[0], 0, CAN_DATA_LEN);
-    frame.data[6] = 0xFF;
-    frame.data[7] = 0xFF;
-
-    ret = send_can_message(socket_fd, &frame);
-    if (ret != 0)
+    metrics_printf(out, "# TYPE modbus_can_sched_queue_depth gauge\n");
+    for (c = 0; c < SCHED_CLASS_COUNT; c++)
     {
-        LOG_ERROR("TCP to ETU: Termination frame send failed\n");
-        return -1;
+        can_sched_get_stats(c, &sched);
+        metrics_printf(out, "modbus_can_sched_queue_depth{class=\"%s\"} %u\n", can_sched_class_name(c), sched.depth);
     }
-
-    LOG_DEBUG("TCP to ETU: Termination frame sent\n");
-
-    ret = receive_can_message_with_filter(socket_fd, &frame, can_tx_ack_id);
-    if (ret != 0)
+    metrics_printf(out, "# TYPE modbus_can_sched_shed_total counter\n");
+    for (c = 0; c < SCHED_CLASS_COUNT; c++)
     {
-        LOG_ERROR("ETU to TCP: Termination ACK receive failed\n");
-        return -1;
+        can_sched_get_stats(c, &sched);
+        metrics_printf(out, "modbus_can_sched_shed_total{class=\"%s\",reason=\"rate\"} %llu\n"
+                            "modbus_can_sched_shed_total{class=\"%s\",reason=\"full\"} %llu\n"
+                            "modbus_can_sched_shed_total{class=\"%s\",reason=\"deadline\"} %llu\n",
+                       can_sched_class_name(c), (unsigned long long)sched.shed_rate,
+                       can_sched_class_name(c), (unsigned long long)sched.shed_full,
+                       can_sched_class_name(c), (unsigned long long)sched.shed_deadline);
     }
 
-    LOG_DEBUG("ETU to TCP: Termination ACK received\n");
-
-    crc = (frame.data[6] << 8) | frame.data[7];
-    if (GenerateCRC(frame.data, 6) != crc)
+    if (CAN_DELTA_READ)
     {
-        LOG_ERROR("CRC mismatch in Termination ACK frame\n");
-        return -1;
+        can_delta_get_stats(&delta);
+        metrics_printf(out, "# TYPE modbus_can_delta_reads_total counter\n"
+                            "modbus_can_delta_reads_total{result=\"unchanged\"} %llu\n"
+                            "modbus_can_delta_reads_total{result=\"changes\"} %llu\n"
+                            "modbus_can_delta_reads_total{result=\"full\"} %llu\n"
+                            "modbus_can_delta_reads_total{result=\"merge_error\"} %llu\n",
+                       (unsigned long long)delta.unchanged, (unsigned long long)delta.changes,
+                       (unsigned long long)delta.full, (unsigned long long)delta.merge_errors);
+        metrics_printf(out, "# TYPE modbus_can_delta_frames_saved_total counter\nmodbus_can_delta_frames_saved_total %llu\n",
+                       (unsigned long long)((delta.frames_full > delta.frames) ? delta.frames_full - delta.frames : 0));
     }
 
-    LOG_DEBUG("Write operation successful without errors\n");
+    discovery_get_stats(&disc);
+    metrics_printf(out, "# TYPE modbus_can_discovery_requests_total counter\nmodbus_can_discovery_requests_total %llu\n"
+                        "# TYPE modbus_can_discovery_rate_limited_total counter\nmodbus_can_discovery_rate_limited_total %llu\n",
+                   (unsigned long long)disc.requests, (unsigned long long)disc.rate_limited);
+}
 
-    return 0;
+/**
+ * @brief SIGHUP: reload the register map file (done by the reload thread).
+ */
+void sighup_handler(int sig)
+{
+    (void)sig;
+    regmap_request_reload();
 }
 
 
-/**  
- * @brief get_own_ip  
- *  
- * This function retrieves the IP address of the current device (excluding loopback).  
- * It iterates over all network interfaces and returns the first valid IPv4 address.  
- * If no valid address is found, it returns the string "UNKNOWN".  
- *  
- * @return A dynamically allocated string containing the device IP address.  
- */  
-char* get_own_ip()  
+/**
+ * @brief Load and publish the register map, start watching for new maps.
+ *
+ * Uses the binary map at REGMAP_PATH if installed and valid, otherwise the
+ * compiled-in tables. Later maps are swapped in on SIGHUP or when a new
+ * file is renamed into place.
+ *
+ * @return 0 on success, -1 if no map at all could be built
+ */
+int setup_register_map(void)
 {
-    struct ifaddrs *ifaddr;
-    struct ifaddrs *ifa;
-    char *ip = NULL;
-    char host[NI_MAXHOST];
+    struct sigaction  sa;
+    regmap_t         *map;
 
-    /*  
-     * Get the list of network interfaces  
-     */  
-    if (getifaddrs(&ifaddr) == -1)  
+    map = regmap_open(REGMAP_PATH);
+    if (map == NULL)
     {
-        perror("getifaddrs");
-        return strdup("UNKNOWN");
-    }
+        LOG_INFO("No register map at %s (%s), using compiled-in tables\n", REGMAP_PATH, strerror(errno));
 
-    /*  
-     * Loop through the interfaces and find the first non-loopback IPv4  
-     */  
-    for (ifa = ifaddr; ifa != NULL; ifa = ifa->ifa_next)  
-    {
-        if ((ifa->ifa_addr != NULL) && (ifa->ifa_addr->sa_family == AF_INET) &&
-            !(ifa->ifa_flags & IFF_LOOPBACK))  
+        map = regmap_from_tables(0);
+        if (map == NULL)
         {
-            if (getnameinfo(ifa->ifa_addr, sizeof(struct sockaddr_in),
-                            host, NI_MAXHOST, NULL, 0, NI_NUMERICHOST) == 0)  
-            {
-                ip = strdup(host);
-                break;
-            }
+            LOG_ERROR("Failed to build register map from compiled-in tables\n");
+            return -1;
         }
     }
 
-    /*  
-     * Free the interface list and return the IP or "UNKNOWN"  
-     */  
-    freeifaddrs(ifaddr);
-    return ip ? ip : strdup("UNKNOWN");
-}
+    LOG_INFO("Register map version %u: %u datasets, %u registers\n",
+             map->hdr->map_version, map->hdr->dataset_count, map->hdr->entry_count);
 
-/**  
- * @brief ip_response_thread  
- *  
- * This function runs as a background thread, listening for UDP broadcast messages.  
- * When it receives a specific request message ("NEED_IP"), it responds with its own IP address.  
- * The IP is determined using the get_own_ip() function and sent to the requesting client.  
- *  
- * @param arg : Not used  
- * @return NULL (thread exit)  
- */  
-void* ip_response_thread(void* arg)  
-{
-    int sockfd;
-    struct sockaddr_in server_addr;
-    struct sockaddr_in client_addr;
-    char buffer[BUF_SIZE];
-    socklen_t addr_len;
-    ssize_t recv_len;
-    char *own_ip;
+    regmap_publish(map);
 
-    addr_len = sizeof(client_addr);
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sighup_handler;
+    sa.sa_flags   = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGHUP, &sa, NULL);
 
-    /*  
-     * Create UDP socket  
-     */  
-    sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sockfd < 0)  
+    if (regmap_watch_start(REGMAP_PATH) != 0)
     {
-        LOG_ERROR("Socket creation failed\n");
-        pthread_exit(NULL);
+        LOG_WARN("Register map reload thread not started, map is fixed until restart\n");
     }
 
-    /*  
-     * Bind to broadcast port and any local IP  
-     */  
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(BROADCAST_PORT);
-    server_addr.sin_addr.s_addr = INADDR_ANY;
+    return 0;
+}
 
-    if (bind(sockfd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0)  
+
+/**
+ * @brief Create the shared-memory register image.
+ *
+ * One dataset slot is created per CAN dataset of the register map loaded at
+ * startup, covering the dataset's Modbus address range, so readers can
+ * snapshot e.g. "monitoring_data" consistently while the CAN path keeps
+ * publishing. The layout stays as created: after a map reload the slot of
+ * a dataset is found by name (register_image_slot()), and a range outside
+ * it is not published.
+ *
+ * @return 0 on success, -1 on failure (bridge continues without the image)
+ */
+int setup_register_image(void)
+{
+    shm_image_dataset_desc desc[SHM_IMAGE_MAX_DATASETS];
+    const regmap_t        *map;
+    const regmap_dataset  *ds;
+    int                    total_datasets = 0;
+    const uint32_t         entries[SHM_TABLE_COUNT] = {
+        MODBUS_ALLOC_NUM_COILS,
+        MODBUS_ALLOC_NUM_DISCRETE_INPUTS,
+        MODBUS_ALLOC_NUM_HOLDING_REGISTERS,
+        MODBUS_ALLOC_NUM_INPUT_REGISTERS
+    };
+
+    map = regmap_read_lock();
+
+    while (((ds = regmap_dataset_get(map, total_datasets)) != NULL) && (ds->kind == REGMAP_KIND_CAN))
     {
-        LOG_ERROR("Bind failed\n");
-        close(sockfd);
-        pthread_exit(NULL);
+        if (total_datasets >= SHM_IMAGE_MAX_DATASETS)
+        {
+            regmap_read_unlock();
+            LOG_ERROR("Too many datasets (%d) for shared register image\n", total_datasets + 1);
+            return -1;
+        }
+
+        desc[total_datasets].name       = regmap_string(map, ds->name_off);
+        desc[total_datasets].first_addr = ds->first_addr - 1;
+        desc[total_datasets].last_addr  = ds->last_addr - 1;
+        total_datasets++;
     }
 
-    LOG_DEBUG("Listening for NEED_IP messages on UDP port %d...\n", BROADCAST_PORT);
+    /*
+     * Names are copied into the segment, the map is not needed afterwards
+     */
+    register_image = shm_image_create(SHM_IMAGE_NAME, entries, desc, total_datasets);
 
-    /*  
-     * Main loop: Wait for UDP messages  
-     */  
-    while (1)  
+    regmap_read_unlock();
+
+    if (register_image == NULL)
     {
-        recv_len = recvfrom(sockfd, buffer, BUF_SIZE - 1, 0,
-                            (struct sockaddr*)&client_addr, &addr_len);
-        if (recv_len < 0)  
-        {
-            LOG_DEBUG("recvfrom\n");
-            continue;
-        }
+        LOG_ERROR("Failed to create shared register image %s: %s\n", SHM_IMAGE_NAME, strerror(errno));
+        return -1;
+    }
+
+    LOG_DEBUG("Shared register image published at /dev/shm%s\n", SHM_IMAGE_NAME);
+    return 0;
+}
 
-        buffer[recv_len] = '\0';
 
-        /*  
-         * If the received message is NEED_IP, respond with own IP  
-         */  
-        if (strcmp(buffer, NEED_IP_MSG) == 0)  
-        {
-            own_ip = get_own_ip();
-            sendto(sockfd, own_ip, strlen(own_ip), 0,
-                   (struct sockaddr*)&client_addr, addr_len);
-            LOG_DEBUG("Responded to %s with IP: %s\n", inet_ntoa(client_addr.sin_addr), own_ip);
-            free(own_ip);
-        }
+/**
+ * @brief Image slot of a map dataset, by name. Call with the map read-locked.
+ *
+ * @return Slot index, -1 if there is no image or the dataset has no slot
+ */
+int register_image_slot(const regmap_t *map, int dataset)
+{
+    const regmap_dataset *ds = regmap_dataset_get(map, dataset);
+
+    if ((register_image == NULL) || (ds == NULL))
+    {
+        return -1;
     }
 
-    close(sockfd);
-    pthread_exit(NULL);
+    return shm_image_find_dataset(register_image, regmap_string(map, ds->name_off));
 }
 
+
 void clear_modbus_mapping(modbus_mapping_t *mb_mapping, uint8_t flags)
 {
     if (!mb_mapping)
@@ -1318,844 +1383,1609 @@ void clear_modbus_mapping(modbus_mapping_t *mb_mapping, uint8_t flags)
 
 
 /**
- * @brief Main function to initialize and manage Modbus and CAN communication.
+ * @brief Execute one CAN transaction (CAN scheduler thread).
  *
- * This function initializes the Modbus TCP server and the CAN interface.
- * It sets up necessary sockets, handles incoming Modbus requests from clients,
- * translates them into CAN messages, receives responses, maps them into Modbus
- * registers, and sends the response back to the client.
+ * received_data is only touched here, on the single CAN thread, and the
+ * result is copied into the requesting client's buffer before the next
+ * transaction can overwrite it.
  *
- * It also creates a separate heartbeat thread to periodically send a CAN heartbeat
- * message. All operations continue in a loop to support real-time communication.
+ * Chained requests (request->next, e.g. write then read-back for FC 0x17)
+ * run back to back in the same job; the chain stops at the first failure.
  *
- * @return Returns 0 on success, -1 on failure.
+ * @param arg can_request of the waiting client thread
+ *
+ * @return 0 on success, -1 on CAN failure
  */
+int run_can_request(void *arg)
+{
+    can_request *request;
+    int          ret;
 
-int main()
+    for (request = (can_request *)arg; request != NULL; request = request->next)
+    {
+        if (request->write)
+        {
+            ret = can_txrx_reassemble_frag_data_write(can_socket_fd, request->can_id, request->data, request->length);
+        }
+        else
+        {
+            ret = can_txrx_reassemble_frag_data_read(can_socket_fd, request->can_id, request->length, request->fun_code);
+            if (ret == 0)
+            {
+                memcpy(request->data, received_data, request->data_len);
+            }
+        }
+
+        if (ret != 0)
+        {
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief modbus_reply_exception() plus the exception counter.
+ */
+int send_exception(modbus_t *ctx, const uint8_t *query, int exception)
 {
-    /*
-     * Communication handles and structures
-     */
-    pthread_t             thread_id;
-    pthread_t             ip_responder_id;
-    int                   socket_fd;
-    struct sockaddr_can   addr;
-    struct ifreq          ifr;
-    struct can_filter     rfilter;
+    metrics_exception(exception);
 
-    /*
-     * Modbus related variables
-     */
-    modbus_t             *ctx;
-    modbus_mapping_t     *mb_mapping;
-    int                   server_socket;
-    uint8_t               query[MAX_ADU_LENGTH];
-    int                   client_socket;
+    return modbus_reply_exception(ctx, query, exception);
+}
 
-    /*
-     * Data processing variables
-     */
-    uint32_t              can_id;
-    uint32_t              data_header;
-    uint32_t              req_type;
-    uint32_t              fun_code;
-    uint32_t              total_size;
-    uint16_t              start_addr;
-    uint16_t              length;
-    int                   found;
-    device_data          *selected_array = NULL; 
-    int                   tcp_found         = 0;
-    int                   tcp_current_dataset_size;
-    device_data           *tcp_selected_array = NULL;
 
-    /*
-     * Loop and index variables
-     */
-    int                   dataset_index;
-    int                   bit;
-    int                   data_index;
-    int                   register_index;
-    size_t                register_offset;
-    const int             total_datasets = sizeof(all_datasets) / sizeof(all_datasets[0]);
-    const int             tcp_total_datasets = sizeof(tcp_data) / sizeof(tcp_data[0]);
-    int                   current_dataset_size;
+/**
+ * @brief pread() on the EEPROM, counted and timed.
+ */
+ssize_t eeprom_read(void *buf, size_t count, off_t offset)
+{
+    uint64_t start_us = can_rtt_now_us();
+    ssize_t  ret      = pread(eeprom_fd, buf, count, offset);
 
-    /*
-     * Status variables
-     */
-    uint8_t               ret = 0;
-    int                   rc;
-    uint8_t               *write_value = received_data; 
-    uint8_t               clear_flag   = CLEAR_NONE; 
-    uint8_t               cp           = 0; 
- 
-    /*
-     * EE_Prom variables
-     */
-    uint32_t               fd; 
-    uint32_t               offset; 
-    uint32_t               Read; 
-    uint32_t               Write=0; 
+    metrics_observe(METRIC_H_EEPROM, can_rtt_now_us() - start_us);
+    metrics_inc(METRIC_EEPROM_READS);
+    if (ret != (ssize_t)count)
+    {
+        metrics_inc(METRIC_EEPROM_ERRORS);
+    }
 
-    /*
-     * Initialize Modbus TCP context
-     */
-    ctx = modbus_new_tcp("0.0.0.0", SERVER_PORT);
-    if (!ctx)
+    return ret;
+}
+
+
+/**
+ * @brief pwrite() on the EEPROM, counted and timed.
+ */
+ssize_t eeprom_write(const void *buf, size_t count, off_t offset)
+{
+    uint64_t start_us = can_rtt_now_us();
+    ssize_t  ret      = pwrite(eeprom_fd, buf, count, offset);
+
+    metrics_observe(METRIC_H_EEPROM, can_rtt_now_us() - start_us);
+    metrics_inc(METRIC_EEPROM_WRITES);
+    if (ret != (ssize_t)count)
     {
-        LOG_ERROR("Failed to create Modbus context: %s\n", modbus_strerror(errno));
-        return -1;
+        metrics_inc(METRIC_EEPROM_ERRORS);
     }
 
-    /*
-     * Configure Modbus debugging
-     */
-    modbus_set_debug(ctx, 0);
+    return ret;
+}
 
-    /*
-     * Allocate Modbus register mapping
-     * Special focus on input registers (5000 allocated)
-     */
-    mb_mapping = modbus_mapping_new(MODBUS_ALLOC_NUM_COILS,MODBUS_ALLOC_NUM_DISCRETE_INPUTS,
-		                    MODBUS_ALLOC_NUM_HOLDING_REGISTERS,MODBUS_ALLOC_NUM_INPUT_REGISTERS);
-    if (!mb_mapping)
+
+/**
+ * @brief Run a CAN transaction through the CAN scheduler.
+ *
+ * On failure the Modbus exception is sent here: SLAVE_OR_SERVER_BUSY if the
+ * scheduler refused the request, GATEWAY_TARGET if the CAN module did not
+ * answer.
+ *
+ * @return 0 on success, -1 if an exception was sent
+ */
+int submit_can_request(modbus_t *ctx, uint8_t *query, can_request *request, uint32_t data_header, uint32_t client_id)
+{
+    can_job job;
+    int     status;
+    int     ret;
+
+    memset(&job, 0, sizeof(job));
+    job.run         = run_can_request;
+    job.arg         = request;
+    job.sched_class = can_sched_class_for_header(data_header);
+    job.client_id   = client_id;
+
+    status = can_sched_submit(&job);
+    if (status != SCHED_OK)
     {
-        LOG_ERROR("Failed to allocate Modbus registers: %s\n", modbus_strerror(errno));
-        modbus_free(ctx);
+        LOG_WARN("CAN request 0x%X refused (%s class, reason %d), server busy\n",
+                 request->can_id, can_sched_class_name(job.sched_class), status);
+        metrics_inc(METRIC_SCHED_REFUSED);
+
+        ret = send_exception(ctx, query, MODBUS_EXCEPTION_SLAVE_OR_SERVER_BUSY);
+        if (ret == -1)
+        {
+            LOG_ERROR("Failed to send Modbus exception response\n");
+        }
         return -1;
     }
 
-    /*
-     * Start Modbus TCP listener
-     */
-    server_socket = modbus_tcp_listen(ctx, 1);
-    if (server_socket == -1)
+    if (job.result != 0)
     {
-        LOG_ERROR("Failed to listen on Modbus TCP: %s\n", modbus_strerror(errno));
-        modbus_mapping_free(mb_mapping);
-        modbus_free(ctx);
+        LOG_ERROR("CAN communication failed\n\n");
+
+        ret = send_exception(ctx, query, MODBUS_EXCEPTION_GATEWAY_TARGET);
+        if (ret == -1)
+        {
+            LOG_ERROR("Failed to send Modbus exception response\n");
+        }
         return -1;
     }
 
-    /*
-     * Server startup message
-     */
-    LOG_DEBUG("Modbus TCP Server started on port %d\n", SERVER_PORT);
+    return 0;
+}
 
-    /*
-     * Initialize CAN interface
-     */
-    setup_can_interface(CAN_INTERFACE, CAN_BITRATE);
 
-    /*
-     * Create CAN socket
-     */
-    socket_fd = socket(PF_CAN, SOCK_RAW, CAN_RAW);
-    if (socket_fd < 0)
+/**
+ * @brief Debug output when the address exists but not for the requested function code.
+ */
+void log_register_mismatch(const regmap_t *map, const regmap_entry *addr_match, uint32_t fun_code)
+{
+    if (addr_match == NULL)
     {
-        LOG_ERROR("Socket creation failed\n");
-        return -1;
+        return;
     }
 
     /*
-     * Configure CAN interface
+     * Register address matches, but requested function code is not supported.
+     * Print debug information for diagnosis.
      */
-    strcpy(ifr.ifr_name, CAN_INTERFACE);
-    if (ioctl(socket_fd, SIOCGIFINDEX, &ifr) < 0)
+    LOG_DEBUG("Register address matched (%u) in %s, but requested function code 0x%02X is not supported.\n",
+              addr_match->addr, regmap_string(map, regmap_dataset_get(map, addr_match->dataset)->name_off), fun_code);
+    LOG_DEBUG("Supported Function Codes: %02X %02X %02X\n\n",
+              addr_match->fun_code[0],
+              addr_match->fun_code[1],
+              addr_match->fun_code[2]);
+}
+
+
+/**
+ * @brief Find the register map entry for one address (TCP datasets first, then CAN).
+ *
+ * @param addr        1-based register address as used in the tables
+ * @param fun_code    Function code the entry must support
+ * @param matched     Copy of the entry
+ * @param data_header Data header of the entry's dataset
+ * @param tcp         Set to 1 for an EEPROM (TCP dataset) register
+ * @param image_slot  Slot of the entry's dataset in the register image, -1 if none
+ *
+ * @return 0 if found, -1 otherwise
+ */
+int resolve_register(uint16_t addr, uint8_t fun_code, regmap_entry *matched, uint32_t *data_header, int *tcp,
+                     int *image_slot)
+{
+    const regmap_t      *map;
+    const regmap_entry  *entry;
+
+    map = regmap_read_lock();
+
+    *tcp  = 1;
+    entry = regmap_lookup(map, REGMAP_KIND_TCP, addr, fun_code, NULL);
+    if (entry == NULL)
     {
-        LOG_ERROR("Error getting CAN interface index\n");
-        return -1;
+        *tcp  = 0;
+        entry = regmap_lookup(map, REGMAP_KIND_CAN, addr, fun_code, NULL);
     }
 
-    addr.can_family  = AF_CAN;
-    addr.can_ifindex = ifr.ifr_ifindex;
-    
-    /*
-     * Bind CAN socket
-     */
-    if (bind(socket_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    if (entry != NULL)
     {
-        LOG_ERROR("Error binding socket to CAN interface\n");
-        return -1;
+        *matched     = *entry;
+        *data_header = regmap_dataset_get(map, entry->dataset)->data_header;
+        *image_slot  = register_image_slot(map, entry->dataset);
     }
 
-    rfilter.can_id = CAN_EFF_FLAG;             // Match only extended ID flag
-    rfilter.can_mask = CAN_EFF_FLAG;           // Filter only by EFF flag
-    
-    /*
-     * Set filter: accept only 29-bit CAN frames
-     */ 
-    if (setsockopt(socket_fd, SOL_CAN_RAW, CAN_RAW_FILTER, &rfilter, sizeof(rfilter)) < 0)
+    regmap_read_unlock();
+
+    return (entry != NULL) ? 0 : -1;
+}
+
+
+/**
+ * @brief Send a Modbus exception, logging if that fails too.
+ *
+ * @return -1 (convenient as the caller's return value)
+ */
+int reply_exception(modbus_t *ctx, uint8_t *query, int exception)
+{
+    if (send_exception(ctx, query, exception) == -1)
     {
-       LOG_ERROR("Error setting CAN filter for Extended ID frames\n");
-       return -1;
+        LOG_ERROR("Failed to send Modbus exception response\n");
     }
 
+    return -1;
+}
+
+
+/**
+ * @brief Handle FC 0x17, Read/Write Multiple Registers.
+ *
+ * The write range is resolved like FC 0x10 and the read range like FC 0x03.
+ * When both are CAN registers the write and the read-back are one CAN
+ * scheduler job: the read request follows the write termination on the bus
+ * without any other transaction in between, so the master gets the
+ * read-back in a single TCP round trip. EEPROM ranges are written/read
+ * directly, always write first.
+ *
+ * @return 0 if a normal reply was sent, -1 if an exception was sent
+ */
+int process_write_read_registers(modbus_t *ctx, modbus_mapping_t *mb_mapping, uint8_t *query, int rc, uint32_t client_id)
+{
+    uint8_t         write_buf[MODBUS_MAX_WR_WRITE_REGISTERS * 2];
+    uint8_t         read_buf[MODBUS_MAX_WR_READ_REGISTERS * 2];
+    regmap_entry    read_entry;
+    regmap_entry    write_entry;
+    can_request     read_request;
+    can_request     write_request;
+    uint32_t        read_header;
+    uint32_t        write_header;
+    int             read_slot;
+    int             write_slot;
+    uint16_t        read_addr;
+    uint16_t        read_count;
+    uint16_t        write_addr;
+    uint16_t        write_count;
+    uint16_t        byte_count;
+    uint16_t        i;
+    int             read_tcp;
+    int             write_tcp;
+    int             ret;
+    const uint8_t  *pdu = query + modbus_get_header_length(ctx);
+
     /*
-     * Create heartbeat thread
+     * Request: read start, read quantity, write start, write quantity,
+     * byte count, values (PDU offsets, after the MBAP header or unit ID)
      */
-    if (pthread_create(&thread_id, NULL, heartbeat_thread, &socket_fd) != 0)
+    read_addr   = ((pdu[1] << 8) | pdu[2]) + 1;
+    read_count  = (pdu[3] << 8) | pdu[4];
+    write_addr  = ((pdu[5] << 8) | pdu[6]) + 1;
+    write_count = (pdu[7] << 8) | pdu[8];
+    byte_count  = pdu[9];
+
+    if ((read_count < 1) || (read_count > MODBUS_MAX_WR_READ_REGISTERS) ||
+        (write_count < 1) || (write_count > MODBUS_MAX_WR_WRITE_REGISTERS) ||
+        (byte_count != write_count * 2) || (rc < (pdu - query) + 10 + byte_count))
     {
-        LOG_ERROR("Error creating heartbeat thread\n");
-        return -1;
+        LOG_ERROR("FC 0x17: invalid quantities (read %u, write %u, bytes %u)\n", read_count, write_count, byte_count);
+        return reply_exception(ctx, query, MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE);
     }
 
-    /*
-     * Create IP responder thread
-     */
-    if (pthread_create(&ip_responder_id, NULL, ip_response_thread, NULL) != 0)
+    if ((resolve_register(write_addr, MODBUS_FUNC_WRITE_MULTIPLE_REGISTERS, &write_entry, &write_header, &write_tcp,
+                          &write_slot) != 0) ||
+        (resolve_register(read_addr, MODBUS_FUNC_READ_HOLDING_REGISTERS, &read_entry, &read_header, &read_tcp,
+                          &read_slot) != 0))
     {
-        LOG_ERROR("Error creating IP responder thread\n");
-        return -1;
+        LOG_ERROR("FC 0x17: write address %u or read address %u not found\n", write_addr, read_addr);
+        metrics_inc(METRIC_LOOKUP_MISSES);
+        return reply_exception(ctx, query, MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
     }
 
-    /*
-     * EE _prom mem pointer open with both read and write
-     */
-    fd = open(EEPROM_PATH, O_RDWR);
-    if (fd < 0) {
-        perror("[ERROR] Failed to open EEPROM");
-        return -1;
+    if ((write_entry.remaining < byte_count) || (read_entry.remaining < (uint32_t)read_count * 2))
+    {
+        LOG_ERROR("FC 0x17: requested size exceeds the available dataset size\n");
+        return reply_exception(ctx, query, MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
     }
 
+    memcpy(write_buf, &pdu[10], byte_count);
+
+    memset(&write_request, 0, sizeof(write_request));
+    write_request.can_id   = etu_id_build(CAN_MODULE_ADDR, CAN_MODULE_ID, write_header,
+                                          ETU_MSG_WRITE_REQ, write_addr);
+    write_request.fun_code = MODBUS_FUNC_WRITE_MULTIPLE_REGISTERS;
+    write_request.length   = write_count;
+    write_request.data     = write_buf;
+    write_request.data_len = byte_count;
+    write_request.write    = 1;
+
+    memset(&read_request, 0, sizeof(read_request));
+    read_request.can_id    = etu_id_build(CAN_MODULE_ADDR, CAN_MODULE_ID, read_header,
+                                          ETU_MSG_READ_REQ, read_addr);
+    read_request.fun_code  = MODBUS_FUNC_READ_HOLDING_REGISTERS;
+    read_request.length    = read_count;
+    read_request.data      = read_buf;
+    read_request.data_len  = read_count * 2;
+    read_request.write     = 0;
 
     /*
-     * Main server loop
+     * Write phase
      */
-    while (1)
+    if (write_tcp)
     {
-        /*
-         * Accept new client connection
-         */
-        client_socket = modbus_tcp_accept(ctx, &server_socket);
-        if (client_socket == -1)
+        ret = eeprom_write(write_buf, byte_count, write_entry.eeprom_offset);
+        if (ret != byte_count)
         {
-            LOG_ERROR("Failed to accept client: %s\n", modbus_strerror(errno));
-            continue;
+            LOG_ERROR("FC 0x17: EEPROM write failed (expected %u bytes, wrote %d)\n", byte_count, ret);
+            return reply_exception(ctx, query, MODBUS_EXCEPTION_SLAVE_OR_SERVER_FAILURE);
         }
-
-        LOG_DEBUG("Client connected.\n");
-
-        /*
-         * Client communication loop
-         */
-        while (1)
+    }
+    else
+    {
+        if (!read_tcp)
         {
-
-            /*
-	     * Receive Modbus data from the client
-	     */
-            rc = modbus_receive(ctx, query);
-	   
-	    /* 
-	     * Returns any error, close the connection and wait for new connection
-	     */ 
-	    if (rc == -1)
-            {
-                LOG_ERROR("Client disconnected.\n\n");
-                close(client_socket);
-                break;
-            }
-	    /*
-	     * Receive Zero byte data, continue
-	     */
-	    else if(rc == 0)
-            {
-              continue;     
-	    }		       
-	    
-	    log("\n\n"); 
-	    LOG_DEBUG("New request coming from Modbus client.\n");
-	    /*
-             * Parse Modbus request parameters
-             */
-            start_addr  = ((query[8] << 8) | query[9]) + 1;
-            length      = (query[10] << 8) | query[11];
-            fun_code    = query[7];
-	    /*
-	     * Reset var
-	     */  
-	    tcp_found   = 0;
-            found       = 0;
-            offset      = 0;
-            
-	    /*
-             * The received_data buffer is shared for both CAN read and write operations.
-             */
-            write_value = received_data;
-
             /*
-             * Here we check whether the requested function code is a valid operation or not.
+             * Write and read-back as one CAN job
              */
-            if ((fun_code == 0x03) || (fun_code == 0x04) || (fun_code == 0x10)) 
-	    {
-                Write = Read = length * 2;
-            } 
-	    else if (fun_code == 0x06) 
-	    {
-                Write = Read = 2;
-            } 
-	    else if ((fun_code == 0x01) || (fun_code == 0x02)) 
-	    {
-                Read = length;
-            } 
-	    else 
-	    {
-                LOG_ERROR("Function code not found: Illegal = %d\n", fun_code);
+            write_request.next = &read_request;
+        }
 
-                /*
-                 * Set error values in all register types.
-                 */
-                ret = modbus_reply_exception(ctx, query, MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
-		if (ret == -1)
-                {
-                    LOG_ERROR("Failed to send Modbus exception response\n");
-                }
+        if (submit_can_request(ctx, query, &write_request, write_header, client_id) != 0)
+        {
+            return -1;
+        }
+    }
 
-                continue;
-            }
+    /*
+     * Read phase (already done if it was chained to the CAN write)
+     */
+    if (read_tcp)
+    {
+        ret = eeprom_read(read_buf, read_count * 2, read_entry.eeprom_offset);
+        if (ret != read_count * 2)
+        {
+            LOG_ERROR("FC 0x17: EEPROM read failed (expected %u bytes, got %d)\n", read_count * 2, ret);
+            return reply_exception(ctx, query, MODBUS_EXCEPTION_SLAVE_OR_SERVER_FAILURE);
+        }
+    }
+    else if (write_tcp)
+    {
+        if (submit_can_request(ctx, query, &read_request, read_header, client_id) != 0)
+        {
+            return -1;
+        }
+    }
 
-            /*
-             * Search through all TCP datasets for a matching register.
-             * This dataset is for TCP configuration only — no CAN bus operations.
-             */
-            for (dataset_index = 0; dataset_index < tcp_total_datasets; dataset_index++) 
-	    {
-                tcp_selected_array = tcp_data[dataset_index];
-                tcp_current_dataset_size = tcp_dataset_counts[dataset_index];
-                 
-		LOG_DEBUG("Processing TCP dataset %d out of %d total datasets.\n", dataset_index, tcp_current_dataset_size);
-
-                if (!(tcp_selected_array[0].reg_address % 10000 <= start_addr) ||
-                    !(tcp_selected_array[tcp_current_dataset_size - 1].reg_address % 10000 >= start_addr)) 
-		{
-
-                    for (data_index = 0; data_index < tcp_current_dataset_size; data_index++) 
-		    {
-                        offset += tcp_selected_array[data_index].size;
-                    }
-                    continue;
-                }
+    for (i = 0; i < read_count; i++)
+    {
+        mb_mapping->tab_registers[read_addr - 1 + i] = ((uint16_t)read_buf[2 * i] << 8) | read_buf[2 * i + 1];
+    }
 
-                for (data_index = 0; data_index < tcp_current_dataset_size; data_index++) 
-		{
-                    offset += tcp_selected_array[data_index].size;
+    if (!read_tcp && (read_slot >= 0))
+    {
+        shm_image_publish(register_image, read_slot, SHM_TABLE_REGISTERS,
+                          read_addr - 1, read_count, &mb_mapping->tab_registers[read_addr - 1]);
+    }
 
-                    if (start_addr != (tcp_selected_array[data_index].reg_address % 10000)) 
-		    
-		    {
-                        continue;
-                    }
+    /*
+     * libmodbus stores the written values in tab_registers before copying
+     * the read range, so an overlapping part returns the written values
+     * (what the ETU holds after an accepted write anyway)
+     */
+    ret = modbus_reply(ctx, query, rc, mb_mapping);
+    if (ret == -1)
+    {
+        LOG_ERROR("Server to client response failed: %s\n\n", modbus_strerror(errno));
+    }
 
-                    offset -= tcp_selected_array[data_index].size;
+    clear_modbus_mapping(mb_mapping, CLEAR_REGISTERS);
 
-                    if (tcp_selected_array[data_index].fun_code[0] == fun_code ||
-                        tcp_selected_array[data_index].fun_code[1] == fun_code ||
-                        tcp_selected_array[data_index].fun_code[2] == fun_code) 
-		    {   
+    return 0;
+}
 
-                        tcp_found = 1;
 
-                        /* Print matched register details */
-                        LOG_DEBUG("Found TCP Register:\n");
-                        LOG_DEBUG("  Name        : %s\n", tcp_selected_array[data_index].attribute_name);
-                        LOG_DEBUG("  Address     : %u (0x%X)\n", tcp_selected_array[data_index].reg_address, tcp_selected_array[data_index].reg_address);
-                        LOG_DEBUG("  Size        : %u\n", tcp_selected_array[data_index].size);
-                        LOG_DEBUG("  Function(s) : %02X %02X %02X\n\n",
-                                 tcp_selected_array[data_index].fun_code[0],
-                                 tcp_selected_array[data_index].fun_code[1],
-                                 tcp_selected_array[data_index].fun_code[2]);
+/**
+ * @brief Serve one Modbus request received from a client.
+ *
+ * Looks the requested address up in the TCP (EEPROM) and CAN datasets,
+ * performs the EEPROM access or submits the CAN transaction to the CAN
+ * scheduler, fills the client's mapping and sends the reply or an
+ * exception. Runs on the client's thread (TCP) or the RTU thread, several
+ * clients may be in here at the same time.
+ *
+ * @param ctx        Modbus context of the client connection or serial port
+ * @param mb_mapping Register mapping owned by this client
+ * @param query      Request ADU from modbus_receive() or rtu_framer_next()
+ * @param rc         Request length
+ * @param client_id  Client identity for the scheduler (IPv4 address)
+ *
+ * @return 0 if a normal reply was sent, -1 if an exception was sent
+ */
+int process_modbus_request(modbus_t *ctx, modbus_mapping_t *mb_mapping, uint8_t *query, int rc, uint32_t client_id)
+{
+    /*
+     * Data processing variables
+     */
+    uint32_t              can_id;
+    uint32_t              data_header;
+    uint32_t              req_type;
+    uint32_t              fun_code;
+    uint32_t              total_size;
+    uint16_t              start_addr;
+    uint16_t              length;
+    int                   found;
+    int                   tcp_found         = 0;
+    const regmap_t        *map;
+    const regmap_entry    *entry;
+    const regmap_entry    *addr_match;
+    regmap_entry          matched;
+    can_request           request;
 
-                        break;
-                    } 
-		    else 
-		    {   
-	                /*
-                         * Register address matches, but requested function code is not supported.
-                         * Print debug information for diagnosis.
-                         */
-                        LOG_DEBUG("Register address matched (%u), but requested function code 0x%02X is not supported.\n",
-                                                                                            tcp_selected_array[data_index].reg_address % 10000, fun_code);
-                        LOG_DEBUG("Supported Function Codes: %02X %02X %02X\n\n",
-                                                                                tcp_selected_array[data_index].fun_code[0],
-                                                                                tcp_selected_array[data_index].fun_code[1],
-                                                                                tcp_selected_array[data_index].fun_code[2]);
-                        break;
-                    }
-                }
+    /*
+     * Loop and index variables
+     */
+    int                   dataset_index;
+    int                   image_slot = -1;
+    int                   bit;
+    int                   data_index;
+    size_t                register_offset;
 
-                if (tcp_found)
-                    break;
-            }
-            
-	    log("\n"); 
-            
-            /* 
-             * If we found a matching register from the TCP dataset    
-             */
-            if (tcp_found)
-            {
-                
-	        LOG_DEBUG("Received a TCP module configuration request.\n");
-
-	       /*
-                * If the requested size is greater than available size,
-                * calculate the remaining dataset size from the matched point.
-                * If the user requests more than the available size, it is invalid.
-                * Return an error.
-                */
-                
-		total_size = 0;
-                for (data_index = data_index; data_index < tcp_current_dataset_size; data_index++)
-                {
-                    total_size += tcp_selected_array[data_index].size;
-                }
+    /*
+     * Status variables
+     */
+    int                   ret = 0;
+    uint8_t               data[sizeof(received_data)];
+    uint8_t               *write_value = data; 
+    uint8_t               clear_flag   = CLEAR_NONE; 
+    uint8_t               cp           = 0; 
+ 
+    /*
+     * EE_Prom variables
+     */
+    uint32_t               offset; 
+    uint32_t               Read; 
+    uint32_t               Write=0; 
 
-                /*
-                 * If the requested size is greater than available size,
-                 * return an error
-                 */
-                if (total_size < Read)
-                {
-                    LOG_ERROR("Register address found, but requested size (%d bytes) exceeds available dataset size (%d bytes)\n", Read, total_size);
+    /*
+     * PDU of the request: after the MBAP header (TCP) or the unit ID (RTU)
+     */
+    const uint8_t          *pdu = query + modbus_get_header_length(ctx);
 
-                    /*
-                     * Set error values in all register types
-                     */
-                    ret = modbus_reply_exception(ctx, query, MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
-		    if (ret == -1)
-                    {
-                       LOG_ERROR("Failed to send Modbus exception response\n");
-                    }
-                    continue;
-                }
 
-                /*
-                 * Move the file pointer to the correct offset where the register data is stored
-                 */
-                ret = lseek(fd, offset, SEEK_SET);
-                if (ret == -1)
-                {
-                    LOG_ERROR("lseek failed: %s\n", strerror(errno));
-                    ret = modbus_reply_exception(ctx, query, MODBUS_EXCEPTION_SLAVE_OR_SERVER_FAILURE);
-		    if (ret == -1)
-                    {
-                       LOG_ERROR("Failed to send Modbus exception response\n");
-                    }
-                    continue;
-                }
+    log("\n\n"); 
+    LOG_DEBUG("New request coming from Modbus client.\n");
+    /*
+     * Parse Modbus request parameters
+     */
+    start_addr  = ((pdu[1] << 8) | pdu[2]) + 1;
+    length      = (pdu[3] << 8) | pdu[4];
+    fun_code    = pdu[0];
+    metrics_request((uint8_t)fun_code);
+    /*
+     * Reset var
+     */  
+    tcp_found   = 0;
+    found       = 0;
+    offset      = 0;
+    
+    /*
+     * The per-request data buffer is used for both read and write operations.
+     */
+    write_value = data;
+    memset(&request, 0, sizeof(request));
 
-                /*
-                 * Write operation supported for function codes:
-                 * 0x06 = Single Register, 0x10 = Multiple Registers
-                 */
-                if ((fun_code == 0x06) || (fun_code == 0x10))
-                {
-                    LOG_DEBUG("EEPROM Write operation detected: Configartion EE_prome Function Code = 0x%02X\n", fun_code);
+    /*
+     * Read/Write Multiple Registers has its own request layout
+     */
+    if (fun_code == MODBUS_FUNC_WRITE_READ_REGISTERS)
+    {
+        return process_write_read_registers(ctx, mb_mapping, query, rc, client_id);
+    }
 
-                    if (fun_code == 0x06)
-                    {
-                        /*
-                         * Extract single register value from query
-                         */
-                        write_value[0] = query[10];
-                        write_value[1] = query[11];
-
-                        /*
-                         * Write the value to EEPROM at the correct offset
-                         */
-                        ret = write(fd, write_value, Write);
-                        if (ret != Write)
-                        {
-                            LOG_ERROR("Failed to write single register to EEPROM (expected %d bytes, wrote %d)\n", Write, ret);
-                            ret = modbus_reply_exception(ctx, query, MODBUS_EXCEPTION_SLAVE_OR_SERVER_FAILURE);
-			    if (ret == -1)
-                            {
-                                LOG_ERROR("Failed to send Modbus exception response\n");
-                            }
-                            continue;
-                        }
-                    }
-                    else
-                    {
-                        for (cp = 0; cp < Write; cp++)
-                        {
-                            write_value[cp] = query[cp + 13];
-                        }
-
-                        /*
-                         * Write multiple values to EEPROM at the correct offset
-                         */
-                        ret = write(fd, write_value, Write);
-                        if (ret != Write)
-                        {
-                            LOG_ERROR("Failed to write multiple registers to EEPROM (expected %d bytes, wrote %d)\n", Write, ret);
-                            ret = modbus_reply_exception(ctx, query, MODBUS_EXCEPTION_SLAVE_OR_SERVER_FAILURE);
-			    if (ret == -1)
-                            {
-                                LOG_ERROR("Failed to send Modbus exception response\n");
-                            } 
-                            continue;
-                        }
-                    }
+    /*
+     * Here we check whether the requested function code is a valid operation or not.
+     */
+    if ((fun_code == 0x03) || (fun_code == 0x04) || (fun_code == 0x10)) 
+    {
+        Write = Read = length * 2;
+    } 
+    else if (fun_code == 0x06) 
+    {
+        Write = Read = 2;
+    } 
+    else if ((fun_code == 0x01) || (fun_code == 0x02)) 
+    {
+        Read = length;
+    } 
+    else 
+    {
+        LOG_ERROR("Function code not found: Illegal = %d\n", fun_code);
 
-                    LOG_DEBUG("EEPROM write operation successful\n");
+        /*
+         * Set error values in all register types.
+         */
+        ret = send_exception(ctx, query, MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+    	if (ret == -1)
+        {
+            LOG_ERROR("Failed to send Modbus exception response\n");
+        }
 
-                    /*
-                     * If both lseek and write were successful, go to the reply label to send response
-                     */
-                    goto EE_PROM_write_reply;
-                }
+        return -1;
+    }
 
-		LOG_DEBUG("EEPROM Read operation detected: Configartion EE_prome Function Code = 0x%02X\n", fun_code);
+    /*
+     * Look the register up in the current register map: first the TCP
+     * datasets (module configuration in EEPROM, no CAN bus operations),
+     * then the CAN module datasets. Only copies leave the read-side
+     * section, so a map swap cannot affect the rest of this request.
+     */
+    map = regmap_read_lock();
 
-                /*
-                 * Read number of bytes from the file into received_data buffer
-                 */
-                ret = read(fd, received_data, Read);
-                if (ret != Read)
-                {
-                    LOG_ERROR("EEPROM read failed or incomplete (expected %d, got %d): %s\n", Read, ret, strerror(errno));
-                    ret = modbus_reply_exception(ctx, query, MODBUS_EXCEPTION_SLAVE_OR_SERVER_FAILURE);
-		    if (ret == -1)
-                    {
-                        LOG_ERROR("Failed to send Modbus exception response\n");
-                    }
-                    continue;
-                }
+    entry = regmap_lookup(map, REGMAP_KIND_TCP, start_addr, fun_code, &addr_match);
+    if (entry != NULL)
+    {
+        tcp_found = 1;
+    }
+    else
+    {
+        log_register_mismatch(map, addr_match, fun_code);
+        entry = regmap_lookup(map, REGMAP_KIND_CAN, start_addr, fun_code, &addr_match);
+        found = (entry != NULL);
+    }
 
-                LOG_DEBUG("EEPROM read operation successful\n");
+    if (entry != NULL)
+    {
+        matched       = *entry;
+        data_header   = regmap_dataset_get(map, entry->dataset)->data_header;
+        dataset_index = entry->dataset;
+        image_slot    = register_image_slot(map, entry->dataset);
+
+        /* Print matched register details */
+        LOG_DEBUG("Found %s Register:\n", tcp_found ? "TCP" : "CAN");
+        LOG_DEBUG("  Name        : %s\n", regmap_string(map, entry->name_off));
+        LOG_DEBUG("  Address     : %u (0x%X)\n", entry->reg_address, entry->reg_address);
+        LOG_DEBUG("  Size        : %u\n", entry->size);
+        LOG_DEBUG("  Function(s) : %02X %02X %02X\n\n",
+                 entry->fun_code[0],
+                 entry->fun_code[1],
+                 entry->fun_code[2]);
+    }
+    else
+    {
+        log_register_mismatch(map, addr_match, fun_code);
+    }
 
-                /*
-                 * If both lseek and read were successful, go to the reply label to send response
-                 */
-                goto EE_PROM_Read_reply;
-            }
-            
-	    /*
-             * Search through all datasets for a matching register.
-             * This dataset is for CAN module read/write operation support.
-             */
-            for (dataset_index = 0; dataset_index < total_datasets; dataset_index++)
-            {
-                selected_array = all_datasets[dataset_index];
-                data_header = header[dataset_index].data_header;
-                current_dataset_size = dataset_counts[dataset_index];
+    regmap_read_unlock();
 
-                LOG_DEBUG("Processing CAN dataset %d out of %d total datasets.\n", dataset_index, current_dataset_size);
+    log("\n"); 
+    
+    /* 
+     * If we found a matching register from the TCP dataset    
+     */
+    if (tcp_found)
+    {
+        
+        LOG_DEBUG("Received a TCP module configuration request.\n");
+
+       /*
+        * If the requested size is greater than available size,
+        * calculate the remaining dataset size from the matched point.
+        * If the user requests more than the available size, it is invalid.
+        * Return an error.
+        */
+        
+        total_size = matched.remaining;
+        offset     = matched.eeprom_offset;
 
-                if (!(selected_array[0].reg_address % 10000 <= start_addr) ||
-                    !(selected_array[current_dataset_size - 1].reg_address % 10000 >= start_addr))
-                    continue;
+        /*
+         * If the requested size is greater than available size,
+         * return an error
+         */
+        if (total_size < Read)
+        {
+            LOG_ERROR("Register address found, but requested size (%d bytes) exceeds available dataset size (%d bytes)\n", Read, total_size);
 
-                for (data_index = 0; data_index < current_dataset_size; data_index++)
-                {
-                    if (start_addr != (selected_array[data_index].reg_address % 10000))
-                        continue;
+            /*
+             * Set error values in all register types
+             */
+            ret = send_exception(ctx, query, MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+    	    if (ret == -1)
+            {
+               LOG_ERROR("Failed to send Modbus exception response\n");
+            }
+            return -1;
+        }
 
-                    if (selected_array[data_index].fun_code[0] == fun_code ||
-                        selected_array[data_index].fun_code[1] == fun_code ||
-                        selected_array[data_index].fun_code[2] == fun_code)
-                    {
-                        found = 1;
-
-                        /* Print matched CAN register details */
-                        LOG_DEBUG("Found CAN Register:\n");
-                        LOG_DEBUG("  Name        : %s\n", selected_array[data_index].attribute_name);
-                        LOG_DEBUG("  Address     : %u (0x%X)\n", selected_array[data_index].reg_address, selected_array[data_index].reg_address);
-                        LOG_DEBUG("  Size        : %u\n", selected_array[data_index].size);
-                        LOG_DEBUG("  Function(s) : %02X %02X %02X\n",
-                                 selected_array[data_index].fun_code[0],
-                                 selected_array[data_index].fun_code[1],
-                                 selected_array[data_index].fun_code[2]);
-
-                        break;
-                    }
-                    else
-                    {
-			/*
-                         * Register address matches, but requested function code is not supported.
-                         * Print debug information for diagnosis.
-                         */
-                        LOG_DEBUG("Register address matched (%u), but requested function code 0x%02X is not supported.\n",
-                                                                                            selected_array[data_index].reg_address % 10000, fun_code);
-                        LOG_DEBUG("Supported Function Codes: %02X %02X %02X\n\n",
-                                                                                 selected_array[data_index].fun_code[0],
-                                                                                 selected_array[data_index].fun_code[1],
-                                                                                 selected_array[data_index].fun_code[2]);
-                        break;
-                    }
-                }
+        /*
+         * Write operation supported for function codes:
+         * 0x06 = Single Register, 0x10 = Multiple Registers
+         */
+        if ((fun_code == 0x06) || (fun_code == 0x10))
+        {
+            LOG_DEBUG("EEPROM Write operation detected: Configartion EE_prome Function Code = 0x%02X\n", fun_code);
 
-                if (found)
-                    break;
-            } 
-            
-	    /*
-             * Handle case when register not found
-	     * Return Error message to the modbus client
-	     */
-            
-            if (!found)
+            if (fun_code == 0x06)
             {
-                LOG_ERROR("Register address %u not found in any dataset\n", start_addr);
+                /*
+                 * Extract single register value from query
+                 */
+                write_value[0] = pdu[3];
+                write_value[1] = pdu[4];
 
                 /*
-                 * Set error values in all register types
+                 * Write the value to EEPROM at the correct offset
                  */
-                ret = modbus_reply_exception(ctx, query, MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
-                if (ret == -1)
+                ret = eeprom_write(write_value, Write, offset);
+                if (ret != Write)
                 {
-                    LOG_ERROR("Failed to send Modbus exception response\n");
+                    LOG_ERROR("Failed to write single register to EEPROM (expected %d bytes, wrote %d)\n", Write, ret);
+                    ret = send_exception(ctx, query, MODBUS_EXCEPTION_SLAVE_OR_SERVER_FAILURE);
+    		    if (ret == -1)
+                    {
+                        LOG_ERROR("Failed to send Modbus exception response\n");
+                    }
+                    return -1;
                 }
-                continue;
-            }
-            
-	    /*
-             * If the requested size is greater than available size,
-             * calculate the remaining dataset size from the matched point.
-             * If the user requests more than the available size, it is invalid.
-             * Return an error.
-             */
-            
-	    total_size = 0;
-            for (data_index = data_index; data_index < current_dataset_size; data_index++)
-            {
-                total_size += selected_array[data_index].size;
             }
-
-	    /*
-	     * if the requested size is greater than avail size,
-	     * return error
-             */
-            if (total_size < Read)
+            else
             {
-                LOG_ERROR("Register address found, but requested size (%d bytes) exceeds available dataset size (%d bytes)\n", Read, total_size);
+                for (cp = 0; cp < Write; cp++)
+                {
+                    write_value[cp] = pdu[cp + 6];
+                }
 
                 /*
-                 * Set error values in all register types
+                 * Write multiple values to EEPROM at the correct offset
                  */
-                ret = modbus_reply_exception(ctx, query, MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
-                if (ret == -1)
+                ret = eeprom_write(write_value, Write, offset);
+                if (ret != Write)
                 {
-                    LOG_ERROR("Failed to send Modbus exception response\n");
+                    LOG_ERROR("Failed to write multiple registers to EEPROM (expected %d bytes, wrote %d)\n", Write, ret);
+                    ret = send_exception(ctx, query, MODBUS_EXCEPTION_SLAVE_OR_SERVER_FAILURE);
+    		    if (ret == -1)
+                    {
+                        LOG_ERROR("Failed to send Modbus exception response\n");
+                    } 
+                    return -1;
                 }
-                continue;
             }
-            
-            LOG_DEBUG("Found data at index: %d\n", register_index);
 
-            LOG_DEBUG("Requested data size: %d bytes\n\n", length);
+            LOG_DEBUG("EEPROM write operation successful\n");
 
             /*
-             * This is CAN Module write operation.
-             * If the function code matches, a write operation will happen.
-             * Supported function codes: 0x06 & 0x10.
+             * If the write was successful, go to the reply label to send response
              */
-            if ((fun_code == 0x06) || (fun_code == 0x10))
-            {
-                LOG_DEBUG("Write operation detected: For CAN module, Function Code = 0x%02X\n", fun_code);
+            goto EE_PROM_write_reply;
+        }
 
-                /*
-                 * Prepare CAN message
-                 */
-                req_type = TCP_TO_ETU_WRITE_REQ_ID;
+    	LOG_DEBUG("EEPROM Read operation detected: Configartion EE_prome Function Code = 0x%02X\n", fun_code);
 
-                /*
-                 * Construct the CAN ID
-                 */
-                can_id = (0 << 27) |
-                         (1 << 23) |
-                         (data_header << 20) |
-                         (req_type << 16) |
-                         (start_addr);
+        /*
+         * A map with a large bit dataset may ask for more than the buffer holds
+         */
+        if (Read > sizeof(data))
+        {
+            LOG_ERROR("EEPROM read of %d bytes exceeds the buffer\n", Read);
+            ret = send_exception(ctx, query, MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+            if (ret == -1)
+            {
+                LOG_ERROR("Failed to send Modbus exception response\n");
+            }
+            return -1;
+        }
 
-                if (fun_code == 0x06)
-                {
-                    /*
-                     * Extract single register value from query
-                     */
-                    length = 1;
-                    write_value[0] = query[10];
-                    write_value[1] = query[11];
-
-                    /*
-                     * Transmit CAN Write Request and handle response
-                     */
-                    ret = can_txrx_reassemble_frag_data_write(socket_fd, can_id, write_value, length);
-                    if (ret != 0)
-                    {
-                        LOG_ERROR("CAN communication failed\n\n");
-
-                        ret = modbus_reply_exception(ctx, query, MODBUS_EXCEPTION_GATEWAY_TARGET);
-                        if (ret == -1)
-                        {
-                            LOG_ERROR("Failed to send Modbus exception response\n");
-                        }
-                        continue;
-                    }
-                }
-                else
-                {
-                    for (cp = 0; cp < Write; cp++)
-                    {
-                        write_value[cp] = query[cp + 13];
-                    }
+        /*
+         * Read number of bytes at the register offset into the data buffer
+         */
+        ret = eeprom_read(data, Read, offset);
+        if (ret != Read)
+        {
+            LOG_ERROR("EEPROM read failed or incomplete (expected %d, got %d): %s\n", Read, ret, strerror(errno));
+            ret = send_exception(ctx, query, MODBUS_EXCEPTION_SLAVE_OR_SERVER_FAILURE);
+    	    if (ret == -1)
+            {
+                LOG_ERROR("Failed to send Modbus exception response\n");
+            }
+            return -1;
+        }
 
-                    /*
-                     * Transmit CAN Write Request and handle response
-                     */
-                    ret = can_txrx_reassemble_frag_data_write(socket_fd, can_id, write_value, length);
-                    if (ret != 0)
-                    {
-                        LOG_ERROR("CAN communication failed\n\n");
-
-                        ret = modbus_reply_exception(ctx, query, MODBUS_EXCEPTION_GATEWAY_TARGET);
-                        if (ret == -1)
-                        {
-                            LOG_ERROR("Failed to send Modbus exception response\n");
-                        }
-                        continue;
-                    }
-                }
+        LOG_DEBUG("EEPROM read operation successful\n");
 
-                LOG_DEBUG("CAN module write operation successful\n");
+        /*
+         * If the read was successful, go to the reply label to send response
+         */
+        goto EE_PROM_Read_reply;
+    }
+    
+    /*
+     * Handle case when register not found
+     * Return Error message to the modbus client
+     */
+    
+    if (!found)
+    {
+        LOG_ERROR("Register address %u not found in any dataset\n", start_addr);
+        metrics_inc(METRIC_LOOKUP_MISSES);
 
-                /*
-                 * Go to the reply label to send response
-                 */
-                goto Can_write_okey_riply;
-            }
+        /*
+         * Set error values in all register types
+         */
+        ret = send_exception(ctx, query, MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+        if (ret == -1)
+        {
+            LOG_ERROR("Failed to send Modbus exception response\n");
+        }
+        return -1;
+    }
+    
+    /*
+     * If the requested size is greater than available size,
+     * calculate the remaining dataset size from the matched point.
+     * If the user requests more than the available size, it is invalid.
+     * Return an error.
+     */
+    
+    total_size = matched.remaining;
 
-            /*
-             * Here: CAN module read operation will be detected
-             */
-            LOG_DEBUG("Read operation detected: For CAN module, Function Code = 0x%02X\n", fun_code);
+    /*
+     * if the requested size is greater than avail size,
+     * return error
+     */
+    if (total_size < Read)
+    {
+        LOG_ERROR("Register address found, but requested size (%d bytes) exceeds available dataset size (%d bytes)\n", Read, total_size);
 
+        /*
+         * Set error values in all register types
+         */
+        ret = send_exception(ctx, query, MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+        if (ret == -1)
+        {
+            LOG_ERROR("Failed to send Modbus exception response\n");
+        }
+        return -1;
+    }
+    
+    LOG_DEBUG("Found data in dataset: %d\n", dataset_index);
+
+    LOG_DEBUG("Requested data size: %d bytes\n\n", length);
+
+    /*
+     * This is CAN Module write operation.
+     * If the function code matches, a write operation will happen.
+     * Supported function codes: 0x06 & 0x10.
+     */
+    if ((fun_code == 0x06) || (fun_code == 0x10))
+    {
+        LOG_DEBUG("Write operation detected: For CAN module, Function Code = 0x%02X\n", fun_code);
+
+        /*
+         * Prepare CAN message
+         */
+        req_type = ETU_MSG_WRITE_REQ;
+
+        /*
+         * Construct the CAN ID
+         */
+        can_id = etu_id_build(CAN_MODULE_ADDR, CAN_MODULE_ID, data_header, req_type, start_addr);
+
+        if (fun_code == 0x06)
+        {
             /*
-             * Prepare CAN message
+             * Extract single register value from query
              */
-            req_type = CAN_READ_REQ_MSG_ID;
+            length = 1;
+            write_value[0] = pdu[3];
+            write_value[1] = pdu[4];
 
             /*
-             * Construct the CAN ID
+             * Transmit CAN Write Request and handle response
              */
-            can_id = (0 << 27) |
-                     (1 << 23) |
-                     (data_header << 20) |
-                     (req_type << 16) |
-                     (start_addr);
+            request.can_id   = can_id;
+            request.fun_code = fun_code;
+            request.length   = length;
+            request.data     = write_value;
+            request.data_len = Write;
+            request.write    = 1;
+
+            ret = submit_can_request(ctx, query, &request, data_header, client_id);
+            if (ret != 0)
+            {
+                return -1;
+            }
+        }
+        else
+        {
+            for (cp = 0; cp < Write; cp++)
+            {
+                write_value[cp] = pdu[cp + 6];
+            }
 
             /*
-             * Send CAN request and receive response
+             * Transmit CAN Write Request and handle response
              */
-            ret = can_txrx_reassemble_frag_data_read(socket_fd, can_id, length, fun_code);
+            request.can_id   = can_id;
+            request.fun_code = fun_code;
+            request.length   = length;
+            request.data     = write_value;
+            request.data_len = Write;
+            request.write    = 1;
+
+            ret = submit_can_request(ctx, query, &request, data_header, client_id);
             if (ret != 0)
             {
-                LOG_ERROR("CAN communication failed\n\n");
-
-                ret = modbus_reply_exception(ctx, query, MODBUS_EXCEPTION_GATEWAY_TARGET);
-                if (ret == -1)
-                {
-                    LOG_ERROR("Failed to send Modbus exception response\n");
-                }
-                continue;
+                return -1;
             }
+        }
 
-            LOG_DEBUG("CAN module read operation successful\n");
+        LOG_DEBUG("CAN module write operation successful\n");
 
-            /*
-             * Process received CAN data into Modbus registers
-             */
+        /*
+         * Go to the reply label to send response
+         */
+        goto Can_write_okey_riply;
+    }
+
+    /*
+     * Here: CAN module read operation will be detected
+     */
+    LOG_DEBUG("Read operation detected: For CAN module, Function Code = 0x%02X\n", fun_code);
+
+    /*
+     * Prepare CAN message
+     */
+    req_type = ETU_MSG_READ_REQ;
+
+    /*
+     * Construct the CAN ID
+     */
+    can_id = etu_id_build(CAN_MODULE_ADDR, CAN_MODULE_ID, data_header, req_type, start_addr);
+
+    /*
+     * Send CAN request and receive response
+     */
+    request.can_id   = can_id;
+    request.fun_code = fun_code;
+    request.length   = length;
+    request.data     = data;
+    request.data_len = Read;
+    request.write    = 0;
+
+    /*
+     * Read is the bit count for FC 1/2: the ETU sends them packed, 8 per byte
+     */
+    if ((fun_code == MODBUS_FUNC_READ_COILS) || (fun_code == MODBUS_FUNC_READ_DISCRETE_INPUTS))
+    {
+        request.data_len = (length + BYTE1 - 1) / BYTE1;
+    }
+
+    ret = submit_can_request(ctx, query, &request, data_header, client_id);
+    if (ret != 0)
+    {
+        return -1;
+    }
+
+    LOG_DEBUG("CAN module read operation successful\n");
+
+    /*
+     * Process received CAN data into Modbus registers
+     */
 
 EE_PROM_Read_reply:	      
-             start_addr--;
-             clear_flag = CLEAR_NONE;
-	     /*
-	      * Read Coils
-	      */
-	     if (fun_code == MODBUS_FUNC_READ_COILS)  
+     start_addr--;
+     clear_flag = CLEAR_NONE;
+     /*
+      * Read Coils
+      */
+     if (fun_code == MODBUS_FUNC_READ_COILS)  
+      {
+    	     clear_flag = CLEAR_BITS;
+             for (register_offset = start_addr, data_index = 0 , bit = 0; register_offset < length + start_addr; register_offset++)
               {
-		     clear_flag = CLEAR_BITS;
-                     for (register_offset = start_addr, data_index = 0 , bit = 0; register_offset < length + start_addr; register_offset++)
-                      {
-                          mb_mapping->tab_bits[register_offset] = ((received_data[data_index] >> bit++) & 0x01 );
-
-			  if(bit >= 7)
-			  {
-                            bit=0;
-			    data_index++;
-			  }
-                      }
+                  mb_mapping->tab_bits[register_offset] = ((data[data_index] >> bit++) & 0x01 );
+
+    		  if(bit >= BYTE1)
+    		  {
+                    bit=0;
+    		    data_index++;
+    		  }
               }
-	     /*
-	      * Read Discrete Inputs
-	      */
-             else if (fun_code == MODBUS_FUNC_READ_DISCRETE_INPUTS)  
-	     {       
-		     clear_flag = CLEAR_INPUT_BITS;
-                     for (register_offset = start_addr, data_index = 0 , bit = 0; register_offset < length + start_addr; register_offset++)
-                      {
-                          mb_mapping->tab_input_bits[register_offset] = ((received_data[data_index] >> bit++) & 0x01 );
-		           
-		          if(bit >= 7)
-			   {
-			     bit=0;
-			     data_index++; 
-			   }			  
-                      }
-             }
-	     /*
-	      * Read Holding Registers
-	      */
-             else if (fun_code == MODBUS_FUNC_READ_HOLDING_REGISTERS)  
+      }
+     /*
+      * Read Discrete Inputs
+      */
+     else if (fun_code == MODBUS_FUNC_READ_DISCRETE_INPUTS)  
+     {       
+    	     clear_flag = CLEAR_INPUT_BITS;
+             for (register_offset = start_addr, data_index = 0 , bit = 0; register_offset < length + start_addr; register_offset++)
               {
-		     clear_flag = CLEAR_REGISTERS;
-                     for (register_offset = start_addr, data_index = 0; register_offset < length + start_addr; register_offset++, data_index++)
-                       {
-                          mb_mapping->tab_registers[register_offset] = ((uint16_t)received_data[2 * data_index] << 8) |
-                                                                       received_data[2 * data_index + 1];
-                       }
+                  mb_mapping->tab_input_bits[register_offset] = ((data[data_index] >> bit++) & 0x01 );
+    	           
+    	          if(bit >= BYTE1)
+    		   {
+    		     bit=0;
+    		     data_index++; 
+    		   }			  
               }
-	      /*
-	       * Read Input Registers
-	       */
-             else if (fun_code == MODBUS_FUNC_READ_INPUT_REGISTERS)  
+     }
+     /*
+      * Read Holding Registers
+      */
+     else if (fun_code == MODBUS_FUNC_READ_HOLDING_REGISTERS)  
+      {
+    	     clear_flag = CLEAR_REGISTERS;
+             for (register_offset = start_addr, data_index = 0; register_offset < length + start_addr; register_offset++, data_index++)
+               {
+                  mb_mapping->tab_registers[register_offset] = ((uint16_t)data[2 * data_index] << 8) |
+                                                               data[2 * data_index + 1];
+               }
+      }
+      /*
+       * Read Input Registers
+       */
+     else if (fun_code == MODBUS_FUNC_READ_INPUT_REGISTERS)  
+       {
+    	     clear_flag = CLEAR_INPUT_REGISTERS;  
+             for (register_offset = start_addr, data_index = 0; register_offset < length + start_addr; register_offset++, data_index++)
                {
-		     clear_flag = CLEAR_INPUT_REGISTERS;  
-                     for (register_offset = start_addr, data_index = 0; register_offset < length + start_addr; register_offset++, data_index++)
-                       {
-                         mb_mapping->tab_input_registers[register_offset] = ((uint16_t)received_data[2 * data_index] << 8) |
-                                                                            received_data[2 * data_index + 1];
-                       }       
-               } 
+                 mb_mapping->tab_input_registers[register_offset] = ((uint16_t)data[2 * data_index] << 8) |
+                                                                    data[2 * data_index + 1];
+               }       
+       } 
+
+     /*
+      * Publish data read from the CAN module to the shared register image.
+      * "found" is only set on the CAN path, EEPROM configuration is not mirrored.
+      */
+     if (found && (image_slot >= 0))
+     {
+         if (fun_code == MODBUS_FUNC_READ_COILS)
+         {
+             shm_image_publish(register_image, image_slot, SHM_TABLE_BITS,
+                               start_addr, length, &mb_mapping->tab_bits[start_addr]);
+         }
+         else if (fun_code == MODBUS_FUNC_READ_DISCRETE_INPUTS)
+         {
+             shm_image_publish(register_image, image_slot, SHM_TABLE_INPUT_BITS,
+                               start_addr, length, &mb_mapping->tab_input_bits[start_addr]);
+         }
+         else if (fun_code == MODBUS_FUNC_READ_HOLDING_REGISTERS)
+         {
+             shm_image_publish(register_image, image_slot, SHM_TABLE_REGISTERS,
+                               start_addr, length, &mb_mapping->tab_registers[start_addr]);
+         }
+         else if (fun_code == MODBUS_FUNC_READ_INPUT_REGISTERS)
+         {
+             shm_image_publish(register_image, image_slot, SHM_TABLE_INPUT_REGISTERS,
+                               start_addr, length, &mb_mapping->tab_input_registers[start_addr]);
+         }
+     }
 
 Can_write_okey_riply:	   
 EE_PROM_write_reply:	     
-             /*
-              * Send Modbus response to client
-              */
-             ret = modbus_reply(ctx, query, rc, mb_mapping);
-
-             if(ret == -1)
-             {
-                LOG_ERROR("Server to client response failed: %s\n\n", modbus_strerror(errno));
-             }
-             else
-             {
-                LOG_DEBUG("Server to client response succeeded\n\n");
-             }
-               
-	    clear_modbus_mapping(mb_mapping,clear_flag);
-	}
-
+     /*
+      * Send Modbus response to client
+      */
+     ret = modbus_reply(ctx, query, rc, mb_mapping);
+
+     if(ret == -1)
+     {
+        LOG_ERROR("Server to client response failed: %s\n\n", modbus_strerror(errno));
+     }
+     else
+     {
+        LOG_DEBUG("Server to client response succeeded\n\n");
      }
+       
+    clear_modbus_mapping(mb_mapping,clear_flag);
+
+    return 0;
+}
+
+
+/**
+ * @brief Client thread: receive and serve Modbus requests of one connection.
+ *
+ * Every client has its own mapping, so replies of different clients never
+ * share register tables. CAN access is serialized by the CAN scheduler.
+ *
+ * @param arg bridge_client allocated by main(), freed here
+ *
+ * @return NULL
+ */
+void *client_thread_fn(void *arg)
+{
+    bridge_client     *client = (bridge_client *)arg;
+    modbus_mapping_t  *mb_mapping;
+    uint8_t            query[MODBUS_TCP_MAX_ADU_LENGTH];
+    uint64_t           start_us;
+    int                rc;
 
     /*
-     * Cleanup before exit
+     * Allocate Modbus register mapping
      */
-    close(socket_fd);
+    mb_mapping = modbus_mapping_new(MODBUS_ALLOC_NUM_COILS,MODBUS_ALLOC_NUM_DISCRETE_INPUTS,
+		                    MODBUS_ALLOC_NUM_HOLDING_REGISTERS,MODBUS_ALLOC_NUM_INPUT_REGISTERS);
+    if (!mb_mapping)
+    {
+        LOG_ERROR("Failed to allocate Modbus registers: %s\n", modbus_strerror(errno));
+    }
+
+    /*
+     * Client communication loop
+     */
+    while (mb_mapping)
+    {
+        /*
+         * Receive Modbus data from the client
+         */
+        rc = modbus_receive(client->ctx, query);
+
+        /*
+         * Returns any error, close the connection
+         */
+        if (rc == -1)
+        {
+            LOG_ERROR("Client disconnected.\n\n");
+            break;
+        }
+        /*
+         * Receive Zero byte data, continue
+         */
+        else if (rc == 0)
+        {
+            continue;
+        }
+
+        start_us = can_rtt_now_us();
+
+        process_modbus_request(client->ctx, mb_mapping, query, rc, client->client_id);
+
+        metrics_observe(METRIC_H_REQUEST, can_rtt_now_us() - start_us);
+    }
+
+    regmap_reader_exit();
     modbus_mapping_free(mb_mapping);
+    modbus_close(client->ctx);
+    modbus_free(client->ctx);
+    free(client);
+    active_clients--;
+
+    return NULL;
+}
+
+
+/**
+ * @brief RS-485 thread: Modbus RTU slave on RTU_DEVICE.
+ *
+ * Frames are delimited by rtu_framer (t3.5 silence timer) and go through
+ * process_modbus_request() like TCP requests, so serial and TCP masters
+ * share the register map, the delta cache and the CAN scheduler. libmodbus
+ * only opens the port and sends the replies. Requests for other unit IDs
+ * on the bus are ignored, broadcasts are executed without a reply. The
+ * port is reopened after an error, the bridge never exits because of it.
+ * A port that cannot be opened is reported once, the retries only at DEBUG.
+ *
+ * @param arg Unused
+ *
+ * @return NULL
+ */
+void *rtu_thread_fn(void *arg)
+{
+    modbus_t          *ctx;
+    modbus_mapping_t  *mb_mapping;
+    rtu_framer         framer;
+    uint8_t            frame[RTU_MAX_ADU];
+    uint64_t           start_us;
+    int                len;
+    int                open_failed = 0;
+
+    (void)arg;
+
+    mb_mapping = modbus_mapping_new(MODBUS_ALLOC_NUM_COILS, MODBUS_ALLOC_NUM_DISCRETE_INPUTS,
+                                    MODBUS_ALLOC_NUM_HOLDING_REGISTERS, MODBUS_ALLOC_NUM_INPUT_REGISTERS);
+    if (!mb_mapping)
+    {
+        LOG_ERROR("RTU: failed to allocate Modbus registers: %s\n", modbus_strerror(errno));
+        return NULL;
+    }
+
+    while (1)
+    {
+        ctx = modbus_new_rtu(RTU_DEVICE, RTU_BAUD, RTU_PARITY, 8, 1);
+        if (ctx == NULL)
+        {
+            LOG_ERROR("RTU: invalid port settings for %s: %s\n", RTU_DEVICE, modbus_strerror(errno));
+            break;
+        }
+        modbus_set_slave(ctx, RTU_UNIT_ID);
+
+        if (modbus_connect(ctx) != 0)
+        {
+            if (!open_failed)
+            {
+                LOG_ERROR("RTU: cannot open %s: %s, retrying every %d ms\n", RTU_DEVICE, modbus_strerror(errno),
+                          RTU_RETRY_MS);
+                open_failed = 1;
+            }
+            else
+            {
+                LOG_DEBUG("RTU: cannot open %s: %s\n", RTU_DEVICE, modbus_strerror(errno));
+            }
+            modbus_free(ctx);
+            usleep(RTU_RETRY_MS * 1000);
+            continue;
+        }
+        open_failed = 0;
+
+        if (RTU_RS485 && (modbus_rtu_set_serial_mode(ctx, MODBUS_RTU_RS485) != 0))
+        {
+            LOG_WARN("RTU: no RS-485 mode on %s (%s), direction control left to the hardware\n",
+                     RTU_DEVICE, modbus_strerror(errno));
+        }
+
+        if (rtu_framer_open(&framer, modbus_get_socket(ctx), RTU_BAUD) != 0)
+        {
+            LOG_ERROR("RTU: cannot create the t3.5 timer: %s\n", strerror(errno));
+            modbus_close(ctx);
+            modbus_free(ctx);
+            break;
+        }
+
+        LOG_INFO("Modbus RTU slave %d on %s, %d baud, t3.5 %u us\n", RTU_UNIT_ID, RTU_DEVICE, RTU_BAUD, framer.t35_us);
+
+        while ((len = rtu_framer_next(&framer, frame, sizeof(frame))) > 0)
+        {
+            if ((frame[0] != RTU_UNIT_ID) && (frame[0] != MODBUS_BROADCAST_ADDRESS))
+            {
+                continue;
+            }
+
+            start_us = can_rtt_now_us();
+
+            process_modbus_request(ctx, mb_mapping, frame, len, RTU_CLIENT_ID);
+
+            metrics_observe(METRIC_H_REQUEST, can_rtt_now_us() - start_us);
+        }
+
+        LOG_ERROR("RTU: %s failed (%s), reopening; %llu frames, %llu CRC errors\n", RTU_DEVICE, strerror(errno),
+                  (unsigned long long)framer.stats.frames, (unsigned long long)framer.stats.crc_errors);
+        rtu_framer_close(&framer);
+        modbus_close(ctx);
+        modbus_free(ctx);
+        usleep(RTU_RETRY_MS * 1000);
+    }
+
+    regmap_reader_exit();
+    modbus_mapping_free(mb_mapping);
+
+    return NULL;
+}
+
+
+/**
+ * @brief Report a state change to the service manager (sd_notify protocol).
+ *
+ * Sends @p state (e.g. "READY=1") as one datagram to the AF_UNIX socket
+ * named in $NOTIFY_SOCKET. Does nothing when the bridge was not started
+ * by a service manager. A leading '@' names an abstract socket.
+ *
+ * @param state Newline separated KEY=VALUE assignments
+ */
+void notify_service_manager(const char *state)
+{
+    struct sockaddr_un  sun;
+    const char         *path = getenv("NOTIFY_SOCKET");
+    socklen_t           len;
+    size_t              path_len;
+    int                 fd;
+
+    if ((path == NULL) || (path[0] != '/' && path[0] != '@'))
+    {
+        return;
+    }
+
+    path_len = strlen(path);
+    if (path_len >= sizeof(sun.sun_path))
+    {
+        return;
+    }
+
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    memcpy(sun.sun_path, path, path_len);
+    if (sun.sun_path[0] == '@')
+    {
+        sun.sun_path[0] = '\0';
+    }
+    len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + path_len);
+
+    fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return;
+    }
+
+    if (sendto(fd, state, strlen(state), MSG_NOSIGNAL, (struct sockaddr *)&sun, len) < 0)
+    {
+        LOG_WARN("Service manager notification failed: %s\n", strerror(errno));
+    }
+
+    close(fd);
+}
+
+
+/**
+ * @brief Bring up the CAN interface and open a raw socket bound to it.
+ *
+ * Only 29-bit (extended) frames are received.
+ *
+ * @return CAN socket file descriptor, -1 on failure
+ */
+int setup_can_socket(const char *interface, int bitrate)
+{
+    struct sockaddr_can   addr;
+    struct ifreq          ifr;
+    struct can_filter     rfilter;
+    int                   socket_fd;
+
+    /*
+     * Initialize CAN interface
+     */
+    if (setup_can_interface(interface, bitrate) != 0)
+    {
+        return -1;
+    }
+
+    /*
+     * Create CAN socket
+     */
+    socket_fd = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+    if (socket_fd < 0)
+    {
+        LOG_ERROR("Socket creation failed\n");
+        return -1;
+    }
+
+    /*
+     * Configure CAN interface
+     */
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, interface, sizeof(ifr.ifr_name) - 1);
+    if (ioctl(socket_fd, SIOCGIFINDEX, &ifr) < 0)
+    {
+        LOG_ERROR("Error getting CAN interface index\n");
+        close(socket_fd);
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.can_family  = AF_CAN;
+    addr.can_ifindex = ifr.ifr_ifindex;
+
+    /*
+     * Bind CAN socket
+     */
+    if (bind(socket_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        LOG_ERROR("Error binding socket to CAN interface\n");
+        close(socket_fd);
+        return -1;
+    }
+
+    rfilter.can_id   = CAN_EFF_FLAG;           // Match only extended ID flag
+    rfilter.can_mask = CAN_EFF_FLAG;           // Filter only by EFF flag
+
+    /*
+     * Set filter: accept only 29-bit CAN frames
+     */
+    if (setsockopt(socket_fd, SOL_CAN_RAW, CAN_RAW_FILTER, &rfilter, sizeof(rfilter)) < 0)
+    {
+        LOG_ERROR("Error setting CAN filter for Extended ID frames\n");
+        close(socket_fd);
+        return -1;
+    }
+
+    return socket_fd;
+}
+
+
+/**
+ * @brief CAN start-up stage, runs concurrently with the Modbus listener.
+ *
+ * Brings up can0, retrying every CAN_INIT_RETRY_MS until it succeeds, then
+ * starts the heartbeat thread and the CAN scheduler. Until then CAN
+ * requests are refused by the scheduler and answered with
+ * MODBUS_EXCEPTION_SLAVE_OR_SERVER_BUSY, EEPROM registers are served
+ * normally.
+ *
+ * @param arg Unused
+ *
+ * @return NULL
+ */
+void *can_init_thread(void *arg)
+{
+    pthread_t   heartbeat_id;
+    int         socket_fd;
+    int         attempt = 0;
+
+    (void)arg;
+
+    /*
+     * Reset per-module round-trip estimators and circuit breakers
+     */
+    can_rtt_init();
+
+    while ((socket_fd = setup_can_socket(CAN_INTERFACE, CAN_BITRATE)) < 0)
+    {
+        attempt++;
+        LOG_WARN("CAN bring-up round %d failed, retrying in %d ms\n", attempt, CAN_INIT_RETRY_MS);
+        if (attempt == 1)
+        {
+            notify_service_manager("STATUS=Modbus listener up, CAN interface not available");
+        }
+        usleep(CAN_INIT_RETRY_MS * 1000);
+    }
+
+    can_socket_fd = socket_fd;
+
+    /*
+     * Create heartbeat thread
+     */
+    if (pthread_create(&heartbeat_id, NULL, heartbeat_thread, &can_socket_fd) != 0)
+    {
+        LOG_ERROR("Error creating heartbeat thread\n");
+    }
+    else
+    {
+        pthread_detach(heartbeat_id);
+    }
+
+    /*
+     * Start the CAN scheduler: from here on all CAN transactions of the
+     * client threads go through its worker thread
+     */
+    while (can_sched_start() != 0)
+    {
+        LOG_ERROR("Error creating CAN scheduler thread, retrying\n");
+        usleep(CAN_INIT_RETRY_MS * 1000);
+    }
+
+    can_ready = 1;
+
+    LOG_INFO("CAN ready %llu ms after start\n",
+             (unsigned long long)((can_rtt_now_us() - startup_us) / 1000));
+    notify_service_manager("READY=1\nSTATUS=Modbus TCP and CAN ready");
+
+    return NULL;
+}
+
+
+/**
+ * @brief Main function to initialize and manage Modbus and CAN communication.
+ *
+ * This function initializes the Modbus TCP server and the CAN interface.
+ * It sets up necessary sockets, handles incoming Modbus requests from clients,
+ * translates them into CAN messages, receives responses, maps them into Modbus
+ * registers, and sends the response back to the client.
+ *
+ * Every Modbus TCP client is served by its own thread (client_thread_fn), CAN
+ * transactions of all clients are serialized and prioritized by the CAN scheduler.
+ *
+ * Start-up stages run concurrently: the Modbus listener is up as soon as the
+ * register map is loaded, the CAN interface is brought up by can_init_thread
+ * meanwhile. Requests that need CAN are answered busy until it is ready; a
+ * CAN failure never terminates the bridge.
+ *
+ * It also creates a separate heartbeat thread to periodically send a CAN heartbeat
+ * message. All operations continue in a loop to support real-time communication.
+ *
+ * @return Returns 0 on success, -1 on failure.
+ */
+
+int main()
+{
+    /*
+     * Communication handles and structures
+     */
+    pthread_t             can_init_id;
+    pthread_t             rtu_thread;
+    discovery_config      discovery;
+
+    /*
+     * Modbus related variables
+     */
+    modbus_t             *ctx;
+    int                   server_socket;
+    int                   client_socket;
+
+    /*
+     * Client thread variables
+     */
+    bridge_client         *client;
+    pthread_t             client_thread;
+    struct sockaddr_in    peer;
+    socklen_t             peer_len;
+
+    startup_us = can_rtt_now_us();
+
+    /*
+     * Start the logger thread: from here on log calls only enqueue
+     */
+    if (log_async_start() != 0)
+    {
+        LOG_WARN("Logger thread not started, logging synchronously\n");
+    }
+
+    /*
+     * Initialize Modbus TCP context
+     */
+    ctx = modbus_new_tcp("0.0.0.0", SERVER_PORT);
+    if (!ctx)
+    {
+        LOG_ERROR("Failed to create Modbus context: %s\n", modbus_strerror(errno));
+        return -1;
+    }
+
+    /*
+     * Configure Modbus debugging
+     */
+    modbus_set_debug(ctx, 0);
+
+    /*
+     * Register map (address lookup), must exist before any request is served
+     */
+    if (setup_register_map() != 0)
+    {
+        modbus_free(ctx);
+        return -1;
+    }
+
+    /*
+     * Start Modbus TCP listener before anything slow: masters can connect
+     * right away and get a busy exception instead of a refused connection
+     */
+    server_socket = modbus_tcp_listen(ctx, BRIDGE_MAX_CLIENTS);
+    if (server_socket == -1)
+    {
+        LOG_ERROR("Failed to listen on Modbus TCP: %s\n", modbus_strerror(errno));
+        modbus_free(ctx);
+        return -1;
+    }
+
+    /*
+     * Server startup message
+     */
+    LOG_DEBUG("Modbus TCP Server started on port %d\n", SERVER_PORT);
+    LOG_INFO("Modbus listener up %llu ms after start\n",
+             (unsigned long long)((can_rtt_now_us() - startup_us) / 1000));
+    notify_service_manager("STATUS=Modbus listener up, CAN initializing");
+
+    /*
+     * Publish the register image for local consumers (optional). Here and
+     * the EEPROM below: before any thread that serves requests starts.
+     */
+    setup_register_image();
+
+    /*
+     * EE _prom mem pointer open with both read and write. Without it the
+     * EEPROM registers answer with an exception, CAN registers still work.
+     */
+    eeprom_fd = open(EEPROM_PATH, O_RDWR);
+    if (eeprom_fd < 0)
+    {
+        LOG_ERROR("Failed to open EEPROM: %s\n", strerror(errno));
+    }
+
+    /*
+     * Bring up CAN, heartbeat and CAN scheduler in the background
+     */
+    if (pthread_create(&can_init_id, NULL, can_init_thread, NULL) != 0)
+    {
+        LOG_ERROR("Error creating CAN init thread\n");
+        modbus_close(ctx);
+        modbus_free(ctx);
+        return -1;
+    }
+    pthread_detach(can_init_id);
+
+    /*
+     * Serial masters on the RS-485 port
+     */
+    if (RTU_DEVICE[0] != '\0')
+    {
+        if (pthread_create(&rtu_thread, NULL, rtu_thread_fn, NULL) != 0)
+        {
+            LOG_ERROR("Error creating RTU thread\n");
+        }
+        else
+        {
+            pthread_detach(rtu_thread);
+        }
+    }
+
+    /*
+     * Answer NEED_IP / NEED_INFO broadcasts (any unit ID is served)
+     */
+    memset(&discovery, 0, sizeof(discovery));
+    discovery.modbus_port = SERVER_PORT;
+    discovery.unit_count  = 0;
+    discovery.status      = discovery_status_fill;
+    if (discovery_start(&discovery) != 0)
+    {
+        LOG_ERROR("Discovery responder not started\n");
+    }
+
+    /*
+     * Counters and latencies for local scraping (Unix socket, HTTP on localhost)
+     */
+    metrics_add_collector(metrics_collect_bridge, NULL);
+    if (metrics_start(METRICS_SOCKET, METRICS_HTTP_PORT) != 0)
+    {
+        LOG_ERROR("Metrics exporter not started\n");
+    }
+
+    /*
+     * Main server loop
+     */
+    while (1)
+    {
+        /*
+         * Accept new client connection
+         */
+        client_socket = modbus_tcp_accept(ctx, &server_socket);
+        if (client_socket == -1)
+        {
+            LOG_ERROR("Failed to accept client: %s\n", modbus_strerror(errno));
+            continue;
+        }
+
+        if (active_clients >= BRIDGE_MAX_CLIENTS)
+        {
+            LOG_WARN("Too many clients (%d), connection refused\n", active_clients);
+            metrics_inc(METRIC_CLIENTS_REFUSED);
+            close(client_socket);
+            continue;
+        }
+
+        client = calloc(1, sizeof(*client));
+        if (client == NULL)
+        {
+            close(client_socket);
+            continue;
+        }
+
+        /*
+         * The client's IPv4 address identifies it for rate limiting
+         */
+        peer_len = sizeof(peer);
+        if (getpeername(client_socket, (struct sockaddr *)&peer, &peer_len) == 0)
+        {
+            client->client_id = ntohl(peer.sin_addr.s_addr);
+        }
+
+        client->socket = client_socket;
+        client->ctx    = modbus_new_tcp("0.0.0.0", SERVER_PORT);
+        if (client->ctx == NULL)
+        {
+            LOG_ERROR("Failed to create Modbus client context: %s\n", modbus_strerror(errno));
+            close(client_socket);
+            free(client);
+            continue;
+        }
+        modbus_set_socket(client->ctx, client_socket);
+
+        active_clients++;
+
+        if (pthread_create(&client_thread, NULL, client_thread_fn, client) != 0)
+        {
+            LOG_ERROR("Error creating client thread\n");
+            active_clients--;
+            modbus_close(client->ctx);
+            modbus_free(client->ctx);
+            free(client);
+            continue;
+        }
+        pthread_detach(client_thread);
+        metrics_inc(METRIC_CLIENTS_ACCEPTED);
+
+        LOG_DEBUG("Client connected.\n");
+    }
+
+    /*
+     * Cleanup before exit
+     */
+    shm_image_destroy(register_image);
+    log_async_stop();
+    close(can_socket_fd);
     modbus_free(ctx);
     return 0;
 
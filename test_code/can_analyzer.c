@@ -0,0 +1,1190 @@
+/**
+ *  @file    can_analyzer.c
+ *  @brief   CAN bus load analyzer and offline ETU transaction reconstructor
+ *
+ *  Answers "is it the bus, the ETU or the bridge?" from traffic alone.
+ *  Input is a live CAN interface or a candump log:
+ *
+ *    candump -l can0                       (1700000000.123456) can0 01210333#0102...
+ *    candump -ta can0 > file               (1700000000.123456)  can0  01210333   [8]  01 02 ...
+ *
+ *  Every 29-bit ID is decoded per modbus/doc/can_id.txt (etu_protocol.h)
+ *  and the ETU transfers are rebuilt from their frames:
+ *
+ *    read    READ_REQ / DELTA_READ_REQ, READ_RESP #k, READ_ACK #k
+ *    write   WRITE_REQ, WRITE_GRANT, WRITE_DATA #k, WRITE_ACK #k,
+ *            WRITE_TERM, WRITE_TERM_ACK
+ *
+ *  Reported:
+ *
+ *    bus       load % at -b bit/s (exact frame length incl. bit stuffing,
+ *              CRC, ACK, EOF and intermission), average and peak per
+ *              second; frames per message type
+ *    phases    latency distributions split by who is waited for:
+ *                etu     request -> first fragment / grant,
+ *                        ACK #k -> fragment #k+1, data #k -> ACK #k,
+ *                        termination -> termination ACK
+ *                bridge  fragment #k -> ACK #k, grant / ACK #k -> next
+ *                        data fragment or termination
+ *                total   request -> last frame of the transfer
+ *    per key   transfers, completed, incomplete (no frame for -t ms),
+ *              retransmissions (repeated request / ACK / data / fragment),
+ *              CRC failures and total latency per module address,
+ *              module ID, data header and Data ID
+ *
+ *  Read lengths come from data[0] of the request in registers, delta
+ *  reads from the stream header in fragment #0. Bit reads (FC 1/2) are
+ *  shorter than that: a read whose fragments are all acknowledged when it
+ *  goes quiet (or its key is requested again) counts as completed at its
+ *  last ACK.
+ *
+ *    gcc -O2 can_analyzer.c etu_protocol.c can_delta.c -o can_analyzer -lm
+ *    ./can_analyzer -f trace.log [-b 1000000] [-t 1000]
+ *    ./can_analyzer -i can0 [-r report_s]          (Ctrl-C for the final report)
+ *
+ *  @author  Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <math.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <net/if.h>
+#include "etu_protocol.h"
+#include "can_delta.h"
+
+
+#define AN_MAX_OPEN             256         /* Transfers being rebuilt            */
+#define AN_MAX_KEYS             1024        /* Module / header / Data ID rows     */
+#define AN_DEFAULT_BITRATE      1000000
+#define AN_DEFAULT_TIMEOUT_MS   1000
+
+#define AN_HIST_SUB_BITS        5
+#define AN_HIST_SUB             (1 << AN_HIST_SUB_BITS)
+#define AN_HIST_POWERS          27
+#define AN_HIST_BUCKETS         (AN_HIST_POWERS * AN_HIST_SUB)
+
+/*
+ * Latency phases
+ */
+#define PH_ETU_FIRST            0           /* Request -> fragment #0 / grant     */
+#define PH_ETU_NEXT             1           /* ACK #k -> fragment #k+1            */
+#define PH_ETU_WRITE_ACK        2           /* Data #k -> ACK #k                  */
+#define PH_ETU_TERM             3           /* Termination -> termination ACK     */
+#define PH_BRIDGE_ACK           4           /* Fragment #k -> ACK #k              */
+#define PH_BRIDGE_DATA          5           /* Grant / ACK #k -> next data / term */
+#define PH_READ_TOTAL           6
+#define PH_WRITE_TOTAL          7
+#define PH_COUNT                8
+
+static const char *const phase_names[PH_COUNT] = {
+    "etu: request -> first answer", "etu: ACK -> next fragment", "etu: data -> write ACK",
+    "etu: term -> term ACK", "bridge: fragment -> ACK", "bridge: grant/ACK -> next data",
+    "total read", "total write"
+};
+
+
+typedef struct {
+    uint64_t    count;
+    uint64_t    max_us;
+    uint64_t    buckets[AN_HIST_BUCKETS];
+} an_hist;
+
+/*
+ * Row of the per-key report
+ */
+typedef struct {
+    uint32_t    key;                /* Request ID with message type 0      */
+    uint8_t     write;
+    uint64_t    transfers;
+    uint64_t    completed;
+    uint64_t    incomplete;
+    uint64_t    retransmits;
+    uint64_t    crc_errors;
+    an_hist     total;
+} an_key;
+
+/*
+ * Transfer being rebuilt
+ */
+typedef struct {
+    uint32_t    key;
+    uint8_t     in_use;
+    uint8_t     write;
+    uint8_t     delta;
+    uint8_t     answered;           /* First fragment / grant seen         */
+    uint16_t    len;                /* Range length in bytes from data[0]  */
+    uint16_t    frags;              /* Expected, exact for writes          */
+    int32_t     last_frag;          /* Highest fragment / data seen         */
+    int32_t     last_ack;           /* Highest ACK seen                     */
+    uint64_t    start_us;
+    uint64_t    last_us;            /* Last frame of this transfer          */
+    uint64_t    prev_us;            /* Time of the frame the next one answers */
+    an_key     *row;
+} an_xfer;
+
+
+static an_hist          phases[PH_COUNT];
+static an_key           keys[AN_MAX_KEYS];
+static int              key_count;
+static an_xfer          open_xfers[AN_MAX_OPEN];
+
+static uint64_t         type_frames[16];
+static uint64_t         other_frames;
+static uint64_t         crc_total;
+static uint64_t         orphan_frames;      /* No transfer to attach to     */
+static uint64_t         total_frames;
+static uint64_t         total_bits;
+static uint64_t         first_us;
+static uint64_t         last_us;
+static uint64_t         window_start_us;
+static uint64_t         window_bits;
+static double           peak_load;
+
+static uint32_t         bitrate    = AN_DEFAULT_BITRATE;
+static uint32_t         timeout_ms = AN_DEFAULT_TIMEOUT_MS;
+static volatile sig_atomic_t stop;
+
+
+/***************************************************************
+ *  Histogram
+ ***************************************************************/
+
+static void hist_add(an_hist *h, uint64_t us)
+{
+    int power;
+    int b;
+
+    if (us < AN_HIST_SUB)
+    {
+        b = (int)us;
+    }
+    else
+    {
+        power = 63 - __builtin_clzll(us);
+        if (power - AN_HIST_SUB_BITS + 1 >= AN_HIST_POWERS)
+        {
+            b = AN_HIST_BUCKETS - 1;
+        }
+        else
+        {
+            b = (power - AN_HIST_SUB_BITS + 1) * AN_HIST_SUB +
+                (int)((us >> (power - AN_HIST_SUB_BITS)) - AN_HIST_SUB);
+        }
+    }
+
+    h->buckets[b]++;
+    h->count++;
+    if (us > h->max_us)
+    {
+        h->max_us = us;
+    }
+}
+
+static uint64_t hist_pct(const an_hist *h, double pct)
+{
+    uint64_t want = (uint64_t)ceil(pct / 100.0 * (double)h->count);
+    uint64_t seen = 0;
+    uint64_t v;
+    int      power;
+    int      b;
+
+    if (h->count == 0)
+    {
+        return 0;
+    }
+    if (want == 0)
+    {
+        want = 1;
+    }
+
+    for (b = 0; b < AN_HIST_BUCKETS; b++)
+    {
+        seen += h->buckets[b];
+        if (seen >= want)
+        {
+            power = b / AN_HIST_SUB;
+            v = power ? ((uint64_t)(AN_HIST_SUB + b % AN_HIST_SUB + 1) << (power - 1)) - 1 : (uint64_t)b;
+            return (v < h->max_us) ? v : h->max_us;
+        }
+    }
+
+    return h->max_us;
+}
+
+
+/***************************************************************
+ *  Bus timing
+ ***************************************************************/
+
+/**
+ * @brief Length on the wire of a data frame in bits, with bit stuffing.
+ *
+ * SOF .. CRC are stuffed (a complement bit after five equal bits); CRC
+ * delimiter, ACK slot + delimiter, EOF and the 3-bit intermission are not.
+ */
+static uint32_t frame_bits(uint32_t can_id, int extended, uint8_t dlc, const uint8_t *data)
+{
+    uint8_t  bits[160];
+    int      n = 0;
+    int      i;
+    int      b;
+    uint16_t crc = 0;
+    int      run;
+    int      stuffed;
+    uint8_t  last;
+
+#define PUT(v) (bits[n++] = (uint8_t)((v) ? 1 : 0))
+
+    PUT(0);                                         /* SOF */
+    if (extended)
+    {
+        for (i = 28; i >= 18; i--) PUT((can_id >> i) & 1);
+        PUT(1);                                     /* SRR */
+        PUT(1);                                     /* IDE */
+        for (i = 17; i >= 0; i--) PUT((can_id >> i) & 1);
+        PUT(0);                                     /* RTR */
+        PUT(0);                                     /* r1  */
+        PUT(0);                                     /* r0  */
+    }
+    else
+    {
+        for (i = 10; i >= 0; i--) PUT((can_id >> i) & 1);
+        PUT(0);                                     /* RTR */
+        PUT(0);                                     /* IDE */
+        PUT(0);                                     /* r0  */
+    }
+    for (i = 3; i >= 0; i--) PUT((dlc >> i) & 1);
+    for (i = 0; i < dlc && i < 8; i++)
+    {
+        for (b = 7; b >= 0; b--) PUT((data[i] >> b) & 1);
+    }
+
+    /*
+     * CRC-15 (polynomial 0x4599) over SOF .. data
+     */
+    for (i = 0; i < n; i++)
+    {
+        int nxt = bits[i] ^ ((crc >> 14) & 1);
+        crc = (uint16_t)((crc << 1) & 0x7FFF);
+        if (nxt)
+        {
+            crc ^= 0x4599;
+        }
+    }
+    for (i = 14; i >= 0; i--) PUT((crc >> i) & 1);
+
+#undef PUT
+
+    stuffed = 0;
+    run     = 1;
+    last    = bits[0];
+    for (i = 1; i < n; i++)
+    {
+        if (bits[i] == last)
+        {
+            run++;
+            if (run == 5)
+            {
+                /*
+                 * The stuff bit starts a new run of its own value
+                 */
+                stuffed++;
+                last = (uint8_t)!last;
+                run  = 1;
+            }
+        }
+        else
+        {
+            last = bits[i];
+            run  = 1;
+        }
+    }
+
+    return (uint32_t)n + (uint32_t)stuffed + 1 + 2 + 7 + 3;
+}
+
+
+static void account_bus(uint64_t ts_us, uint32_t bits)
+{
+    double load;
+
+    if (first_us == 0)
+    {
+        first_us        = ts_us;
+        window_start_us = ts_us;
+    }
+
+    while (ts_us >= window_start_us + 1000000)
+    {
+        load = 100.0 * (double)window_bits / (double)bitrate;
+        if (load > peak_load)
+        {
+            peak_load = load;
+        }
+        window_bits      = 0;
+        window_start_us += 1000000;
+    }
+
+    window_bits += bits;
+    total_bits  += bits;
+    last_us      = ts_us;
+}
+
+
+/***************************************************************
+ *  Transfer reconstruction
+ ***************************************************************/
+
+static an_key *key_row(uint32_t key, uint8_t write)
+{
+    int i;
+
+    for (i = 0; i < key_count; i++)
+    {
+        if ((keys[i].key == key) && (keys[i].write == write))
+        {
+            return &keys[i];
+        }
+    }
+
+    if (key_count >= AN_MAX_KEYS)
+    {
+        return &keys[AN_MAX_KEYS - 1];      /* Overflow row, still counted */
+    }
+
+    memset(&keys[key_count], 0, sizeof(keys[0]));
+    keys[key_count].key   = key;
+    keys[key_count].write = write;
+
+    return &keys[key_count++];
+}
+
+
+static void xfer_close(an_xfer *x, int completed, uint64_t end_us)
+{
+    if (completed)
+    {
+        x->row->completed++;
+        hist_add(&x->row->total, end_us - x->start_us);
+        hist_add(&phases[x->write ? PH_WRITE_TOTAL : PH_READ_TOTAL], end_us - x->start_us);
+    }
+    else
+    {
+        x->row->incomplete++;
+    }
+
+    x->in_use = 0;
+}
+
+
+/**
+ * @brief Give up a transfer that went quiet or was superseded.
+ *
+ * A read with every fragment seen acknowledged was shorter than data[0]
+ * suggested (bit read) and finished at its last ACK.
+ */
+static void xfer_abandon(an_xfer *x)
+{
+    xfer_close(x, !x->write && (x->last_frag >= 0) && (x->last_ack == x->last_frag), x->last_us);
+}
+
+
+static void expire(uint64_t now)
+{
+    int i;
+
+    for (i = 0; i < AN_MAX_OPEN; i++)
+    {
+        if (open_xfers[i].in_use && (now - open_xfers[i].last_us > (uint64_t)timeout_ms * 1000))
+        {
+            xfer_abandon(&open_xfers[i]);
+        }
+    }
+}
+
+
+static an_xfer *xfer_find(uint32_t key, uint8_t write)
+{
+    int i;
+
+    for (i = 0; i < AN_MAX_OPEN; i++)
+    {
+        if (open_xfers[i].in_use && (open_xfers[i].key == key) && (open_xfers[i].write == write))
+        {
+            return &open_xfers[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief Open transfer owning fragment @p can_id of @p msg_type.
+ *
+ * Fragment IDs of transfers at nearby Data IDs overlap; the most recently
+ * active candidate wins.
+ */
+static an_xfer *xfer_for_fragment(uint32_t can_id, uint8_t msg_type, uint8_t write, int32_t *index)
+{
+    an_xfer  *best = NULL;
+    an_xfer  *x;
+    uint32_t  first;
+    uint32_t  k;
+    int       i;
+
+    for (i = 0; i < AN_MAX_OPEN; i++)
+    {
+        x = &open_xfers[i];
+        if (!x->in_use || (x->write != write))
+        {
+            continue;
+        }
+
+        first = etu_frag_id(x->key, msg_type, 0);
+        if ((can_id < first) || ((can_id - first) % ETU_FRAG_ID_STEP))
+        {
+            continue;
+        }
+
+        k = (can_id - first) / ETU_FRAG_ID_STEP;
+        if (k > x->frags)
+        {
+            continue;
+        }
+
+        if ((best == NULL) || (x->last_us > best->last_us))
+        {
+            best   = x;
+            *index = (int32_t)k;
+        }
+    }
+
+    return best;
+}
+
+
+static an_xfer *xfer_open(uint32_t key, uint8_t write, uint64_t ts)
+{
+    an_xfer *x = NULL;
+    int      i;
+
+    for (i = 0; i < AN_MAX_OPEN; i++)
+    {
+        if (!open_xfers[i].in_use)
+        {
+            x = &open_xfers[i];
+            break;
+        }
+    }
+
+    if (x == NULL)
+    {
+        /*
+         * Table full: the oldest one is given up
+         */
+        x = &open_xfers[0];
+        for (i = 1; i < AN_MAX_OPEN; i++)
+        {
+            if (open_xfers[i].last_us < x->last_us)
+            {
+                x = &open_xfers[i];
+            }
+        }
+        xfer_abandon(x);
+    }
+
+    memset(x, 0, sizeof(*x));
+    x->in_use    = 1;
+    x->key       = key;
+    x->write     = write;
+    x->last_frag = -1;
+    x->last_ack  = -1;
+    x->start_us  = ts;
+    x->last_us   = ts;
+    x->prev_us   = ts;
+    x->row       = key_row(key, write);
+    x->row->transfers++;
+
+    return x;
+}
+
+
+static void on_request(uint32_t can_id, const uint8_t *data, uint64_t ts, uint8_t write)
+{
+    uint32_t  key = etu_id_with_type(can_id, ETU_MSG_READ_REQ);
+    an_xfer  *x   = xfer_find(key, write);
+
+    /*
+     * Same request again before any answer: retransmission
+     */
+    if ((x != NULL) && !x->answered)
+    {
+        x->row->retransmits++;
+        x->last_us = ts;
+        x->prev_us = ts;
+        return;
+    }
+
+    if (x != NULL)
+    {
+        xfer_abandon(x);
+    }
+
+    x        = xfer_open(key, write, ts);
+    x->len   = (uint16_t)(data[0] * 2);
+    x->delta = (etu_id_type(can_id) == ETU_MSG_DELTA_READ_REQ);
+
+    if (write)
+    {
+        x->frags = etu_frag_count(x->len);
+    }
+    else if (x->delta)
+    {
+        x->frags = etu_frag_count(CAN_DELTA_MAX_STREAM);    /* Until fragment #0 */
+    }
+    else
+    {
+        x->frags = etu_frag_count(x->len) ? etu_frag_count(x->len) : 1;
+    }
+}
+
+
+static void on_read_response(uint32_t can_id, const uint8_t *data, uint64_t ts)
+{
+    an_xfer *x;
+    int32_t  k = 0;
+    int      len;
+
+    x = xfer_for_fragment(can_id, ETU_MSG_READ_RESP, 0, &k);
+    if (x == NULL)
+    {
+        orphan_frames++;
+        return;
+    }
+
+    if (k <= x->last_frag)
+    {
+        x->row->retransmits++;
+    }
+    else
+    {
+        hist_add(&phases[(k == 0) ? PH_ETU_FIRST : PH_ETU_NEXT], ts - x->prev_us);
+        x->last_frag = k;
+        x->answered  = 1;
+
+        /*
+         * Delta response: fragment #0 announces the stream length
+         */
+        if ((k == 0) && x->delta)
+        {
+            len = can_delta_stream_length(data, x->len);
+            if (len > 0)
+            {
+                x->frags = etu_frag_count((uint16_t)len);
+            }
+        }
+    }
+
+    x->prev_us = ts;
+    x->last_us = ts;
+}
+
+
+static void on_read_ack(uint32_t can_id, uint64_t ts)
+{
+    an_xfer *x;
+    int32_t  k = 0;
+
+    x = xfer_for_fragment(can_id, ETU_MSG_READ_ACK, 0, &k);
+    if (x == NULL)
+    {
+        orphan_frames++;
+        return;
+    }
+
+    if (k <= x->last_ack)
+    {
+        x->row->retransmits++;
+    }
+    else
+    {
+        hist_add(&phases[PH_BRIDGE_ACK], ts - x->prev_us);
+        x->last_ack = k;
+    }
+
+    x->prev_us = ts;
+    x->last_us = ts;
+
+    if (k + 1 >= x->frags)
+    {
+        xfer_close(x, 1, ts);
+    }
+}
+
+
+static void on_write_frame(uint32_t can_id, uint8_t type, uint64_t ts)
+{
+    an_xfer  *x;
+    uint32_t  key;
+    int32_t   k = 0;
+
+    switch (type)
+    {
+        case ETU_MSG_WRITE_GRANT:
+            key = etu_id_with_type(can_id, ETU_MSG_READ_REQ);
+            x   = xfer_find(key, 1);
+            if (x == NULL)
+            {
+                orphan_frames++;
+                return;
+            }
+            if (x->answered)
+            {
+                x->row->retransmits++;
+            }
+            else
+            {
+                hist_add(&phases[PH_ETU_FIRST], ts - x->prev_us);
+                x->answered = 1;
+            }
+            break;
+
+        case ETU_MSG_WRITE_DATA:
+        case ETU_MSG_WRITE_TERM:
+            x = xfer_for_fragment(can_id, type, 1, &k);
+            if (x == NULL)
+            {
+                orphan_frames++;
+                return;
+            }
+            if ((type == ETU_MSG_WRITE_DATA) ? (k <= x->last_frag) : (x->last_frag >= (int32_t)x->frags))
+            {
+                x->row->retransmits++;
+            }
+            else
+            {
+                hist_add(&phases[PH_BRIDGE_DATA], ts - x->prev_us);
+                x->last_frag = (type == ETU_MSG_WRITE_DATA) ? k : (int32_t)x->frags;
+            }
+            break;
+
+        case ETU_MSG_WRITE_ACK:
+        case ETU_MSG_WRITE_TERM_ACK:
+            x = xfer_for_fragment(can_id, type, 1, &k);
+            if (x == NULL)
+            {
+                orphan_frames++;
+                return;
+            }
+            if (k <= x->last_ack)
+            {
+                x->row->retransmits++;
+            }
+            else
+            {
+                hist_add(&phases[(type == ETU_MSG_WRITE_ACK) ? PH_ETU_WRITE_ACK : PH_ETU_TERM], ts - x->prev_us);
+                x->last_ack = k;
+            }
+            x->prev_us = ts;
+            x->last_us = ts;
+            if (type == ETU_MSG_WRITE_TERM_ACK)
+            {
+                xfer_close(x, 1, ts);
+            }
+            return;
+
+        default:
+            return;
+    }
+
+    x->prev_us = ts;
+    x->last_us = ts;
+}
+
+
+/**
+ * @brief Count a CRC failure against the transfer's row (or an own row).
+ */
+static void on_crc_error(uint32_t can_id)
+{
+    uint8_t  type  = etu_id_type(can_id);
+    uint8_t  write = (type >= ETU_MSG_WRITE_REQ) && (type <= ETU_MSG_WRITE_TERM_ACK);
+    an_xfer *x     = NULL;
+    int32_t  k;
+
+    crc_total++;
+
+    if ((type == ETU_MSG_READ_RESP) || (type == ETU_MSG_READ_ACK) || (type == ETU_MSG_WRITE_DATA) ||
+        (type == ETU_MSG_WRITE_ACK) || (type == ETU_MSG_WRITE_TERM) || (type == ETU_MSG_WRITE_TERM_ACK))
+    {
+        x = xfer_for_fragment(can_id, type, write, &k);
+    }
+
+    if (x != NULL)
+    {
+        x->row->crc_errors++;
+    }
+    else
+    {
+        key_row(etu_id_with_type(can_id, ETU_MSG_READ_REQ), write)->crc_errors++;
+    }
+}
+
+
+static void process_frame(uint64_t ts, uint32_t raw_id, uint8_t dlc, const uint8_t *data)
+{
+    uint32_t can_id   = raw_id & CAN_EFF_MASK;
+    int      extended = (raw_id & CAN_EFF_FLAG) != 0;
+    uint8_t  type;
+
+    if (raw_id & CAN_ERR_FLAG)
+    {
+        return;
+    }
+
+    total_frames++;
+    account_bus(ts, frame_bits(can_id, extended, dlc, data));
+    expire(ts);
+
+    if (!extended || (dlc != ETU_FRAME_LEN))
+    {
+        other_frames++;
+        return;
+    }
+
+    type = etu_id_type(can_id);
+    type_frames[type]++;
+
+    if (!etu_frame_check(data))
+    {
+        on_crc_error(can_id);
+        return;
+    }
+
+    switch (type)
+    {
+        case ETU_MSG_READ_REQ:
+        case ETU_MSG_DELTA_READ_REQ:
+            on_request(can_id, data, ts, 0);
+            break;
+        case ETU_MSG_WRITE_REQ:
+            on_request(can_id, data, ts, 1);
+            break;
+        case ETU_MSG_READ_RESP:
+            on_read_response(can_id, data, ts);
+            break;
+        case ETU_MSG_READ_ACK:
+            on_read_ack(can_id, ts);
+            break;
+        case ETU_MSG_WRITE_GRANT:
+        case ETU_MSG_WRITE_DATA:
+        case ETU_MSG_WRITE_ACK:
+        case ETU_MSG_WRITE_TERM:
+        case ETU_MSG_WRITE_TERM_ACK:
+            on_write_frame(can_id, type, ts);
+            break;
+        default:
+            other_frames++;     /* Heartbeat and other message types */
+            break;
+    }
+}
+
+
+/***************************************************************
+ *  Input
+ ***************************************************************/
+
+static int hexval(char c)
+{
+    if ((c >= '0') && (c <= '9')) return c - '0';
+    if ((c >= 'a') && (c <= 'f')) return c - 'a' + 10;
+    if ((c >= 'A') && (c <= 'F')) return c - 'A' + 10;
+    return -1;
+}
+
+
+/**
+ * @brief Parse one candump line (-l log format or -ta screen format).
+ *
+ * @return 0 on success, -1 if the line is not a data frame
+ */
+static int parse_candump(const char *line, uint64_t *ts, uint32_t *raw_id, uint8_t *dlc, uint8_t *data)
+{
+    const char *p = strchr(line, '(');
+    char        ifname[IFNAMSIZ + 1];
+    char        frame[64];
+    char       *hash;
+    double      sec;
+    int         consumed;
+    int         hi;
+    int         lo;
+    unsigned    byte;
+    unsigned    n;
+
+    if ((p == NULL) || (sscanf(p, "(%lf) %16s %63s%n", &sec, ifname, frame, &consumed) != 3))
+    {
+        return -1;
+    }
+
+    *ts  = (uint64_t)(sec * 1e6 + 0.5);
+    *dlc = 0;
+
+    hash = strchr(frame, '#');
+    if (hash != NULL)
+    {
+        /*
+         * Log format: ID#HEX
+         */
+        *hash = '\0';
+        p     = hash + 1;
+        if ((p[0] == 'R') || (p[0] == '#'))
+        {
+            return -1;          /* Remote or CAN FD frame */
+        }
+
+        while ((*dlc < 8) && ((hi = hexval(p[0])) >= 0) && ((lo = hexval(p[1])) >= 0))
+        {
+            data[(*dlc)++] = (uint8_t)((hi << 4) | lo);
+            p += 2;
+        }
+    }
+    else
+    {
+        /*
+         * Screen format: ID  [n]  bytes
+         */
+        p += consumed;
+        if (sscanf(p, " [%u]%n", &n, &consumed) != 1)
+        {
+            return -1;
+        }
+        p += consumed;
+
+        while (*dlc < ((n > 8) ? 8 : n))
+        {
+            if (sscanf(p, " %2x%n", &byte, &consumed) != 1)
+            {
+                return -1;
+            }
+            data[(*dlc)++] = (uint8_t)byte;
+            p += consumed;
+        }
+    }
+
+    /*
+     * candump prints extended IDs with 8 digits, standard ones with 3
+     */
+    *raw_id = (uint32_t)strtoul(frame, NULL, 16);
+    if (strlen(frame) > 3)
+    {
+        *raw_id |= CAN_EFF_FLAG;
+    }
+
+    return 0;
+}
+
+
+static int read_file(const char *path)
+{
+    FILE    *f = (strcmp(path, "-") == 0) ? stdin : fopen(path, "r");
+    char     line[512];
+    uint64_t ts;
+    uint32_t raw_id;
+    uint8_t  dlc;
+    uint8_t  data[8];
+    uint64_t lines = 0;
+    uint64_t skipped = 0;
+
+    if (f == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        lines++;
+        memset(data, 0, sizeof(data));
+        if (parse_candump(line, &ts, &raw_id, &dlc, data) != 0)
+        {
+            skipped++;
+            continue;
+        }
+        process_frame(ts, raw_id, dlc, data);
+    }
+
+    if (f != stdin)
+    {
+        fclose(f);
+    }
+
+    if (skipped)
+    {
+        fprintf(stderr, "%llu of %llu lines not parsed as data frames\n",
+                (unsigned long long)skipped, (unsigned long long)lines);
+    }
+
+    return 0;
+}
+
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+
+static void print_report(void);
+
+static int read_live(const char *interface, uint32_t report_s)
+{
+    struct sockaddr_can  addr;
+    struct ifreq         ifr;
+    struct can_frame     frame;
+    struct iovec         iov;
+    struct msghdr        msg;
+    struct cmsghdr      *cmsg;
+    struct timeval       tv;
+    char                 ctrl[CMSG_SPACE(sizeof(struct timespec))];
+    struct timespec      stamp;
+    uint64_t             ts;
+    uint64_t             next_report = 0;
+    int                  sock;
+    int                  one = 1;
+
+    sock = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+    if (sock < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, interface, IFNAMSIZ - 1);
+    if (ioctl(sock, SIOCGIFINDEX, &ifr) < 0)
+    {
+        fprintf(stderr, "CAN interface %s: %s\n", interface, strerror(errno));
+        close(sock);
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.can_family  = AF_CAN;
+    addr.can_ifindex = ifr.ifr_ifindex;
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("bind");
+        close(sock);
+        return -1;
+    }
+
+    /*
+     * Kernel receive time stamps: the latencies do not include our scheduling
+     */
+    setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one));
+    tv.tv_sec  = 0;
+    tv.tv_usec = 200000;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    while (!stop)
+    {
+        iov.iov_base       = &frame;
+        iov.iov_len        = sizeof(frame);
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov        = &iov;
+        msg.msg_iovlen     = 1;
+        msg.msg_control    = ctrl;
+        msg.msg_controllen = sizeof(ctrl);
+
+        if (recvmsg(sock, &msg, 0) != sizeof(frame))
+        {
+            continue;
+        }
+
+        clock_gettime(CLOCK_REALTIME, &stamp);
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_TIMESTAMPNS))
+            {
+                memcpy(&stamp, CMSG_DATA(cmsg), sizeof(stamp));
+            }
+        }
+
+        ts = (uint64_t)stamp.tv_sec * 1000000ULL + (uint64_t)stamp.tv_nsec / 1000;
+        process_frame(ts, frame.can_id, frame.can_dlc, frame.data);
+
+        if (report_s)
+        {
+            if (next_report == 0)
+            {
+                next_report = ts + (uint64_t)report_s * 1000000ULL;
+            }
+            else if (ts >= next_report)
+            {
+                print_report();
+                next_report += (uint64_t)report_s * 1000000ULL;
+            }
+        }
+    }
+
+    close(sock);
+    return 0;
+}
+
+
+/***************************************************************
+ *  Report
+ ***************************************************************/
+
+static void print_hist_row(const char *name, const an_hist *h)
+{
+    printf("  %-32s %8llu %8llu %8llu %8llu %8llu %8llu\n", name, (unsigned long long)h->count,
+           (unsigned long long)hist_pct(h, 50), (unsigned long long)hist_pct(h, 90),
+           (unsigned long long)hist_pct(h, 99), (unsigned long long)hist_pct(h, 99.9),
+           (unsigned long long)h->max_us);
+}
+
+
+static int cmp_key(const void *a, const void *b)
+{
+    const an_key *x = a;
+    const an_key *y = b;
+
+    if (x->key != y->key)
+    {
+        return (x->key > y->key) ? 1 : -1;
+    }
+    return x->write - y->write;
+}
+
+
+static void print_report(void)
+{
+    double   seconds = (last_us > first_us) ? (double)(last_us - first_us) / 1e6 : 0.0;
+    etu_id   id;
+    an_key   sorted[AN_MAX_KEYS];
+    int      i;
+
+    printf("\n=== bus ===\n");
+    printf("  %llu frames in %.3f s, %llu bits on the wire at %u bit/s\n",
+           (unsigned long long)total_frames, seconds, (unsigned long long)total_bits, bitrate);
+    if (seconds > 0)
+    {
+        printf("  load: average %.1f %%, peak %.1f %% (1 s windows)\n",
+               100.0 * (double)total_bits / (seconds * bitrate),
+               (peak_load > 100.0 * window_bits / bitrate) ? peak_load : 100.0 * window_bits / bitrate);
+    }
+    printf("  frames per type:");
+    for (i = 0; i < 16; i++)
+    {
+        if (type_frames[i])
+        {
+            printf(" %s=%llu", etu_msg_name((uint8_t)i), (unsigned long long)type_frames[i]);
+        }
+    }
+    printf("\n  other frames %llu, CRC failures %llu, frames without transfer %llu\n",
+           (unsigned long long)other_frames, (unsigned long long)crc_total, (unsigned long long)orphan_frames);
+
+    printf("\n=== phases (us) ===\n");
+    printf("  %-32s %8s %8s %8s %8s %8s %8s\n", "", "count", "p50", "p90", "p99", "p99.9", "max");
+    for (i = 0; i < PH_COUNT; i++)
+    {
+        print_hist_row(phase_names[i], &phases[i]);
+    }
+
+    printf("\n=== transfers per module / Data ID ===\n");
+    printf("  %-4s %-3s %-3s %-6s %-5s %8s %8s %8s %8s %6s %8s %8s\n", "addr", "mod", "hdr", "dataid",
+           "op", "xfers", "ok", "incompl", "retx", "crc", "p50 us", "p99 us");
+
+    memcpy(sorted, keys, sizeof(an_key) * (size_t)key_count);
+    qsort(sorted, (size_t)key_count, sizeof(an_key), cmp_key);
+
+    for (i = 0; i < key_count; i++)
+    {
+        etu_id_parse(sorted[i].key, &id);
+        printf("  %-4u %-3u %-3u 0x%04X %-5s %8llu %8llu %8llu %8llu %6llu %8llu %8llu\n",
+               id.module_addr, id.module_id, id.data_header, id.data_id, sorted[i].write ? "write" : "read",
+               (unsigned long long)sorted[i].transfers, (unsigned long long)sorted[i].completed,
+               (unsigned long long)sorted[i].incomplete, (unsigned long long)sorted[i].retransmits,
+               (unsigned long long)sorted[i].crc_errors,
+               (unsigned long long)hist_pct(&sorted[i].total, 50), (unsigned long long)hist_pct(&sorted[i].total, 99));
+    }
+
+    fflush(stdout);
+}
+
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s (-f candump.log | -f - | -i interface [-r report_s]) [-b bitrate] [-t timeout_ms]\n", prog);
+}
+
+
+int main(int argc, char *argv[])
+{
+    const char *file      = NULL;
+    const char *interface = NULL;
+    uint32_t    report_s  = 0;
+    int         opt;
+    int         i;
+
+    while ((opt = getopt(argc, argv, "f:i:b:t:r:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'f': file       = optarg; break;
+            case 'i': interface  = optarg; break;
+            case 'b': bitrate    = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 't': timeout_ms = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'r': report_s   = (uint32_t)strtoul(optarg, NULL, 0); break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (((file == NULL) == (interface == NULL)) || (bitrate == 0))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if ((file != NULL) ? (read_file(file) != 0) : (read_live(interface, report_s) != 0))
+    {
+        return 1;
+    }
+
+    /*
+     * Transfers still open at the end of the trace
+     */
+    for (i = 0; i < AN_MAX_OPEN; i++)
+    {
+        if (open_xfers[i].in_use)
+        {
+            xfer_abandon(&open_xfers[i]);
+        }
+    }
+
+    print_report();
+
+    return 0;
+}
@@ -0,0 +1,796 @@
+/**
+ *  @file    can_capacity.c
+ *  @brief   Analytical CAN bus timing model and poll capacity planner
+ *
+ *  How many registers per second fit on one ETU bus, from the register
+ *  map and the protocol constants alone:
+ *
+ *    frame     8 data bytes, 29-bit ID. Worst case on the wire with bit
+ *              stuffing (one stuff bit per 4 bits over SOF .. CRC):
+ *                54 + 13 + 64 + floor((54 + 64 - 1) / 4) = 160 bits
+ *              without stuffing 131 bits (incl. 3-bit intermission)
+ *    read      READ_REQ, then per fragment of 6 bytes READ_RESP + READ_ACK
+ *                frames = 1 + 2F
+ *    write     WRITE_REQ, GRANT, per fragment DATA + ACK, TERM, TERM_ACK
+ *                frames = 4 + 2F
+ *    delta     UNCHANGED 3 frames; CHANGES / FULL as a read of the stream
+ *              (6-byte header, bitmap, changed words)
+ *
+ *  The protocol is stop-and-wait and the bridge's CAN scheduler runs one
+ *  transfer at a time, so a transfer also holds the bus for every
+ *  turnaround in between:
+ *
+ *    duration = frames * frame_time + (ETU turnarounds) * -e + (bridge turnarounds) * -g
+ *
+ *  The poll capacity is 1 / sum(rate * duration) of the mix (scheduler
+ *  occupancy), the bus load is sum(rate * frames * frame_time) plus the
+ *  heartbeat (2 frames/s). Take -e / -g from can_analyzer's phase p50s.
+ *
+ *  Mix file (-m), one line per polled dataset ('#' comments):
+ *
+ *    name|*  rate_hz  [read|write|delta[:changed_pct]]  [registers | bits]
+ *
+ *  Without -m every CAN dataset is read at -R Hz. A dataset poll is split
+ *  into Modbus requests, one CAN transfer each: at most 125 registers
+ *  (FC 3/4) or 123 (FC 16). Coil and discrete input datasets (FC 1/2/5/15,
+ *  one bit per entry) count bits instead: ceil(bits / 8) bytes per
+ *  transfer, at most 2000 bits per read and 1968 per write.
+ *
+ *  Prediction vs measurement: -q takes a replay_harness request trace,
+ *  -c its metrics JSON. Frames the bridge sends take no time on vcan and
+ *  the recorded ETU delays already contain the ETU frames' wire time, so
+ *  the "vcan" column counts only the ETU frames. Use -e 0 for a -V run.
+ *
+ *    gcc -O2 can_capacity.c register_map.c log_async.c -o can_capacity -lpthread -lm
+ *    ./can_capacity -r regmap.bin [-b 1000000] [-e 200] [-g 100] [-m mix.txt | -R 1]
+ *    ./can_capacity -r regmap.bin -q golden.txt -c run.json -e 200 -g 100
+ *
+ *  @author  Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include "register_map.h"
+
+
+#define CC_FRAME_DATA_BYTES     8
+#define CC_FRAGMENT_PAYLOAD     6           /* ETU_FRAME_PAYLOAD          */
+#define CC_DELTA_HEADER_LEN     6           /* CAN_DELTA_HEADER_LEN       */
+#define CC_EXT_OVERHEAD_BITS    54          /* SOF .. CRC without data, extended ID */
+#define CC_TAIL_BITS            13          /* CRC delim, ACK, EOF, intermission */
+#define CC_MAX_READ_REGS        125         /* Modbus FC 3/4 limit        */
+#define CC_MAX_WRITE_REGS       123         /* Modbus FC 16 limit         */
+#define CC_MAX_READ_BITS        2000        /* Modbus FC 1/2 limit        */
+#define CC_MAX_WRITE_BITS       1968        /* Modbus FC 15 limit         */
+#define CC_HEARTBEAT_HZ         2           /* Bridge heartbeat, 500 ms   */
+
+#define CC_DEFAULT_BITRATE      1000000
+#define CC_DEFAULT_ETU_US       200.0
+#define CC_DEFAULT_BRIDGE_US    100.0
+
+#define CC_MAX_MIX              256
+
+#define OP_READ                 0
+#define OP_WRITE                1
+#define OP_DELTA                2
+
+
+/*
+ * Cost of one CAN transfer
+ */
+typedef struct {
+    uint32_t    frames;
+    uint32_t    etu_frames;         /* Sent by the ETU                       */
+    uint32_t    etu_turns;          /* Waits for the ETU                     */
+    uint32_t    bridge_turns;       /* Waits for the bridge                  */
+} cc_cost;
+
+typedef struct {
+    const char *name;
+    uint8_t     data_header;
+    uint32_t    registers;          /* Bits for a bit dataset                */
+    int         bits;
+    double      rate_hz;
+    int         op;
+    double      changed_pct;
+    cc_cost     cost;               /* All transfers of one poll             */
+    uint32_t    transfers;
+} cc_item;
+
+
+static double   frame_us;                  /* Worst case, at the bitrate    */
+static double   frame_us_nominal;
+static double   etu_us    = CC_DEFAULT_ETU_US;
+static double   bridge_us = CC_DEFAULT_BRIDGE_US;
+
+static cc_item  mix[CC_MAX_MIX];
+static int      mix_count;
+
+
+/***************************************************************
+ *  Model
+ ***************************************************************/
+
+/**
+ * @brief Frame length in bits for @p data_bytes, extended ID.
+ *
+ * @param stuffed  1 = worst-case bit stuffing, 0 = none
+ */
+static uint32_t frame_bits(uint32_t data_bytes, int stuffed)
+{
+    uint32_t body = CC_EXT_OVERHEAD_BITS + 8 * data_bytes;
+
+    return body + CC_TAIL_BITS + (stuffed ? (body - 1) / 4 : 0);
+}
+
+
+static uint32_t frag_count(uint32_t bytes)
+{
+    return (bytes + CC_FRAGMENT_PAYLOAD - 1) / CC_FRAGMENT_PAYLOAD;
+}
+
+
+static void cost_add(cc_cost *sum, const cc_cost *c)
+{
+    sum->frames       += c->frames;
+    sum->etu_frames   += c->etu_frames;
+    sum->etu_turns    += c->etu_turns;
+    sum->bridge_turns += c->bridge_turns;
+}
+
+
+/**
+ * @brief One read of @p bytes: request, F fragments, F ACKs.
+ */
+static cc_cost read_cost(uint32_t bytes)
+{
+    cc_cost  c;
+    uint32_t f = frag_count(bytes) ? frag_count(bytes) : 1;
+
+    c.frames       = 1 + 2 * f;
+    c.etu_frames   = f;
+    c.etu_turns    = f;             /* Request -> #0, ACK #k -> #k+1 */
+    c.bridge_turns = f;             /* Fragment #k -> ACK #k         */
+
+    return c;
+}
+
+
+static cc_cost write_cost(uint32_t bytes)
+{
+    cc_cost  c;
+    uint32_t f = frag_count(bytes);
+
+    c.frames       = 4 + 2 * f;
+    c.etu_frames   = 2 + f;         /* Grant, F ACKs, term ACK       */
+    c.etu_turns    = 2 + f;
+    c.bridge_turns = 1 + f;         /* Grant / ACK -> next data, term */
+
+    return c;
+}
+
+
+/**
+ * @brief Delta read with @p changed_pct percent of the words changed.
+ */
+static cc_cost delta_cost(uint32_t bytes, double changed_pct)
+{
+    uint32_t words   = (bytes + 1) / 2;
+    uint32_t changed = (uint32_t)ceil(words * changed_pct / 100.0);
+    uint32_t stream;
+
+    if (changed == 0)
+    {
+        return read_cost(CC_DELTA_HEADER_LEN);
+    }
+
+    stream = CC_DELTA_HEADER_LEN + (words + 7) / 8 + changed * 2;
+    if (stream > CC_DELTA_HEADER_LEN + bytes)
+    {
+        stream = CC_DELTA_HEADER_LEN + bytes;       /* FULL */
+    }
+
+    return read_cost(stream);
+}
+
+
+static cc_cost transfer_cost(int op, uint32_t bytes, double changed_pct)
+{
+    switch (op)
+    {
+        case OP_WRITE: return write_cost(bytes);
+        case OP_DELTA: return delta_cost(bytes, changed_pct);
+        default:       return read_cost(bytes);
+    }
+}
+
+
+static double bus_us(const cc_cost *c)
+{
+    return c->frames * frame_us;
+}
+
+static double duration_us(const cc_cost *c)
+{
+    return c->frames * frame_us + c->etu_turns * etu_us + c->bridge_turns * bridge_us;
+}
+
+/*
+ * On vcan only the replayed ETU frames carry (recorded) wire time
+ */
+static double vcan_duration_us(const cc_cost *c)
+{
+    return c->etu_frames * frame_us + c->etu_turns * etu_us + c->bridge_turns * bridge_us;
+}
+
+
+/**
+ * @brief Cost of polling @p count registers (bits if @p bits): one transfer per Modbus request.
+ */
+static cc_cost poll_cost(int op, uint32_t count, int bits, double changed_pct, uint32_t *transfers)
+{
+    uint32_t per;
+    uint32_t n;
+    cc_cost  sum;
+    cc_cost  c;
+
+    if (bits)
+    {
+        per = (op == OP_WRITE) ? CC_MAX_WRITE_BITS : CC_MAX_READ_BITS;
+    }
+    else
+    {
+        per = (op == OP_WRITE) ? CC_MAX_WRITE_REGS : CC_MAX_READ_REGS;
+    }
+
+    memset(&sum, 0, sizeof(sum));
+    *transfers = 0;
+
+    while (count > 0)
+    {
+        n = (count > per) ? per : count;
+        c = transfer_cost(op, bits ? (n + 7) / 8 : n * 2, changed_pct);
+        cost_add(&sum, &c);
+        count -= n;
+        (*transfers)++;
+    }
+
+    return sum;
+}
+
+
+/***************************************************************
+ *  Register map
+ ***************************************************************/
+
+/*
+ * Coils and discrete inputs: one bit per entry, read with FC 1/2
+ */
+static int dataset_is_bits(const regmap_t *map, const regmap_dataset *ds)
+{
+    const uint8_t *fc;
+
+    if (ds->entry_count == 0)
+    {
+        return 0;
+    }
+
+    fc = map->entries[ds->first_entry].fun_code;
+    return (fc[0] == 1) || (fc[0] == 2);
+}
+
+/**
+ * @brief Registers of a dataset, bits for a bit dataset.
+ */
+static uint32_t dataset_registers(const regmap_t *map, const regmap_dataset *ds)
+{
+    if (ds->entry_count == 0)
+    {
+        return 0;
+    }
+
+    if (dataset_is_bits(map, ds))
+    {
+        return map->entries[ds->first_entry].remaining;
+    }
+
+    return map->entries[ds->first_entry].remaining / 2;
+}
+
+
+static const regmap_dataset *dataset_by_name(const regmap_t *map, const char *name)
+{
+    const regmap_dataset *ds;
+    uint32_t              i;
+
+    for (i = 0; i < map->hdr->dataset_count; i++)
+    {
+        ds = &map->datasets[i];
+        if ((ds->kind == REGMAP_KIND_CAN) && (strcmp(regmap_string(map, ds->name_off), name) == 0))
+        {
+            return ds;
+        }
+    }
+
+    return NULL;
+}
+
+
+static int mix_add(const regmap_t *map, const regmap_dataset *ds, double rate, int op, double pct, uint32_t regs)
+{
+    cc_item *it;
+
+    if (mix_count >= CC_MAX_MIX)
+    {
+        fprintf(stderr, "more than %d mix items\n", CC_MAX_MIX);
+        return -1;
+    }
+
+    it = &mix[mix_count++];
+    memset(it, 0, sizeof(*it));
+    it->name        = regmap_string(map, ds->name_off);
+    it->data_header = ds->data_header;
+    it->registers   = regs ? regs : dataset_registers(map, ds);
+    it->bits        = dataset_is_bits(map, ds);
+    it->rate_hz     = rate;
+    it->op          = op;
+    it->changed_pct = pct;
+    it->cost        = poll_cost(op, it->registers, it->bits, pct, &it->transfers);
+
+    return 0;
+}
+
+
+static int load_mix(const regmap_t *map, const char *path)
+{
+    FILE                 *f = fopen(path, "r");
+    char                  line[256];
+    char                  name[128];
+    char                  opname[32];
+    const regmap_dataset *ds;
+    double                rate;
+    double                pct;
+    unsigned              regs;
+    uint32_t              i;
+    int                   fields;
+    int                   op;
+    int                   lineno = 0;
+
+    if (f == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        lineno++;
+        if ((line[strspn(line, " \t")] == '#') || (line[strspn(line, " \t\r\n")] == '\0'))
+        {
+            continue;
+        }
+
+        strcpy(opname, "read");
+        regs   = 0;
+        fields = sscanf(line, "%127s %lf %31s %u", name, &rate, opname, &regs);
+        if (fields < 2)
+        {
+            fprintf(stderr, "%s:%d: expected \"name rate_hz [read|write|delta[:pct]] [registers]\"\n", path, lineno);
+            fclose(f);
+            return -1;
+        }
+
+        pct = 0.0;
+        if (strncmp(opname, "delta", 5) == 0)
+        {
+            op = OP_DELTA;
+            if (opname[5] == ':')
+            {
+                pct = strtod(opname + 6, NULL);
+            }
+        }
+        else
+        {
+            op = (strcmp(opname, "write") == 0) ? OP_WRITE : OP_READ;
+        }
+
+        if (strcmp(name, "*") == 0)
+        {
+            for (i = 0; i < map->hdr->dataset_count; i++)
+            {
+                if ((map->datasets[i].kind == REGMAP_KIND_CAN) &&
+                    (mix_add(map, &map->datasets[i], rate, op, pct, regs) != 0))
+                {
+                    fclose(f);
+                    return -1;
+                }
+            }
+            continue;
+        }
+
+        ds = dataset_by_name(map, name);
+        if (ds == NULL)
+        {
+            fprintf(stderr, "%s:%d: no CAN dataset \"%s\" in the map\n", path, lineno, name);
+            fclose(f);
+            return -1;
+        }
+        if (mix_add(map, ds, rate, op, pct, regs) != 0)
+        {
+            fclose(f);
+            return -1;
+        }
+    }
+
+    fclose(f);
+    return 0;
+}
+
+
+/***************************************************************
+ *  Reports
+ ***************************************************************/
+
+static void print_constants(uint32_t bitrate)
+{
+    cc_cost hb;
+
+    memset(&hb, 0, sizeof(hb));
+    hb.frames = 1;
+
+    printf("bit rate %u bit/s, 8-byte extended frame: %u bits worst case (%.1f us), %u bits unstuffed (%.1f us)\n",
+           bitrate, frame_bits(CC_FRAME_DATA_BYTES, 1), frame_us, frame_bits(CC_FRAME_DATA_BYTES, 0),
+           frame_us_nominal);
+    printf("turnaround ETU %.0f us, bridge %.0f us; heartbeat %d frames/s = %.2f %% bus\n\n",
+           etu_us, bridge_us, CC_HEARTBEAT_HZ, 100.0 * CC_HEARTBEAT_HZ * bus_us(&hb) / 1e6);
+}
+
+
+static void print_datasets(const regmap_t *map)
+{
+    const regmap_dataset *ds;
+    uint32_t              regs;
+    uint32_t              transfers;
+    cc_cost               c;
+    uint32_t              i;
+
+    printf("per dataset, full read (one poll)\n");
+    printf("  %-28s %3s %5s %4s %5s %6s %9s %10s %9s %9s\n", "dataset", "hdr", "count", "unit", "xfers", "frames",
+           "bus us", "poll us", "max Hz", "count/s");
+
+    for (i = 0; i < map->hdr->dataset_count; i++)
+    {
+        ds = &map->datasets[i];
+        if (ds->kind != REGMAP_KIND_CAN)
+        {
+            continue;
+        }
+
+        regs = dataset_registers(map, ds);
+        c    = poll_cost(OP_READ, regs, dataset_is_bits(map, ds), 0, &transfers);
+        printf("  %-28.28s %3u %5u %4s %5u %6u %9.0f %10.0f %9.1f %9.0f\n", regmap_string(map, ds->name_off),
+               ds->data_header, regs, dataset_is_bits(map, ds) ? "bit" : "reg", transfers, c.frames,
+               bus_us(&c), duration_us(&c),
+               c.frames ? 1e6 / duration_us(&c) : 0.0, c.frames ? regs * 1e6 / duration_us(&c) : 0.0);
+    }
+    printf("\n");
+}
+
+
+static void print_mix(void)
+{
+    double   occupancy = 0.0;
+    double   bus_load  = 0.0;
+    double   regs_s    = 0.0;
+    double   bits_s    = 0.0;
+    double   scale;
+    cc_cost  hb;
+    int      i;
+
+    memset(&hb, 0, sizeof(hb));
+    hb.frames = 1;
+
+    printf("poll mix\n");
+    printf("  %-28s %-6s %5s %4s %8s %6s %10s %8s %8s\n", "dataset", "op", "count", "unit", "rate Hz", "frames",
+           "poll us", "bus %", "sched %");
+
+    for (i = 0; i < mix_count; i++)
+    {
+        double busy = mix[i].rate_hz * duration_us(&mix[i].cost) / 1e6;
+        double load = mix[i].rate_hz * bus_us(&mix[i].cost) / 1e6;
+
+        occupancy += busy;
+        bus_load  += load;
+        if (mix[i].bits)
+        {
+            bits_s += mix[i].rate_hz * mix[i].registers;
+        }
+        else
+        {
+            regs_s += mix[i].rate_hz * mix[i].registers;
+        }
+
+        printf("  %-28.28s %-6s %5u %4s %8.2f %6u %10.0f %8.2f %8.2f\n", mix[i].name,
+               (mix[i].op == OP_WRITE) ? "write" : (mix[i].op == OP_DELTA) ? "delta" : "read",
+               mix[i].registers, mix[i].bits ? "bit" : "reg", mix[i].rate_hz, mix[i].cost.frames, duration_us(&mix[i].cost),
+               100.0 * load, 100.0 * busy);
+    }
+
+    bus_load += CC_HEARTBEAT_HZ * bus_us(&hb) / 1e6;
+
+    printf("\n  bus load %.1f %%, scheduler busy %.1f %%, %.0f registers/s, %.0f bits/s\n",
+           100.0 * bus_load, 100.0 * occupancy, regs_s, bits_s);
+    if (occupancy > 0)
+    {
+        scale = 1.0 / occupancy;
+        printf("  sustainable: all rates x %.2f (%.0f registers/s, %.0f bits/s); bus load at that point %.1f %%\n",
+               scale, regs_s * scale, bits_s * scale, 100.0 * (bus_load - CC_HEARTBEAT_HZ * bus_us(&hb) / 1e6) * scale +
+               100.0 * CC_HEARTBEAT_HZ * bus_us(&hb) / 1e6);
+        if (occupancy > 1.0)
+        {
+            printf("  OVERLOADED: the scheduler would shed or delay %.0f %% of the polls\n",
+                   100.0 * (1.0 - 1.0 / occupancy));
+        }
+    }
+    printf("\n");
+}
+
+
+/***************************************************************
+ *  Prediction vs replay_harness
+ ***************************************************************/
+
+static double json_number(const char *text, const char *key)
+{
+    char        pattern[64];
+    const char *p;
+
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    p = strstr(text, pattern);
+
+    return (p != NULL) ? strtod(p + strlen(pattern), NULL) : -1.0;
+}
+
+
+/**
+ * @brief Predict a replay_harness request trace and compare with its metrics.
+ */
+static int compare_trace(const regmap_t *map, const char *trace, const char *metrics)
+{
+    FILE               *f = fopen(trace, "r");
+    char                line[4096];
+    char                text[4096];
+    double              time_s;
+    double              first_s = -1.0;
+    double              last_s  = 0.0;
+    double              sum_bus = 0.0;
+    double              sum_vcan = 0.0;
+    double              mean_bus;
+    double              mean_vcan;
+    double              measured;
+    unsigned            unit;
+    unsigned            fc;
+    unsigned            addr;
+    unsigned            count;
+    uint32_t            can_requests = 0;
+    uint32_t            other = 0;
+    uint32_t            values;
+    uint32_t            transfers;
+    cc_cost             c;
+    char               *tok;
+    size_t              n;
+
+    if (f == NULL)
+    {
+        perror(trace);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        if (sscanf(line, "%lf %u %u %u %u", &time_s, &unit, &fc, &addr, &count) != 5)
+        {
+            continue;
+        }
+        if (first_s < 0)
+        {
+            first_s = time_s;
+        }
+        last_s = time_s;
+
+        /*
+         * Same lookup as the bridge: protocol address + 1, EEPROM first.
+         * Coil writes (FC 5/15) get an exception without a CAN transfer.
+         */
+        if ((fc == 5) || (fc == 15) ||
+            (regmap_lookup(map, REGMAP_KIND_TCP, (uint16_t)(addr + 1), (uint8_t)fc, NULL) != NULL) ||
+            (regmap_lookup(map, REGMAP_KIND_CAN, (uint16_t)(addr + 1), (uint8_t)fc, NULL) == NULL))
+        {
+            other++;
+            continue;
+        }
+
+        /*
+         * Written values: the tokens after the five fields, up to '='
+         */
+        values = 0;
+        strtok(line, " \t\r\n");
+        for (n = 0; n < 4; n++)
+        {
+            strtok(NULL, " \t\r\n");
+        }
+        while (((tok = strtok(NULL, " \t\r\n")) != NULL) && (strcmp(tok, "=") != 0) && (tok[0] != '#'))
+        {
+            if (strncmp(tok, "w:", 2) != 0)
+            {
+                values++;
+            }
+        }
+
+        if ((fc == 6) || (fc == 16))
+        {
+            c = poll_cost(OP_WRITE, (fc == 6) ? 1 : values, 0, 0, &transfers);
+        }
+        else if ((fc == 1) || (fc == 2))
+        {
+            c = read_cost((count + 7) / 8);
+        }
+        else
+        {
+            c = read_cost(count * 2);
+            if (fc == 23)
+            {
+                cc_cost w = write_cost(values * 2);
+                cost_add(&c, &w);
+            }
+        }
+
+        sum_bus  += duration_us(&c);
+        sum_vcan += vcan_duration_us(&c);
+        can_requests++;
+    }
+    fclose(f);
+
+    if (can_requests == 0)
+    {
+        fprintf(stderr, "%s: no request served over CAN\n", trace);
+        return -1;
+    }
+
+    mean_bus  = sum_bus / can_requests;
+    mean_vcan = sum_vcan / can_requests;
+
+    printf("request trace %s: %u CAN requests, %u EEPROM / unmapped / coil writes, %.1f s\n", trace, can_requests, other,
+           (last_s > first_s) ? last_s - first_s : 0.0);
+    printf("  %-28s %12s %12s %12s\n", "", "real bus", "vcan", "measured");
+
+    measured = -1.0;
+    if (metrics != NULL)
+    {
+        f = fopen(metrics, "r");
+        if (f == NULL)
+        {
+            perror(metrics);
+            return -1;
+        }
+        n = fread(text, 1, sizeof(text) - 1, f);
+        text[n] = '\0';
+        fclose(f);
+        measured = json_number(text, "lat_mean_us");
+    }
+
+    printf("  %-28s %12.0f %12.0f", "mean CAN latency us", mean_bus, mean_vcan);
+    if (measured >= 0)
+    {
+        printf(" %12.0f  (measured / vcan model %.2f)", measured, mean_vcan > 0 ? measured / mean_vcan : 0.0);
+    }
+    printf("\n  %-28s %12.0f %12.0f", "closed-loop max req/s", 1e6 / mean_bus, 1e6 / mean_vcan);
+    if (metrics != NULL)
+    {
+        measured = json_number(text, "req_per_s");
+        if ((measured >= 0) && (strstr(text, "\"virtual\"") != NULL))
+        {
+            printf(" %12.0f", measured);
+        }
+        else
+        {
+            printf(" %12s", "(paced run)");
+        }
+    }
+    printf("\n\n");
+
+    return 0;
+}
+
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s -r regmap.bin [-b bitrate] [-e etu_us] [-g bridge_us] [-m mix.txt | -R rate_hz]\n"
+                    "          [-q requests.txt [-c metrics.json]]\n", prog);
+}
+
+
+int main(int argc, char *argv[])
+{
+    const char *map_path    = NULL;
+    const char *mix_path    = NULL;
+    const char *trace_path  = NULL;
+    const char *metrics     = NULL;
+    double      rate        = 1.0;
+    uint32_t    bitrate     = CC_DEFAULT_BITRATE;
+    regmap_t   *map;
+    uint32_t    i;
+    int         ret = 0;
+    int         opt;
+
+    while ((opt = getopt(argc, argv, "r:b:e:g:m:R:q:c:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'r': map_path   = optarg; break;
+            case 'b': bitrate    = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'e': etu_us     = strtod(optarg, NULL); break;
+            case 'g': bridge_us  = strtod(optarg, NULL); break;
+            case 'm': mix_path   = optarg; break;
+            case 'R': rate       = strtod(optarg, NULL); break;
+            case 'q': trace_path = optarg; break;
+            case 'c': metrics    = optarg; break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if ((map_path == NULL) || (bitrate == 0))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    map = regmap_open(map_path);
+    if (map == NULL)
+    {
+        fprintf(stderr, "cannot load register map %s\n", map_path);
+        return 1;
+    }
+
+    frame_us         = frame_bits(CC_FRAME_DATA_BYTES, 1) * 1e6 / bitrate;
+    frame_us_nominal = frame_bits(CC_FRAME_DATA_BYTES, 0) * 1e6 / bitrate;
+
+    print_constants(bitrate);
+    print_datasets(map);
+
+    if (mix_path != NULL)
+    {
+        ret = load_mix(map, mix_path);
+    }
+    else
+    {
+        for (i = 0; (i < map->hdr->dataset_count) && (ret == 0); i++)
+        {
+            if (map->datasets[i].kind == REGMAP_KIND_CAN)
+            {
+                ret = mix_add(map, &map->datasets[i], rate, OP_READ, 0, 0);
+            }
+        }
+    }
+    if (ret == 0)
+    {
+        print_mix();
+    }
+
+    if ((ret == 0) && (trace_path != NULL))
+    {
+        ret = compare_trace(map, trace_path, metrics);
+    }
+
+    regmap_close(map);
+
+    return (ret == 0) ? 0 : 1;
+}
@@ -0,0 +1,277 @@
+/**
+ *  @file    can_delta.c
+ *  @brief   Delta-read extension of the ETU read protocol
+ *
+ *  See can_delta.h for the wire format.
+ *
+ *  @author  Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#include <string.h>
+#include "can_delta.h"
+
+
+static can_delta_slot   slots[CAN_DELTA_CACHE_SLOTS];
+static can_delta_stats  stats;
+static uint64_t         use_clock;
+
+
+uint32_t can_delta_version(const uint8_t *data, uint16_t len)
+{
+    uint32_t hash = 2166136261U;
+    uint16_t i;
+
+    for (i = 0; i < len; i++)
+    {
+        hash ^= data[i];
+        hash *= 16777619U;
+    }
+
+    return hash ? hash : 1;
+}
+
+
+static void put_be32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+
+static uint32_t get_be32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+
+int can_delta_encode(const uint8_t *prev, uint32_t prev_version, const uint8_t *cur, uint16_t len,
+                     uint32_t requested, uint8_t *out)
+{
+    uint16_t words      = (uint16_t)((len + 1) / 2);
+    uint16_t bitmap_len = (uint16_t)((words + 7) / 8);
+    uint16_t changed    = 0;
+    uint8_t *bitmap     = out + CAN_DELTA_HEADER_LEN;
+    uint8_t *payload    = bitmap + bitmap_len;
+    uint16_t w;
+    uint16_t b;
+
+    if ((len == 0) || (len > CAN_DELTA_MAX_BYTES))
+    {
+        return -1;
+    }
+
+    memset(out, 0, CAN_DELTA_HEADER_LEN);
+    put_be32(&out[1], can_delta_version(cur, len));
+
+    if ((prev != NULL) && (requested != 0) && (requested == prev_version))
+    {
+        memset(bitmap, 0, bitmap_len);
+
+        for (w = 0; w < words; w++)
+        {
+            b = (uint16_t)(w * 2);
+
+            if ((prev[b] == cur[b]) && ((b + 1 >= len) || (prev[b + 1] == cur[b + 1])))
+            {
+                continue;
+            }
+
+            bitmap[w / 8] |= (uint8_t)(1 << (w % 8));
+            payload[changed * 2]     = cur[b];
+            payload[changed * 2 + 1] = (b + 1 < len) ? cur[b + 1] : 0;
+            changed++;
+        }
+
+        if (changed == 0)
+        {
+            out[0] = CAN_DELTA_UNCHANGED;
+            return CAN_DELTA_HEADER_LEN;
+        }
+
+        /*
+         * Only worth it if the bitmap plus changed words is shorter than the range
+         */
+        if ((changed <= 0xFF) && (bitmap_len + changed * 2 < len))
+        {
+            out[0] = CAN_DELTA_CHANGES;
+            out[5] = (uint8_t)changed;
+            return CAN_DELTA_HEADER_LEN + bitmap_len + changed * 2;
+        }
+    }
+
+    out[0] = CAN_DELTA_FULL;
+    memcpy(out + CAN_DELTA_HEADER_LEN, cur, len);
+
+    return CAN_DELTA_HEADER_LEN + len;
+}
+
+
+int can_delta_stream_length(const uint8_t header[CAN_DELTA_HEADER_LEN], uint16_t len)
+{
+    uint16_t words = (uint16_t)((len + 1) / 2);
+
+    switch (header[0])
+    {
+        case CAN_DELTA_UNCHANGED:
+            return CAN_DELTA_HEADER_LEN;
+
+        case CAN_DELTA_CHANGES:
+            if ((header[5] == 0) || (header[5] > words))
+            {
+                return -1;
+            }
+            return CAN_DELTA_HEADER_LEN + (words + 7) / 8 + header[5] * 2;
+
+        case CAN_DELTA_FULL:
+            return CAN_DELTA_HEADER_LEN + len;
+
+        default:
+            return -1;
+    }
+}
+
+
+int can_delta_apply(can_delta_slot *slot, const uint8_t *stream, int stream_len)
+{
+    uint16_t       words   = (uint16_t)((slot->len + 1) / 2);
+    uint16_t       bitmap_len;
+    uint16_t       changed = 0;
+    uint32_t       version;
+    const uint8_t *payload;
+    uint16_t       w;
+    uint16_t       b;
+
+    if ((stream_len < CAN_DELTA_HEADER_LEN) || (can_delta_stream_length(stream, slot->len) != stream_len))
+    {
+        goto invalid;
+    }
+
+    version = get_be32(&stream[1]);
+
+    switch (stream[0])
+    {
+        case CAN_DELTA_UNCHANGED:
+            if ((slot->version == 0) || (version != slot->version))
+            {
+                goto invalid;
+            }
+            return 0;
+
+        case CAN_DELTA_FULL:
+            memcpy(slot->data, stream + CAN_DELTA_HEADER_LEN, slot->len);
+            break;
+
+        case CAN_DELTA_CHANGES:
+            if (slot->version == 0)
+            {
+                goto invalid;
+            }
+
+            bitmap_len = (uint16_t)((words + 7) / 8);
+            payload    = stream + CAN_DELTA_HEADER_LEN + bitmap_len;
+
+            for (w = 0; w < words; w++)
+            {
+                if (!(stream[CAN_DELTA_HEADER_LEN + w / 8] & (1 << (w % 8))))
+                {
+                    continue;
+                }
+
+                if (changed >= stream[5])
+                {
+                    goto invalid;
+                }
+
+                b = (uint16_t)(w * 2);
+                slot->data[b] = payload[changed * 2];
+                if (b + 1 < slot->len)
+                {
+                    slot->data[b + 1] = payload[changed * 2 + 1];
+                }
+                changed++;
+            }
+
+            if (changed != stream[5])
+            {
+                goto invalid;
+            }
+            break;
+
+        default:
+            goto invalid;
+    }
+
+    /*
+     * The merged copy must be exactly what the ETU holds
+     */
+    if (can_delta_version(slot->data, slot->len) != version)
+    {
+        goto invalid;
+    }
+
+    slot->version = version;
+    return 0;
+
+invalid:
+    stats.merge_errors++;
+    slot->version = 0;
+    return -1;
+}
+
+
+can_delta_slot *can_delta_slot_get(uint32_t can_id, uint16_t len)
+{
+    can_delta_slot *oldest = &slots[0];
+    int             i;
+
+    use_clock++;
+
+    for (i = 0; i < CAN_DELTA_CACHE_SLOTS; i++)
+    {
+        if ((slots[i].len != 0) && (slots[i].can_id == can_id) && (slots[i].len == len))
+        {
+            slots[i].last_use = use_clock;
+            return &slots[i];
+        }
+
+        if (slots[i].last_use < oldest->last_use)
+        {
+            oldest = &slots[i];
+        }
+    }
+
+    oldest->can_id   = can_id;
+    oldest->len      = len;
+    oldest->version  = 0;
+    oldest->last_use = use_clock;
+
+    return oldest;
+}
+
+
+void can_delta_account(int status, uint32_t frames, uint16_t len)
+{
+    stats.requests++;
+    stats.frames      += frames;
+    stats.frames_full += (len + 5) / 6;
+
+    switch (status)
+    {
+        case CAN_DELTA_UNCHANGED: stats.unchanged++; break;
+        case CAN_DELTA_CHANGES:   stats.changes++;   break;
+        default:                  stats.full++;      break;
+    }
+}
+
+
+void can_delta_get_stats(can_delta_stats *out)
+{
+    /*
+     * Written by the CAN scheduler thread only, a torn read just skews a log line
+     */
+    *out = stats;
+}
@@ -0,0 +1,142 @@
+/**
+ *  @file    can_delta.h
+ *  @brief   Delta-read extension of the ETU read protocol
+ *
+ *  A normal read transfers the whole requested range, 6 data bytes per
+ *  fragment, although most metering and status values did not change since
+ *  the last poll. With delta reads the bridge tells the ETU which version of
+ *  the range it already holds and the ETU sends only what changed.
+ *
+ *  Request (message type CAN_DELTA_READ_REQ_MSG_ID = 8, otherwise the same
+ *  CAN ID as the normal read request):
+ *
+ *      data[0]     size, as in the normal read request
+ *      data[1..4]  version of the bridge's cached copy, big endian, 0 = none
+ *      data[6..7]  CRC
+ *
+ *  Response: normal read response/ACK sequence (message types 1 and 9, IDs
+ *  stepping by 3). The 6-byte payloads form one stream:
+ *
+ *      [0]         CAN_DELTA_UNCHANGED / CAN_DELTA_CHANGES / CAN_DELTA_FULL
+ *      [1..4]      version of the ETU data after this response, big endian
+ *      [5]         number of changed words (CAN_DELTA_CHANGES)
+ *      UNCHANGED:  nothing more, the whole poll is one frame + one ACK
+ *      CHANGES:    bitmap, 1 bit per 16-bit word (LSB first), then the
+ *                  changed words in address order
+ *      FULL:       the complete range, as in a normal response
+ *
+ *  The version is a hash of the data (FNV-1a, never 0), so after merging a
+ *  delta the bridge checks that its copy hashes to the announced version.
+ *  The ETU keeps the last image it sent; a delta is only sent if the
+ *  requested version is that image's version, otherwise (or if the delta
+ *  would be longer) the full range is sent.
+ *
+ *  The encoder and decoder are pure functions shared by the bridge and the
+ *  ETU simulator. The cache is used by the CAN scheduler thread only.
+ *
+ *  Enable in the bridge with -DCAN_DELTA_READ=1; ETU firmware without the
+ *  extension does not answer message type 8.
+ *
+ *  @author  Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#ifndef CAN_DELTA_H
+#define CAN_DELTA_H
+
+#include <stdint.h>
+
+
+#ifndef CAN_DELTA_READ
+#define CAN_DELTA_READ              0       /* Use delta reads towards the ETU   */
+#endif
+
+#define CAN_DELTA_READ_REQ_MSG_ID   8       /* TCP to ETU: Delta Read Request    */
+
+#define CAN_DELTA_UNCHANGED         0
+#define CAN_DELTA_CHANGES           1
+#define CAN_DELTA_FULL              2
+
+#define CAN_DELTA_HEADER_LEN        6       /* One fragment                      */
+#define CAN_DELTA_MAX_BYTES         512     /* Largest read: 255 registers       */
+#define CAN_DELTA_MAX_WORDS         (CAN_DELTA_MAX_BYTES / 2)
+#define CAN_DELTA_MAX_STREAM        (CAN_DELTA_HEADER_LEN + CAN_DELTA_MAX_WORDS / 8 + CAN_DELTA_MAX_BYTES)
+#define CAN_DELTA_CACHE_SLOTS       32      /* Cached read ranges                */
+
+
+/*
+ * Bridge-side copy of one read range (CAN ID + byte length)
+ */
+typedef struct {
+    uint32_t    can_id;
+    uint16_t    len;
+    uint32_t    version;            /* 0 = nothing cached              */
+    uint64_t    last_use;
+    uint8_t     data[CAN_DELTA_MAX_BYTES];
+} can_delta_slot;
+
+/*
+ * Counters (bridge side)
+ */
+typedef struct {
+    uint64_t    requests;
+    uint64_t    unchanged;
+    uint64_t    changes;
+    uint64_t    full;
+    uint64_t    merge_errors;       /* Merged copy did not match the version  */
+    uint64_t    frames;             /* Response fragments received            */
+    uint64_t    frames_full;        /* Fragments a normal read would have used */
+} can_delta_stats;
+
+
+/**
+ * @brief Version of a data range (FNV-1a, never 0).
+ */
+uint32_t can_delta_version(const uint8_t *data, uint16_t len);
+
+/**
+ * @brief Build the response stream (ETU side).
+ *
+ * @param prev          Last image sent for this range, NULL if none
+ * @param prev_version  Its version
+ * @param cur           Current data
+ * @param len           Range length in bytes
+ * @param requested     Version the bridge holds (request data[1..4])
+ * @param out           Stream buffer, CAN_DELTA_MAX_STREAM bytes
+ *
+ * @return Stream length in bytes, -1 if len is out of range
+ */
+int can_delta_encode(const uint8_t *prev, uint32_t prev_version, const uint8_t *cur, uint16_t len,
+                     uint32_t requested, uint8_t *out);
+
+/**
+ * @brief Total stream length announced by the first fragment.
+ *
+ * @return Length in bytes, -1 if the header is invalid for this range
+ */
+int can_delta_stream_length(const uint8_t header[CAN_DELTA_HEADER_LEN], uint16_t len);
+
+/**
+ * @brief Merge a response stream into the cached copy (bridge side).
+ *
+ * On success slot->data and slot->version hold the ETU's current data. On
+ * failure the slot is invalidated (version 0).
+ *
+ * @return 0 on success, -1 on a malformed stream or version mismatch
+ */
+int can_delta_apply(can_delta_slot *slot, const uint8_t *stream, int stream_len);
+
+/**
+ * @brief Cached copy for a read range, recycling the least recently used slot.
+ */
+can_delta_slot *can_delta_slot_get(uint32_t can_id, uint16_t len);
+
+/**
+ * @brief Account one delta read (frames received, status of the response).
+ */
+void can_delta_account(int status, uint32_t frames, uint16_t len);
+
+void can_delta_get_stats(can_delta_stats *out);
+
+#endif /* CAN_DELTA_H */
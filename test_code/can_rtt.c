@@ -0,0 +1,240 @@
+/**
+ *  @file    can_rtt.c
+ *  @brief   Per-module CAN round-trip estimation, adaptive timeouts and circuit breaker
+ *
+ *  See can_rtt.h for the algorithm.
+ *
+ *  @author  Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "can_rtt.h"
+
+
+static can_module_rtt   modules[CAN_MAX_MODULES];
+static pthread_mutex_t  modules_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+uint64_t can_rtt_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000ULL;
+}
+
+
+static uint32_t clamp_rto_us(uint64_t rto_us)
+{
+    if (rto_us < (uint64_t)CAN_RTO_MIN_MS * 1000)
+    {
+        return CAN_RTO_MIN_MS * 1000;
+    }
+
+    if (rto_us > (uint64_t)CAN_RTO_MAX_MS * 1000)
+    {
+        return CAN_RTO_MAX_MS * 1000;
+    }
+
+    return (uint32_t)rto_us;
+}
+
+
+void can_rtt_init(void)
+{
+    int i;
+
+    pthread_mutex_lock(&modules_lock);
+
+    memset(modules, 0, sizeof(modules));
+    for (i = 0; i < CAN_MAX_MODULES; i++)
+    {
+        modules[i].rto_us      = CAN_RTO_INITIAL_MS * 1000;
+        modules[i].cooldown_ms = CAN_BREAKER_COOLDOWN_MS;
+        modules[i].state       = CAN_BREAKER_CLOSED;
+    }
+
+    pthread_mutex_unlock(&modules_lock);
+}
+
+
+uint32_t can_rtt_timeout_ms(uint32_t can_id)
+{
+    uint32_t rto_us;
+
+    pthread_mutex_lock(&modules_lock);
+    rto_us = modules[CAN_MODULE_INDEX(can_id)].rto_us;
+    pthread_mutex_unlock(&modules_lock);
+
+    /*
+     * Zero means can_rtt_init() was never called
+     */
+    if (rto_us == 0)
+    {
+        rto_us = CAN_RTO_INITIAL_MS * 1000;
+    }
+
+    return (rto_us + 999) / 1000;
+}
+
+
+void can_rtt_sample(uint32_t can_id, uint32_t rtt_us)
+{
+    can_module_rtt *m;
+    uint32_t        delta;
+    uint32_t        var_term;
+
+    pthread_mutex_lock(&modules_lock);
+
+    m = &modules[CAN_MODULE_INDEX(can_id)];
+
+    if (m->samples == 0)
+    {
+        /*
+         * First measurement: SRTT = R, RTTVAR = R / 2
+         */
+        m->srtt_us   = rtt_us;
+        m->rttvar_us = rtt_us / 2;
+    }
+    else
+    {
+        delta        = (m->srtt_us > rtt_us) ? (m->srtt_us - rtt_us) : (rtt_us - m->srtt_us);
+        m->rttvar_us = (3 * m->rttvar_us + delta) / 4;
+        m->srtt_us   = (7 * m->srtt_us + rtt_us) / 8;
+    }
+
+    m->samples++;
+
+    var_term = 4 * m->rttvar_us;
+    if (var_term < CAN_RTO_GRANULARITY_US)
+    {
+        var_term = CAN_RTO_GRANULARITY_US;
+    }
+
+    m->rto_us = clamp_rto_us((uint64_t)m->srtt_us + var_term);
+
+    pthread_mutex_unlock(&modules_lock);
+}
+
+
+void can_rtt_timeout(uint32_t can_id)
+{
+    can_module_rtt *m;
+
+    pthread_mutex_lock(&modules_lock);
+
+    m = &modules[CAN_MODULE_INDEX(can_id)];
+    m->timeouts++;
+    m->rto_us = clamp_rto_us((uint64_t)(m->rto_us ? m->rto_us : CAN_RTO_INITIAL_MS * 1000) * 2);
+
+    pthread_mutex_unlock(&modules_lock);
+}
+
+
+void can_rtt_retransmit(uint32_t can_id)
+{
+    pthread_mutex_lock(&modules_lock);
+    modules[CAN_MODULE_INDEX(can_id)].retransmits++;
+    pthread_mutex_unlock(&modules_lock);
+}
+
+
+void can_rtt_crc_error(uint32_t can_id)
+{
+    pthread_mutex_lock(&modules_lock);
+    modules[CAN_MODULE_INDEX(can_id)].crc_errors++;
+    pthread_mutex_unlock(&modules_lock);
+}
+
+
+int can_breaker_allow(uint32_t can_id)
+{
+    can_module_rtt *m;
+    int             allow = 1;
+
+    pthread_mutex_lock(&modules_lock);
+
+    m = &modules[CAN_MODULE_INDEX(can_id)];
+
+    if (m->state == CAN_BREAKER_OPEN)
+    {
+        if (can_rtt_now_us() >= m->open_until_us)
+        {
+            /*
+             * Cool-down over: let exactly one probe through
+             */
+            m->state = CAN_BREAKER_HALF_OPEN;
+        }
+        else
+        {
+            m->fast_fails++;
+            allow = 0;
+        }
+    }
+    else if (m->state == CAN_BREAKER_HALF_OPEN)
+    {
+        /*
+         * A probe is already in flight
+         */
+        m->fast_fails++;
+        allow = 0;
+    }
+
+    pthread_mutex_unlock(&modules_lock);
+
+    return allow;
+}
+
+
+void can_breaker_result(uint32_t can_id, int success)
+{
+    can_module_rtt *m;
+
+    pthread_mutex_lock(&modules_lock);
+
+    m = &modules[CAN_MODULE_INDEX(can_id)];
+
+    if (success)
+    {
+        m->consecutive_failures = 0;
+        m->cooldown_ms          = CAN_BREAKER_COOLDOWN_MS;
+        m->state                = CAN_BREAKER_CLOSED;
+    }
+    else
+    {
+        m->consecutive_failures++;
+
+        if (m->state == CAN_BREAKER_HALF_OPEN)
+        {
+            /*
+             * Probe failed: open again with a longer cool-down
+             */
+            m->cooldown_ms *= 2;
+            if (m->cooldown_ms > CAN_BREAKER_COOLDOWN_MAX_MS)
+            {
+                m->cooldown_ms = CAN_BREAKER_COOLDOWN_MAX_MS;
+            }
+            m->state         = CAN_BREAKER_OPEN;
+            m->open_until_us = can_rtt_now_us() + (uint64_t)m->cooldown_ms * 1000;
+        }
+        else if (m->consecutive_failures >= CAN_BREAKER_THRESHOLD)
+        {
+            m->state         = CAN_BREAKER_OPEN;
+            m->open_until_us = can_rtt_now_us() + (uint64_t)m->cooldown_ms * 1000;
+        }
+    }
+
+    pthread_mutex_unlock(&modules_lock);
+}
+
+
+void can_rtt_get(uint32_t can_id, can_module_rtt *out)
+{
+    pthread_mutex_lock(&modules_lock);
+    *out = modules[CAN_MODULE_INDEX(can_id)];
+    pthread_mutex_unlock(&modules_lock);
+}
@@ -0,0 +1,129 @@
+/**
+ *  @file    can_rtt.h
+ *  @brief   Per-module CAN round-trip estimation, adaptive timeouts and circuit breaker
+ *
+ *  Every ETU module (Module Address + Module ID bits of the 29-bit CAN ID)
+ *  gets its own round-trip estimator, computed the same way TCP computes
+ *  its retransmission timeout (RFC 6298):
+ *
+ *      SRTT   = 7/8 * SRTT   + 1/8 * RTT
+ *      RTTVAR = 3/4 * RTTVAR + 1/4 * |SRTT - RTT|
+ *      RTO    = SRTT + max(G, 4 * RTTVAR)
+ *
+ *  The RTO is the per-fragment timeout. A timeout doubles the RTO (Karn),
+ *  and retransmitted fragments are never used as RTT samples.
+ *
+ *  A module that fails CAN_BREAKER_THRESHOLD transactions in a row is
+ *  marked down (breaker OPEN): requests to it fail immediately until the
+ *  cool-down expires, then one probe request is let through (HALF_OPEN).
+ *
+ *  @author  Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#ifndef CAN_RTT_H
+#define CAN_RTT_H
+
+#include <stdint.h>
+
+
+/*
+ * Timeout bounds (milliseconds)
+ */
+#define CAN_RTO_INITIAL_MS          500     /* Before the first sample                    */
+#define CAN_RTO_MIN_MS              20      /* Never wait less than this per fragment     */
+#define CAN_RTO_MAX_MS              2000    /* Old fixed CAN_READ_TIME budget             */
+#define CAN_RTO_GRANULARITY_US      2000    /* Clock granularity term G                   */
+
+/*
+ * Retransmission and circuit breaker
+ */
+#define CAN_FRAG_MAX_RETRIES        2       /* Retransmissions of one fragment            */
+#define CAN_BREAKER_THRESHOLD       3       /* Consecutive failed transactions to open    */
+#define CAN_BREAKER_COOLDOWN_MS     5000    /* First cool-down, doubles while it fails    */
+#define CAN_BREAKER_COOLDOWN_MAX_MS 60000
+
+/*
+ * Module index = Module Address (2 bits) + Module ID (4 bits), CAN ID bits 23..28
+ */
+#define CAN_MODULE_SHIFT            23
+#define CAN_MODULE_MASK             0x3F
+#define CAN_MAX_MODULES             64
+#define CAN_MODULE_INDEX(can_id)    ((((uint32_t)(can_id)) >> CAN_MODULE_SHIFT) & CAN_MODULE_MASK)
+
+
+typedef enum {
+    CAN_BREAKER_CLOSED = 0,    /* Module healthy, requests pass        */
+    CAN_BREAKER_OPEN,          /* Module down, requests fast-fail      */
+    CAN_BREAKER_HALF_OPEN      /* Cool-down over, one probe in flight  */
+} can_breaker_state;
+
+
+typedef struct {
+    uint32_t            srtt_us;
+    uint32_t            rttvar_us;
+    uint32_t            rto_us;
+    uint32_t            samples;
+    uint32_t            timeouts;
+    uint32_t            retransmits;
+    uint32_t            crc_errors;
+    uint32_t            fast_fails;
+    uint32_t            consecutive_failures;
+    uint32_t            cooldown_ms;
+    uint64_t            open_until_us;
+    can_breaker_state   state;
+} can_module_rtt;
+
+
+/**
+ * @brief Reset all module estimators and breakers.
+ */
+void can_rtt_init(void);
+
+/**
+ * @brief Current per-fragment timeout for the module addressed by @p can_id.
+ */
+uint32_t can_rtt_timeout_ms(uint32_t can_id);
+
+/**
+ * @brief Feed one round-trip sample (first transmission only, Karn's rule).
+ */
+void can_rtt_sample(uint32_t can_id, uint32_t rtt_us);
+
+/**
+ * @brief Account a fragment timeout: doubles the module RTO.
+ */
+void can_rtt_timeout(uint32_t can_id);
+
+/**
+ * @brief Account a retransmission or a CRC error (statistics only).
+ */
+void can_rtt_retransmit(uint32_t can_id);
+void can_rtt_crc_error(uint32_t can_id);
+
+/**
+ * @brief Ask the circuit breaker whether a transaction may start.
+ *
+ * @return 1 if the request may go on the bus, 0 if it must fast-fail
+ */
+int can_breaker_allow(uint32_t can_id);
+
+/**
+ * @brief Report the outcome of a whole transaction to the circuit breaker.
+ *
+ * @param success 1 if the transaction completed, 0 if it failed
+ */
+void can_breaker_result(uint32_t can_id, int success);
+
+/**
+ * @brief Copy the state of one module (for diagnostics).
+ */
+void can_rtt_get(uint32_t can_id, can_module_rtt *out);
+
+/**
+ * @brief Monotonic time in microseconds.
+ */
+uint64_t can_rtt_now_us(void);
+
+#endif /* CAN_RTT_H */
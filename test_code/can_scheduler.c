@@ -0,0 +1,438 @@
+/**
+ *  @file    can_scheduler.c
+ *  @brief   Prioritized admission control between the Modbus front end and the CAN engine
+ *
+ *  See can_scheduler.h for the policy.
+ *
+ *  @author  Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include "can_scheduler.h"
+#include "can_rtt.h"
+#include "metrics.h"
+#include "log.h"
+
+
+/*
+ * Bounded FIFO per class
+ */
+typedef struct {
+    can_job    *jobs[SCHED_QUEUE_DEPTH];
+    uint32_t    head;
+    uint32_t    count;
+} sched_queue;
+
+/*
+ * Token bucket per client, tokens in 1/1000 units
+ */
+typedef struct {
+    uint32_t    client_id;
+    uint32_t    tokens_milli;
+    uint64_t    last_us;
+    int         used;
+} sched_bucket;
+
+
+static sched_queue            queues[SCHED_CLASS_COUNT];
+static can_sched_class_stats  stats[SCHED_CLASS_COUNT];
+static sched_bucket           buckets[SCHED_MAX_CLIENTS];
+static int                    running_class = -1;     /* Class of the job on the bus, -1 = idle */
+static int                    started;
+static pthread_t              worker_thread;
+static pthread_mutex_t        sched_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t         work_cond;
+static pthread_cond_t         done_cond;
+
+static const char *const class_names[SCHED_CLASS_COUNT] = {
+    "Commands", "Breaker status", "Settings", "Metering", "Records"
+};
+
+
+const char *can_sched_class_name(int sched_class)
+{
+    if ((sched_class < 0) || (sched_class >= SCHED_CLASS_COUNT))
+    {
+        return "Unknown";
+    }
+
+    return class_names[sched_class];
+}
+
+
+int can_sched_class_for_header(uint32_t data_header)
+{
+    /*
+     * Data header categories as used in the CAN ID (see doc/can_id.txt)
+     */
+    switch (data_header)
+    {
+        case 0:  return SCHED_CLASS_COMMANDS;          /* Commands                 */
+        case 2:  return SCHED_CLASS_BREAKER_STATUS;    /* Breaker status           */
+        case 1:  return SCHED_CLASS_SETTINGS;          /* Settings                 */
+        case 3:  return SCHED_CLASS_METERING;          /* Metering                 */
+        case 7:  return SCHED_CLASS_BREAKER_STATUS;    /* Heartbeat                */
+        default: return SCHED_CLASS_RECORDS;           /* Trip/event/maintenance   */
+    }
+}
+
+
+/**
+ * @brief Take one token from the client's bucket (sched_lock held).
+ *
+ * @return 1 if the request may proceed, 0 if the client is over its rate
+ */
+static int bucket_take(uint32_t client_id, uint64_t now_us)
+{
+    sched_bucket *b      = NULL;
+    sched_bucket *oldest = &buckets[0];
+    uint64_t      refill;
+    int           i;
+
+    for (i = 0; i < SCHED_MAX_CLIENTS; i++)
+    {
+        if (buckets[i].used && (buckets[i].client_id == client_id))
+        {
+            b = &buckets[i];
+            break;
+        }
+
+        if (!buckets[i].used || (oldest->used && (buckets[i].last_us < oldest->last_us)))
+        {
+            oldest = &buckets[i];
+        }
+    }
+
+    if (b == NULL)
+    {
+        /*
+         * New client (or table full): recycle the least recently seen entry
+         */
+        b               = oldest;
+        b->used         = 1;
+        b->client_id    = client_id;
+        b->tokens_milli = SCHED_CLIENT_BURST * 1000;
+        b->last_us      = now_us;
+    }
+
+    refill = ((now_us - b->last_us) * SCHED_CLIENT_RATE) / 1000;
+    if (refill > 0)
+    {
+        b->tokens_milli = (uint32_t)(b->tokens_milli + refill > SCHED_CLIENT_BURST * 1000 ?
+                                     SCHED_CLIENT_BURST * 1000 : b->tokens_milli + refill);
+        b->last_us = now_us;
+    }
+
+    if (b->tokens_milli < 1000)
+    {
+        return 0;
+    }
+
+    b->tokens_milli -= 1000;
+    return 1;
+}
+
+
+/**
+ * @brief Estimated time until a new job of this class would finish (sched_lock held).
+ *
+ * Everything queued at the same or higher priority runs first, plus the
+ * job currently on the bus, plus the job itself.
+ */
+static uint64_t estimate_completion_us(int sched_class)
+{
+    uint64_t wait_us = 0;
+    int      c;
+
+    for (c = 0; c <= sched_class; c++)
+    {
+        wait_us += (uint64_t)queues[c].count * stats[c].service_avg_us;
+    }
+
+    if (running_class >= 0)
+    {
+        wait_us += stats[running_class].service_avg_us;
+    }
+
+    return wait_us + stats[sched_class].service_avg_us;
+}
+
+
+static void finish_job(can_job *job, int status)
+{
+    job->status = status;
+    job->done   = 1;
+    pthread_cond_broadcast(&done_cond);
+}
+
+
+/**
+ * @brief Pop the highest-priority job, shedding expired ones (sched_lock held).
+ */
+static can_job *next_job(uint64_t now_us)
+{
+    sched_queue *q;
+    can_job     *job;
+    int          c;
+
+    for (c = 0; c < SCHED_CLASS_COUNT; c++)
+    {
+        q = &queues[c];
+
+        while (q->count > 0)
+        {
+            job      = q->jobs[q->head];
+            q->head  = (q->head + 1) % SCHED_QUEUE_DEPTH;
+            q->count--;
+            stats[c].depth = q->count;
+
+            if (now_us > job->deadline_us)
+            {
+                /*
+                 * The master has already given up on this one
+                 */
+                stats[c].shed_deadline++;
+                finish_job(job, SCHED_REJECT_DEADLINE);
+                continue;
+            }
+
+            return job;
+        }
+    }
+
+    return NULL;
+}
+
+
+static void *sched_worker(void *arg)
+{
+    struct timespec  wake;
+    can_job         *job;
+    uint64_t         start_us;
+    uint64_t         wait_us;
+    uint32_t         service_us;
+    time_t           next_stats = 0;
+    int              result;
+    int              c;
+
+    (void)arg;
+
+    pthread_mutex_lock(&sched_lock);
+
+    while (1)
+    {
+        /*
+         * Every iteration, not only when idle: under sustained load is when
+         * the shedding and queue depth figures matter
+         */
+        clock_gettime(CLOCK_MONOTONIC, &wake);
+
+        if (wake.tv_sec >= next_stats)
+        {
+            if (next_stats != 0)
+            {
+                pthread_mutex_unlock(&sched_lock);
+                can_sched_log_stats();
+                pthread_mutex_lock(&sched_lock);
+            }
+            next_stats = wake.tv_sec + SCHED_STATS_PERIOD_S;
+        }
+
+        job = next_job(can_rtt_now_us());
+
+        if (job == NULL)
+        {
+            wake.tv_sec += 1;
+            pthread_cond_timedwait(&work_cond, &sched_lock, &wake);
+            continue;
+        }
+
+        c             = job->sched_class;
+        running_class = c;
+        start_us      = can_rtt_now_us();
+        wait_us       = start_us - job->enqueue_us;
+
+        pthread_mutex_unlock(&sched_lock);
+
+        metrics_observe(METRIC_H_SCHED_WAIT, wait_us);
+        result = job->run(job->arg);
+
+        pthread_mutex_lock(&sched_lock);
+
+        service_us = (uint32_t)(can_rtt_now_us() - start_us);
+
+        /*
+         * EWMA with gain 1/8, same as the CAN SRTT
+         */
+        stats[c].service_avg_us = (7 * stats[c].service_avg_us + service_us) / 8;
+        stats[c].executed++;
+        stats[c].wait_total_us += wait_us;
+        if (wait_us > stats[c].wait_max_us)
+        {
+            stats[c].wait_max_us = wait_us;
+        }
+
+        running_class = -1;
+        job->result   = result;
+        finish_job(job, SCHED_OK);
+    }
+
+    return NULL;
+}
+
+
+int can_sched_start(void)
+{
+    pthread_condattr_t attr;
+    int                c;
+
+    pthread_mutex_lock(&sched_lock);
+
+    if (started)
+    {
+        pthread_mutex_unlock(&sched_lock);
+        return 0;
+    }
+
+    memset(queues, 0, sizeof(queues));
+    memset(stats, 0, sizeof(stats));
+    memset(buckets, 0, sizeof(buckets));
+    for (c = 0; c < SCHED_CLASS_COUNT; c++)
+    {
+        stats[c].service_avg_us = SCHED_INITIAL_SERVICE_US;
+    }
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&work_cond, &attr);
+    pthread_cond_init(&done_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if (pthread_create(&worker_thread, NULL, sched_worker, NULL) != 0)
+    {
+        pthread_mutex_unlock(&sched_lock);
+        return -1;
+    }
+
+    started = 1;
+    pthread_mutex_unlock(&sched_lock);
+
+    return 0;
+}
+
+
+int can_sched_submit(can_job *job)
+{
+    sched_queue *q;
+    uint64_t     now_us = can_rtt_now_us();
+    int          c      = job->sched_class;
+
+    if ((c < 0) || (c >= SCHED_CLASS_COUNT))
+    {
+        c = job->sched_class = SCHED_CLASS_RECORDS;
+    }
+
+    job->enqueue_us  = now_us;
+    job->deadline_us = now_us + (uint64_t)(job->deadline_ms ? job->deadline_ms : SCHED_DEFAULT_DEADLINE_MS) * 1000;
+    job->done        = 0;
+    job->result      = -1;
+
+    pthread_mutex_lock(&sched_lock);
+
+    if (!started)
+    {
+        pthread_mutex_unlock(&sched_lock);
+        job->status = SCHED_REJECT_NOT_READY;
+        return job->status;
+    }
+
+    q = &queues[c];
+
+    if (q->count >= SCHED_QUEUE_DEPTH)
+    {
+        stats[c].shed_full++;
+        pthread_mutex_unlock(&sched_lock);
+        job->status = SCHED_REJECT_FULL;
+        return job->status;
+    }
+
+    if (now_us + estimate_completion_us(c) > job->deadline_us)
+    {
+        /*
+         * Early shed: answering busy now is better than timing out later
+         */
+        stats[c].shed_deadline++;
+        pthread_mutex_unlock(&sched_lock);
+        job->status = SCHED_REJECT_DEADLINE;
+        return job->status;
+    }
+
+    /*
+     * Token last: a request shed as full or late does not cost the client one
+     */
+    if (!bucket_take(job->client_id, now_us))
+    {
+        stats[c].shed_rate++;
+        pthread_mutex_unlock(&sched_lock);
+        job->status = SCHED_REJECT_RATE;
+        return job->status;
+    }
+
+    q->jobs[(q->head + q->count) % SCHED_QUEUE_DEPTH] = job;
+    q->count++;
+    stats[c].depth = q->count;
+    if (q->count > stats[c].max_depth)
+    {
+        stats[c].max_depth = q->count;
+    }
+
+    pthread_cond_signal(&work_cond);
+
+    while (!job->done)
+    {
+        pthread_cond_wait(&done_cond, &sched_lock);
+    }
+
+    pthread_mutex_unlock(&sched_lock);
+
+    return job->status;
+}
+
+
+void can_sched_get_stats(int sched_class, can_sched_class_stats *out)
+{
+    memset(out, 0, sizeof(*out));
+
+    if ((sched_class < 0) || (sched_class >= SCHED_CLASS_COUNT))
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&sched_lock);
+    *out = stats[sched_class];
+    pthread_mutex_unlock(&sched_lock);
+}
+
+
+void can_sched_log_stats(void)
+{
+    can_sched_class_stats s;
+    int                   c;
+
+    for (c = 0; c < SCHED_CLASS_COUNT; c++)
+    {
+        can_sched_get_stats(c, &s);
+
+        LOG_INFO("Sched %-14s depth %2u (max %2u) executed %llu wait avg %llu us max %llu us service %u us shed rate/full/deadline %llu/%llu/%llu\n",
+                 class_names[c], s.depth, s.max_depth, (unsigned long long)s.executed,
+                 (unsigned long long)(s.executed ? s.wait_total_us / s.executed : 0),
+                 (unsigned long long)s.wait_max_us, s.service_avg_us,
+                 (unsigned long long)s.shed_rate, (unsigned long long)s.shed_full,
+                 (unsigned long long)s.shed_deadline);
+    }
+}
@@ -0,0 +1,136 @@
+/**
+ *  @file    can_scheduler.h
+ *  @brief   Prioritized admission control between the Modbus front end and the CAN engine
+ *
+ *  There is one CAN bus behind the bridge, so CAN transactions are executed
+ *  one at a time by a single CAN worker thread. Front-end threads submit a
+ *  job and wait for it. The scheduler decides which job runs next and which
+ *  jobs are refused:
+ *
+ *  - Priority classes per dataset category. Commands always go first, then
+ *    breaker status, settings, metering and records.
+ *  - Per-client token buckets. A master polling faster than
+ *    SCHED_CLIENT_RATE requests/s (with a SCHED_CLIENT_BURST burst) is
+ *    refused. This applies to Commands too, otherwise one master sending
+ *    commands in a loop would starve every other class.
+ *  - Bounded queue per class (SCHED_QUEUE_DEPTH).
+ *  - Deadline shedding: at admission the wait is estimated from the jobs
+ *    queued ahead and the measured service time of their classes. A job
+ *    that would miss its deadline is refused at once, and a job whose
+ *    deadline expired while queued is dropped without going on the bus.
+ *
+ *  A refused job should be answered with MODBUS_EXCEPTION_SLAVE_OR_SERVER_BUSY.
+ *
+ *  @author  Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#ifndef CAN_SCHEDULER_H
+#define CAN_SCHEDULER_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+
+/*
+ * Priority classes, 0 = highest
+ */
+#define SCHED_CLASS_COMMANDS        0
+#define SCHED_CLASS_BREAKER_STATUS  1
+#define SCHED_CLASS_SETTINGS        2
+#define SCHED_CLASS_METERING        3
+#define SCHED_CLASS_RECORDS         4
+#define SCHED_CLASS_COUNT           5
+
+/*
+ * Limits
+ */
+#define SCHED_QUEUE_DEPTH           16      /* Jobs per class                          */
+#define SCHED_MAX_CLIENTS           32      /* Token buckets tracked                   */
+#define SCHED_CLIENT_RATE           20      /* Sustained requests/s per client         */
+#define SCHED_CLIENT_BURST          10      /* Bucket size                             */
+#define SCHED_DEFAULT_DEADLINE_MS   1000    /* Typical Modbus master response timeout  */
+#define SCHED_INITIAL_SERVICE_US    20000   /* Service time estimate before measuring  */
+#define SCHED_STATS_PERIOD_S        60      /* Periodic LOG_INFO of the class stats    */
+
+/*
+ * Submit results (0 = executed, job->result holds the CAN outcome)
+ */
+#define SCHED_OK                    0
+#define SCHED_REJECT_RATE           1       /* Client token bucket empty               */
+#define SCHED_REJECT_FULL           2       /* Class queue full                        */
+#define SCHED_REJECT_DEADLINE       3       /* Would miss / missed its deadline        */
+#define SCHED_REJECT_NOT_READY      4       /* CAN engine not running                  */
+
+
+/*
+ * One CAN transaction waiting for the bus
+ */
+typedef struct can_job {
+    int           (*run)(void *arg);    /* Executed on the CAN worker thread       */
+    void           *arg;
+    int             sched_class;        /* SCHED_CLASS_*                           */
+    uint32_t        client_id;          /* e.g. IPv4 address of the master         */
+    uint32_t        deadline_ms;        /* Relative deadline, 0 = default          */
+
+    /* Filled by the scheduler */
+    uint64_t        enqueue_us;
+    uint64_t        deadline_us;
+    int             status;             /* SCHED_*                                 */
+    int             result;             /* Return value of run()                   */
+    int             done;
+} can_job;
+
+
+/*
+ * Per-class statistics
+ */
+typedef struct {
+    uint32_t    depth;                  /* Jobs currently queued                   */
+    uint32_t    max_depth;
+    uint64_t    executed;
+    uint64_t    shed_rate;
+    uint64_t    shed_full;
+    uint64_t    shed_deadline;
+    uint64_t    wait_total_us;          /* Queue wait of executed jobs             */
+    uint64_t    wait_max_us;
+    uint32_t    service_avg_us;         /* EWMA of run() duration                  */
+} can_sched_class_stats;
+
+
+/**
+ * @brief Start the CAN worker thread.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int can_sched_start(void);
+
+/**
+ * @brief Submit a job and wait until it was executed or refused.
+ *
+ * @return SCHED_OK if run() was executed (see job->result), SCHED_REJECT_* otherwise
+ */
+int can_sched_submit(can_job *job);
+
+/**
+ * @brief Map a dataset category (CMD_* data header) to a priority class.
+ */
+int can_sched_class_for_header(uint32_t data_header);
+
+/**
+ * @brief Copy the statistics of one class.
+ */
+void can_sched_get_stats(int sched_class, can_sched_class_stats *out);
+
+/**
+ * @brief Log depth, wait time and shed counts of every class.
+ */
+void can_sched_log_stats(void);
+
+/**
+ * @brief Human-readable name of a class.
+ */
+const char *can_sched_class_name(int sched_class);
+
+#endif /* CAN_SCHEDULER_H */
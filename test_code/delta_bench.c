@@ -0,0 +1,236 @@
+/**
+ *  @file    delta_bench.c
+ *  @brief   Bus frames per poll cycle: normal reads vs delta reads
+ *
+ *  Drives the ETU side (can_delta_encode with the ETU's last-sent image,
+ *  as the ETU simulator does) and the bridge side (can_delta_apply into the
+ *  cache) over a simulated metering dataset, and counts CAN frames per poll:
+ *  request + response fragments + ACKs. Every merged copy is compared with
+ *  the ETU data.
+ *
+ *  Metering workload, 64 registers:
+ *    12 x V/I floats   low word changes 70 %, high word 5 % of polls
+ *     8 x power        50 %
+ *     4 x energy u32   low word 30 %, high word rarely
+ *    remaining status / min / max / frequency  2 %
+ *  followed by a sweep with every word changing with the same probability.
+ *
+ *    gcc -O2 delta_bench.c can_delta.c -o delta_bench
+ *    ./delta_bench [polls] [transaction loss %]
+ *
+ *  A lost transaction leaves the bridge on its old version while the ETU
+ *  already moved on, so the next poll is answered in full.
+ *
+ *  @author  Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "can_delta.h"
+
+
+#define BENCH_POLLS             10000
+#define BENCH_REGISTERS         64
+#define BENCH_BYTES             (BENCH_REGISTERS * 2)
+#define BENCH_FRAME_BYTES       6       /* Data bytes per fragment         */
+#define BENCH_FRAME_BITS        160     /* Extended frame, 8 data bytes, worst-case stuffing */
+#define BENCH_BITRATE           1000000
+
+
+/*
+ * Change probability per register word, in 1/1000
+ */
+static uint16_t change_permille[BENCH_REGISTERS];
+
+/*
+ * ETU side
+ */
+static uint8_t  etu_data[BENCH_BYTES];
+static uint8_t  etu_sent[BENCH_BYTES];
+static uint32_t etu_sent_version;
+static int      etu_has_sent;
+
+
+static uint32_t rng_state = 12345;
+
+static uint32_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+
+static void metering_profile(void)
+{
+    int r = 0;
+    int i;
+
+    for (i = 0; i < 12; i++)
+    {
+        change_permille[r++] = 50;      /* High word */
+        change_permille[r++] = 700;     /* Low word  */
+    }
+    for (i = 0; i < 8; i++)
+    {
+        change_permille[r++] = 500;
+    }
+    for (i = 0; i < 4; i++)
+    {
+        change_permille[r++] = 1;
+        change_permille[r++] = 300;
+    }
+    while (r < BENCH_REGISTERS)
+    {
+        change_permille[r++] = 20;
+    }
+}
+
+
+static void uniform_profile(uint16_t permille)
+{
+    int r;
+
+    for (r = 0; r < BENCH_REGISTERS; r++)
+    {
+        change_permille[r] = permille;
+    }
+}
+
+
+static void update_etu_data(void)
+{
+    uint32_t v;
+    int      r;
+
+    for (r = 0; r < BENCH_REGISTERS; r++)
+    {
+        if (rng() % 1000 < change_permille[r])
+        {
+            /*
+             * Any value except the current one
+             */
+            v = ((uint32_t)etu_data[r * 2] << 8) | etu_data[r * 2 + 1];
+            v = (v + 1 + rng() % 0xFFFF) & 0xFFFF;
+            etu_data[r * 2]     = (uint8_t)(v >> 8);
+            etu_data[r * 2 + 1] = (uint8_t)v;
+        }
+    }
+}
+
+
+static uint32_t frames_for(int bytes)
+{
+    uint32_t fragments = (uint32_t)((bytes + BENCH_FRAME_BYTES - 1) / BENCH_FRAME_BYTES);
+
+    return 1 + 2 * fragments;   /* Request, fragments, one ACK per fragment */
+}
+
+
+static int run(const char *name, uint32_t polls, uint32_t loss_permille)
+{
+    static uint8_t   stream[CAN_DELTA_MAX_STREAM];
+    can_delta_slot  *slot;
+    uint64_t         frames_normal = 0;
+    uint64_t         frames_delta  = 0;
+    uint32_t         count[3]      = { 0, 0, 0 };
+    uint32_t         errors        = 0;
+    uint32_t         p;
+    int              len;
+
+    memset(etu_data, 0, sizeof(etu_data));
+    etu_has_sent = 0;
+
+    /*
+     * Fresh cache entry for each run
+     */
+    slot = can_delta_slot_get(0x01300000U + (rng() & 0xFFFF), BENCH_BYTES);
+    slot->version = 0;
+
+    for (p = 0; p < polls; p++)
+    {
+        update_etu_data();
+
+        /*
+         * ETU: answer the bridge's version, remember what was sent
+         */
+        len = can_delta_encode(etu_has_sent ? etu_sent : NULL, etu_sent_version,
+                               etu_data, BENCH_BYTES, slot->version, stream);
+        memcpy(etu_sent, etu_data, BENCH_BYTES);
+        etu_sent_version = can_delta_version(etu_data, BENCH_BYTES);
+        etu_has_sent     = 1;
+
+        frames_normal += frames_for(BENCH_BYTES);
+        frames_delta  += frames_for(len);
+        count[stream[0]]++;
+
+        if (rng() % 1000 < loss_permille)
+        {
+            /*
+             * Transaction failed on the bus, the bridge keeps its old copy
+             */
+            slot->version = 0;
+            continue;
+        }
+
+        if ((can_delta_apply(slot, stream, len) != 0) || (memcmp(slot->data, etu_data, BENCH_BYTES) != 0))
+        {
+            errors++;
+        }
+    }
+
+    printf("%-18s %8.2f %8.2f %7.1f %%  %7.0f %7.0f   %5.1f/%5.1f/%5.1f %%  %u\n", name,
+           (double)frames_normal / polls, (double)frames_delta / polls,
+           100.0 - 100.0 * (double)frames_delta / (double)frames_normal,
+           (double)frames_normal / polls * BENCH_FRAME_BITS * 1e6 / BENCH_BITRATE,
+           (double)frames_delta / polls * BENCH_FRAME_BITS * 1e6 / BENCH_BITRATE,
+           100.0 * count[CAN_DELTA_UNCHANGED] / polls, 100.0 * count[CAN_DELTA_CHANGES] / polls,
+           100.0 * count[CAN_DELTA_FULL] / polls, errors);
+
+    return errors ? 1 : 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+    static const uint16_t sweep[] = { 0, 10, 50, 100, 200, 300, 500, 1000 };
+    uint32_t polls = BENCH_POLLS;
+    uint32_t loss  = 0;
+    char     name[32];
+    int      failed = 0;
+    size_t   i;
+
+    if (argc > 1)
+    {
+        polls = (uint32_t)strtoul(argv[1], NULL, 0);
+    }
+    if (argc > 2)
+    {
+        loss = (uint32_t)(strtod(argv[2], NULL) * 10.0);
+    }
+    if (polls == 0)
+    {
+        polls = 1;
+    }
+
+    printf("%u polls of %d registers, transaction loss %.1f %%\n\n", polls, BENCH_REGISTERS, loss / 10.0);
+    printf("%-18s %8s %8s %9s  %7s %7s   %-19s  %s\n", "workload", "frames", "delta",
+           "saved", "bus us", "delta", "unch/chg/full", "errors");
+
+    metering_profile();
+    failed |= run("metering", polls, loss);
+
+    for (i = 0; i < sizeof(sweep) / sizeof(sweep[0]); i++)
+    {
+        uniform_profile(sweep[i]);
+        snprintf(name, sizeof(name), "uniform %5.1f %%", sweep[i] / 10.0);
+        failed |= run(name, polls, loss);
+    }
+
+    return failed;
+}
@@ -0,0 +1,226 @@
+/**
+ *  @file    discover.c
+ *  @brief   Find Modbus/CAN gateways on the local networks (NEED_INFO broadcast)
+ *
+ *  Sends one NEED_INFO broadcast (discovery.h) and lists every binary reply
+ *  that arrives within the wait time: address, MAC, Modbus port, register
+ *  map version, CAN state and served unit IDs. Replies are collected
+ *  without per-gateway round trips, so hundreds of gateways answer in one
+ *  wait period. -l asks with the old NEED_IP and prints the text replies.
+ *
+ *    gcc -O2 discover.c -o discover
+ *    ./discover [-b 255.255.255.255] [-w 500] [-n repeats] [-l]
+ *
+ *  @author  Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "discovery.h"
+
+
+#define MAX_GATEWAYS    1024
+
+
+typedef struct {
+    uint32_t    addr;
+    uint8_t     reply[DISC_REPLY_MAX];
+    int         len;
+} gateway;
+
+static gateway  gateways[MAX_GATEWAYS];
+static int      gateway_count;
+
+
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000ULL + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+
+/**
+ * @return 1 if the reply is new, 0 for a repeat (several broadcasts or interfaces)
+ */
+static int remember(uint32_t addr, const uint8_t *reply, int len)
+{
+    int i;
+
+    for (i = 0; i < gateway_count; i++)
+    {
+        if (gateways[i].addr == addr)
+        {
+            return 0;
+        }
+    }
+    if (gateway_count >= MAX_GATEWAYS)
+    {
+        return 0;
+    }
+
+    gateways[gateway_count].addr = addr;
+    gateways[gateway_count].len  = (len > DISC_REPLY_MAX) ? DISC_REPLY_MAX : len;
+    memcpy(gateways[gateway_count].reply, reply, (size_t)gateways[gateway_count].len);
+    gateway_count++;
+
+    return 1;
+}
+
+
+static void print_info(const struct sockaddr_in *from, const uint8_t *r, int len)
+{
+    char     ip[INET_ADDRSTRLEN];
+    uint32_t map_version;
+    int      units;
+    int      i;
+
+    if ((len < DISC_HEADER_LEN) || (memcmp(r, DISC_MAGIC, 4) != 0))
+    {
+        printf("%-15s  (not a gateway reply, %d bytes)\n", inet_ntoa(from->sin_addr), len);
+        return;
+    }
+    if (r[4] != DISC_VERSION)
+    {
+        printf("%-15s  (reply version %u)\n", inet_ntoa(from->sin_addr), r[4]);
+        return;
+    }
+
+    inet_ntop(AF_INET, &r[8], ip, sizeof(ip));
+    map_version = ((uint32_t)r[19] << 24) | ((uint32_t)r[20] << 16) | ((uint32_t)r[21] << 8) | r[22];
+    units       = r[25];
+
+    printf("%-15s /%-2u  %02x:%02x:%02x:%02x:%02x:%02x  port %-5u  map v%-4u %2u datasets  CAN %-4s%s%s  units ",
+           ip, r[12], r[13], r[14], r[15], r[16], r[17], r[18], (r[6] << 8) | r[7], map_version,
+           (r[23] << 8) | r[24], (r[5] & DISC_FLAG_CAN_READY) ? "up" : "down",
+           (r[5] & DISC_FLAG_DELTA_READ) ? "  delta" : "", (r[5] & DISC_FLAG_MAP_FILE) ? "  map file" : "");
+
+    if (units == 0)
+    {
+        printf("any");
+    }
+    for (i = 0; (i < units) && (DISC_HEADER_LEN + i < len); i++)
+    {
+        printf("%s%u", i ? "," : "", r[DISC_HEADER_LEN + i]);
+    }
+    printf("\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+    const char         *bcast   = "255.255.255.255";
+    const char         *request = DISC_REQUEST_INFO;
+    uint32_t            wait_ms = 500;
+    int                 repeats = 2;
+    int                 legacy  = 0;
+    struct sockaddr_in  to;
+    struct sockaddr_in  from;
+    socklen_t           from_len;
+    struct pollfd       pfd;
+    uint8_t             buf[256];
+    uint64_t            start;
+    uint64_t            deadline;
+    uint64_t            next_send;
+    int                 sent = 0;
+    int                 sock;
+    int                 one = 1;
+    int                 len;
+    int                 opt;
+
+    while ((opt = getopt(argc, argv, "b:w:n:l")) != -1)
+    {
+        switch (opt)
+        {
+            case 'b': bcast   = optarg; break;
+            case 'w': wait_ms = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'n': repeats = atoi(optarg); break;
+            case 'l': legacy  = 1; request = DISC_REQUEST_IP; break;
+            default:
+                fprintf(stderr, "usage: %s [-b broadcast] [-w wait_ms] [-n repeats] [-l]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0)
+    {
+        perror("socket");
+        return 1;
+    }
+    setsockopt(sock, SOL_SOCKET, SO_BROADCAST, &one, sizeof(one));
+
+    memset(&to, 0, sizeof(to));
+    to.sin_family = AF_INET;
+    to.sin_port   = htons(DISC_PORT);
+    if (inet_pton(AF_INET, bcast, &to.sin_addr) != 1)
+    {
+        fprintf(stderr, "bad address %s\n", bcast);
+        return 1;
+    }
+
+    /*
+     * A lost broadcast is sent again; a gateway's reply is printed once
+     */
+    if (repeats < 1)
+    {
+        repeats = 1;
+    }
+    start     = now_ms();
+    deadline  = start + wait_ms;
+    next_send = start;
+    pfd.fd     = sock;
+    pfd.events = POLLIN;
+
+    while (now_ms() < deadline)
+    {
+        if ((sent < repeats) && (now_ms() >= next_send))
+        {
+            if (sendto(sock, request, strlen(request), 0, (struct sockaddr *)&to, sizeof(to)) < 0)
+            {
+                perror("sendto");
+                return 1;
+            }
+            sent++;
+            next_send = start + (uint64_t)wait_ms * sent / repeats / 2;
+        }
+
+        if (poll(&pfd, 1, 10) <= 0)
+        {
+            continue;
+        }
+
+        from_len = sizeof(from);
+        len = (int)recvfrom(sock, buf, sizeof(buf) - 1, 0, (struct sockaddr *)&from, &from_len);
+        if ((len <= 0) || !remember(from.sin_addr.s_addr, buf, len))
+        {
+            continue;
+        }
+
+        if (legacy)
+        {
+            buf[len] = '\0';
+            printf("%-15s  %s\n", inet_ntoa(from.sin_addr), (char *)buf);
+        }
+        else
+        {
+            print_info(&from, buf, len);
+        }
+    }
+
+    fprintf(stderr, "%d gateways in %u ms\n", gateway_count, (unsigned)(now_ms() - start));
+    close(sock);
+
+    return 0;
+}
@@ -0,0 +1,823 @@
+/**
+ *  @file    discovery.c
+ *  @brief   UDP discovery responder with a netlink-driven address cache
+ *
+ *  See discovery.h for the requests and the reply format. One thread owns
+ *  the address cache and the UDP socket; it sleeps in poll() on the UDP
+ *  socket and the rtnetlink socket.
+ *
+ *  @author  Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_arp.h>
+#include "discovery.h"
+#include "log.h"
+
+
+#define DISC_MAX_LINKS          16
+#define DISC_MAX_ADDRS          32
+#define DISC_NL_BUF             16384
+#define DISC_NL_TIMEOUT_MS      1000
+
+/*
+ * Interface, from RTM_NEWLINK
+ */
+typedef struct {
+    int         ifindex;
+    uint32_t    flags;                      /* IFF_*                       */
+    uint8_t     mac[6];
+    char        name[IFNAMSIZ];
+} disc_link;
+
+/*
+ * IPv4 address with both replies ready to send
+ */
+typedef struct {
+    int         ifindex;
+    uint32_t    addr;                       /* Network byte order          */
+    uint32_t    mask;
+    uint8_t     prefix;
+    uint8_t     secondary;
+    uint8_t     text_len;
+    uint8_t     reply_len;
+    char        text[INET_ADDRSTRLEN];
+    uint8_t     reply[DISC_REPLY_MAX];
+} disc_addr;
+
+/*
+ * Token bucket, tokens in 1/1000 units
+ */
+typedef struct {
+    uint32_t    source;
+    uint32_t    tokens_milli;
+    uint64_t    last_us;
+    int         used;
+} disc_bucket;
+
+
+static discovery_config  disc_config;
+static disc_link         links[DISC_MAX_LINKS];
+static int               link_count;
+static disc_addr         addrs[DISC_MAX_ADDRS];
+static int               addr_count;
+static disc_bucket       buckets[DISC_MAX_SOURCES];
+static disc_bucket       global_bucket;
+static uint32_t          nl_seq;
+
+static atomic_ullong     stat_requests;
+static atomic_ullong     stat_replies;
+static atomic_ullong     stat_rate_limited;
+static atomic_ullong     stat_netlink_events;
+static atomic_uint       stat_addresses;
+
+
+static uint64_t disc_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000;
+}
+
+
+/***************************************************************
+ *  Address cache
+ ***************************************************************/
+
+static disc_link *link_find(int ifindex)
+{
+    int i;
+
+    for (i = 0; i < link_count; i++)
+    {
+        if (links[i].ifindex == ifindex)
+        {
+            return &links[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief Prebuild the text and binary replies of @p a.
+ *
+ * Status fields ([5], [19..24]) are filled in at send time.
+ */
+static void reply_build(disc_addr *a)
+{
+    const disc_link *l = link_find(a->ifindex);
+    uint8_t         *r = a->reply;
+
+    inet_ntop(AF_INET, &a->addr, a->text, sizeof(a->text));
+    a->text_len = (uint8_t)strlen(a->text);
+
+    memset(r, 0, DISC_REPLY_MAX);
+    memcpy(r, DISC_MAGIC, 4);
+    r[4] = DISC_VERSION;
+    r[6] = (uint8_t)(disc_config.modbus_port >> 8);
+    r[7] = (uint8_t)disc_config.modbus_port;
+    memcpy(&r[8], &a->addr, 4);
+    r[12] = a->prefix;
+    if (l != NULL)
+    {
+        memcpy(&r[13], l->mac, 6);
+    }
+    r[25] = disc_config.unit_count;
+    memcpy(&r[DISC_HEADER_LEN], disc_config.units, disc_config.unit_count);
+
+    a->reply_len = (uint8_t)(DISC_HEADER_LEN + disc_config.unit_count);
+}
+
+
+static void cache_addr(int add, int ifindex, uint32_t addr, uint8_t prefix, uint8_t secondary)
+{
+    int i;
+
+    for (i = 0; i < addr_count; i++)
+    {
+        if ((addrs[i].ifindex == ifindex) && (addrs[i].addr == addr))
+        {
+            break;
+        }
+    }
+
+    if (!add)
+    {
+        if (i < addr_count)
+        {
+            addrs[i] = addrs[--addr_count];
+        }
+    }
+    else
+    {
+        if (i == addr_count)
+        {
+            if (addr_count >= DISC_MAX_ADDRS)
+            {
+                LOG_WARN("Discovery: more than %d IPv4 addresses, %s ignored\n", DISC_MAX_ADDRS,
+                         inet_ntoa(*(struct in_addr *)&addr));
+                return;
+            }
+            addr_count++;
+        }
+
+        addrs[i].ifindex   = ifindex;
+        addrs[i].addr      = addr;
+        addrs[i].prefix    = prefix;
+        addrs[i].mask      = prefix ? htonl(0xFFFFFFFFU << (32 - prefix)) : 0;
+        addrs[i].secondary = secondary;
+        reply_build(&addrs[i]);
+    }
+
+    atomic_store_explicit(&stat_addresses, (unsigned)addr_count, memory_order_relaxed);
+}
+
+
+static void cache_link(int add, const struct ifinfomsg *ifi, const char *name, const uint8_t *mac)
+{
+    disc_link *l = link_find(ifi->ifi_index);
+    int        i;
+
+    if (!add)
+    {
+        if (l != NULL)
+        {
+            *l = links[--link_count];
+        }
+        return;
+    }
+
+    if (l == NULL)
+    {
+        if (link_count >= DISC_MAX_LINKS)
+        {
+            return;
+        }
+        l = &links[link_count++];
+        memset(l, 0, sizeof(*l));
+        l->ifindex = ifi->ifi_index;
+    }
+
+    l->flags = ifi->ifi_flags;
+    if (name != NULL)
+    {
+        snprintf(l->name, sizeof(l->name), "%s", name);
+    }
+    if (mac != NULL)
+    {
+        memcpy(l->mac, mac, 6);
+    }
+
+    /*
+     * The MAC is part of the replies of this interface's addresses
+     */
+    for (i = 0; i < addr_count; i++)
+    {
+        if (addrs[i].ifindex == l->ifindex)
+        {
+            reply_build(&addrs[i]);
+        }
+    }
+}
+
+
+/***************************************************************
+ *  rtnetlink
+ ***************************************************************/
+
+static void nl_message(const struct nlmsghdr *nh)
+{
+    const struct ifaddrmsg *ifa;
+    const struct ifinfomsg *ifi;
+    const struct rtattr    *rta;
+    const uint8_t          *mac;
+    const char             *name;
+    const uint32_t         *local;
+    const uint32_t         *address;
+    int                     len;
+
+    switch (nh->nlmsg_type)
+    {
+        case RTM_NEWADDR:
+        case RTM_DELADDR:
+            ifa = NLMSG_DATA(nh);
+            if (ifa->ifa_family != AF_INET)
+            {
+                return;
+            }
+
+            local   = NULL;
+            address = NULL;
+            len     = (int)IFA_PAYLOAD(nh);
+            for (rta = IFA_RTA(ifa); RTA_OK(rta, len); rta = RTA_NEXT(rta, len))
+            {
+                if (rta->rta_type == IFA_LOCAL)
+                {
+                    local = RTA_DATA(rta);
+                }
+                else if (rta->rta_type == IFA_ADDRESS)
+                {
+                    address = RTA_DATA(rta);
+                }
+            }
+
+            /*
+             * IFA_LOCAL is the own address on point-to-point links
+             */
+            if (local == NULL)
+            {
+                local = address;
+            }
+            if (local != NULL)
+            {
+                cache_addr(nh->nlmsg_type == RTM_NEWADDR, (int)ifa->ifa_index, *local, ifa->ifa_prefixlen,
+                           (ifa->ifa_flags & IFA_F_SECONDARY) != 0);
+            }
+            break;
+
+        case RTM_NEWLINK:
+        case RTM_DELLINK:
+            ifi  = NLMSG_DATA(nh);
+            name = NULL;
+            mac  = NULL;
+            len  = (int)IFLA_PAYLOAD(nh);
+            for (rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len))
+            {
+                if (rta->rta_type == IFLA_IFNAME)
+                {
+                    name = RTA_DATA(rta);
+                }
+                else if ((rta->rta_type == IFLA_ADDRESS) && (RTA_PAYLOAD(rta) == 6))
+                {
+                    mac = RTA_DATA(rta);
+                }
+            }
+            cache_link(nh->nlmsg_type == RTM_NEWLINK, ifi, name, mac);
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+/**
+ * @brief Process what is queued on the netlink socket.
+ *
+ * @return 1 when the end of a dump was seen, 0 otherwise, -1 on overrun
+ *         (events lost, the cache must be dumped again)
+ */
+static int nl_receive(int nl_fd)
+{
+    static uint8_t   buf[DISC_NL_BUF] __attribute__((aligned(4)));
+    struct nlmsghdr *nh;
+    int              len;
+    int              done = 0;
+
+    len = (int)recv(nl_fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if (len < 0)
+    {
+        return (errno == ENOBUFS) ? -1 : 0;
+    }
+
+    for (nh = (struct nlmsghdr *)buf; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len))
+    {
+        if ((nh->nlmsg_type == NLMSG_DONE) || (nh->nlmsg_type == NLMSG_ERROR))
+        {
+            done = 1;
+            continue;
+        }
+        atomic_fetch_add_explicit(&stat_netlink_events, 1, memory_order_relaxed);
+        nl_message(nh);
+    }
+
+    return done;
+}
+
+
+static int nl_dump(int nl_fd, int type)
+{
+    struct {
+        struct nlmsghdr  nh;
+        struct rtgenmsg  gen;
+    } req;
+    struct pollfd pfd;
+    int           ret;
+
+    memset(&req, 0, sizeof(req));
+    req.nh.nlmsg_len   = NLMSG_LENGTH(sizeof(struct rtgenmsg));
+    req.nh.nlmsg_type  = (uint16_t)type;
+    req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.nh.nlmsg_seq   = ++nl_seq;
+    req.gen.rtgen_family = (type == RTM_GETADDR) ? AF_INET : AF_UNSPEC;
+
+    if (send(nl_fd, &req, req.nh.nlmsg_len, 0) < 0)
+    {
+        return -1;
+    }
+
+    pfd.fd     = nl_fd;
+    pfd.events = POLLIN;
+    for (;;)
+    {
+        if (poll(&pfd, 1, DISC_NL_TIMEOUT_MS) <= 0)
+        {
+            return -1;
+        }
+        ret = nl_receive(nl_fd);
+        if (ret != 0)
+        {
+            return (ret > 0) ? 0 : -1;
+        }
+    }
+}
+
+
+/**
+ * @brief (Re)load the whole cache: links first, the replies carry the MAC.
+ */
+static void nl_resync(int nl_fd)
+{
+    link_count = 0;
+    addr_count = 0;
+
+    if ((nl_dump(nl_fd, RTM_GETLINK) != 0) || (nl_dump(nl_fd, RTM_GETADDR) != 0))
+    {
+        LOG_WARN("Discovery: netlink dump incomplete, %d addresses cached\n", addr_count);
+    }
+    atomic_store_explicit(&stat_addresses, (unsigned)addr_count, memory_order_relaxed);
+
+    LOG_DEBUG("Discovery: %d interfaces, %d IPv4 addresses\n", link_count, addr_count);
+}
+
+
+static int nl_open(void)
+{
+    struct sockaddr_nl sa;
+    int                fd;
+    int                rcvbuf = 256 * 1024;
+
+    fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    memset(&sa, 0, sizeof(sa));
+    sa.nl_family = AF_NETLINK;
+    sa.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR;
+    if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+/***************************************************************
+ *  Requests
+ ***************************************************************/
+
+static int is_usable(const disc_addr *a)
+{
+    const disc_link *l = link_find(a->ifindex);
+
+    if ((ntohl(a->addr) >> 24) == 127)
+    {
+        return 0;
+    }
+
+    return (l == NULL) || (((l->flags & IFF_UP) != 0) && ((l->flags & IFF_LOOPBACK) == 0));
+}
+
+
+/**
+ * @brief Address to announce to @p source, whose broadcast came in on @p ifindex.
+ *
+ * Same subnet on the receiving interface, then any primary address of
+ * that interface, then any primary address at all.
+ */
+static const disc_addr *pick_addr(int ifindex, uint32_t source)
+{
+    const disc_addr *best = NULL;
+    int              best_rank = 0;
+    int              rank;
+    int              i;
+
+    for (i = 0; i < addr_count; i++)
+    {
+        const disc_addr *a = &addrs[i];
+
+        if (!is_usable(a))
+        {
+            continue;
+        }
+
+        rank = a->secondary ? 1 : 2;
+        if (a->ifindex == ifindex)
+        {
+            rank += 2;
+            if ((a->addr & a->mask) == (source & a->mask))
+            {
+                rank += 4;
+            }
+        }
+
+        if (rank > best_rank)
+        {
+            best      = a;
+            best_rank = rank;
+        }
+    }
+
+    return best;
+}
+
+
+/**
+ * @return 1 if @p b holds a whole token after refilling it up to @p now
+ */
+static int bucket_refill(disc_bucket *b, uint32_t rate, uint32_t burst, uint64_t now)
+{
+    uint64_t refill = (now - b->last_us) * rate / 1000;
+
+    /*
+     * Only move last_us with a refill: otherwise calls closer together than
+     * one milli-token would throw the elapsed time away and never refill
+     */
+    if (refill > 0)
+    {
+        b->tokens_milli = (uint32_t)((b->tokens_milli + refill > burst * 1000ULL) ? burst * 1000ULL
+                                                                                  : b->tokens_milli + refill);
+        b->last_us = now;
+    }
+
+    return b->tokens_milli >= 1000;
+}
+
+
+/**
+ * @return 1 if @p source may get a reply now
+ */
+static int rate_allow(uint32_t source)
+{
+    disc_bucket *b      = NULL;
+    disc_bucket *oldest = &buckets[0];
+    uint64_t     now    = disc_now_us();
+    int          i;
+
+    if (!global_bucket.used)
+    {
+        global_bucket.used         = 1;
+        global_bucket.last_us      = now;
+        global_bucket.tokens_milli = DISC_GLOBAL_RATE * 1000U;
+    }
+
+    for (i = 0; i < DISC_MAX_SOURCES; i++)
+    {
+        if (buckets[i].used && (buckets[i].source == source))
+        {
+            b = &buckets[i];
+            break;
+        }
+        if (!buckets[i].used || (buckets[i].last_us < oldest->last_us))
+        {
+            oldest = &buckets[i];
+        }
+    }
+
+    if (b == NULL)
+    {
+        /*
+         * New source: take a free or the least recently seen bucket
+         */
+        b = oldest;
+        b->used         = 1;
+        b->source       = source;
+        b->last_us      = now;
+        b->tokens_milli = DISC_SOURCE_BURST * 1000U;
+    }
+
+    /*
+     * A token from each, or from neither: a source over its own rate must
+     * not drain the global bucket for everybody else
+     */
+    if (!bucket_refill(b, DISC_SOURCE_RATE, DISC_SOURCE_BURST, now) ||
+        !bucket_refill(&global_bucket, DISC_GLOBAL_RATE, DISC_GLOBAL_RATE, now))
+    {
+        return 0;
+    }
+    b->tokens_milli            -= 1000;
+    global_bucket.tokens_milli -= 1000;
+
+    return 1;
+}
+
+
+static void answer(int sock, const uint8_t *req, ssize_t len, const struct sockaddr_in *from, int ifindex)
+{
+    const disc_addr  *a;
+    discovery_status  st;
+    uint8_t           reply[DISC_REPLY_MAX];
+    int               binary;
+
+    /*
+     * Requests are plain strings, a trailing NUL or newline is accepted
+     */
+    while ((len > 0) && ((req[len - 1] == '\0') || (req[len - 1] == '\n') || (req[len - 1] == '\r')))
+    {
+        len--;
+    }
+
+    if ((len == (ssize_t)strlen(DISC_REQUEST_INFO)) && (memcmp(req, DISC_REQUEST_INFO, (size_t)len) == 0))
+    {
+        binary = 1;
+    }
+    else if ((len == (ssize_t)strlen(DISC_REQUEST_IP)) && (memcmp(req, DISC_REQUEST_IP, (size_t)len) == 0))
+    {
+        binary = 0;
+    }
+    else
+    {
+        return;
+    }
+
+    atomic_fetch_add_explicit(&stat_requests, 1, memory_order_relaxed);
+
+    if (!rate_allow(from->sin_addr.s_addr))
+    {
+        atomic_fetch_add_explicit(&stat_rate_limited, 1, memory_order_relaxed);
+        return;
+    }
+
+    a = pick_addr(ifindex, from->sin_addr.s_addr);
+
+    if (!binary)
+    {
+        if (a != NULL)
+        {
+            sendto(sock, a->text, a->text_len, 0, (const struct sockaddr *)from, sizeof(*from));
+        }
+        else
+        {
+            sendto(sock, "UNKNOWN", 7, 0, (const struct sockaddr *)from, sizeof(*from));
+        }
+    }
+    else
+    {
+        if (a != NULL)
+        {
+            memcpy(reply, a->reply, a->reply_len);
+        }
+        else
+        {
+            disc_addr none;
+
+            memset(&none, 0, sizeof(none));
+            reply_build(&none);
+            memcpy(reply, none.reply, none.reply_len);
+        }
+
+        memset(&st, 0, sizeof(st));
+        if (disc_config.status != NULL)
+        {
+            disc_config.status(&st);
+        }
+        reply[5]  = st.flags;
+        reply[19] = (uint8_t)(st.map_version >> 24);
+        reply[20] = (uint8_t)(st.map_version >> 16);
+        reply[21] = (uint8_t)(st.map_version >> 8);
+        reply[22] = (uint8_t)st.map_version;
+        reply[23] = (uint8_t)(st.dataset_count >> 8);
+        reply[24] = (uint8_t)st.dataset_count;
+
+        sendto(sock, reply, (size_t)(DISC_HEADER_LEN + disc_config.unit_count), 0,
+               (const struct sockaddr *)from, sizeof(*from));
+    }
+
+    atomic_fetch_add_explicit(&stat_replies, 1, memory_order_relaxed);
+}
+
+
+static int udp_open(void)
+{
+    struct sockaddr_in sa;
+    int                fd;
+    int                one = 1;
+
+    fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(fd, IPPROTO_IP, IP_PKTINFO, &one, sizeof(one));
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family      = AF_INET;
+    sa.sin_port        = htons(DISC_PORT);
+    sa.sin_addr.s_addr = INADDR_ANY;
+    if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+typedef struct {
+    int udp_fd;
+    int nl_fd;
+} disc_sockets;
+
+static disc_sockets disc_fds;
+
+
+static void *discovery_thread(void *arg)
+{
+    disc_sockets       *s = arg;
+    struct pollfd       pfd[2];
+    struct sockaddr_in  from;
+    struct msghdr       msg;
+    struct iovec        iov;
+    struct cmsghdr     *cmsg;
+    uint8_t             buf[64];
+    char                ctrl[CMSG_SPACE(sizeof(struct in_pktinfo))];
+    ssize_t             len;
+    int                 ifindex;
+
+    pfd[0].fd     = s->udp_fd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd     = s->nl_fd;
+    pfd[1].events = POLLIN;
+
+    for (;;)
+    {
+        if (poll(pfd, 2, -1) < 0)
+        {
+            continue;
+        }
+
+        if (pfd[1].revents & POLLIN)
+        {
+            if (nl_receive(s->nl_fd) < 0)
+            {
+                LOG_WARN("Discovery: netlink overrun, reloading the address cache\n");
+                nl_resync(s->nl_fd);
+            }
+        }
+
+        if (pfd[0].revents & POLLIN)
+        {
+            iov.iov_base       = buf;
+            iov.iov_len        = sizeof(buf);
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_name       = &from;
+            msg.msg_namelen    = sizeof(from);
+            msg.msg_iov        = &iov;
+            msg.msg_iovlen     = 1;
+            msg.msg_control    = ctrl;
+            msg.msg_controllen = sizeof(ctrl);
+
+            len = recvmsg(s->udp_fd, &msg, MSG_DONTWAIT);
+            if (len <= 0)
+            {
+                continue;
+            }
+
+            ifindex = 0;
+            for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+            {
+                if ((cmsg->cmsg_level == IPPROTO_IP) && (cmsg->cmsg_type == IP_PKTINFO))
+                {
+                    ifindex = ((struct in_pktinfo *)CMSG_DATA(cmsg))->ipi_ifindex;
+                }
+            }
+
+            answer(s->udp_fd, buf, len, &from, ifindex);
+        }
+    }
+
+    return NULL;
+}
+
+
+int discovery_start(const discovery_config *config)
+{
+    pthread_t tid;
+
+    disc_config = *config;
+    if (disc_config.unit_count > DISC_MAX_UNITS)
+    {
+        disc_config.unit_count = DISC_MAX_UNITS;
+    }
+
+    disc_fds.udp_fd = udp_open();
+    if (disc_fds.udp_fd < 0)
+    {
+        LOG_ERROR("Discovery: UDP port %d: %s\n", DISC_PORT, strerror(errno));
+        return -1;
+    }
+
+    disc_fds.nl_fd = nl_open();
+    if (disc_fds.nl_fd < 0)
+    {
+        LOG_ERROR("Discovery: netlink socket: %s\n", strerror(errno));
+        close(disc_fds.udp_fd);
+        return -1;
+    }
+
+    /*
+     * Cache filled before the first request can arrive
+     */
+    nl_resync(disc_fds.nl_fd);
+
+    if (pthread_create(&tid, NULL, discovery_thread, &disc_fds) != 0)
+    {
+        LOG_ERROR("Discovery: cannot create thread\n");
+        close(disc_fds.nl_fd);
+        close(disc_fds.udp_fd);
+        return -1;
+    }
+    pthread_detach(tid);
+
+    LOG_DEBUG("Listening for %s / %s on UDP port %d\n", DISC_REQUEST_IP, DISC_REQUEST_INFO, DISC_PORT);
+
+    return 0;
+}
+
+
+void discovery_get_stats(discovery_stats *out)
+{
+    out->requests       = atomic_load_explicit(&stat_requests, memory_order_relaxed);
+    out->replies        = atomic_load_explicit(&stat_replies, memory_order_relaxed);
+    out->rate_limited   = atomic_load_explicit(&stat_rate_limited, memory_order_relaxed);
+    out->netlink_events = atomic_load_explicit(&stat_netlink_events, memory_order_relaxed);
+    out->addresses      = atomic_load_explicit(&stat_addresses, memory_order_relaxed);
+}
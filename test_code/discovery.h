@@ -0,0 +1,108 @@
+/**
+ *  @file    discovery.h
+ *  @brief   UDP discovery responder with a netlink-driven address cache
+ *
+ *  Tools find gateways by broadcasting to DISC_PORT:
+ *
+ *    "NEED_IP"     answered with the address as text ("192.168.1.20"),
+ *                  as before
+ *    "NEED_INFO"   answered with the compact binary reply below
+ *
+ *  The responder keeps the interface addresses in a cache fed by rtnetlink
+ *  (RTM_NEWADDR / RTM_DELADDR / RTM_NEWLINK) and holds both replies for
+ *  every address ready to send; a request costs one recvmsg and one
+ *  sendto. The address answered is the one on the interface the broadcast
+ *  came in on, in the sender's subnet if there is one, so a gateway with
+ *  several ports answers each network with its own address.
+ *
+ *  Each source address gets DISC_SOURCE_RATE replies/s (burst
+ *  DISC_SOURCE_BURST), all sources together DISC_GLOBAL_RATE.
+ *
+ *  Binary reply (multi-byte fields big-endian):
+ *
+ *    [0..3]    DISC_MAGIC "MBGW"
+ *    [4]       DISC_VERSION
+ *    [5]       flags, DISC_FLAG_*
+ *    [6..7]    Modbus TCP port
+ *    [8..11]   IPv4 address
+ *    [12]      prefix length
+ *    [13..18]  MAC address of the interface
+ *    [19..22]  register map version
+ *    [23..24]  dataset count
+ *    [25]      n = number of unit IDs served, 0 = any
+ *    [26..]    n unit IDs
+ *
+ *  @author  Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#ifndef DISCOVERY_H
+#define DISCOVERY_H
+
+#include <stdint.h>
+
+
+#define DISC_PORT               12345
+#define DISC_REQUEST_IP         "NEED_IP"
+#define DISC_REQUEST_INFO       "NEED_INFO"
+
+#define DISC_MAGIC              "MBGW"
+#define DISC_VERSION            1
+#define DISC_HEADER_LEN         26
+#define DISC_MAX_UNITS          32
+#define DISC_REPLY_MAX          (DISC_HEADER_LEN + DISC_MAX_UNITS)
+
+#define DISC_FLAG_CAN_READY     0x01    /* CAN side up                         */
+#define DISC_FLAG_DELTA_READ    0x02    /* Delta reads towards the ETU         */
+#define DISC_FLAG_MAP_FILE      0x04    /* Register map from file, not built in */
+
+#define DISC_SOURCE_RATE        5       /* Replies/s per source address        */
+#define DISC_SOURCE_BURST       10
+#define DISC_GLOBAL_RATE        1000    /* Replies/s in total                  */
+#define DISC_MAX_SOURCES        64      /* Token buckets tracked               */
+
+
+/*
+ * Changing part of the reply, asked for at every binary reply
+ */
+typedef struct {
+    uint8_t     flags;
+    uint32_t    map_version;
+    uint16_t    dataset_count;
+} discovery_status;
+
+typedef void (*discovery_status_fn)(discovery_status *out);
+
+/*
+ * Fixed part, given at start
+ */
+typedef struct {
+    uint16_t             modbus_port;
+    uint8_t              unit_count;            /* 0 = any unit ID     */
+    uint8_t              units[DISC_MAX_UNITS];
+    discovery_status_fn  status;                /* May be NULL         */
+} discovery_config;
+
+
+/**
+ * @brief Start the responder thread.
+ *
+ * @return 0 on success, -1 if a socket could not be set up
+ */
+int discovery_start(const discovery_config *config);
+
+/*
+ * Counters since start
+ */
+typedef struct {
+    uint64_t    requests;
+    uint64_t    replies;
+    uint64_t    rate_limited;
+    uint64_t    netlink_events;
+    uint32_t    addresses;              /* IPv4 addresses in the cache */
+} discovery_stats;
+
+void discovery_get_stats(discovery_stats *out);
+
+#endif /* DISCOVERY_H */
@@ -0,0 +1,185 @@
+/**
+ *  @file    etu_protocol.c
+ *  @brief   ETU CAN protocol codec: transfer state machine
+ *
+ *  See etu_protocol.h for the message sequences.
+ *
+ *  @author  Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#include "etu_protocol.h"
+
+
+static const char *const msg_names[16] = {
+    "READ_REQ", "READ_RESP", "WRITE_REQ", "WRITE_GRANT", "WRITE_DATA", "WRITE_ACK",
+    "WRITE_TERM", "WRITE_TERM_ACK", "DELTA_READ_REQ", "READ_ACK",
+    "TYPE_A", "TYPE_B", "TYPE_C", "TYPE_D", "TYPE_E", "TYPE_F"
+};
+
+
+const char *etu_msg_name(uint8_t msg_type)
+{
+    return msg_names[msg_type & 0xF];
+}
+
+
+void etu_read_begin(etu_xfer *x, uint32_t req_id, uint8_t size_field, uint8_t *buf, uint16_t len)
+{
+    memset(x, 0, sizeof(*x));
+    x->req_id     = req_id;
+    x->rx_buf     = buf;
+    x->len        = len;
+    x->frags      = etu_frag_count(len) ? etu_frag_count(len) : 1;
+    x->size_field = size_field;
+    x->op         = ETU_XFER_READ;
+    x->state      = ETU_ST_REQUEST;
+}
+
+
+void etu_read_set_length(etu_xfer *x, uint16_t len)
+{
+    x->len   = len;
+    x->frags = etu_frag_count(len) ? etu_frag_count(len) : 1;
+
+    if ((x->state == ETU_ST_READ_ACK) || (x->state == ETU_ST_FINAL_ACK))
+    {
+        x->state = (x->frag >= x->frags) ? ETU_ST_FINAL_ACK : ETU_ST_READ_ACK;
+    }
+}
+
+
+void etu_write_begin(etu_xfer *x, uint32_t req_id, uint8_t size_field, const uint8_t *buf, uint16_t len)
+{
+    memset(x, 0, sizeof(*x));
+    x->req_id     = req_id;
+    x->tx_buf     = buf;
+    x->len        = len;
+    x->frags      = etu_frag_count(len);
+    x->size_field = size_field;
+    x->op         = ETU_XFER_WRITE;
+    x->state      = ETU_ST_REQUEST;
+}
+
+
+uint32_t etu_xfer_tx(etu_xfer *x, uint32_t *can_id, uint8_t data[ETU_FRAME_LEN])
+{
+    switch (x->state)
+    {
+        case ETU_ST_REQUEST:
+            *can_id = x->req_id;
+            etu_frame_request(data, x->size_field, x->req_version);
+            if (x->op == ETU_XFER_READ)
+            {
+                return etu_frag_id(x->req_id, ETU_MSG_READ_RESP, 0);
+            }
+            return etu_id_with_type(x->req_id, ETU_MSG_WRITE_GRANT);
+
+        case ETU_ST_READ_ACK:
+            *can_id = etu_frag_id(x->req_id, ETU_MSG_READ_ACK, (uint16_t)(x->frag - 1));
+            etu_frame_empty(data);
+            return etu_frag_id(x->req_id, ETU_MSG_READ_RESP, x->frag);
+
+        case ETU_ST_FINAL_ACK:
+            *can_id = etu_frag_id(x->req_id, ETU_MSG_READ_ACK, (uint16_t)(x->frag - 1));
+            etu_frame_empty(data);
+            x->state = ETU_ST_DONE;
+            return 0;
+
+        case ETU_ST_WRITE_DATA:
+            *can_id = etu_frag_id(x->req_id, ETU_MSG_WRITE_DATA, x->frag);
+            etu_frame_fragment(data, x->tx_buf, x->len, x->frag);
+            return etu_frag_id(x->req_id, ETU_MSG_WRITE_ACK, x->frag);
+
+        case ETU_ST_WRITE_TERM:
+            *can_id = etu_frag_id(x->req_id, ETU_MSG_WRITE_TERM, x->frags);
+            etu_frame_empty(data);
+            return etu_frag_id(x->req_id, ETU_MSG_WRITE_TERM_ACK, x->frags);
+
+        default:
+            return 0;
+    }
+}
+
+
+/**
+ * @brief ID the current state waits for, 0 if none.
+ */
+static uint32_t expected_id(const etu_xfer *x)
+{
+    switch (x->state)
+    {
+        case ETU_ST_REQUEST:
+            return (x->op == ETU_XFER_READ) ? etu_frag_id(x->req_id, ETU_MSG_READ_RESP, 0)
+                                            : etu_id_with_type(x->req_id, ETU_MSG_WRITE_GRANT);
+        case ETU_ST_READ_ACK:
+            return etu_frag_id(x->req_id, ETU_MSG_READ_RESP, x->frag);
+        case ETU_ST_WRITE_DATA:
+            return etu_frag_id(x->req_id, ETU_MSG_WRITE_ACK, x->frag);
+        case ETU_ST_WRITE_TERM:
+            return etu_frag_id(x->req_id, ETU_MSG_WRITE_TERM_ACK, x->frags);
+        default:
+            return 0;
+    }
+}
+
+
+int etu_xfer_rx(etu_xfer *x, uint32_t can_id, const uint8_t data[ETU_FRAME_LEN])
+{
+    uint16_t offset;
+    uint16_t n;
+    uint32_t expect = expected_id(x);
+
+    if ((expect == 0) || (can_id != expect))
+    {
+        return ETU_RX_IGNORED;
+    }
+
+    if (!etu_frame_check(data))
+    {
+        return ETU_RX_CRC;
+    }
+
+    switch (x->state)
+    {
+        case ETU_ST_REQUEST:
+        case ETU_ST_READ_ACK:
+            if (x->op == ETU_XFER_WRITE)
+            {
+                /*
+                 * Write granted
+                 */
+                x->state = x->frags ? ETU_ST_WRITE_DATA : ETU_ST_WRITE_TERM;
+                break;
+            }
+
+            offset = (uint16_t)(x->frag * ETU_FRAME_PAYLOAD);
+            if (offset < x->len)
+            {
+                n = (x->len - offset >= ETU_FRAME_PAYLOAD) ? ETU_FRAME_PAYLOAD : (uint16_t)(x->len - offset);
+                memcpy(x->rx_buf + offset, data, n);
+            }
+
+            x->frag++;
+            x->state = (x->frag >= x->frags) ? ETU_ST_FINAL_ACK : ETU_ST_READ_ACK;
+            break;
+
+        case ETU_ST_WRITE_DATA:
+            x->frag++;
+            if (x->frag >= x->frags)
+            {
+                x->state = ETU_ST_WRITE_TERM;
+            }
+            break;
+
+        case ETU_ST_WRITE_TERM:
+            x->state = ETU_ST_DONE;
+            break;
+
+        default:
+            return ETU_RX_IGNORED;
+    }
+
+    return ETU_RX_OK;
+}
@@ -0,0 +1,290 @@
+/**
+ *  @file    etu_protocol.h
+ *  @brief   ETU CAN protocol codec: IDs, fragment sequencing, CRC, transfer state machine
+ *
+ *  One definition of the ETU protocol for the bridge, the ETU simulator and
+ *  the tools. Nothing here does I/O or allocates: the ID and CRC helpers are
+ *  inline, and a transfer (etu_xfer) is a small struct the caller owns and
+ *  drives with received frames, so an engine can run any number of them.
+ *
+ *  29-bit CAN ID (see modbus/doc/can_id.txt):
+ *
+ *      [28:27] Module Address  [26:23] Module ID  [22:20] Data Header
+ *      [19:16] Message Type    [15:0]  Data ID (register address)
+ *
+ *  Every frame has 8 data bytes: 6 payload bytes and a CRC over them in
+ *  data[6..7] (big endian, one's complement of the byte sum). ACKs and the
+ *  termination carry an all-zero payload, i.e. CRC 0xFFFF.
+ *
+ *  Read:   TCP  READ_REQ       data[0] = size (registers, or bits for FC 1/2)
+ *                              DELTA_READ_REQ: data[1..4] = cached version
+ *          ETU  READ_RESP #0   6 bytes of data     } repeated, the ID of
+ *          TCP  READ_ACK  #0                       } fragment n is the
+ *          ...                                     } base ID + n * 3
+ *          TCP  READ_ACK  #last (no answer)
+ *
+ *  Write:  TCP  WRITE_REQ      data[0] = length (registers)
+ *          ETU  WRITE_GRANT
+ *          TCP  WRITE_DATA #n  6 bytes of data     } n = 0 .. fragments-1
+ *          ETU  WRITE_ACK  #n                      }
+ *          TCP  WRITE_TERM #fragments
+ *          ETU  WRITE_TERM_ACK #fragments
+ *
+ *  The fragment step is added to the whole ID, as the ETU firmware does.
+ *
+ *  @author  Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#ifndef ETU_PROTOCOL_H
+#define ETU_PROTOCOL_H
+
+#include <stdint.h>
+#include <string.h>
+
+
+/*
+ * Message types (CAN ID bits 16..19)
+ */
+#define ETU_MSG_READ_REQ            0   /* TCP to ETU: Read Request                 */
+#define ETU_MSG_READ_RESP           1   /* ETU to TCP: Read Response fragment       */
+#define ETU_MSG_WRITE_REQ           2   /* TCP to ETU: Write Request                */
+#define ETU_MSG_WRITE_GRANT         3   /* ETU to TCP: Write Grant                  */
+#define ETU_MSG_WRITE_DATA          4   /* TCP to ETU: Write Data fragment          */
+#define ETU_MSG_WRITE_ACK           5   /* ETU to TCP: Write Data Acknowledgement   */
+#define ETU_MSG_WRITE_TERM          6   /* TCP to ETU: Write Termination            */
+#define ETU_MSG_WRITE_TERM_ACK      7   /* ETU to TCP: Termination Acknowledgement  */
+#define ETU_MSG_DELTA_READ_REQ      8   /* TCP to ETU: Delta Read Request           */
+#define ETU_MSG_READ_ACK            9   /* TCP to ETU: Read Response Acknowledgement */
+
+#define ETU_FRAME_LEN               8
+#define ETU_FRAME_PAYLOAD           6   /* Data bytes per fragment                  */
+#define ETU_FRAG_ID_STEP            3   /* ID increment per fragment                */
+
+#define ETU_ADDR_SHIFT              27
+#define ETU_MODULE_SHIFT            23
+#define ETU_HEADER_SHIFT            20
+#define ETU_TYPE_SHIFT              16
+#define ETU_TYPE_MASK               (0xFU << ETU_TYPE_SHIFT)
+
+
+/*
+ * Decoded CAN ID
+ */
+typedef struct {
+    uint8_t     module_addr;        /* 2 bits  */
+    uint8_t     module_id;          /* 4 bits  */
+    uint8_t     data_header;        /* 3 bits  */
+    uint8_t     msg_type;           /* 4 bits  */
+    uint16_t    data_id;            /* 16 bits */
+} etu_id;
+
+
+static inline uint32_t etu_id_build(uint8_t module_addr, uint8_t module_id, uint8_t data_header,
+                                    uint8_t msg_type, uint16_t data_id)
+{
+    return ((uint32_t)(module_addr & 0x3) << ETU_ADDR_SHIFT) |
+           ((uint32_t)(module_id & 0xF) << ETU_MODULE_SHIFT) |
+           ((uint32_t)(data_header & 0x7) << ETU_HEADER_SHIFT) |
+           ((uint32_t)(msg_type & 0xF) << ETU_TYPE_SHIFT) |
+           data_id;
+}
+
+static inline void etu_id_parse(uint32_t can_id, etu_id *out)
+{
+    out->module_addr = (uint8_t)((can_id >> ETU_ADDR_SHIFT) & 0x3);
+    out->module_id   = (uint8_t)((can_id >> ETU_MODULE_SHIFT) & 0xF);
+    out->data_header = (uint8_t)((can_id >> ETU_HEADER_SHIFT) & 0x7);
+    out->msg_type    = (uint8_t)((can_id >> ETU_TYPE_SHIFT) & 0xF);
+    out->data_id     = (uint16_t)can_id;
+}
+
+static inline uint8_t etu_id_type(uint32_t can_id)
+{
+    return (uint8_t)((can_id >> ETU_TYPE_SHIFT) & 0xF);
+}
+
+/**
+ * @brief Same ID with another message type.
+ */
+static inline uint32_t etu_id_with_type(uint32_t can_id, uint8_t msg_type)
+{
+    return (can_id & ~ETU_TYPE_MASK) | ((uint32_t)(msg_type & 0xF) << ETU_TYPE_SHIFT);
+}
+
+/**
+ * @brief ID of fragment @p index of message type @p msg_type in the transfer started by @p req_id.
+ */
+static inline uint32_t etu_frag_id(uint32_t req_id, uint8_t msg_type, uint16_t index)
+{
+    return etu_id_with_type(req_id, msg_type) + (uint32_t)index * ETU_FRAG_ID_STEP;
+}
+
+/**
+ * @brief Number of fragments for @p len payload bytes.
+ */
+static inline uint16_t etu_frag_count(uint16_t len)
+{
+    return (uint16_t)((len + ETU_FRAME_PAYLOAD - 1) / ETU_FRAME_PAYLOAD);
+}
+
+static inline uint16_t etu_crc(const uint8_t *data, uint16_t len)
+{
+    uint16_t sum = 0;
+    uint16_t i;
+
+    for (i = 0; i < len; i++)
+    {
+        sum += data[i];
+    }
+
+    return (uint16_t)~sum;
+}
+
+/**
+ * @brief Write the CRC of data[0..5] into data[6..7].
+ */
+static inline void etu_frame_seal(uint8_t data[ETU_FRAME_LEN])
+{
+    uint16_t crc = etu_crc(data, ETU_FRAME_PAYLOAD);
+
+    data[6] = (uint8_t)(crc >> 8);
+    data[7] = (uint8_t)crc;
+}
+
+/**
+ * @return 1 if data[6..7] is the CRC of data[0..5]
+ */
+static inline int etu_frame_check(const uint8_t data[ETU_FRAME_LEN])
+{
+    return etu_crc(data, ETU_FRAME_PAYLOAD) == (uint16_t)((data[6] << 8) | data[7]);
+}
+
+/**
+ * @brief Request frame: data[0] = size, data[1..4] = version (delta read, else 0).
+ */
+static inline void etu_frame_request(uint8_t data[ETU_FRAME_LEN], uint8_t size, uint32_t version)
+{
+    memset(data, 0, ETU_FRAME_LEN);
+    data[0] = size;
+    data[1] = (uint8_t)(version >> 24);
+    data[2] = (uint8_t)(version >> 16);
+    data[3] = (uint8_t)(version >> 8);
+    data[4] = (uint8_t)version;
+    etu_frame_seal(data);
+}
+
+/**
+ * @brief ACK / termination frame: empty payload.
+ */
+static inline void etu_frame_empty(uint8_t data[ETU_FRAME_LEN])
+{
+    memset(data, 0, ETU_FRAME_LEN);
+    etu_frame_seal(data);
+}
+
+/**
+ * @brief Data fragment @p index of @p buf: payload bytes, zero padded, sealed.
+ */
+static inline void etu_frame_fragment(uint8_t data[ETU_FRAME_LEN], const uint8_t *buf, uint16_t len, uint16_t index)
+{
+    uint16_t offset = (uint16_t)(index * ETU_FRAME_PAYLOAD);
+    uint16_t n      = (len - offset >= ETU_FRAME_PAYLOAD) ? ETU_FRAME_PAYLOAD : (uint16_t)(len - offset);
+
+    memset(data, 0, ETU_FRAME_LEN);
+    memcpy(data, buf + offset, n);
+    etu_frame_seal(data);
+}
+
+
+/***************************************************************
+ *  Transfer state machine (TCP / bridge side)
+ ***************************************************************/
+
+#define ETU_XFER_READ               0
+#define ETU_XFER_WRITE              1
+
+/*
+ * States
+ */
+#define ETU_ST_REQUEST              0   /* Send the request                    */
+#define ETU_ST_READ_ACK             1   /* Send ACK of the previous fragment   */
+#define ETU_ST_FINAL_ACK            2   /* Send ACK of the last fragment, done */
+#define ETU_ST_WRITE_DATA           3   /* Send data fragment                  */
+#define ETU_ST_WRITE_TERM           4   /* Send termination                    */
+#define ETU_ST_DONE                 5
+
+/*
+ * etu_xfer_rx() results
+ */
+#define ETU_RX_OK                   0   /* Expected frame, transfer advanced   */
+#define ETU_RX_IGNORED              1   /* Not the frame this transfer expects */
+#define ETU_RX_CRC                  2   /* Expected ID but CRC mismatch        */
+
+
+typedef struct {
+    uint32_t        req_id;         /* Request ID, message type included      */
+    uint32_t        req_version;    /* Delta read: version in the request     */
+    uint8_t        *rx_buf;         /* Read target                            */
+    const uint8_t  *tx_buf;         /* Write source                           */
+    uint16_t        len;            /* Payload bytes                          */
+    uint16_t        frag;           /* Fragment being sent / awaited          */
+    uint16_t        frags;          /* Fragment count                         */
+    uint8_t         size_field;     /* data[0] of the request                 */
+    uint8_t         op;             /* ETU_XFER_READ / ETU_XFER_WRITE         */
+    uint8_t         state;          /* ETU_ST_*                               */
+} etu_xfer;
+
+
+/**
+ * @brief Start a read of @p len bytes into @p buf.
+ *
+ * @param req_id      Read request ID (ETU_MSG_READ_REQ or ETU_MSG_DELTA_READ_REQ)
+ * @param size_field  data[0] of the request (registers or bits)
+ */
+void etu_read_begin(etu_xfer *x, uint32_t req_id, uint8_t size_field, uint8_t *buf, uint16_t len);
+
+/**
+ * @brief Change the expected read length (delta reads learn it from fragment 0).
+ */
+void etu_read_set_length(etu_xfer *x, uint16_t len);
+
+/**
+ * @brief Start a write of @p len bytes from @p buf.
+ *
+ * @param size_field  data[0] of the request (registers)
+ */
+void etu_write_begin(etu_xfer *x, uint32_t req_id, uint8_t size_field, const uint8_t *buf, uint16_t len);
+
+/**
+ * @brief Frame to send in the current state.
+ *
+ * Calling it again without etu_xfer_rx() in between gives the same frame,
+ * which is what a retransmission needs. The final read ACK is the
+ * exception: returning it ends the transfer (ETU_ST_DONE), so a second
+ * call gives no frame and leaves @p can_id and @p data untouched.
+ *
+ * @return ID of the expected answer, 0 if none is expected (the final read
+ *         ACK) or the transfer is done
+ */
+uint32_t etu_xfer_tx(etu_xfer *x, uint32_t *can_id, uint8_t data[ETU_FRAME_LEN]);
+
+/**
+ * @brief Feed a received frame.
+ *
+ * @return ETU_RX_OK, ETU_RX_IGNORED or ETU_RX_CRC
+ */
+int etu_xfer_rx(etu_xfer *x, uint32_t can_id, const uint8_t data[ETU_FRAME_LEN]);
+
+static inline int etu_xfer_done(const etu_xfer *x)
+{
+    return x->state == ETU_ST_DONE;
+}
+
+/**
+ * @brief Name of a message type, for logs and the analyzer.
+ */
+const char *etu_msg_name(uint8_t msg_type);
+
+#endif /* ETU_PROTOCOL_H */
@@ -0,0 +1,708 @@
+/**
+ *  @file    etu_protocol_test.c
+ *  @brief   Round-trip checks of the ETU protocol codec
+ *
+ *  Checks etu_protocol.h against the protocol as written down in its
+ *  header, computing the expected IDs and CRCs by hand rather than with
+ *  the codec's own helpers:
+ *
+ *    ids         build / parse / type / with_type for every ETU_MSG_* and
+ *                random field values, field masking, one literal ID
+ *    fragments   fragment IDs (base + n * 3), fragment count, fragment
+ *                frames reassembling to the source with zero padding
+ *    crc         seal / check, a known vector, every single-bit error
+ *                detected, request frames carrying size and version
+ *    read        etu_xfer reads of 0..300 bytes against a scripted ETU
+ *    write       etu_xfer writes of 0..300 bytes against a scripted ETU
+ *    delta       delta reads (can_delta.h) over changing data: the length
+ *                learnt from fragment 0, merged copy equal to the ETU's
+ *
+ *  The scripted ETU checks every ID the transfer sends, and the link
+ *  between them drops, duplicates, corrupts and injects stray frames, so
+ *  retransmission (calling etu_xfer_tx() again) and ETU_RX_IGNORED /
+ *  ETU_RX_CRC are exercised too.
+ *
+ *    gcc -O2 etu_protocol_test.c etu_protocol.c can_delta.c -o etu_protocol_test
+ *    ./etu_protocol_test [rounds]
+ *
+ *  Exits 0 if every check passed.
+ *
+ *  @author  Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "etu_protocol.h"
+#include "can_delta.h"
+
+
+#define TEST_ROUNDS             2000
+#define TEST_MAX_LEN            300
+#define TEST_MAX_STEPS          20000   /* Frames per transfer before giving up */
+#define TEST_FAULT_PERMILLE     80      /* Per frame: drop, duplicate, corrupt, stray */
+
+#define CHECK(cond, ...)                                        \
+    do                                                          \
+    {                                                           \
+        checks++;                                               \
+        if (!(cond))                                            \
+        {                                                       \
+            if (failures++ < 20)                                \
+            {                                                   \
+                printf("FAIL %s:%d: ", __func__, __LINE__);     \
+                printf(__VA_ARGS__);                            \
+                printf("\n");                                   \
+            }                                                   \
+        }                                                       \
+    } while (0)
+
+
+static unsigned long checks;
+static unsigned long failures;
+static uint32_t      rng_state = 0x2545F491;
+
+
+static uint32_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+
+/***************************************************************
+ *  Hand-written reference of the ID layout and the CRC
+ ***************************************************************/
+
+static uint32_t ref_id(uint32_t addr, uint32_t module, uint32_t header, uint32_t type, uint32_t data_id)
+{
+    return (addr << 27) | (module << 23) | (header << 20) | (type << 16) | data_id;
+}
+
+/**
+ * @brief ID of fragment @p n of message type @p type for the request @p req_id.
+ */
+static uint32_t ref_frag(uint32_t req_id, uint32_t type, uint32_t n)
+{
+    return ((req_id & ~(0xFU << 16)) | (type << 16)) + n * 3;
+}
+
+static uint16_t ref_crc(const uint8_t *data)
+{
+    unsigned int sum = 0;
+    int          i;
+
+    for (i = 0; i < 6; i++)
+    {
+        sum += data[i];
+    }
+
+    return (uint16_t)(0xFFFF - (sum & 0xFFFF));
+}
+
+
+/***************************************************************
+ *  Codec checks
+ ***************************************************************/
+
+static void test_ids(int rounds)
+{
+    uint32_t id;
+    etu_id   p;
+    uint8_t  type;
+    uint8_t  addr, module, header;
+    uint16_t data_id;
+    int      r;
+
+    CHECK(etu_id_build(1, 2, 3, ETU_MSG_WRITE_DATA, 0x1234) == 0x09341234, "literal ID");
+
+    for (type = ETU_MSG_READ_REQ; type <= ETU_MSG_READ_ACK; type++)
+    {
+        CHECK(strcmp(etu_msg_name(type), "?") != 0, "no name for message type %u", type);
+
+        for (r = 0; r < rounds; r++)
+        {
+            addr    = (uint8_t)(rng() & 0x3);
+            module  = (uint8_t)(rng() & 0xF);
+            header  = (uint8_t)(rng() & 0x7);
+            data_id = (uint16_t)rng();
+
+            id = etu_id_build(addr, module, header, type, data_id);
+            CHECK(id == ref_id(addr, module, header, type, data_id), "build type %u: 0x%08X", type, id);
+            CHECK(id <= 0x1FFFFFFF, "ID 0x%08X wider than 29 bits", id);
+
+            etu_id_parse(id, &p);
+            CHECK((p.module_addr == addr) && (p.module_id == module) && (p.data_header == header) &&
+                  (p.msg_type == type) && (p.data_id == data_id), "parse type %u: 0x%08X", type, id);
+            CHECK(etu_id_type(id) == type, "etu_id_type 0x%08X", id);
+
+            /*
+             * Changing the type touches nothing else
+             */
+            CHECK(etu_id_with_type(id, ETU_MSG_READ_ACK) == ref_id(addr, module, header, ETU_MSG_READ_ACK, data_id),
+                  "with_type 0x%08X", id);
+
+            /*
+             * Out-of-range field values are masked, not spilled into the neighbours
+             */
+            CHECK(etu_id_build((uint8_t)(addr | 0xFC), (uint8_t)(module | 0xF0), (uint8_t)(header | 0xF8),
+                               (uint8_t)(type | 0xF0), data_id) == id, "masking type %u", type);
+        }
+    }
+}
+
+
+static void test_fragments(int rounds)
+{
+    uint8_t  buf[TEST_MAX_LEN];
+    uint8_t  out[TEST_MAX_LEN + ETU_FRAME_PAYLOAD];
+    uint8_t  frame[ETU_FRAME_LEN];
+    uint32_t req_id;
+    uint16_t len;
+    uint16_t n;
+    uint16_t i;
+    int      r;
+
+    for (len = 0; len <= TEST_MAX_LEN; len++)
+    {
+        CHECK(etu_frag_count(len) == (len + 5) / 6, "frag_count(%u) = %u", len, etu_frag_count(len));
+    }
+
+    for (r = 0; r < rounds; r++)
+    {
+        req_id = ref_id(rng() & 0x3, rng() & 0xF, rng() & 0x7, ETU_MSG_READ_REQ, rng() & 0xFFFF);
+        n      = (uint16_t)(rng() % 100);
+
+        CHECK(etu_frag_id(req_id, ETU_MSG_READ_RESP, n) == ref_frag(req_id, ETU_MSG_READ_RESP, n),
+              "read response fragment %u of 0x%08X", n, req_id);
+        CHECK(etu_frag_id(req_id, ETU_MSG_READ_ACK, n) == ref_frag(req_id, ETU_MSG_READ_ACK, n),
+              "read ACK fragment %u of 0x%08X", n, req_id);
+        CHECK(etu_frag_id(req_id, ETU_MSG_WRITE_DATA, n) == ref_frag(req_id, ETU_MSG_WRITE_DATA, n),
+              "write data fragment %u of 0x%08X", n, req_id);
+        CHECK(etu_frag_id(req_id, ETU_MSG_WRITE_ACK, n) == ref_frag(req_id, ETU_MSG_WRITE_ACK, n),
+              "write ACK fragment %u of 0x%08X", n, req_id);
+        CHECK(etu_frag_id(req_id, ETU_MSG_WRITE_TERM, 0) == etu_id_with_type(req_id, ETU_MSG_WRITE_TERM),
+              "fragment 0 is the base ID");
+
+        /*
+         * Fragment frames put back together give the source, padded with zeros
+         */
+        len = (uint16_t)(rng() % (TEST_MAX_LEN + 1));
+        for (i = 0; i < len; i++)
+        {
+            buf[i] = (uint8_t)rng();
+        }
+        memset(out, 0xAA, sizeof(out));
+
+        for (i = 0; i < etu_frag_count(len); i++)
+        {
+            etu_frame_fragment(frame, buf, len, i);
+            CHECK(etu_frame_check(frame), "fragment %u of %u bytes not sealed", i, len);
+            memcpy(out + i * ETU_FRAME_PAYLOAD, frame, ETU_FRAME_PAYLOAD);
+        }
+        CHECK(memcmp(out, buf, len) == 0, "fragments of %u bytes do not reassemble", len);
+        for (i = len; i < etu_frag_count(len) * ETU_FRAME_PAYLOAD; i++)
+        {
+            CHECK(out[i] == 0, "padding byte %u of %u bytes is 0x%02X", i, len, out[i]);
+        }
+    }
+}
+
+
+static void test_crc(int rounds)
+{
+    uint8_t  frame[ETU_FRAME_LEN];
+    uint8_t  bad[ETU_FRAME_LEN];
+    uint32_t version;
+    uint8_t  size;
+    int      bit;
+    int      r;
+    int      i;
+
+    /*
+     * ACKs and terminations: all-zero payload, CRC 0xFFFF
+     */
+    memset(frame, 0x55, sizeof(frame));
+    etu_frame_empty(frame);
+    CHECK((frame[0] | frame[1] | frame[2] | frame[3] | frame[4] | frame[5]) == 0, "empty frame payload");
+    CHECK((frame[6] == 0xFF) && (frame[7] == 0xFF), "empty frame CRC %02X%02X", frame[6], frame[7]);
+
+    for (r = 0; r < rounds; r++)
+    {
+        for (i = 0; i < ETU_FRAME_LEN; i++)
+        {
+            frame[i] = (uint8_t)rng();
+        }
+        etu_frame_seal(frame);
+        CHECK(((frame[6] << 8) | frame[7]) == ref_crc(frame), "CRC trailer");
+        CHECK(etu_frame_check(frame), "sealed frame rejected");
+        CHECK(etu_crc(frame, ETU_FRAME_PAYLOAD) == ref_crc(frame), "etu_crc");
+
+        /*
+         * Any single flipped bit, payload or trailer, is caught
+         */
+        for (bit = 0; bit < ETU_FRAME_LEN * 8; bit++)
+        {
+            memcpy(bad, frame, sizeof(bad));
+            bad[bit / 8] ^= (uint8_t)(1 << (bit % 8));
+            CHECK(!etu_frame_check(bad), "bit %d flipped not detected", bit);
+        }
+
+        size    = (uint8_t)rng();
+        version = rng();
+        etu_frame_request(frame, size, version);
+        CHECK((frame[0] == size) && (frame[1] == (uint8_t)(version >> 24)) && (frame[2] == (uint8_t)(version >> 16)) &&
+              (frame[3] == (uint8_t)(version >> 8)) && (frame[4] == (uint8_t)version) && (frame[5] == 0),
+              "request frame size %u version 0x%08X", size, version);
+        CHECK(etu_frame_check(frame), "request frame not sealed");
+    }
+}
+
+
+/***************************************************************
+ *  Scripted ETU and the link to it
+ ***************************************************************/
+
+typedef struct {
+    uint32_t id;
+    uint8_t  data[ETU_FRAME_LEN];
+} test_frame;
+
+typedef struct {
+    /*
+     * Read side: what the ETU answers with
+     */
+    const uint8_t *stream;
+    uint16_t       stream_len;
+    int            delta;           /* Expects DELTA_READ_REQ, builds the stream itself */
+    const uint8_t *cur;             /* Delta: current data                    */
+    uint16_t       cur_len;
+    uint8_t        sent[CAN_DELTA_MAX_BYTES];  /* Delta: last image sent     */
+    uint32_t       sent_version;
+    int            has_sent;
+    uint8_t        delta_stream[CAN_DELTA_MAX_STREAM];
+
+    /*
+     * Write side: what the ETU received
+     */
+    uint8_t        written[TEST_MAX_LEN + ETU_FRAME_PAYLOAD];
+    uint16_t       write_frags;
+    int            terminated;
+
+    uint32_t       req_id;          /* Expected request ID                   */
+    uint16_t       frags;
+    int            protocol_errors;
+} test_etu;
+
+
+/**
+ * @brief One frame from the bridge into the scripted ETU.
+ *
+ * @return 1 with the answer in @p out, 0 if the ETU does not answer
+ */
+static int etu_answer(test_etu *etu, const test_frame *in, test_frame *out)
+{
+    uint32_t type = (in->id >> 16) & 0xF;
+    uint32_t n;
+    int      len;
+
+    if (!etu_frame_check(in->data))
+    {
+        etu->protocol_errors++;
+        return 0;
+    }
+
+    if (in->id == etu->req_id)
+    {
+        if ((type == ETU_MSG_READ_REQ) || (type == ETU_MSG_DELTA_READ_REQ))
+        {
+            if (etu->delta)
+            {
+                /*
+                 * Re-encoded on every (re)sent request, as the ETU does
+                 */
+                len = can_delta_encode(etu->has_sent ? etu->sent : NULL, etu->sent_version, etu->cur, etu->cur_len,
+                                       ((uint32_t)in->data[1] << 24) | ((uint32_t)in->data[2] << 16) |
+                                       ((uint32_t)in->data[3] << 8) | in->data[4], etu->delta_stream);
+                memcpy(etu->sent, etu->cur, etu->cur_len);
+                etu->sent_version = can_delta_version(etu->cur, etu->cur_len);
+                etu->has_sent     = 1;
+                etu->stream       = etu->delta_stream;
+                etu->stream_len   = (uint16_t)len;
+            }
+            etu->frags = (uint16_t)((etu->stream_len + 5) / 6);
+            if (etu->frags == 0)
+            {
+                etu->frags = 1;
+            }
+
+            out->id = ref_frag(etu->req_id, ETU_MSG_READ_RESP, 0);
+            etu_frame_fragment(out->data, etu->stream, etu->stream_len, 0);
+            return 1;
+        }
+
+        out->id = ref_frag(etu->req_id, ETU_MSG_WRITE_GRANT, 0);
+        etu_frame_empty(out->data);
+        return 1;
+    }
+
+    n = (in->id - ref_frag(etu->req_id, type, 0)) / 3;
+    if ((in->id != ref_frag(etu->req_id, type, n)) || (n > 0xFFFF))
+    {
+        etu->protocol_errors++;
+        return 0;
+    }
+
+    switch (type)
+    {
+        case ETU_MSG_READ_ACK:
+            if (n >= etu->frags)
+            {
+                etu->protocol_errors++;
+                return 0;
+            }
+            if (n + 1 == etu->frags)
+            {
+                return 0;           /* Final ACK: nothing follows */
+            }
+            out->id = ref_frag(etu->req_id, ETU_MSG_READ_RESP, n + 1);
+            etu_frame_fragment(out->data, etu->stream, etu->stream_len, (uint16_t)(n + 1));
+            return 1;
+
+        case ETU_MSG_WRITE_DATA:
+            memcpy(etu->written + n * ETU_FRAME_PAYLOAD, in->data, ETU_FRAME_PAYLOAD);
+            if (n + 1 > etu->write_frags)
+            {
+                etu->write_frags = (uint16_t)(n + 1);
+            }
+            out->id = ref_frag(etu->req_id, ETU_MSG_WRITE_ACK, n);
+            etu_frame_empty(out->data);
+            return 1;
+
+        case ETU_MSG_WRITE_TERM:
+            if (n != etu->write_frags)
+            {
+                etu->protocol_errors++;
+            }
+            etu->terminated = 1;
+            out->id = ref_frag(etu->req_id, ETU_MSG_WRITE_TERM_ACK, n);
+            etu_frame_empty(out->data);
+            return 1;
+
+        default:
+            etu->protocol_errors++;
+            return 0;
+    }
+}
+
+
+typedef struct {
+    int     (*on_frame)(etu_xfer *x, const test_frame *f, void *ctx);
+    void     *ctx;
+    unsigned  sent;
+    unsigned  crc_errors;
+    unsigned  ignored;
+} test_link;
+
+
+/**
+ * @brief Runs a transfer to the end over a faulty link.
+ *
+ * Bridge side as in the bridge: send, wait for the expected answer, send
+ * the same frame again when it does not come.
+ *
+ * @return 0 if the transfer completed
+ */
+static int run_transfer(etu_xfer *x, test_etu *etu, test_link *link)
+{
+    test_frame tx;
+    test_frame rx;
+    test_frame replay;
+    uint32_t   expect;
+    int        steps;
+    int        fault;
+    int        have_replay = 0;
+    int        ret;
+
+    for (steps = 0; (steps < TEST_MAX_STEPS) && !etu_xfer_done(x); steps++)
+    {
+        expect = etu_xfer_tx(x, &tx.id, tx.data);
+        link->sent++;
+
+        fault = (rng() % 1000 < TEST_FAULT_PERMILLE) ? (int)(rng() % 4) : -1;
+
+        if ((fault == 0) || !etu_answer(etu, &tx, &rx))
+        {
+            /*
+             * Request lost, or nothing to answer (final ACK)
+             */
+            CHECK((expect == 0) || (fault == 0), "no answer to 0x%08X although 0x%08X expected", tx.id, expect);
+            continue;
+        }
+        CHECK(rx.id == expect, "answer 0x%08X, transfer expected 0x%08X", rx.id, expect);
+
+        if (fault == 1)
+        {
+            /*
+             * Corrupted answer: must not advance the transfer
+             */
+            rx.data[rng() % ETU_FRAME_LEN] ^= (uint8_t)(1 + rng() % 255);
+            CHECK(etu_xfer_rx(x, rx.id, rx.data) == ETU_RX_CRC, "corrupted frame 0x%08X accepted", rx.id);
+            link->crc_errors++;
+            continue;
+        }
+
+        if (fault == 2 && have_replay)
+        {
+            /*
+             * Late duplicate of an earlier answer first
+             */
+            CHECK(etu_xfer_rx(x, replay.id, replay.data) == ETU_RX_IGNORED, "stale frame 0x%08X accepted", replay.id);
+            link->ignored++;
+        }
+        if (fault == 3)
+        {
+            /*
+             * Another module's traffic on the bus
+             */
+            CHECK(etu_xfer_rx(x, rx.id ^ (1U << 27), rx.data) == ETU_RX_IGNORED, "foreign frame accepted");
+            link->ignored++;
+        }
+
+        ret = etu_xfer_rx(x, rx.id, rx.data);
+        CHECK(ret == ETU_RX_OK, "expected frame 0x%08X: %d", rx.id, ret);
+
+        if ((ret == ETU_RX_OK) && (link->on_frame != NULL) && (link->on_frame(x, &rx, link->ctx) != 0))
+        {
+            return -1;
+        }
+
+        replay      = rx;
+        have_replay = 1;
+    }
+
+    return etu_xfer_done(x) ? 0 : -1;
+}
+
+
+static uint32_t random_req(uint8_t type)
+{
+    return ref_id(rng() & 0x3, rng() & 0xF, rng() & 0x7, type, rng() % 0xF000);
+}
+
+
+static void test_read(int rounds)
+{
+    static test_etu etu;
+    test_link  link;
+    etu_xfer   x;
+    uint8_t    src[TEST_MAX_LEN];
+    uint8_t    dst[TEST_MAX_LEN + 1];
+    uint8_t    frame[ETU_FRAME_LEN];
+    uint32_t   id;
+    uint32_t   again;
+    uint16_t   len;
+    uint16_t   i;
+    int        r;
+
+    for (r = 0; r < rounds; r++)
+    {
+        len = (uint16_t)(rng() % (TEST_MAX_LEN + 1));
+        for (i = 0; i < len; i++)
+        {
+            src[i] = (uint8_t)rng();
+        }
+        memset(dst, 0xEE, sizeof(dst));
+
+        memset(&etu, 0, sizeof(etu));
+        etu.req_id     = random_req(ETU_MSG_READ_REQ);
+        etu.stream     = src;
+        etu.stream_len = len;
+        memset(&link, 0, sizeof(link));
+
+        etu_read_begin(&x, etu.req_id, (uint8_t)(len / 2), dst, len);
+        CHECK(run_transfer(&x, &etu, &link) == 0, "read of %u bytes did not complete", len);
+        CHECK(memcmp(dst, src, len) == 0, "read of %u bytes: data differs", len);
+        CHECK(dst[len] == 0xEE, "read of %u bytes wrote past the buffer", len);
+        CHECK(etu.protocol_errors == 0, "read of %u bytes: %d protocol errors at the ETU", len, etu.protocol_errors);
+
+        /*
+         * Once done (final ACK sent) there is nothing more to send
+         */
+        id    = 0x12345;
+        again = etu_xfer_tx(&x, &id, frame);
+        CHECK((again == 0) && (id == 0x12345), "done transfer sent 0x%08X again", id);
+    }
+}
+
+
+static void test_write(int rounds)
+{
+    static test_etu etu;
+    test_link  link;
+    etu_xfer   x;
+    uint8_t    src[TEST_MAX_LEN];
+    uint16_t   len;
+    uint16_t   i;
+    int        r;
+
+    for (r = 0; r < rounds; r++)
+    {
+        len = (uint16_t)(rng() % (TEST_MAX_LEN + 1));
+        for (i = 0; i < len; i++)
+        {
+            src[i] = (uint8_t)rng();
+        }
+
+        memset(&etu, 0, sizeof(etu));
+        etu.req_id = random_req(ETU_MSG_WRITE_REQ);
+        memset(&link, 0, sizeof(link));
+
+        etu_write_begin(&x, etu.req_id, (uint8_t)(len / 2), src, len);
+        CHECK(run_transfer(&x, &etu, &link) == 0, "write of %u bytes did not complete", len);
+        CHECK(etu.terminated, "write of %u bytes not terminated", len);
+        CHECK(etu.write_frags == etu_frag_count(len), "write of %u bytes: %u fragments", len, etu.write_frags);
+        CHECK(memcmp(etu.written, src, len) == 0, "write of %u bytes: data differs", len);
+        for (i = len; i < etu.write_frags * ETU_FRAME_PAYLOAD; i++)
+        {
+            CHECK(etu.written[i] == 0, "write of %u bytes: padding byte %u", len, i);
+        }
+        CHECK(etu.protocol_errors == 0, "write of %u bytes: %d protocol errors at the ETU", len, etu.protocol_errors);
+    }
+}
+
+
+typedef struct {
+    uint16_t len;
+    int      learnt;
+} delta_ctx;
+
+/**
+ * @brief Fragment 0 announces the stream length, as delta_on_frame() in the bridge.
+ */
+static int delta_on_frame(etu_xfer *x, const test_frame *f, void *arg)
+{
+    delta_ctx *ctx = arg;
+    int        stream_len;
+
+    if (x->frag != 1)
+    {
+        return 0;
+    }
+
+    stream_len = can_delta_stream_length(f->data, ctx->len);
+    CHECK(stream_len >= CAN_DELTA_HEADER_LEN, "delta header rejected");
+    if (stream_len < 0)
+    {
+        return -1;
+    }
+    etu_read_set_length(x, (uint16_t)stream_len);
+    ctx->learnt = 1;
+
+    return 0;
+}
+
+
+static void test_delta(int rounds)
+{
+    static test_etu       etu;
+    static can_delta_slot slot;
+    static uint8_t        stream[CAN_DELTA_MAX_STREAM];
+    uint8_t    data[CAN_DELTA_MAX_BYTES];
+    test_link  link;
+    delta_ctx  ctx;
+    etu_xfer   x;
+    uint32_t   req_id;
+    uint16_t   len;
+    uint16_t   i;
+    int        polls;
+    int        p;
+    int        r;
+
+    for (r = 0; r < rounds / 20 + 1; r++)
+    {
+        len    = (uint16_t)(2 * (1 + rng() % 120));
+        req_id = random_req(ETU_MSG_DELTA_READ_REQ);
+        for (i = 0; i < len; i++)
+        {
+            data[i] = (uint8_t)rng();
+        }
+
+        memset(&etu, 0, sizeof(etu));
+        memset(&slot, 0, sizeof(slot));
+        slot.can_id = req_id;
+        slot.len    = len;
+        etu.req_id  = req_id;
+        etu.delta   = 1;
+        etu.cur     = data;
+        etu.cur_len = len;
+
+        polls = 20;
+        for (p = 0; p < polls; p++)
+        {
+            /*
+             * A few words change between polls, sometimes none, sometimes all
+             */
+            if (p > 0)
+            {
+                for (i = 0; i < len; i += 2)
+                {
+                    if (rng() % 1000 < ((p % 7 == 0) ? 1000U : (p % 3 == 0) ? 0U : 50U))
+                    {
+                        data[i + 1] = (uint8_t)rng();
+                    }
+                }
+            }
+
+            memset(&link, 0, sizeof(link));
+            ctx.len      = len;
+            ctx.learnt   = 0;
+            link.on_frame = delta_on_frame;
+            link.ctx      = &ctx;
+
+            etu_read_begin(&x, req_id, (uint8_t)(len / 2), stream, CAN_DELTA_HEADER_LEN);
+            x.req_version = slot.version;
+
+            CHECK(run_transfer(&x, &etu, &link) == 0, "delta read of %u bytes, poll %d did not complete", len, p);
+            CHECK(ctx.learnt, "delta read: length never learnt");
+            CHECK(x.len == etu.stream_len, "delta read: length %u, ETU sent %u", x.len, etu.stream_len);
+            CHECK(can_delta_apply(&slot, stream, x.len) == 0, "delta of %u bytes, poll %d did not merge", len, p);
+            CHECK(memcmp(slot.data, data, len) == 0, "delta of %u bytes, poll %d: copy differs", len, p);
+            CHECK(slot.version == can_delta_version(data, len), "delta version");
+            CHECK(etu.protocol_errors == 0, "delta read: %d protocol errors at the ETU", etu.protocol_errors);
+        }
+    }
+}
+
+
+int main(int argc, char *argv[])
+{
+    int rounds = (argc > 1) ? atoi(argv[1]) : TEST_ROUNDS;
+
+    if (rounds < 1)
+    {
+        rounds = TEST_ROUNDS;
+    }
+
+    test_ids(rounds);
+    printf("ids        %8lu checks\n", checks);
+    test_fragments(rounds);
+    printf("fragments  %8lu checks\n", checks);
+    test_crc(rounds);
+    printf("crc        %8lu checks\n", checks);
+    test_read(rounds);
+    printf("read       %8lu checks\n", checks);
+    test_write(rounds);
+    printf("write      %8lu checks\n", checks);
+    test_delta(rounds);
+    printf("delta      %8lu checks\n", checks);
+
+    printf("\n%lu checks, %lu failed: %s\n", checks, failures, failures ? "FAILED" : "ok");
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,121 @@
+/*
+=============================================================================================================|
+|Log Configuration Guide:                                                                                    |
+|============================================================================================================|
+| Severity Macro      | Value | Description                                                                  |
+|---------------------|-------|------------------------------------------------------------------------------|
+| LOG_SEV_NONE        | 0     | No logs compiled in.                                                         |
+| LOG_SEV_ERROR       | 1     | LOG_ERROR only.                                                              |
+| LOG_SEV_WARN        | 2     | + LOG_WARN.                                                                  |
+| LOG_SEV_INFO        | 3     | + LOG_INFO.                                                                  |
+| LOG_SEV_DEBUG       | 4     | + LOG_DEBUG, log() and LOG_HEX(data, len, fmt, ...) (one record per dump).   |
+|---------------------|-------|------------------------------------------------------------------------------|
+| LOG_COMPILE_LEVEL   |       | Build-time threshold. Calls above it compile to nothing (arguments are not   |
+|                     |       | evaluated). e.g. -DLOG_COMPILE_LEVEL=LOG_SEV_INFO for field builds.          |
+|---------------------|-------|------------------------------------------------------------------------------|
+| Format Macro        | Value | Description                                                                  |
+|---------------------|-------|------------------------------------------------------------------------------|
+| LOG_LEVEL_BASIC     | 1     | Only the message (printf style).                                             |
+| LOG_LEVEL_TIME      | 2     | Timestamp + log level + message.                                             |
+| LOG_LEVEL_FULL      | 3     | Timestamp + log level + file + line + function + message.                    |
+=============================================================================================================
+
+Enabled messages go through a lock-free ring (log_async.c). The calling thread
+only formats the message body into a ring slot; timestamp/prefix formatting and
+all console I/O happen on the logger thread started by log_async_start().
+When the ring is nearly full, messages below ERROR are dropped and counted per
+severity (log_async_dropped_sev(), exported as modbus_can_log_dropped_total);
+the last LOG_ERROR_RESERVE slots are kept for ERROR records, and an ERROR
+caller waits for the logger thread rather than lose its record.
+Before log_async_start() (or in tools that never call it) messages are written
+synchronously.
+*/
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// Severities
+#define LOG_SEV_NONE    0
+#define LOG_SEV_ERROR   1
+#define LOG_SEV_WARN    2
+#define LOG_SEV_INFO    3
+#define LOG_SEV_DEBUG   4
+
+// Output formats
+#define LOG_LEVEL_NONE  0
+#define LOG_LEVEL_BASIC 1
+#define LOG_LEVEL_TIME  2
+#define LOG_LEVEL_FULL  3
+
+/* ========== CONFIGURATION ========== */
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_SEV_DEBUG   // 0-4 (4 = everything compiled in)
+#endif
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_FULL          // 0-3 (3 = full prefix)
+#endif
+
+/* ========== BACKEND (log_async.c) ========== */
+int      log_async_start(void);
+void     log_async_flush(void);
+void     log_async_stop(void);
+uint64_t log_async_dropped(void);              // All severities
+uint64_t log_async_dropped_sev(int sev);       // One LOG_SEV_* value
+
+void log_async_write(int sev, const char *file, int line, const char *func,
+                     const char *fmt, ...) __attribute__((format(printf, 5, 6)));
+void log_async_hex(int sev, const char *file, int line, const char *func,
+                   const uint8_t *data, size_t len, const char *fmt, ...) __attribute__((format(printf, 7, 8)));
+
+/*
+ * Compiled-out form: keeps printf format checking and marks the arguments
+ * as used, but generates no code.
+ */
+#define LOG_DISCARD(fmt, ...) \
+    do { \
+        if (0) { \
+            printf(fmt, ##__VA_ARGS__); \
+        } \
+    } while (0)
+
+/* ========== LOG MACROS ========== */
+#if (LOG_LEVEL > LOG_LEVEL_NONE) && (LOG_COMPILE_LEVEL >= LOG_SEV_ERROR)
+#define LOG_ERROR(fmt, ...) log_async_write(LOG_SEV_ERROR, __FILE__, __LINE__, __func__, fmt, ##__VA_ARGS__)
+#else
+#define LOG_ERROR(fmt, ...) LOG_DISCARD(fmt, ##__VA_ARGS__)
+#endif
+
+#if (LOG_LEVEL > LOG_LEVEL_NONE) && (LOG_COMPILE_LEVEL >= LOG_SEV_WARN)
+#define LOG_WARN(fmt, ...)  log_async_write(LOG_SEV_WARN, __FILE__, __LINE__, __func__, fmt, ##__VA_ARGS__)
+#else
+#define LOG_WARN(fmt, ...)  LOG_DISCARD(fmt, ##__VA_ARGS__)
+#endif
+
+#if (LOG_LEVEL > LOG_LEVEL_NONE) && (LOG_COMPILE_LEVEL >= LOG_SEV_INFO)
+#define LOG_INFO(fmt, ...)  log_async_write(LOG_SEV_INFO, __FILE__, __LINE__, __func__, fmt, ##__VA_ARGS__)
+#else
+#define LOG_INFO(fmt, ...)  LOG_DISCARD(fmt, ##__VA_ARGS__)
+#endif
+
+#if (LOG_LEVEL > LOG_LEVEL_NONE) && (LOG_COMPILE_LEVEL >= LOG_SEV_DEBUG)
+#define LOG_DEBUG(fmt, ...) log_async_write(LOG_SEV_DEBUG, __FILE__, __LINE__, __func__, fmt, ##__VA_ARGS__)
+#define LOG_HEX(data, len, fmt, ...) log_async_hex(LOG_SEV_DEBUG, __FILE__, __LINE__, __func__, data, len, fmt, ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(fmt, ...) LOG_DISCARD(fmt, ##__VA_ARGS__)
+#define LOG_HEX(data, len, fmt, ...) LOG_DISCARD(fmt, ##__VA_ARGS__)
+#endif
+
+/* ========== SIMPLE PRINTF STYLE LOG (no prefix, debug severity) ========== */
+#undef log
+#if (LOG_LEVEL > LOG_LEVEL_NONE) && (LOG_COMPILE_LEVEL >= LOG_SEV_DEBUG)
+#define log(fmt, ...) log_async_write(LOG_SEV_NONE, NULL, 0, NULL, fmt, ##__VA_ARGS__)
+#else
+#define log(fmt, ...) LOG_DISCARD(fmt, ##__VA_ARGS__)
+#endif
+
+#endif /* LOG_H */
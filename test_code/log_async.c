@@ -0,0 +1,484 @@
+/**
+ *  @file    log_async.c
+ *  @brief   Asynchronous logging backend for log.h
+ *
+ *  Producers (any thread) claim a slot in a bounded lock-free ring
+ *  (Vyukov MPMC sequence ring), format the message body into it and
+ *  publish it. One logger thread drains the ring, adds the timestamp and
+ *  prefix, and does all writes to stdout.
+ *
+ *  The message body is formatted on the caller's thread because C varargs
+ *  cannot be kept past the call (string arguments point into the caller's
+ *  buffers). What is deferred is everything that costs more than that:
+ *  localtime/strftime, the prefix, stdio locking and the write() syscall.
+ *
+ *  The last LOG_ERROR_RESERVE slots are kept for ERROR records: a flood of
+ *  debug output is dropped (and counted per severity) before it can push
+ *  out an error. If even the reserve is full, an ERROR caller waits for the
+ *  logger thread instead of losing the record.
+ *
+ *  The logger thread sleeps on a condition variable when the ring is empty.
+ *  A producer only takes the mutex to wake it when it is actually asleep,
+ *  so the request path stays lock-free while the logger is busy.
+ *
+ *  @author  Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "log.h"
+
+
+#define LOG_RING_SIZE       1024            /* Must be a power of two */
+#define LOG_RING_MASK       (LOG_RING_SIZE - 1)
+#define LOG_MSG_LEN         240
+#define LOG_ERROR_RESERVE   64              /* Slots only ERROR records may use      */
+#define LOG_IDLE_WAIT_S     1               /* Logger wakes up at least this often   */
+#define LOG_ERROR_WAIT_NS   10000000        /* ERROR caller re-checks a full ring    */
+#define LOG_FLUSH_POLL_NS   1000000         /* log_async_flush() poll interval       */
+
+
+typedef struct {
+    _Atomic size_t   seq;
+    int              sev;
+    int              line;
+    const char      *file;
+    const char      *func;
+    struct timespec  ts;
+    char             msg[LOG_MSG_LEN];
+} log_slot;
+
+
+static log_slot          ring[LOG_RING_SIZE];
+static _Atomic size_t    enqueue_pos;
+static _Atomic size_t    dequeue_pos;
+static _Atomic uint64_t  dropped[LOG_SEV_DEBUG + 1];
+static atomic_int        running;
+static atomic_int        logger_idle;       /* Logger is (about to be) waiting on work_cond */
+static atomic_int        space_waiters;     /* ERROR callers waiting on space_cond          */
+static int               conds_ready;
+static pthread_t         logger_thread;
+static pthread_mutex_t   wake_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t    work_cond;
+static pthread_cond_t    space_cond;
+
+static const char *const sev_tag[] = { "", "ERROR", "WARN", "INFO", "DEBUG" };
+
+
+/**
+ * @brief Write one message with its prefix to stdout (logger thread or sync mode).
+ */
+static void log_emit(int sev, const char *file, int line, const char *func,
+                     const struct timespec *ts, const char *msg)
+{
+    static time_t  cached_sec = -1;
+    static char    cached_stamp[20];
+    struct tm      tm_now;
+
+    if (sev == LOG_SEV_NONE)
+    {
+        fputs(msg, stdout);
+        return;
+    }
+
+    if (LOG_LEVEL == LOG_LEVEL_BASIC)
+    {
+        fprintf(stdout, "%s %s", sev_tag[sev], msg);
+        return;
+    }
+
+    /*
+     * localtime_r + strftime once per second, not once per message
+     */
+    if (ts->tv_sec != cached_sec)
+    {
+        localtime_r(&ts->tv_sec, &tm_now);
+        strftime(cached_stamp, sizeof(cached_stamp), "%Y-%m-%d %H:%M:%S", &tm_now);
+        cached_sec = ts->tv_sec;
+    }
+
+    if (LOG_LEVEL == LOG_LEVEL_TIME)
+    {
+        fprintf(stdout, "%s %s %s", cached_stamp, sev_tag[sev], msg);
+    }
+    else
+    {
+        fprintf(stdout, "%s.%03ld %-5s [%s:%-4d - %-35s] %s", cached_stamp, ts->tv_nsec / 1000000,
+                sev_tag[sev], file, line, func, msg);
+    }
+}
+
+
+/**
+ * @brief Claim the next free slot, or NULL if the ring is full.
+ */
+static log_slot *log_claim(size_t *pos_out)
+{
+    log_slot  *slot;
+    size_t     pos;
+    size_t     seq;
+    intptr_t   diff;
+
+    pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+
+    while (1)
+    {
+        slot = &ring[pos & LOG_RING_MASK];
+        seq  = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (diff == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+            {
+                *pos_out = pos;
+                return slot;
+            }
+        }
+        else if (diff < 0)
+        {
+            return NULL;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+        }
+    }
+}
+
+
+static void log_publish(log_slot *slot, size_t pos)
+{
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+
+    /*
+     * Pairs with the fence in log_thread(): either the logger sees this
+     * record before it sleeps, or we see it idle and wake it
+     */
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (atomic_load_explicit(&logger_idle, memory_order_relaxed))
+    {
+        pthread_mutex_lock(&wake_lock);
+        pthread_cond_signal(&work_cond);
+        pthread_mutex_unlock(&wake_lock);
+    }
+}
+
+
+/**
+ * @brief Claim a slot for an ERROR record, waiting for the logger if the ring is full.
+ *
+ * @return Slot, or NULL if the backend was stopped while waiting
+ */
+static log_slot *log_claim_error(size_t *pos_out)
+{
+    struct timespec  wake;
+    log_slot        *slot;
+
+    slot = log_claim(pos_out);
+    if (slot != NULL)
+    {
+        return slot;
+    }
+
+    pthread_mutex_lock(&wake_lock);
+    atomic_fetch_add(&space_waiters, 1);
+
+    while (((slot = log_claim(pos_out)) == NULL) && atomic_load(&running))
+    {
+        clock_gettime(CLOCK_MONOTONIC, &wake);
+        wake.tv_nsec += LOG_ERROR_WAIT_NS;
+        if (wake.tv_nsec >= 1000000000L)
+        {
+            wake.tv_sec++;
+            wake.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&space_cond, &wake_lock, &wake);
+    }
+
+    atomic_fetch_sub(&space_waiters, 1);
+    pthread_mutex_unlock(&wake_lock);
+
+    return slot;
+}
+
+
+static void *log_thread(void *arg)
+{
+    struct timespec  wake;
+    log_slot        *slot;
+    size_t           seq;
+    int              drained;
+
+    (void)arg;
+
+    while (1)
+    {
+        drained = 0;
+
+        while (1)
+        {
+            slot = &ring[dequeue_pos & LOG_RING_MASK];
+            seq  = atomic_load_explicit(&slot->seq, memory_order_acquire);
+
+            if (seq != dequeue_pos + 1)
+            {
+                break;
+            }
+
+            log_emit(slot->sev, slot->file, slot->line, slot->func, &slot->ts, slot->msg);
+
+            atomic_store_explicit(&slot->seq, dequeue_pos + LOG_RING_SIZE, memory_order_release);
+            atomic_fetch_add(&dequeue_pos, 1);
+            drained++;
+
+            if (atomic_load_explicit(&space_waiters, memory_order_relaxed))
+            {
+                pthread_mutex_lock(&wake_lock);
+                pthread_cond_broadcast(&space_cond);
+                pthread_mutex_unlock(&wake_lock);
+            }
+        }
+
+        if (drained)
+        {
+            fflush(stdout);
+            continue;
+        }
+
+        if (!atomic_load(&running))
+        {
+            break;
+        }
+
+        pthread_mutex_lock(&wake_lock);
+        atomic_store(&logger_idle, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+
+        slot = &ring[dequeue_pos & LOG_RING_MASK];
+        if ((atomic_load_explicit(&slot->seq, memory_order_acquire) != dequeue_pos + 1) &&
+            atomic_load(&running))
+        {
+            /*
+             * The timeout is only a safety net, log_publish() wakes us
+             */
+            clock_gettime(CLOCK_MONOTONIC, &wake);
+            wake.tv_sec += LOG_IDLE_WAIT_S;
+            pthread_cond_timedwait(&work_cond, &wake_lock, &wake);
+        }
+
+        atomic_store(&logger_idle, 0);
+        pthread_mutex_unlock(&wake_lock);
+    }
+
+    return NULL;
+}
+
+
+int log_async_start(void)
+{
+    pthread_condattr_t attr;
+    size_t             i;
+
+    if (atomic_load(&running))
+    {
+        return 0;
+    }
+
+    if (!conds_ready)
+    {
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&work_cond, &attr);
+        pthread_cond_init(&space_cond, &attr);
+        pthread_condattr_destroy(&attr);
+        conds_ready = 1;
+    }
+
+    for (i = 0; i < LOG_RING_SIZE; i++)
+    {
+        atomic_init(&ring[i].seq, i);
+    }
+    atomic_store(&enqueue_pos, 0);
+    atomic_store(&dequeue_pos, 0);
+
+    atomic_store(&running, 1);
+
+    if (pthread_create(&logger_thread, NULL, log_thread, NULL) != 0)
+    {
+        atomic_store(&running, 0);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+void log_async_flush(void)
+{
+    struct timespec wait = { 0, LOG_FLUSH_POLL_NS };
+
+    if (!atomic_load(&running))
+    {
+        fflush(stdout);
+        return;
+    }
+
+    /*
+     * Wait until the logger thread caught up with everything enqueued so far
+     */
+    while (atomic_load(&dequeue_pos) < atomic_load(&enqueue_pos))
+    {
+        nanosleep(&wait, NULL);
+    }
+}
+
+
+void log_async_stop(void)
+{
+    if (!atomic_load(&running))
+    {
+        return;
+    }
+
+    atomic_store(&running, 0);
+
+    pthread_mutex_lock(&wake_lock);
+    pthread_cond_signal(&work_cond);
+    pthread_cond_broadcast(&space_cond);
+    pthread_mutex_unlock(&wake_lock);
+
+    pthread_join(logger_thread, NULL);
+    fflush(stdout);
+}
+
+
+uint64_t log_async_dropped(void)
+{
+    uint64_t total = 0;
+    int      sev;
+
+    for (sev = LOG_SEV_NONE; sev <= LOG_SEV_DEBUG; sev++)
+    {
+        total += atomic_load(&dropped[sev]);
+    }
+
+    return total;
+}
+
+
+uint64_t log_async_dropped_sev(int sev)
+{
+    if ((sev < LOG_SEV_NONE) || (sev > LOG_SEV_DEBUG))
+    {
+        return 0;
+    }
+
+    return atomic_load(&dropped[sev]);
+}
+
+
+void log_async_write(int sev, const char *file, int line, const char *func, const char *fmt, ...)
+{
+    struct timespec  ts;
+    log_slot        *slot;
+    size_t           pos;
+    size_t           head;
+    size_t           tail;
+    char             msg[LOG_MSG_LEN];
+    va_list          ap;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    if (!atomic_load_explicit(&running, memory_order_relaxed))
+    {
+        /*
+         * Synchronous mode: backend not started
+         */
+        va_start(ap, fmt);
+        vsnprintf(msg, sizeof(msg), fmt, ap);
+        va_end(ap);
+        log_emit(sev, file, line, func, &ts, msg);
+        return;
+    }
+
+    if (sev == LOG_SEV_ERROR)
+    {
+        slot = log_claim_error(&pos);
+    }
+    else
+    {
+        /*
+         * dequeue_pos first: it never passes enqueue_pos, so the fill level
+         * computed from the two loads cannot underflow
+         */
+        head = atomic_load_explicit(&dequeue_pos, memory_order_relaxed);
+        tail = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+
+        slot = (tail - head >= LOG_RING_SIZE - LOG_ERROR_RESERVE) ? NULL : log_claim(&pos);
+    }
+
+    if (slot == NULL)
+    {
+        atomic_fetch_add_explicit(&dropped[(sev >= LOG_SEV_NONE) && (sev <= LOG_SEV_DEBUG) ? sev : LOG_SEV_NONE],
+                                  1, memory_order_relaxed);
+        return;
+    }
+
+    slot->sev  = sev;
+    slot->file = file;
+    slot->line = line;
+    slot->func = func;
+    slot->ts   = ts;
+
+    va_start(ap, fmt);
+    vsnprintf(slot->msg, sizeof(slot->msg), fmt, ap);
+    va_end(ap);
+
+    log_publish(slot, pos);
+}
+
+
+void log_async_hex(int sev, const char *file, int line, const char *func,
+                   const uint8_t *data, size_t len, const char *fmt, ...)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    char              msg[LOG_MSG_LEN];
+    size_t            n;
+    size_t            i;
+    va_list           ap;
+
+    /*
+     * One record for the whole dump instead of one printf per byte
+     */
+    va_start(ap, fmt);
+    n = (size_t)vsnprintf(msg, sizeof(msg), fmt, ap);
+    va_end(ap);
+
+    if (n >= sizeof(msg))
+    {
+        n = sizeof(msg) - 1;
+    }
+
+    for (i = 0; (i < len) && (n + 4 < sizeof(msg)); i++)
+    {
+        msg[n++] = hex[data[i] >> 4];
+        msg[n++] = hex[data[i] & 0x0F];
+        msg[n++] = ' ';
+    }
+    msg[n++] = '\n';
+    msg[n]   = '\0';
+
+    log_async_write(sev, file, line, func, "%s", msg);
+}
@@ -0,0 +1,653 @@
+/**
+ *  @file    metrics.c
+ *  @brief   Runtime counters and latency histograms with a local scrape endpoint
+ *
+ *  See metrics.h. The shard table is only locked when a thread takes or
+ *  gives back a shard and when the exporter sums them, never on an update.
+ *
+ *  @author  Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "metrics.h"
+#include "log.h"
+
+
+#define METRICS_PREFIX      "modbus_can_"
+#define METRICS_HTTP_REQ    1024
+
+
+/*
+ * Values summed over all shards
+ */
+typedef struct {
+    uint64_t    counters[METRIC_COUNTER_COUNT];
+    uint64_t    requests[METRICS_FC_SLOTS];
+    uint64_t    exceptions[METRICS_EXC_SLOTS];
+    uint64_t    count[METRIC_HIST_COUNT][METRICS_HIST_BUCKETS];
+    uint64_t    sum_us[METRIC_HIST_COUNT];
+} metrics_total;
+
+typedef struct {
+    const char  *name;
+    const char  *help;
+} metrics_name;
+
+typedef struct {
+    metrics_collector_fn    fn;
+    void                   *ctx;
+} metrics_collector;
+
+
+static const metrics_name counter_names[METRIC_COUNTER_COUNT] = {
+    [METRIC_LOOKUP_MISSES]    = { "lookup_misses_total",    "Requests for addresses or function codes not in the register map" },
+    [METRIC_CAN_TX_FRAMES]    = { "can_tx_frames_total",    "CAN frames sent" },
+    [METRIC_CAN_TX_ERRORS]    = { "can_tx_errors_total",    "CAN frames that could not be sent" },
+    [METRIC_CAN_RX_FRAMES]    = { "can_rx_frames_total",    "Expected CAN frames received" },
+    [METRIC_CAN_CRC_ERRORS]   = { "can_crc_errors_total",   "CAN frames with a bad ETU CRC" },
+    [METRIC_CAN_TIMEOUTS]     = { "can_timeouts_total",     "CAN frames not answered within the RTO" },
+    [METRIC_CAN_RETRANSMITS]  = { "can_retransmits_total",  "CAN frames sent again" },
+    [METRIC_CAN_XFER_ERRORS]  = { "can_xfer_errors_total",  "ETU transfers failed after all retries" },
+    [METRIC_SCHED_REFUSED]    = { "sched_refused_total",    "Requests refused by the CAN scheduler" },
+    [METRIC_EEPROM_READS]     = { "eeprom_reads_total",     "EEPROM reads" },
+    [METRIC_EEPROM_WRITES]    = { "eeprom_writes_total",    "EEPROM writes" },
+    [METRIC_EEPROM_ERRORS]    = { "eeprom_errors_total",    "Failed EEPROM reads and writes" },
+    [METRIC_CLIENTS_ACCEPTED] = { "clients_accepted_total", "Modbus TCP connections accepted" },
+    [METRIC_CLIENTS_REFUSED]  = { "clients_refused_total",  "Modbus TCP connections refused (client limit)" },
+};
+
+static const char *hist_names[METRIC_HIST_COUNT] = {
+    [METRIC_H_REQUEST]       = "request",
+    [METRIC_H_SCHED_WAIT]    = "sched_wait",
+    [METRIC_H_CAN_READ]      = "can_read",
+    [METRIC_H_CAN_WRITE]     = "can_write",
+    [METRIC_H_CAN_FRAME_RTT] = "can_frame_rtt",
+    [METRIC_H_EEPROM]        = "eeprom",
+};
+
+__thread metrics_shard *metrics_tls;
+
+static metrics_shard      shards[METRICS_MAX_SHARDS];
+static metrics_shard      overflow = { .in_use = 1, .shared = 1 };
+static metrics_shard      retired;                  /* Shards of exited threads  */
+static pthread_mutex_t    shards_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t     key_once    = PTHREAD_ONCE_INIT;
+static pthread_key_t      shard_key;
+static metrics_collector  collectors[METRICS_MAX_COLLECTORS];
+static int                collector_count;
+static int                unix_fd = -1;
+static int                http_fd = -1;
+
+
+static uint64_t load(_Atomic uint64_t *v)
+{
+    return atomic_load_explicit(v, memory_order_relaxed);
+}
+
+
+/**
+ * @brief Add every value of a shard to acc (caller holds shards_lock).
+ */
+static void shard_sum(metrics_shard *s, metrics_total *acc)
+{
+    int i;
+    int b;
+
+    for (i = 0; i < METRIC_COUNTER_COUNT; i++)
+    {
+        acc->counters[i] += load(&s->counters[i]);
+    }
+    for (i = 0; i < METRICS_FC_SLOTS; i++)
+    {
+        acc->requests[i] += load(&s->requests[i]);
+    }
+    for (i = 0; i < METRICS_EXC_SLOTS; i++)
+    {
+        acc->exceptions[i] += load(&s->exceptions[i]);
+    }
+    for (i = 0; i < METRIC_HIST_COUNT; i++)
+    {
+        for (b = 0; b < METRICS_HIST_BUCKETS; b++)
+        {
+            acc->count[i][b] += load(&s->hist[i].count[b]);
+        }
+        acc->sum_us[i] += load(&s->hist[i].sum_us);
+    }
+}
+
+
+/**
+ * @brief Fold a shard into the retired totals (caller holds shards_lock).
+ */
+static void shard_retire(metrics_shard *s)
+{
+    int i;
+    int b;
+
+    for (i = 0; i < METRIC_COUNTER_COUNT; i++)
+    {
+        metrics_bump(&retired.counters[i], load(&s->counters[i]), 0);
+    }
+    for (i = 0; i < METRICS_FC_SLOTS; i++)
+    {
+        metrics_bump(&retired.requests[i], load(&s->requests[i]), 0);
+    }
+    for (i = 0; i < METRICS_EXC_SLOTS; i++)
+    {
+        metrics_bump(&retired.exceptions[i], load(&s->exceptions[i]), 0);
+    }
+    for (i = 0; i < METRIC_HIST_COUNT; i++)
+    {
+        for (b = 0; b < METRICS_HIST_BUCKETS; b++)
+        {
+            metrics_bump(&retired.hist[i].count[b], load(&s->hist[i].count[b]), 0);
+        }
+        metrics_bump(&retired.hist[i].sum_us, load(&s->hist[i].sum_us), 0);
+    }
+}
+
+
+/**
+ * @brief Thread exit: hand the shard back, its values stay in the totals.
+ */
+static void shard_release(void *arg)
+{
+    metrics_shard *s = (metrics_shard *)arg;
+
+    pthread_mutex_lock(&shards_lock);
+    shard_retire(s);
+    s->in_use = 0;
+    pthread_mutex_unlock(&shards_lock);
+
+    metrics_tls = NULL;
+}
+
+
+static void key_create(void)
+{
+    pthread_key_create(&shard_key, shard_release);
+}
+
+
+metrics_shard *metrics_shard_attach(void)
+{
+    metrics_shard *s = &overflow;
+    int            i;
+
+    pthread_once(&key_once, key_create);
+
+    pthread_mutex_lock(&shards_lock);
+    for (i = 0; i < METRICS_MAX_SHARDS; i++)
+    {
+        if (!shards[i].in_use)
+        {
+            s = &shards[i];
+            memset(s, 0, sizeof(*s));
+            s->in_use = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&shards_lock);
+
+    if (s != &overflow)
+    {
+        pthread_setspecific(shard_key, s);
+    }
+    metrics_tls = s;
+
+    return s;
+}
+
+
+int metrics_add_collector(metrics_collector_fn fn, void *ctx)
+{
+    if (collector_count >= METRICS_MAX_COLLECTORS)
+    {
+        return -1;
+    }
+
+    collectors[collector_count].fn  = fn;
+    collectors[collector_count].ctx = ctx;
+    collector_count++;
+
+    return 0;
+}
+
+
+void metrics_printf(metrics_out *out, const char *fmt, ...)
+{
+    va_list  ap;
+    char    *grown;
+    size_t   cap;
+    int      n;
+
+    for (;;)
+    {
+        va_start(ap, fmt);
+        n = vsnprintf(out->buf ? out->buf + out->len : NULL, out->cap - out->len, fmt, ap);
+        va_end(ap);
+
+        if ((n < 0) || (out->len + (size_t)n < out->cap))
+        {
+            break;
+        }
+
+        /*
+         * Did not fit (or no buffer yet): grow and format again
+         */
+        cap = out->cap ? out->cap * 2 : 4096;
+        while (cap <= out->len + (size_t)n)
+        {
+            cap *= 2;
+        }
+        if (cap > METRICS_TEXT_MAX)
+        {
+            return;
+        }
+        grown = realloc(out->buf, cap);
+        if (grown == NULL)
+        {
+            return;
+        }
+        out->buf = grown;
+        out->cap = cap;
+    }
+
+    if (n > 0)
+    {
+        out->len += (size_t)n;
+    }
+}
+
+
+static void render_header(metrics_out *out, const char *name, const char *type, const char *help)
+{
+    metrics_printf(out, "# HELP " METRICS_PREFIX "%s %s\n", name, help);
+    metrics_printf(out, "# TYPE " METRICS_PREFIX "%s %s\n", name, type);
+}
+
+
+size_t metrics_render(metrics_out *out)
+{
+    metrics_total   *t;
+    uint64_t         cum;
+    int              i;
+    int              b;
+
+    memset(out, 0, sizeof(*out));
+
+    t = calloc(1, sizeof(*t));
+    if (t == NULL)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&shards_lock);
+    shard_sum(&retired, t);
+    shard_sum(&overflow, t);
+    for (i = 0; i < METRICS_MAX_SHARDS; i++)
+    {
+        if (shards[i].in_use)
+        {
+            shard_sum(&shards[i], t);
+        }
+    }
+    pthread_mutex_unlock(&shards_lock);
+
+    render_header(out, "requests_total", "counter", "Modbus requests by function code (fc=\"0\": others)");
+    for (i = 0; i < METRICS_FC_SLOTS; i++)
+    {
+        if (t->requests[i])
+        {
+            metrics_printf(out, METRICS_PREFIX "requests_total{fc=\"%d\"} %llu\n", i, (unsigned long long)t->requests[i]);
+        }
+    }
+
+    render_header(out, "exceptions_total", "counter", "Modbus exception replies by exception code");
+    for (i = 0; i < METRICS_EXC_SLOTS; i++)
+    {
+        if (t->exceptions[i])
+        {
+            metrics_printf(out, METRICS_PREFIX "exceptions_total{code=\"%d\"} %llu\n", i, (unsigned long long)t->exceptions[i]);
+        }
+    }
+
+    for (i = 0; i < METRIC_COUNTER_COUNT; i++)
+    {
+        render_header(out, counter_names[i].name, "counter", counter_names[i].help);
+        metrics_printf(out, METRICS_PREFIX "%s %llu\n", counter_names[i].name, (unsigned long long)t->counters[i]);
+    }
+
+    /*
+     * Bucket b holds values up to 2^b us, so the cumulative count up to b
+     * is exact for le = 2^b us
+     */
+    render_header(out, "latency_seconds", "histogram", "Latency of the request phases");
+    for (i = 0; i < METRIC_HIST_COUNT; i++)
+    {
+        cum = 0;
+        for (b = 0; b < METRICS_HIST_BUCKETS - 1; b++)
+        {
+            cum += t->count[i][b];
+            metrics_printf(out, METRICS_PREFIX "latency_seconds_bucket{phase=\"%s\",le=\"%.6f\"} %llu\n",
+                           hist_names[i], (double)(1ULL << b) / 1e6, (unsigned long long)cum);
+        }
+        cum += t->count[i][b];
+        metrics_printf(out, METRICS_PREFIX "latency_seconds_bucket{phase=\"%s\",le=\"+Inf\"} %llu\n",
+                       hist_names[i], (unsigned long long)cum);
+        metrics_printf(out, METRICS_PREFIX "latency_seconds_sum{phase=\"%s\"} %.6f\n",
+                       hist_names[i], (double)t->sum_us[i] / 1e6);
+        metrics_printf(out, METRICS_PREFIX "latency_seconds_count{phase=\"%s\"} %llu\n",
+                       hist_names[i], (unsigned long long)cum);
+    }
+
+    free(t);
+
+    for (i = 0; i < collector_count; i++)
+    {
+        collectors[i].fn(out, collectors[i].ctx);
+    }
+
+    return out->len;
+}
+
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0)
+    {
+        n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief Answer one HTTP request: GET / or GET /metrics.
+ */
+static void serve_http(int fd)
+{
+    char            req[METRICS_HTTP_REQ];
+    char            head[160];
+    struct pollfd   pfd;
+    metrics_out     out;
+    ssize_t         n;
+    int             len;
+
+    pfd.fd     = fd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, METRICS_CLIENT_TIMEOUT_MS) <= 0)
+    {
+        return;
+    }
+
+    /*
+     * The request line is all that matters, headers are not read
+     */
+    n = recv(fd, req, sizeof(req) - 1, 0);
+    if (n <= 0)
+    {
+        return;
+    }
+    req[n] = '\0';
+
+    if ((strncmp(req, "GET / ", 6) != 0) && (strncmp(req, "GET /metrics", 12) != 0))
+    {
+        len = snprintf(head, sizeof(head), "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+        write_all(fd, head, (size_t)len);
+        return;
+    }
+
+    metrics_render(&out);
+
+    len = snprintf(head, sizeof(head),
+                   "HTTP/1.0 200 OK\r\n"
+                   "Content-Type: text/plain; version=0.0.4\r\n"
+                   "Content-Length: %zu\r\n"
+                   "Connection: close\r\n\r\n", out.len);
+    if (write_all(fd, head, (size_t)len) == 0)
+    {
+        write_all(fd, out.buf, out.len);
+    }
+    free(out.buf);
+}
+
+
+static void serve_unix(int fd)
+{
+    metrics_out out;
+
+    metrics_render(&out);
+    write_all(fd, out.buf, out.len);
+    free(out.buf);
+}
+
+
+/**
+ * @brief Exporter thread: one scrape at a time, each connection is closed after the reply.
+ */
+static void *metrics_thread(void *arg)
+{
+    struct pollfd   pfd[2];
+    struct timeval  tv = { 0, METRICS_CLIENT_TIMEOUT_MS * 1000 };
+    int             nfds = 0;
+    int             fd;
+    int             i;
+
+    (void)arg;
+
+    if (unix_fd >= 0)
+    {
+        pfd[nfds].fd     = unix_fd;
+        pfd[nfds].events = POLLIN;
+        nfds++;
+    }
+    if (http_fd >= 0)
+    {
+        pfd[nfds].fd     = http_fd;
+        pfd[nfds].events = POLLIN;
+        nfds++;
+    }
+
+    for (;;)
+    {
+        if (poll(pfd, (nfds_t)nfds, -1) < 0)
+        {
+            if (errno != EINTR)
+            {
+                LOG_ERROR("Metrics: poll failed: %s\n", strerror(errno));
+                return NULL;
+            }
+            continue;
+        }
+
+        for (i = 0; i < nfds; i++)
+        {
+            if (!(pfd[i].revents & POLLIN))
+            {
+                continue;
+            }
+
+            fd = accept4(pfd[i].fd, NULL, NULL, SOCK_CLOEXEC);
+            if (fd < 0)
+            {
+                continue;
+            }
+
+            /*
+             * A scraper that stops reading must not stall the exporter
+             */
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+            if (pfd[i].fd == http_fd)
+            {
+                serve_http(fd);
+            }
+            else
+            {
+                serve_unix(fd);
+            }
+            close(fd);
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief Listening Unix stream socket, a leading '@' names an abstract socket.
+ */
+static int unix_open(const char *path)
+{
+    struct sockaddr_un  sun;
+    socklen_t           len;
+    size_t              path_len;
+    int                 fd;
+
+    path_len = strlen(path);
+    if ((path_len == 0) || (path_len >= sizeof(sun.sun_path)))
+    {
+        return -1;
+    }
+
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    memcpy(sun.sun_path, path, path_len);
+    if (sun.sun_path[0] == '@')
+    {
+        sun.sun_path[0] = '\0';
+    }
+    else
+    {
+        /*
+         * Left over from a previous run
+         */
+        unlink(path);
+    }
+    len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + path_len);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    if ((bind(fd, (struct sockaddr *)&sun, len) != 0) || (listen(fd, 4) != 0))
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+/**
+ * @brief Listening TCP socket on 127.0.0.1 only, the endpoint is not for the plant network.
+ */
+static int http_open(uint16_t port)
+{
+    struct sockaddr_in  sin;
+    int                 one = 1;
+    int                 fd;
+
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family      = AF_INET;
+    sin.sin_port        = htons(port);
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if ((bind(fd, (struct sockaddr *)&sin, sizeof(sin)) != 0) || (listen(fd, 4) != 0))
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+int metrics_start(const char *socket_path, uint16_t http_port)
+{
+    pthread_t tid;
+
+    if (socket_path != NULL)
+    {
+        unix_fd = unix_open(socket_path);
+        if (unix_fd < 0)
+        {
+            LOG_ERROR("Metrics: cannot listen on %s: %s\n", socket_path, strerror(errno));
+        }
+    }
+
+    if (http_port != 0)
+    {
+        http_fd = http_open(http_port);
+        if (http_fd < 0)
+        {
+            LOG_ERROR("Metrics: cannot listen on 127.0.0.1:%u: %s\n", http_port, strerror(errno));
+        }
+    }
+
+    if ((unix_fd < 0) && (http_fd < 0))
+    {
+        return -1;
+    }
+
+    if (pthread_create(&tid, NULL, metrics_thread, NULL) != 0)
+    {
+        LOG_ERROR("Metrics: cannot create thread\n");
+        if (unix_fd >= 0)
+        {
+            close(unix_fd);
+        }
+        if (http_fd >= 0)
+        {
+            close(http_fd);
+        }
+        unix_fd = http_fd = -1;
+        return -1;
+    }
+    pthread_detach(tid);
+
+    LOG_DEBUG("Metrics on %s%s%s\n", (unix_fd >= 0) ? socket_path : "",
+              ((unix_fd >= 0) && (http_fd >= 0)) ? " and " : "",
+              (http_fd >= 0) ? "127.0.0.1 (HTTP)" : "");
+
+    return 0;
+}
@@ -0,0 +1,218 @@
+/**
+ *  @file    metrics.h
+ *  @brief   Runtime counters and latency histograms with a local scrape endpoint
+ *
+ *  Every thread that records a metric gets its own shard: a counter update
+ *  is a relaxed load and store on a cache line only that thread writes, no
+ *  lock and no atomic read-modify-write. The exporter sums the shards when
+ *  it is scraped. A shard is folded into the totals and given back when its
+ *  thread exits (Modbus client threads come and go with the connections).
+ *
+ *  Latency histograms have power-of-two buckets in microseconds: bucket i
+ *  counts values up to 2^i us that did not fit bucket i - 1, the last
+ *  bucket everything above.
+ *
+ *  The exporter thread answers
+ *
+ *    - a Unix stream socket: every connection gets the text and is closed
+ *      ("socat - UNIX-CONNECT:/run/modbus_can_metrics.sock")
+ *    - optionally HTTP on 127.0.0.1 ("curl http://127.0.0.1:9502/metrics")
+ *
+ *  in the Prometheus text exposition format. Collectors registered with
+ *  metrics_add_collector() append values that other modules keep
+ *  themselves (scheduler, delta reads, discovery).
+ *
+ *  @author  Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+
+#define METRICS_MAX_SHARDS          32      /* Threads with their own shard at once   */
+#define METRICS_MAX_COLLECTORS      8
+#define METRICS_FC_SLOTS            32      /* Function codes 1..31, slot 0 = others  */
+#define METRICS_EXC_SLOTS           16      /* Exception codes 1..15, slot 0 = others */
+#define METRICS_HIST_BUCKETS        24      /* Up to 2^23 us (8.4 s), then +Inf       */
+#define METRICS_TEXT_MAX            65536   /* Largest scrape reply                   */
+#define METRICS_CLIENT_TIMEOUT_MS   500     /* Wait for an HTTP request line          */
+
+/*
+ * Counters
+ */
+#define METRIC_LOOKUP_MISSES        0       /* Address/FC not in the register map     */
+#define METRIC_CAN_TX_FRAMES        1
+#define METRIC_CAN_TX_ERRORS        2       /* TX queue full or write() failed        */
+#define METRIC_CAN_RX_FRAMES        3       /* Frames with the expected ID            */
+#define METRIC_CAN_CRC_ERRORS       4
+#define METRIC_CAN_TIMEOUTS         5       /* No answer within the RTO               */
+#define METRIC_CAN_RETRANSMITS      6
+#define METRIC_CAN_XFER_ERRORS      7       /* Transfers that failed after retries    */
+#define METRIC_SCHED_REFUSED        8       /* Answered busy by the CAN scheduler     */
+#define METRIC_EEPROM_READS         9
+#define METRIC_EEPROM_WRITES        10
+#define METRIC_EEPROM_ERRORS        11
+#define METRIC_CLIENTS_ACCEPTED     12
+#define METRIC_CLIENTS_REFUSED      13
+#define METRIC_COUNTER_COUNT        14
+
+/*
+ * Latency histograms (phases of a request)
+ */
+#define METRIC_H_REQUEST            0       /* Modbus request received to reply sent  */
+#define METRIC_H_SCHED_WAIT         1       /* Submitted to the CAN worker to started */
+#define METRIC_H_CAN_READ           2       /* One ETU read transfer                  */
+#define METRIC_H_CAN_WRITE          3       /* One ETU write transfer                 */
+#define METRIC_H_CAN_FRAME_RTT      4       /* Frame sent to answer received          */
+#define METRIC_H_EEPROM             5       /* One pread/pwrite                       */
+#define METRIC_HIST_COUNT           6
+
+
+/*
+ * One thread's values. Only the owning thread writes, so plain relaxed
+ * load + store is enough; the exporter may read at any time.
+ */
+typedef struct {
+    _Atomic uint64_t    count[METRICS_HIST_BUCKETS];
+    _Atomic uint64_t    sum_us;
+} metrics_hist;
+
+typedef struct {
+    _Atomic uint64_t    counters[METRIC_COUNTER_COUNT];
+    _Atomic uint64_t    requests[METRICS_FC_SLOTS];
+    _Atomic uint64_t    exceptions[METRICS_EXC_SLOTS];
+    metrics_hist        hist[METRIC_HIST_COUNT];
+    int                 in_use;
+    int                 shared;             /* Overflow shard, several writers    */
+} __attribute__((aligned(64))) metrics_shard;
+
+/*
+ * Output buffer handed to collectors
+ */
+typedef struct {
+    char       *buf;
+    size_t      len;
+    size_t      cap;
+} metrics_out;
+
+typedef void (*metrics_collector_fn)(metrics_out *out, void *ctx);
+
+
+extern __thread metrics_shard *metrics_tls;
+
+/**
+ * @brief Shard of the calling thread, taken on first use.
+ *
+ * When all METRICS_MAX_SHARDS are taken the thread shares an overflow
+ * shard that is updated with atomic read-modify-write instead.
+ */
+metrics_shard *metrics_shard_attach(void);
+
+
+static inline void metrics_bump(_Atomic uint64_t *v, uint64_t n, int shared)
+{
+    if (shared)
+    {
+        atomic_fetch_add_explicit(v, n, memory_order_relaxed);
+        return;
+    }
+    atomic_store_explicit(v, atomic_load_explicit(v, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+static inline metrics_shard *metrics_self(void)
+{
+    metrics_shard *s = metrics_tls;
+
+    return s ? s : metrics_shard_attach();
+}
+
+/**
+ * @brief Add n to a counter (METRIC_*).
+ */
+static inline void metrics_add(int counter, uint64_t n)
+{
+    metrics_shard *s = metrics_self();
+
+    metrics_bump(&s->counters[counter], n, s->shared);
+}
+
+static inline void metrics_inc(int counter)
+{
+    metrics_add(counter, 1);
+}
+
+/**
+ * @brief Count one Modbus request by function code.
+ */
+static inline void metrics_request(uint8_t fun_code)
+{
+    metrics_shard *s = metrics_self();
+
+    metrics_bump(&s->requests[(fun_code < METRICS_FC_SLOTS) ? fun_code : 0], 1, s->shared);
+}
+
+/**
+ * @brief Count one Modbus exception reply by exception code.
+ */
+static inline void metrics_exception(int code)
+{
+    metrics_shard *s = metrics_self();
+
+    metrics_bump(&s->exceptions[((code > 0) && (code < METRICS_EXC_SLOTS)) ? code : 0], 1, s->shared);
+}
+
+/**
+ * @brief Record one latency sample (METRIC_H_*), in microseconds.
+ */
+static inline void metrics_observe(int hist, uint64_t us)
+{
+    metrics_shard *s = metrics_self();
+    int            b = (us > 1) ? 64 - __builtin_clzll(us - 1) : 0;
+
+    if (b >= METRICS_HIST_BUCKETS)
+    {
+        b = METRICS_HIST_BUCKETS - 1;
+    }
+    metrics_bump(&s->hist[hist].count[b], 1, s->shared);
+    metrics_bump(&s->hist[hist].sum_us, us, s->shared);
+}
+
+
+/**
+ * @brief Register a function that appends its own lines to every scrape.
+ *
+ * Call before metrics_start(). Collectors run on the exporter thread.
+ *
+ * @return 0 on success, -1 if METRICS_MAX_COLLECTORS are registered
+ */
+int metrics_add_collector(metrics_collector_fn fn, void *ctx);
+
+/**
+ * @brief Append formatted text to a scrape reply (for collectors).
+ */
+void metrics_printf(metrics_out *out, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * @brief Render all metrics in the text exposition format.
+ *
+ * @return Length in bytes, out->buf must be freed by the caller
+ */
+size_t metrics_render(metrics_out *out);
+
+/**
+ * @brief Start the exporter thread.
+ *
+ * @param socket_path  Unix socket to listen on, NULL for none
+ * @param http_port    HTTP port on 127.0.0.1, 0 for none
+ *
+ * @return 0 on success, -1 if neither endpoint could be opened
+ */
+int metrics_start(const char *socket_path, uint16_t http_port);
+
+#endif /* METRICS_H */
@@ -0,0 +1,172 @@
+/**
+ *  @file    metrics_bench.c
+ *  @brief   Cost of one metrics update: per-thread shards against shared counters
+ *
+ *  N threads each do the updates of a busy request path (request counter,
+ *  CAN TX/RX counters, one latency sample) in a loop, once through
+ *  metrics.h and once on a single shared set of counters with atomic
+ *  fetch-add and with a mutex, the obvious alternatives. Reported is the
+ *  wall time per update, so contention between the threads shows.
+ *  At the end the scrape text is rendered once and checked against the
+ *  number of updates.
+ *
+ *    gcc -O2 metrics_bench.c metrics.c log_async.c -o metrics_bench -lpthread
+ *    ./metrics_bench [threads] [iterations per thread]
+ *
+ *  @author  Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "metrics.h"
+
+
+#define BENCH_MAX_THREADS       16
+#define BENCH_UPDATES_PER_ITER  4
+
+
+typedef struct {
+    _Atomic uint64_t    requests;
+    _Atomic uint64_t    tx;
+    _Atomic uint64_t    rx;
+    _Atomic uint64_t    hist[METRICS_HIST_BUCKETS];
+} shared_counters;
+
+typedef struct {
+    int         mode;
+    uint64_t    iterations;
+} bench_arg;
+
+enum { MODE_SHARDED, MODE_ATOMIC, MODE_MUTEX, MODE_COUNT };
+
+static const char       *mode_names[MODE_COUNT] = { "per-thread shards", "shared atomic", "shared mutex" };
+static shared_counters   shared;
+static pthread_mutex_t   shared_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_barrier_t start_barrier;
+
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+
+static int bucket(uint64_t us)
+{
+    int b = (us > 1) ? 64 - __builtin_clzll(us - 1) : 0;
+
+    return (b >= METRICS_HIST_BUCKETS) ? METRICS_HIST_BUCKETS - 1 : b;
+}
+
+
+static void *bench_thread(void *p)
+{
+    bench_arg *arg = (bench_arg *)p;
+    uint64_t   i;
+    uint64_t   us;
+
+    pthread_barrier_wait(&start_barrier);
+
+    for (i = 0; i < arg->iterations; i++)
+    {
+        us = 100 + (i & 1023);
+
+        switch (arg->mode)
+        {
+            case MODE_SHARDED:
+                metrics_request(3);
+                metrics_inc(METRIC_CAN_TX_FRAMES);
+                metrics_inc(METRIC_CAN_RX_FRAMES);
+                metrics_observe(METRIC_H_CAN_READ, us);
+                break;
+
+            case MODE_ATOMIC:
+                atomic_fetch_add_explicit(&shared.requests, 1, memory_order_relaxed);
+                atomic_fetch_add_explicit(&shared.tx, 1, memory_order_relaxed);
+                atomic_fetch_add_explicit(&shared.rx, 1, memory_order_relaxed);
+                atomic_fetch_add_explicit(&shared.hist[bucket(us)], 1, memory_order_relaxed);
+                break;
+
+            default:
+                pthread_mutex_lock(&shared_lock);
+                shared.requests++;
+                shared.tx++;
+                shared.rx++;
+                shared.hist[bucket(us)]++;
+                pthread_mutex_unlock(&shared_lock);
+                break;
+        }
+    }
+
+    return NULL;
+}
+
+
+static double run(int mode, int threads, uint64_t iterations)
+{
+    pthread_t  tid[BENCH_MAX_THREADS];
+    bench_arg  arg = { mode, iterations };
+    uint64_t   start;
+    int        i;
+
+    pthread_barrier_init(&start_barrier, NULL, (unsigned)threads + 1);
+    for (i = 0; i < threads; i++)
+    {
+        pthread_create(&tid[i], NULL, bench_thread, &arg);
+    }
+
+    pthread_barrier_wait(&start_barrier);
+    start = now_ns();
+    for (i = 0; i < threads; i++)
+    {
+        pthread_join(tid[i], NULL);
+    }
+    pthread_barrier_destroy(&start_barrier);
+
+    /*
+     * Wall time per update of one thread: what the request path pays
+     */
+    return (double)(now_ns() - start) / (double)(iterations * BENCH_UPDATES_PER_ITER);
+}
+
+
+int main(int argc, char *argv[])
+{
+    int          threads    = (argc > 1) ? atoi(argv[1]) : 4;
+    uint64_t     iterations = (argc > 2) ? strtoull(argv[2], NULL, 0) : 5000000;
+    metrics_out  out;
+    char         expect[64];
+    int          mode;
+
+    if ((threads < 1) || (threads > BENCH_MAX_THREADS))
+    {
+        fprintf(stderr, "threads must be 1..%d\n", BENCH_MAX_THREADS);
+        return 1;
+    }
+
+    for (mode = 0; mode < MODE_COUNT; mode++)
+    {
+        printf("%-18s %2d threads  %6.2f ns/update\n", mode_names[mode], threads, run(mode, threads, iterations));
+    }
+
+    /*
+     * The sharded run's threads have exited: their values must be in the totals
+     */
+    metrics_render(&out);
+    snprintf(expect, sizeof(expect), "modbus_can_requests_total{fc=\"3\"} %llu\n",
+             (unsigned long long)iterations * (unsigned long long)threads);
+    printf("scrape %zu bytes, totals %s\n", out.len, (out.buf && strstr(out.buf, expect)) ? "ok" : "WRONG");
+    free(out.buf);
+
+    return 0;
+}
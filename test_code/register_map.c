@@ -0,0 +1,814 @@
+/**
+ *  @file    register_map.c
+ *  @brief   Binary register map: loader, lookup, builder and RCU-style reload
+ *
+ *  See register_map.h for the file layout and the publication rules.
+ *
+ *  @author  Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include "register_map.h"
+#include "log.h"
+
+
+#define REGMAP_MAX_ENTRIES      8192
+#define REGMAP_MAX_STRINGS      (256 * 1024)
+#define REGMAP_GRACE_SLEEP_US   1000
+
+
+struct regmap_builder {
+    uint32_t         map_version;
+    regmap_dataset   datasets[REGMAP_MAX_DATASETS];
+    uint32_t         dataset_count;
+    regmap_entry    *entries;
+    uint32_t         entry_count;
+    char            *strings;
+    uint32_t         strings_size;
+    uint32_t         eeprom_offset;     /* Running byte offset over all TCP entries */
+};
+
+
+/*
+ * Publication state
+ */
+static _Atomic(regmap_t *)   current_map;
+static _Atomic uint64_t      map_epoch = 1;
+static _Atomic uint64_t      reader_epoch[REGMAP_MAX_READERS];     /* 0 = not reading */
+static atomic_int            reader_used[REGMAP_MAX_READERS];
+static __thread int          reader_slot = -1;
+static pthread_mutex_t       publish_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Reload thread state
+ */
+static pthread_t             watch_thread;
+static int                   reload_pipe[2] = { -1, -1 };
+static char                  watch_path[256];
+
+
+static uint32_t fnv1a(const uint8_t *data, size_t len)
+{
+    uint32_t hash = 2166136261U;
+    size_t   i;
+
+    for (i = 0; i < len; i++)
+    {
+        hash ^= data[i];
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+
+/**
+ * @brief Point the handle's table pointers into the image.
+ */
+static void regmap_attach(regmap_t *map)
+{
+    map->hdr      = (const regmap_header *)map->base;
+    map->datasets = (const regmap_dataset *)(map->base + map->hdr->dataset_offset);
+    map->entries  = (const regmap_entry *)(map->base + map->hdr->entry_offset);
+    map->index    = (const regmap_index *)(map->base + map->hdr->index_offset);
+    map->strings  = (const char *)(map->base + map->hdr->strings_offset);
+}
+
+
+static int table_fits(uint32_t offset, uint32_t count, size_t entry_size, size_t total)
+{
+    return ((uint64_t)offset + (uint64_t)count * entry_size) <= total;
+}
+
+
+/**
+ * @brief Check everything a lookup will rely on, so lookups need no checks.
+ */
+static int regmap_validate(const uint8_t *base, size_t size)
+{
+    const regmap_header  *hdr = (const regmap_header *)base;
+    const regmap_dataset *ds;
+    const regmap_entry   *en;
+    const regmap_index   *ix;
+    uint32_t              i;
+
+    if ((size < sizeof(regmap_header)) ||
+        (hdr->magic != REGMAP_MAGIC) ||
+        (hdr->format_version != REGMAP_FORMAT_VERSION) ||
+        (hdr->total_size != size) ||
+        (hdr->dataset_count > REGMAP_MAX_DATASETS) ||
+        (hdr->entry_count > REGMAP_MAX_ENTRIES) ||
+        (hdr->strings_size == 0) ||
+        ((hdr->dataset_offset | hdr->entry_offset | hdr->index_offset) & 3) ||
+        !table_fits(hdr->dataset_offset, hdr->dataset_count, sizeof(regmap_dataset), size) ||
+        !table_fits(hdr->entry_offset, hdr->entry_count, sizeof(regmap_entry), size) ||
+        (hdr->index_count > hdr->entry_count) ||
+        !table_fits(hdr->index_offset, hdr->index_count, sizeof(regmap_index), size) ||
+        !table_fits(hdr->strings_offset, hdr->strings_size, 1, size) ||
+        (base[hdr->strings_offset + hdr->strings_size - 1] != '\0') ||
+        (fnv1a(base + sizeof(regmap_header), size - sizeof(regmap_header)) != hdr->checksum))
+    {
+        return -1;
+    }
+
+    ds = (const regmap_dataset *)(base + hdr->dataset_offset);
+    en = (const regmap_entry *)(base + hdr->entry_offset);
+    ix = (const regmap_index *)(base + hdr->index_offset);
+
+    for (i = 0; i < hdr->dataset_count; i++)
+    {
+        if ((ds[i].name_off >= hdr->strings_size) ||
+            ((uint64_t)ds[i].first_entry + ds[i].entry_count > hdr->entry_count))
+        {
+            return -1;
+        }
+    }
+
+    for (i = 0; i < hdr->entry_count; i++)
+    {
+        if ((en[i].name_off >= hdr->strings_size) || (en[i].dataset >= hdr->dataset_count))
+        {
+            return -1;
+        }
+    }
+
+    for (i = 0; i < hdr->index_count; i++)
+    {
+        if ((ix[i].entry >= hdr->entry_count) ||
+            ((i > 0) && ((((uint32_t)ix[i - 1].kind << 16) | ix[i - 1].addr) >
+                         (((uint32_t)ix[i].kind << 16) | ix[i].addr))))
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+regmap_t *regmap_open(const char *path)
+{
+    struct stat  st;
+    regmap_t    *map;
+    void        *base;
+    int          fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+
+    if ((fstat(fd, &st) != 0) || (st.st_size < (off_t)sizeof(regmap_header)))
+    {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (base == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    if (regmap_validate(base, (size_t)st.st_size) != 0)
+    {
+        munmap(base, (size_t)st.st_size);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    map = calloc(1, sizeof(*map));
+    if (map == NULL)
+    {
+        munmap(base, (size_t)st.st_size);
+        return NULL;
+    }
+
+    map->base   = base;
+    map->size   = (size_t)st.st_size;
+    map->mapped = 1;
+    regmap_attach(map);
+
+    return map;
+}
+
+
+void regmap_close(regmap_t *map)
+{
+    if (map == NULL)
+    {
+        return;
+    }
+
+    if (map->mapped)
+    {
+        munmap((void *)map->base, map->size);
+    }
+    else
+    {
+        free((void *)map->base);
+    }
+
+    free(map);
+}
+
+
+const regmap_entry *regmap_lookup(const regmap_t *map, int kind, uint16_t addr,
+                                  uint8_t fun_code, const regmap_entry **addr_match)
+{
+    const regmap_entry *entry;
+    uint32_t            key = ((uint32_t)kind << 16) | addr;
+    uint32_t            lo  = 0;
+    uint32_t            hi  = map->hdr->index_count;
+    uint32_t            mid;
+
+    if (addr_match != NULL)
+    {
+        *addr_match = NULL;
+    }
+
+    /*
+     * Lower bound of (kind, addr)
+     */
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+
+        if ((((uint32_t)map->index[mid].kind << 16) | map->index[mid].addr) < key)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    for (; (lo < map->hdr->index_count) && (map->index[lo].kind == kind) && (map->index[lo].addr == addr); lo++)
+    {
+        entry = &map->entries[map->index[lo].entry];
+
+        if ((addr_match != NULL) && (*addr_match == NULL))
+        {
+            *addr_match = entry;
+        }
+
+        if ((entry->fun_code[0] == fun_code) ||
+            (entry->fun_code[1] == fun_code) ||
+            (entry->fun_code[2] == fun_code))
+        {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+
+const regmap_dataset *regmap_dataset_get(const regmap_t *map, uint32_t dataset)
+{
+    if (dataset >= map->hdr->dataset_count)
+    {
+        return NULL;
+    }
+
+    return &map->datasets[dataset];
+}
+
+
+const char *regmap_string(const regmap_t *map, uint32_t name_off)
+{
+    return map->strings + name_off;
+}
+
+
+/***************************************************************
+ *  Building
+ ***************************************************************/
+
+static uint32_t builder_string(regmap_builder *b, const char *s)
+{
+    size_t   len = strlen(s ? s : "") + 1;
+    uint32_t off = b->strings_size;
+
+    if (b->strings_size + len > REGMAP_MAX_STRINGS)
+    {
+        return 0;
+    }
+
+    memcpy(b->strings + off, s ? s : "", len);
+    b->strings_size += (uint32_t)len;
+
+    return off;
+}
+
+
+regmap_builder *regmap_builder_new(uint32_t map_version)
+{
+    regmap_builder *b;
+
+    b = calloc(1, sizeof(*b));
+    if (b == NULL)
+    {
+        return NULL;
+    }
+
+    b->entries = calloc(REGMAP_MAX_ENTRIES, sizeof(regmap_entry));
+    b->strings = malloc(REGMAP_MAX_STRINGS);
+    if ((b->entries == NULL) || (b->strings == NULL))
+    {
+        free(b->entries);
+        free(b->strings);
+        free(b);
+        return NULL;
+    }
+
+    b->map_version  = map_version;
+    b->strings[0]   = '\0';     /* Offset 0 = empty string */
+    b->strings_size = 1;
+
+    return b;
+}
+
+
+int regmap_builder_dataset(regmap_builder *b, const char *name, int kind, uint8_t data_header)
+{
+    regmap_dataset *ds;
+
+    if (b->dataset_count >= REGMAP_MAX_DATASETS)
+    {
+        return -1;
+    }
+
+    ds              = &b->datasets[b->dataset_count++];
+    ds->name_off    = builder_string(b, name);
+    ds->first_entry = b->entry_count;
+    ds->entry_count = 0;
+    ds->data_header = data_header;
+    ds->kind        = (uint8_t)kind;
+
+    return 0;
+}
+
+
+int regmap_builder_entry(regmap_builder *b, uint32_t reg_address, uint16_t size,
+                         const uint8_t fun_code[3], const char *name)
+{
+    regmap_dataset *ds;
+    regmap_entry   *en;
+    uint32_t        i;
+
+    if ((b->dataset_count == 0) || (b->entry_count >= REGMAP_MAX_ENTRIES))
+    {
+        return -1;
+    }
+
+    ds = &b->datasets[b->dataset_count - 1];
+    en = &b->entries[b->entry_count++];
+
+    en->reg_address = reg_address;
+    en->addr        = (uint16_t)(reg_address % 10000);
+    en->size        = size;
+    en->name_off    = builder_string(b, name);
+    en->dataset     = (uint8_t)(b->dataset_count - 1);
+    memcpy(en->fun_code, fun_code, 3);
+
+    if (ds->kind == REGMAP_KIND_TCP)
+    {
+        /*
+         * EEPROM layout: TCP datasets back to back, entries in table order
+         */
+        en->eeprom_offset  = b->eeprom_offset;
+        b->eeprom_offset  += size;
+    }
+
+    if (ds->entry_count == 0)
+    {
+        ds->first_addr = en->addr;
+    }
+    ds->last_addr = en->addr;
+    ds->entry_count++;
+
+    /*
+     * Every entry of the dataset so far gains this entry's bytes
+     */
+    for (i = ds->first_entry; i < b->entry_count; i++)
+    {
+        b->entries[i].remaining += size;
+    }
+
+    return 0;
+}
+
+
+static int index_cmp(const void *a, const void *b)
+{
+    const regmap_index *x = a;
+    const regmap_index *y = b;
+    uint32_t            kx = ((uint32_t)x->kind << 16) | x->addr;
+    uint32_t            ky = ((uint32_t)y->kind << 16) | y->addr;
+
+    if (kx != ky)
+    {
+        return (kx > ky) - (kx < ky);
+    }
+
+    return (x->entry > y->entry) - (x->entry < y->entry);
+}
+
+
+regmap_t *regmap_builder_finish(regmap_builder *b)
+{
+    regmap_header         hdr;
+    regmap_index         *index;
+    const regmap_dataset *ds;
+    const regmap_entry   *en;
+    regmap_t             *map = NULL;
+    uint8_t              *base;
+    uint32_t              count = 0;
+    uint32_t              kept  = 0;
+    uint32_t              i;
+
+    index = calloc(b->entry_count ? b->entry_count : 1, sizeof(regmap_index));
+    if (index == NULL)
+    {
+        goto out;
+    }
+
+    /*
+     * Index only what the linear scan could reach: the dataset range check
+     * skipped entries outside first..last address (e.g. 310016 % 10000)
+     */
+    for (i = 0; i < b->entry_count; i++)
+    {
+        en = &b->entries[i];
+        ds = &b->datasets[en->dataset];
+
+        if ((en->addr < ds->first_addr) || (en->addr > ds->last_addr))
+        {
+            continue;
+        }
+
+        index[count].addr  = en->addr;
+        index[count].kind  = ds->kind;
+        index[count].entry = i;
+        count++;
+    }
+    qsort(index, count, sizeof(regmap_index), index_cmp);
+
+    /*
+     * Within one dataset only the first entry with an address was considered
+     */
+    for (i = 0; i < count; i++)
+    {
+        if ((kept > 0) &&
+            (index[kept - 1].kind == index[i].kind) &&
+            (index[kept - 1].addr == index[i].addr) &&
+            (b->entries[index[kept - 1].entry].dataset == b->entries[index[i].entry].dataset))
+        {
+            continue;
+        }
+        index[kept++] = index[i];
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic          = REGMAP_MAGIC;
+    hdr.format_version = REGMAP_FORMAT_VERSION;
+    hdr.map_version    = b->map_version;
+    hdr.dataset_count  = b->dataset_count;
+    hdr.entry_count    = b->entry_count;
+    hdr.index_count    = kept;
+    hdr.strings_size   = b->strings_size;
+    hdr.dataset_offset = sizeof(regmap_header);
+    hdr.entry_offset   = hdr.dataset_offset + b->dataset_count * sizeof(regmap_dataset);
+    hdr.index_offset   = hdr.entry_offset + b->entry_count * sizeof(regmap_entry);
+    hdr.strings_offset = hdr.index_offset + kept * sizeof(regmap_index);
+    hdr.total_size     = hdr.strings_offset + b->strings_size;
+
+    base = calloc(1, hdr.total_size);
+    if (base == NULL)
+    {
+        goto out;
+    }
+
+    memcpy(base + hdr.dataset_offset, b->datasets, b->dataset_count * sizeof(regmap_dataset));
+    memcpy(base + hdr.entry_offset, b->entries, b->entry_count * sizeof(regmap_entry));
+    memcpy(base + hdr.index_offset, index, kept * sizeof(regmap_index));
+    memcpy(base + hdr.strings_offset, b->strings, b->strings_size);
+
+    hdr.checksum = fnv1a(base + sizeof(regmap_header), hdr.total_size - sizeof(regmap_header));
+    memcpy(base, &hdr, sizeof(hdr));
+
+    map = calloc(1, sizeof(*map));
+    if (map == NULL)
+    {
+        free(base);
+        goto out;
+    }
+
+    map->base   = base;
+    map->size   = hdr.total_size;
+    map->mapped = 0;
+    regmap_attach(map);
+
+out:
+    free(index);
+    free(b->entries);
+    free(b->strings);
+    free(b);
+
+    return map;
+}
+
+
+int regmap_write_file(const regmap_t *map, const char *path)
+{
+    char    tmp[300];
+    size_t  done = 0;
+    ssize_t n;
+    int     fd;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    while (done < map->size)
+    {
+        n = write(fd, map->base + done, map->size - done);
+        if (n <= 0)
+        {
+            close(fd);
+            unlink(tmp);
+            return -1;
+        }
+        done += (size_t)n;
+    }
+
+    if ((fsync(fd) != 0) || (close(fd) != 0))
+    {
+        unlink(tmp);
+        return -1;
+    }
+
+    /*
+     * rename() so a reader never maps a half-written file
+     */
+    return rename(tmp, path);
+}
+
+
+/***************************************************************
+ *  RCU-style publication
+ ***************************************************************/
+
+static int reader_claim_slot(void)
+{
+    int expected;
+    int i;
+
+    while (1)
+    {
+        for (i = 0; i < REGMAP_MAX_READERS; i++)
+        {
+            expected = 0;
+            if (atomic_compare_exchange_strong(&reader_used[i], &expected, 1))
+            {
+                return i;
+            }
+        }
+
+        /*
+         * More reader threads than slots: wait for one to exit
+         */
+        usleep(REGMAP_GRACE_SLEEP_US);
+    }
+}
+
+
+const regmap_t *regmap_read_lock(void)
+{
+    if (reader_slot < 0)
+    {
+        reader_slot = reader_claim_slot();
+    }
+
+    /*
+     * Announce the epoch before loading the pointer (both seq_cst): a
+     * publisher that swapped the pointer after our load will see us.
+     */
+    atomic_store(&reader_epoch[reader_slot], atomic_load(&map_epoch));
+
+    return atomic_load(&current_map);
+}
+
+
+void regmap_read_unlock(void)
+{
+    if (reader_slot >= 0)
+    {
+        atomic_store_explicit(&reader_epoch[reader_slot], 0, memory_order_release);
+    }
+}
+
+
+void regmap_reader_exit(void)
+{
+    if (reader_slot >= 0)
+    {
+        atomic_store(&reader_epoch[reader_slot], 0);
+        atomic_store(&reader_used[reader_slot], 0);
+        reader_slot = -1;
+    }
+}
+
+
+void regmap_publish(regmap_t *map)
+{
+    regmap_t *old;
+    uint64_t  epoch;
+    uint64_t  seen;
+    int       i;
+
+    pthread_mutex_lock(&publish_lock);
+
+    old   = atomic_exchange(&current_map, map);
+    epoch = atomic_fetch_add(&map_epoch, 1) + 1;
+
+    /*
+     * Grace period: wait until every reader that may hold the old map has
+     * left its read-side section. Readers starting now see the new epoch.
+     */
+    for (i = 0; i < REGMAP_MAX_READERS; i++)
+    {
+        while (1)
+        {
+            seen = atomic_load(&reader_epoch[i]);
+            if ((seen == 0) || (seen >= epoch))
+            {
+                break;
+            }
+            usleep(REGMAP_GRACE_SLEEP_US);
+        }
+    }
+
+    pthread_mutex_unlock(&publish_lock);
+
+    regmap_close(old);
+}
+
+
+/***************************************************************
+ *  Reload thread
+ ***************************************************************/
+
+void regmap_request_reload(void)
+{
+    char c = 'R';
+
+    if (reload_pipe[1] >= 0)
+    {
+        (void)write(reload_pipe[1], &c, 1);
+    }
+}
+
+
+static void regmap_reload(void)
+{
+    regmap_t *map;
+
+    map = regmap_open(watch_path);
+    if (map == NULL)
+    {
+        LOG_ERROR("Register map %s not loaded (%s), keeping current map\n", watch_path, strerror(errno));
+        return;
+    }
+
+    regmap_publish(map);
+
+    LOG_INFO("Register map %s version %u loaded: %u datasets, %u registers\n",
+             watch_path, map->hdr->map_version, map->hdr->dataset_count, map->hdr->entry_count);
+}
+
+
+static void *regmap_watch(void *arg)
+{
+    struct pollfd  fds[2];
+    char           buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    char           dir_copy[256];
+    char           base_copy[256];
+    const char    *base_name;
+    const struct inotify_event *ev;
+    ssize_t        len;
+    ssize_t        pos;
+    int            ino_fd;
+    int            reload;
+
+    (void)arg;
+
+    strncpy(dir_copy, watch_path, sizeof(dir_copy) - 1);
+    dir_copy[sizeof(dir_copy) - 1] = '\0';
+    strncpy(base_copy, watch_path, sizeof(base_copy) - 1);
+    base_copy[sizeof(base_copy) - 1] = '\0';
+    base_name = basename(base_copy);
+
+    /*
+     * Watch the directory: a new map arrives by rename, which replaces the inode
+     */
+    ino_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if ((ino_fd >= 0) && (inotify_add_watch(ino_fd, dirname(dir_copy), IN_CLOSE_WRITE | IN_MOVED_TO) < 0))
+    {
+        LOG_WARN("Register map directory not watched (%s), reload with SIGHUP only\n", strerror(errno));
+        close(ino_fd);
+        ino_fd = -1;
+    }
+
+    fds[0].fd     = reload_pipe[0];
+    fds[0].events = POLLIN;
+    fds[1].fd     = ino_fd;
+    fds[1].events = POLLIN;
+
+    while (1)
+    {
+        if (poll(fds, (ino_fd >= 0) ? 2 : 1, -1) < 0)
+        {
+            continue;
+        }
+
+        reload = 0;
+
+        if (fds[0].revents & POLLIN)
+        {
+            while (read(reload_pipe[0], buf, sizeof(buf)) > 0)
+            {
+            }
+            reload = 1;
+        }
+
+        if ((ino_fd >= 0) && (fds[1].revents & POLLIN))
+        {
+            while ((len = read(ino_fd, buf, sizeof(buf))) > 0)
+            {
+                for (pos = 0; pos < len; pos += sizeof(struct inotify_event) + ev->len)
+                {
+                    ev = (const struct inotify_event *)(buf + pos);
+                    if ((ev->len > 0) && (strcmp(ev->name, base_name) == 0))
+                    {
+                        reload = 1;
+                    }
+                }
+            }
+        }
+
+        if (reload)
+        {
+            regmap_reload();
+        }
+    }
+
+    return NULL;
+}
+
+
+int regmap_watch_start(const char *path)
+{
+    strncpy(watch_path, path, sizeof(watch_path) - 1);
+
+    if (pipe(reload_pipe) != 0)
+    {
+        return -1;
+    }
+
+    fcntl(reload_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(reload_pipe[1], F_SETFL, O_NONBLOCK);
+
+    if (pthread_create(&watch_thread, NULL, regmap_watch, NULL) != 0)
+    {
+        return -1;
+    }
+
+    pthread_detach(watch_thread);
+
+    return 0;
+}
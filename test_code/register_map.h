@@ -0,0 +1,226 @@
+/**
+ *  @file    register_map.h
+ *  @brief   Binary register map, loaded with mmap and hot-swapped at run time
+ *
+ *  The register map (Modbus address -> dataset, size, function codes,
+ *  EEPROM offset) used to exist only as compiled-in tables from
+ *  register_details.h. It can now also come from a versioned binary file
+ *  that is used in place after mmap: fixed-size sorted tables plus a lookup
+ *  index, no parsing at load time beyond validation.
+ *
+ *  File layout (native byte order, all offsets from the start of the file):
+ *  [regmap_header][regmap_dataset x N][regmap_entry x M][regmap_index x I][strings]
+ *
+ *  - Datasets are stored in lookup order, CAN datasets first so that a CAN
+ *    dataset's index is the same as in the compiled-in all_datasets[].
+ *  - Entries are stored dataset by dataset, in table order.
+ *  - The index is sorted by (kind, address, entry) for binary search. It
+ *    only holds entries the former linear scan could reach: inside their
+ *    dataset's first..last address range, and only the first entry of a
+ *    dataset for a given address.
+ *
+ *  Swapping maps (SIGHUP or a new file at REGMAP_PATH) is RCU style:
+ *  the new map pointer is published atomically, requests that already hold
+ *  the old map finish with it, and the old mapping is released only after
+ *  every reader has left its read-side section.
+ *
+ *  Install a new map with rename (regmap_gen does this), never by
+ *  rewriting the file in place: a mapped file must not change under readers.
+ *
+ *  @author  Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#ifndef REGISTER_MAP_H
+#define REGISTER_MAP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+#define REGMAP_PATH             "/etc/modbus_can/regmap.bin"
+#define REGMAP_MAGIC            0x50414D52U   /* "RMAP" */
+#define REGMAP_FORMAT_VERSION   1
+
+#define REGMAP_KIND_CAN         0             /* Served from the ETU over CAN      */
+#define REGMAP_KIND_TCP         1             /* Module configuration in EEPROM    */
+
+#define REGMAP_MAX_READERS      64            /* Threads that may hold a read lock */
+#define REGMAP_MAX_DATASETS     32
+
+
+/*
+ * File header, 64 bytes
+ */
+typedef struct {
+    uint32_t    magic;
+    uint32_t    format_version;
+    uint32_t    map_version;        /* Chosen by whoever generated the map     */
+    uint32_t    total_size;         /* File size in bytes                      */
+    uint32_t    dataset_count;
+    uint32_t    entry_count;
+    uint32_t    strings_size;
+    uint32_t    dataset_offset;
+    uint32_t    entry_offset;
+    uint32_t    index_offset;
+    uint32_t    strings_offset;
+    uint32_t    checksum;           /* FNV-1a of everything after the header   */
+    uint32_t    index_count;        /* Reachable entries, <= entry_count       */
+    uint32_t    reserved[3];
+} regmap_header;
+
+/*
+ * One dataset (e.g. "monitoring_data")
+ */
+typedef struct {
+    uint32_t    name_off;           /* Into the string table                   */
+    uint32_t    first_entry;
+    uint32_t    entry_count;
+    uint16_t    first_addr;         /* Modbus address % 10000 of first entry   */
+    uint16_t    last_addr;
+    uint8_t     data_header;        /* CMD_* category used in the CAN ID       */
+    uint8_t     kind;               /* REGMAP_KIND_*                           */
+    uint8_t     reserved[2];
+} regmap_dataset;
+
+/*
+ * One register (row of register_details.h)
+ */
+typedef struct {
+    uint32_t    reg_address;        /* Full address as in the tables, 300001  */
+    uint32_t    name_off;
+    uint32_t    eeprom_offset;      /* TCP datasets: byte offset in EEPROM     */
+    uint32_t    remaining;          /* Bytes from this entry to dataset end    */
+    uint16_t    addr;               /* reg_address % 10000                     */
+    uint16_t    size;
+    uint8_t     fun_code[3];
+    uint8_t     dataset;
+} regmap_entry;
+
+/*
+ * Lookup index, sorted by (kind, addr, entry)
+ */
+typedef struct {
+    uint16_t    addr;
+    uint8_t     kind;
+    uint8_t     reserved;
+    uint32_t    entry;
+} regmap_index;
+
+
+/*
+ * Loaded map (mmap'd file or built in memory)
+ */
+typedef struct {
+    const uint8_t         *base;
+    size_t                 size;
+    int                    mapped;      /* 1 = munmap, 0 = free */
+    const regmap_header   *hdr;
+    const regmap_dataset  *datasets;
+    const regmap_entry    *entries;
+    const regmap_index    *index;
+    const char            *strings;
+} regmap_t;
+
+/*
+ * Incremental builder, used for the compiled-in tables and by regmap_gen
+ */
+typedef struct regmap_builder regmap_builder;
+
+
+/***************************************************************
+ *  Loading and lookup
+ ***************************************************************/
+
+/**
+ * @brief Map and validate a binary register map file.
+ *
+ * @return Map handle, or NULL (errno set) if missing or invalid
+ */
+regmap_t *regmap_open(const char *path);
+
+/**
+ * @brief Release a map that is no longer published.
+ */
+void regmap_close(regmap_t *map);
+
+/**
+ * @brief Find the register serving (kind, addr, fun_code).
+ *
+ * Same result as the former linear scan: the first entry in dataset order
+ * with this address that supports the function code.
+ *
+ * @param addr_match  Optional, set to the first entry with this address
+ *                    (even if the function code is not supported)
+ *
+ * @return Entry or NULL
+ */
+const regmap_entry *regmap_lookup(const regmap_t *map, int kind, uint16_t addr,
+                                  uint8_t fun_code, const regmap_entry **addr_match);
+
+const regmap_dataset *regmap_dataset_get(const regmap_t *map, uint32_t dataset);
+const char           *regmap_string(const regmap_t *map, uint32_t name_off);
+
+
+/***************************************************************
+ *  Building
+ ***************************************************************/
+
+regmap_builder *regmap_builder_new(uint32_t map_version);
+int             regmap_builder_dataset(regmap_builder *b, const char *name, int kind, uint8_t data_header);
+int             regmap_builder_entry(regmap_builder *b, uint32_t reg_address, uint16_t size,
+                                     const uint8_t fun_code[3], const char *name);
+
+/**
+ * @brief Lay out the image, sort the index and free the builder.
+ *
+ * @return In-memory map (same layout as the file), NULL on failure
+ */
+regmap_t *regmap_builder_finish(regmap_builder *b);
+
+/**
+ * @brief Write a map to @p path via a temporary file and rename().
+ */
+int regmap_write_file(const regmap_t *map, const char *path);
+
+
+/***************************************************************
+ *  RCU-style publication
+ ***************************************************************/
+
+/**
+ * @brief Enter a read-side section and get the current map.
+ *
+ * Must be paired with regmap_read_unlock() on the same thread. Keep the
+ * section short: copy what is needed and unlock.
+ */
+const regmap_t *regmap_read_lock(void);
+void            regmap_read_unlock(void);
+
+/**
+ * @brief Release this thread's reader slot (call before a reader thread exits).
+ */
+void regmap_reader_exit(void);
+
+/**
+ * @brief Publish a new map and release the old one once no reader uses it.
+ *
+ * Blocks the caller (the reload thread) until the grace period is over.
+ */
+void regmap_publish(regmap_t *map);
+
+/**
+ * @brief Start the reload thread: watches @p path with inotify and reloads
+ *        on regmap_request_reload().
+ *
+ * @return 0 on success, -1 on failure
+ */
+int regmap_watch_start(const char *path);
+
+/**
+ * @brief Ask the reload thread to reload the file. Async-signal-safe (SIGHUP).
+ */
+void regmap_request_reload(void);
+
+#endif /* REGISTER_MAP_H */
@@ -0,0 +1,181 @@
+/**
+ *  @file    register_tables.h
+ *  @brief   Compiled-in dataset tables of the Modbus/CAN bridge
+ *
+ *  Groups the register_details.h arrays into datasets with their CAN
+ *  category. Included by the bridge (built-in register map when no binary
+ *  map file is installed) and by regmap_gen (writes the binary map).
+ *  Include register_details.h first; include from one file per program.
+ *
+ *  @author  Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#ifndef REGISTER_TABLES_H
+#define REGISTER_TABLES_H
+
+#include "register_map.h"
+
+
+/**************************************************************
+ * Dataset Category to Index Mapping
+ *
+ * Category                              | Index
+ * --------------------------------------|-------
+ * Commands                              | 0
+ * Event Data Transmit                   | 1
+ * Settings                              | 2
+ * Metering                              | 3
+ * Breaker Status                        | 4
+ * Records (Trip, Events, Maintenance)   | 5
+ * HeartBeat                             | 6
+ **************************************************************/
+
+/**************************************************************
+ * Dataset to Category Mapping
+ *
+ * Dataset Name           | Category
+ * ------------------------|------------------------
+ * Status                 | Breaker Status
+ * Monitoring Data        | Metering
+ * Breaker Data           | Breaker Status
+ * Protection Settings    | Settings
+ * General Settings       | Settings
+ * Module Settings        | Settings
+ * Commands               | Commands
+ * Data Records           | Records
+ * Product Info RS-485    | Breaker Status
+ * Module Data            | Breaker Status
+ * User defined Map       | Breaker Status
+ **************************************************************/
+
+
+#define CMD_COMMANDS                0
+#define CMD_BREAKER_STATUS          2 
+#define CMD_METERING                3
+#define CMD_SETTINGS                1
+#define CMD_Trip_ECORDS             4
+#define CMD_Events_RECORDS          5
+#define CMD_Maintainence_RECORD     6
+#define CMD_HEARTBEAT               7
+
+
+device_data *tcp_data[] = {
+    module_data_TCP,
+    module_settings_TCP,
+};
+
+const int tcp_dataset_counts[] = {
+    sizeof(module_data_TCP) / sizeof(module_data_TCP[0]),
+    sizeof(module_settings_TCP) / sizeof(module_settings_TCP[0])
+};
+
+device_data *all_datasets[] = {
+    status,
+    monitoring_data,
+    breaker_data,
+    protection_settings,
+    general_settings,
+    module_settings,
+    module_data,
+    commands,
+    data_records,
+    Product_Info_RS_485,
+    Product_Info_PC_HMI,
+    User_Defined_Map
+};
+
+const int dataset_counts[] = {
+    sizeof(status) / sizeof(status[0]),
+    sizeof(monitoring_data) / sizeof(monitoring_data[0]),
+    sizeof(breaker_data) / sizeof(breaker_data[0]),
+    sizeof(protection_settings) / sizeof(protection_settings[0]),
+    sizeof(general_settings) / sizeof(general_settings[0]),
+    sizeof(module_settings) / sizeof(module_settings[0]),
+    sizeof(module_data) / sizeof(module_data[0]),
+    sizeof(commands) / sizeof(commands[0]),
+    sizeof(data_records) / sizeof(data_records[0]),
+    sizeof(Product_Info_RS_485) / sizeof(Product_Info_RS_485[0]),
+    sizeof(Product_Info_PC_HMI) / sizeof(Product_Info_PC_HMI[0]),
+    sizeof(User_Defined_Map) / sizeof(User_Defined_Map[0])
+};
+
+
+typedef struct {
+    const char *dataset_name;  // Dataset name like "monitoring_data"
+    int data_header;           // Mapped command category
+} dataheater_mapping;
+
+static dataheater_mapping header[] = {
+    { "status",              CMD_BREAKER_STATUS },
+    { "monitoring_data",     CMD_METERING },
+    { "breaker_data",        CMD_BREAKER_STATUS },
+    { "protection_settings", CMD_SETTINGS },
+    { "general_settings",    CMD_SETTINGS },
+    { "module_settings",     CMD_SETTINGS },
+    { "module_data",         CMD_BREAKER_STATUS },
+    { "commands",            CMD_COMMANDS },
+    { "data_records",        CMD_Trip_ECORDS },
+    { "Product_Info_RS_485", CMD_BREAKER_STATUS },
+    { "Product_Info_PC_HMI", CMD_BREAKER_STATUS },
+    { "User_Defined_Map",    CMD_BREAKER_STATUS }
+};
+
+
+/**
+ * @brief Build a register map from the compiled-in tables.
+ *
+ * CAN datasets first, in all_datasets[] order, then the TCP (EEPROM) datasets.
+ *
+ * @return In-memory map, NULL on failure
+ */
+static regmap_t *regmap_from_tables(uint32_t map_version)
+{
+    static const char *const tcp_names[] = { "module_data_TCP", "module_settings_TCP" };
+    regmap_builder          *b;
+    int                      dataset_index;
+    int                      data_index;
+    device_data             *d;
+
+    b = regmap_builder_new(map_version);
+    if (b == NULL)
+    {
+        return NULL;
+    }
+
+    for (dataset_index = 0; dataset_index < (int)(sizeof(all_datasets) / sizeof(all_datasets[0])); dataset_index++)
+    {
+        regmap_builder_dataset(b, header[dataset_index].dataset_name, REGMAP_KIND_CAN,
+                               (uint8_t)header[dataset_index].data_header);
+
+        for (data_index = 0; data_index < dataset_counts[dataset_index]; data_index++)
+        {
+            d = &all_datasets[dataset_index][data_index];
+            if (regmap_builder_entry(b, d->reg_address, d->size, d->fun_code, d->attribute_name) != 0)
+            {
+                regmap_close(regmap_builder_finish(b));
+                return NULL;
+            }
+        }
+    }
+
+    for (dataset_index = 0; dataset_index < (int)(sizeof(tcp_data) / sizeof(tcp_data[0])); dataset_index++)
+    {
+        regmap_builder_dataset(b, tcp_names[dataset_index], REGMAP_KIND_TCP, 0);
+
+        for (data_index = 0; data_index < tcp_dataset_counts[dataset_index]; data_index++)
+        {
+            d = &tcp_data[dataset_index][data_index];
+            if (regmap_builder_entry(b, d->reg_address, d->size, d->fun_code, d->attribute_name) != 0)
+            {
+                regmap_close(regmap_builder_finish(b));
+                return NULL;
+            }
+        }
+    }
+
+    return regmap_builder_finish(b);
+}
+
+#endif /* REGISTER_TABLES_H */
@@ -0,0 +1,190 @@
+/**
+ *  @file    regmap_gen.c
+ *  @brief   Generate the binary register map from register_details.h
+ *
+ *  Built on the host against the register_details.h of the new firmware,
+ *  so a changed map can be installed on a running bridge without
+ *  recompiling it:
+ *
+ *    gcc -O2 -I<board> regmap_gen.c register_map.c log_async.c -o regmap_gen -lpthread
+ *    ./regmap_gen 7 regmap.bin            (map version 7)
+ *    ./regmap_gen --check regmap.bin      (validate, compare with the tables, time lookups)
+ *
+ *  On the target: copy to /etc/modbus_can/regmap.bin.new, then
+ *  mv regmap.bin.new regmap.bin (inotify picks it up) or kill -HUP the bridge.
+ *
+ *  @author  Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "register_details.h"
+#include "register_tables.h"
+
+
+static const uint8_t check_fun_codes[] = { 0x01, 0x02, 0x03, 0x04, 0x06, 0x10 };
+
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+
+/**
+ * @brief The bridge's former CAN dataset scan, kept as reference.
+ */
+static device_data *linear_lookup(uint16_t start_addr, uint8_t fun_code, int *dataset_out)
+{
+    const int    total_datasets = sizeof(all_datasets) / sizeof(all_datasets[0]);
+    device_data *selected_array;
+    int          dataset_index;
+    int          data_index;
+
+    for (dataset_index = 0; dataset_index < total_datasets; dataset_index++)
+    {
+        selected_array = all_datasets[dataset_index];
+
+        if (!(selected_array[0].reg_address % 10000 <= start_addr) ||
+            !(selected_array[dataset_counts[dataset_index] - 1].reg_address % 10000 >= start_addr))
+            continue;
+
+        for (data_index = 0; data_index < dataset_counts[dataset_index]; data_index++)
+        {
+            if (start_addr != (selected_array[data_index].reg_address % 10000))
+                continue;
+
+            if (selected_array[data_index].fun_code[0] == fun_code ||
+                selected_array[data_index].fun_code[1] == fun_code ||
+                selected_array[data_index].fun_code[2] == fun_code)
+            {
+                *dataset_out = dataset_index;
+                return &selected_array[data_index];
+            }
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+
+static int check_map(const char *path)
+{
+    const regmap_entry *entry;
+    device_data        *ref;
+    regmap_t           *map;
+    uint64_t            start;
+    uint64_t            t_linear;
+    uint64_t            t_map;
+    uint32_t            addr;
+    uint32_t            hits = 0;
+    uint32_t            mismatches = 0;
+    volatile uintptr_t  sink = 0;
+    int                 dataset;
+    size_t              f;
+
+    map = regmap_open(path);
+    if (map == NULL)
+    {
+        fprintf(stderr, "%s: not a valid register map\n", path);
+        return 1;
+    }
+
+    printf("%s: map version %u, %u datasets, %u registers, %u bytes\n", path,
+           map->hdr->map_version, map->hdr->dataset_count, map->hdr->entry_count, map->hdr->total_size);
+
+    /*
+     * Every address and function code must resolve as the linear scan did
+     */
+    for (addr = 0; addr < 10000; addr++)
+    {
+        for (f = 0; f < sizeof(check_fun_codes); f++)
+        {
+            ref   = linear_lookup((uint16_t)addr, check_fun_codes[f], &dataset);
+            entry = regmap_lookup(map, REGMAP_KIND_CAN, (uint16_t)addr, check_fun_codes[f], NULL);
+
+            if ((ref == NULL) != (entry == NULL) ||
+                (ref && ((uint32_t)ref->reg_address != entry->reg_address || dataset != entry->dataset)))
+            {
+                mismatches++;
+            }
+            hits += (entry != NULL);
+        }
+    }
+
+    start = now_ns();
+    for (addr = 0; addr < 10000; addr++)
+    {
+        for (f = 0; f < sizeof(check_fun_codes); f++)
+        {
+            sink += (uintptr_t)linear_lookup((uint16_t)addr, check_fun_codes[f], &dataset);
+        }
+    }
+    t_linear = now_ns() - start;
+
+    start = now_ns();
+    for (addr = 0; addr < 10000; addr++)
+    {
+        for (f = 0; f < sizeof(check_fun_codes); f++)
+        {
+            sink += (uintptr_t)regmap_lookup(map, REGMAP_KIND_CAN, (uint16_t)addr, check_fun_codes[f], NULL);
+        }
+    }
+    t_map = now_ns() - start;
+
+    printf("lookups: %u resolved, %u mismatches against the compiled-in tables\n", hits, mismatches);
+    printf("per lookup: linear scan %.1f ns, map index %.1f ns\n",
+           (double)t_linear / (10000.0 * sizeof(check_fun_codes)),
+           (double)t_map / (10000.0 * sizeof(check_fun_codes)));
+
+    regmap_close(map);
+
+    return mismatches ? 1 : 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+    regmap_t *map;
+
+    if ((argc == 3) && (strcmp(argv[1], "--check") == 0))
+    {
+        return check_map(argv[2]);
+    }
+
+    if (argc != 3)
+    {
+        fprintf(stderr, "usage: %s <map_version> <output>\n       %s --check <map>\n", argv[0], argv[0]);
+        return 2;
+    }
+
+    map = regmap_from_tables((uint32_t)strtoul(argv[1], NULL, 0));
+    if (map == NULL)
+    {
+        fprintf(stderr, "failed to build register map\n");
+        return 1;
+    }
+
+    if (regmap_write_file(map, argv[2]) != 0)
+    {
+        perror(argv[2]);
+        regmap_close(map);
+        return 1;
+    }
+
+    printf("%s: map version %u, %u datasets, %u registers, %u bytes\n", argv[2],
+           map->hdr->map_version, map->hdr->dataset_count, map->hdr->entry_count, map->hdr->total_size);
+
+    regmap_close(map);
+
+    return 0;
+}
@@ -0,0 +1,1659 @@
+/**
+ *  @file    replay_harness.c
+ *  @brief   Deterministic CAN + Modbus replay harness for bridge regression runs
+ *
+ *  Plays both neighbours of the bridge from recordings:
+ *
+ *    ETU side      every frame the bridge sends on the CAN interface (vcan)
+ *                  is answered with the ETU frames that followed the same
+ *                  frame in the recorded candump log. The n-th occurrence of
+ *                  an ID gets the n-th recorded answer, so the replay does
+ *                  not depend on the bridge's timing. Heartbeats and other
+ *                  frames without transfer meaning are ignored.
+ *    Modbus side   the request trace is sent over one loopback TCP
+ *                  connection, each response is compared with the expected
+ *                  one in the trace.
+ *
+ *  Timing:
+ *
+ *    real      (default) requests at their trace times, ETU answers after
+ *              their recorded delays, both divided by -x speed
+ *    virtual   (-V) requests back to back, ETU answers at once: the run
+ *              measures only the bridge
+ *
+ *  Request trace, one request per line ('#' comments):
+ *
+ *    time_s unit fc addr count [w:waddr] [values...] [= expected]
+ *
+ *      values      FC 5/6 one value, FC 15 bits, FC 16 registers,
+ *                  FC 23 registers written at waddr
+ *      expected    registers or bits read, "ok" for writes, "!NN" for an
+ *                  exception; without it the response is not checked
+ *
+ *  -o writes the trace back with the responses seen as expected values:
+ *  run it once against the bench (real ETU, candump -l running) to get the
+ *  two recordings, then replay them against every new build.
+ *
+ *  Metrics are one JSON object (stdout or -j file): request latency
+ *  percentiles, mismatches, CAN replay counters, bridge CPU time and peak
+ *  RSS from /proc. With -B baseline.json the run fails when p99 latency or
+ *  CPU per request got worse than -T percent.
+ *
+ *    gcc -O2 replay_harness.c etu_protocol.c -o replay_harness -lpthread -lm
+ *    ./replay_harness -c bench.log -q requests.txt -i vcan0 -p 1502 [-V] \
+ *                     [-B baseline.json] -- ./am437x_TCP_ETU_COMMUNICATE
+ *
+ *  Without a command after "--" a running bridge is used (-P pid for CPU
+ *  figures); without -c the CAN side is left to a real ETU.
+ *
+ *  CAN only (-c without -q): for bridges that poll the ETU by themselves
+ *  and have no Modbus listener (modbus/FINAL_WORK). No TCP connection; the
+ *  run ends once every recorded bridge frame was seen again, or after -d
+ *  seconds, and fails on recorded frames the bridge never sent. CPU per
+ *  request is then CPU per answered bridge frame.
+ *
+ *    ./replay_harness -c bench.log -i vcan0 -d 30 -- ./am437x_TCP_ETU_COMMUNICATE
+ *
+ *  Exit status: 0 pass, 1 mismatch / timeout / unmatched or missing CAN
+ *  frame, 2 regression against the baseline, 3 setup error.
+ *
+ *  @author  Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "etu_protocol.h"
+
+
+#define RP_MAX_VALUES           256
+#define RP_MAX_PENDING          256         /* ETU frames waiting for their delay  */
+#define RP_DEFAULT_TIMEOUT_MS   2000
+#define RP_DEFAULT_START_S      20          /* Bridge start-up until port answers  */
+#define RP_DEFAULT_DURATION_S   60          /* CAN only: longest run               */
+#define RP_DEFAULT_TOLERANCE    10.0
+
+#define RP_HIST_SUB_BITS        5
+#define RP_HIST_SUB             (1 << RP_HIST_SUB_BITS)
+#define RP_HIST_POWERS          27
+#define RP_HIST_BUCKETS         (RP_HIST_POWERS * RP_HIST_SUB)
+
+#define RP_EXIT_PASS            0
+#define RP_EXIT_FAIL            1
+#define RP_EXIT_REGRESSION      2
+#define RP_EXIT_SETUP           3
+
+#define EXPECT_NONE             0
+#define EXPECT_VALUES           1
+#define EXPECT_OK               2
+#define EXPECT_EXCEPTION        3
+
+
+/***************************************************************
+ *  Traces
+ ***************************************************************/
+
+/*
+ * ETU frame of the recording, sent delay_us after the bridge frame it answers
+ */
+typedef struct {
+    uint32_t    delay_us;
+    uint32_t    can_id;
+    uint8_t     data[ETU_FRAME_LEN];
+} rp_answer;
+
+/*
+ * Bridge frame of the recording and the ETU frames that followed it
+ */
+typedef struct {
+    uint32_t    can_id;
+    uint32_t    seq;                /* Position in the recording          */
+    uint32_t    first;              /* answers[first .. first + count)    */
+    uint32_t    count;
+    uint8_t     data[ETU_FRAME_LEN];
+} rp_group;
+
+/*
+ * All groups of one bridge frame ID, replayed in order
+ */
+typedef struct {
+    uint32_t    can_id;
+    uint32_t    first;              /* Index into sorted groups           */
+    uint32_t    count;
+    uint32_t    next;
+} rp_key;
+
+typedef struct {
+    double      time_s;
+    uint8_t     unit;
+    uint8_t     fc;
+    uint16_t    addr;
+    uint16_t    count;
+    uint16_t    waddr;
+    uint16_t    nvalues;
+    uint16_t    values[RP_MAX_VALUES];
+    uint8_t     expect;
+    uint8_t     exception;
+    uint16_t    nexpected;
+    uint16_t    expected[RP_MAX_VALUES];
+} rp_request;
+
+
+static rp_answer   *answers;
+static uint32_t     answer_count;
+static rp_group    *groups;
+static uint32_t     group_count;
+static rp_key      *keys;
+static uint32_t     key_count;
+
+static rp_request  *requests;
+static uint32_t     request_count;
+
+
+/***************************************************************
+ *  Run state
+ ***************************************************************/
+
+typedef struct {
+    uint64_t    count;
+    uint64_t    sum_us;
+    uint64_t    max_us;
+    uint64_t    buckets[RP_HIST_BUCKETS];
+} rp_hist;
+
+typedef struct {
+    uint64_t    when_us;
+    uint32_t    seq;                /* Keeps recorded order on equal times */
+    uint32_t    can_id;
+    uint8_t     data[ETU_FRAME_LEN];
+} rp_pending;
+
+static int              virtual_timing;
+static int              can_only;           /* No request trace                */
+static double           speed = 1.0;
+static uint32_t         timeout_ms = RP_DEFAULT_TIMEOUT_MS;
+static volatile int     can_stop;
+
+static rp_hist          latency;
+static uint64_t         req_ok;
+static uint64_t         req_mismatch;
+static uint64_t         req_timeout;
+static uint64_t         req_late;           /* Sent after its trace time   */
+
+static uint64_t         can_rx;             /* Bridge frames seen          */
+static uint64_t         can_answered;
+static uint64_t         can_tx;             /* ETU frames sent             */
+static uint64_t         can_unmatched;      /* ID not in the recording, or
+                                               more occurrences than recorded */
+static uint64_t         can_data_mismatch;  /* Same ID, other payload      */
+static uint64_t         can_ignored;        /* Heartbeat and other types   */
+static volatile uint32_t can_replayed;      /* Recorded bridge frames seen */
+static uint64_t         can_missing;        /* CAN only: never seen again  */
+
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000;
+}
+
+
+static void hist_add(rp_hist *h, uint64_t us)
+{
+    int power;
+    int b;
+
+    if (us < RP_HIST_SUB)
+    {
+        b = (int)us;
+    }
+    else
+    {
+        power = 63 - __builtin_clzll(us);
+        if (power - RP_HIST_SUB_BITS + 1 >= RP_HIST_POWERS)
+        {
+            b = RP_HIST_BUCKETS - 1;
+        }
+        else
+        {
+            b = (power - RP_HIST_SUB_BITS + 1) * RP_HIST_SUB +
+                (int)((us >> (power - RP_HIST_SUB_BITS)) - RP_HIST_SUB);
+        }
+    }
+
+    h->buckets[b]++;
+    h->count++;
+    h->sum_us += us;
+    if (us > h->max_us)
+    {
+        h->max_us = us;
+    }
+}
+
+static uint64_t hist_pct(const rp_hist *h, double pct)
+{
+    uint64_t want = (uint64_t)ceil(pct / 100.0 * (double)h->count);
+    uint64_t seen = 0;
+    uint64_t v;
+    int      power;
+    int      b;
+
+    if (h->count == 0)
+    {
+        return 0;
+    }
+    if (want == 0)
+    {
+        want = 1;
+    }
+
+    for (b = 0; b < RP_HIST_BUCKETS; b++)
+    {
+        seen += h->buckets[b];
+        if (seen >= want)
+        {
+            power = b / RP_HIST_SUB;
+            v = power ? ((uint64_t)(RP_HIST_SUB + b % RP_HIST_SUB + 1) << (power - 1)) - 1 : (uint64_t)b;
+            return (v < h->max_us) ? v : h->max_us;
+        }
+    }
+
+    return h->max_us;
+}
+
+
+/***************************************************************
+ *  CAN recording
+ ***************************************************************/
+
+/*
+ * Frames the bridge sends; everything else in a transfer comes from the ETU
+ */
+static int is_bridge_type(uint8_t type)
+{
+    return (type == ETU_MSG_READ_REQ) || (type == ETU_MSG_WRITE_REQ) || (type == ETU_MSG_WRITE_DATA) ||
+           (type == ETU_MSG_WRITE_TERM) || (type == ETU_MSG_DELTA_READ_REQ) || (type == ETU_MSG_READ_ACK);
+}
+
+static int is_etu_type(uint8_t type)
+{
+    return (type == ETU_MSG_READ_RESP) || (type == ETU_MSG_WRITE_GRANT) || (type == ETU_MSG_WRITE_ACK) ||
+           (type == ETU_MSG_WRITE_TERM_ACK);
+}
+
+
+static int hexval(char c)
+{
+    if ((c >= '0') && (c <= '9')) return c - '0';
+    if ((c >= 'a') && (c <= 'f')) return c - 'a' + 10;
+    if ((c >= 'A') && (c <= 'F')) return c - 'A' + 10;
+    return -1;
+}
+
+
+/**
+ * @brief One candump -l line: "(sec.usec) iface ID#HEX".
+ *
+ * @return 0 for an extended 8-byte data frame, -1 otherwise
+ */
+static int parse_log_line(const char *line, uint64_t *ts, uint32_t *can_id, uint8_t data[ETU_FRAME_LEN])
+{
+    char        ifname[IFNAMSIZ + 1];
+    char        frame[64];
+    const char *p;
+    char       *hash;
+    double      sec;
+    int         n = 0;
+    int         hi;
+    int         lo;
+
+    if (sscanf(line, " (%lf) %16s %63s", &sec, ifname, frame) != 3)
+    {
+        return -1;
+    }
+
+    hash = strchr(frame, '#');
+    if ((hash == NULL) || (hash - frame != 8))
+    {
+        return -1;              /* Standard ID, no data */
+    }
+
+    *hash = '\0';
+    for (p = hash + 1; (n < ETU_FRAME_LEN) && ((hi = hexval(p[0])) >= 0) && ((lo = hexval(p[1])) >= 0); p += 2)
+    {
+        data[n++] = (uint8_t)((hi << 4) | lo);
+    }
+    if ((n != ETU_FRAME_LEN) || (*p != '\0'))
+    {
+        return -1;
+    }
+
+    *ts     = (uint64_t)(sec * 1e6 + 0.5);
+    *can_id = (uint32_t)strtoul(frame, NULL, 16) & CAN_EFF_MASK;
+
+    return 0;
+}
+
+
+static int cmp_group(const void *a, const void *b)
+{
+    const rp_group *x = a;
+    const rp_group *y = b;
+
+    if (x->can_id != y->can_id)
+    {
+        return (x->can_id > y->can_id) ? 1 : -1;
+    }
+    return (x->seq > y->seq) - (x->seq < y->seq);
+}
+
+
+static void *grow(void *array, uint32_t count, size_t size)
+{
+    void *p;
+
+    if (count & (count - 1))
+    {
+        return array;           /* Room left until the next power of two */
+    }
+
+    p = realloc(array, (count ? count * 2 : 64) * size);
+    if (p == NULL)
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(RP_EXIT_SETUP);
+    }
+
+    return p;
+}
+
+
+static int load_can_trace(const char *path)
+{
+    FILE     *f = fopen(path, "r");
+    char      line[256];
+    uint64_t  ts;
+    uint64_t  trigger_ts = 0;
+    uint32_t  can_id;
+    uint8_t   data[ETU_FRAME_LEN];
+    uint8_t   type;
+    uint32_t  g;
+    uint32_t  k;
+
+    if (f == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        if (parse_log_line(line, &ts, &can_id, data) != 0)
+        {
+            continue;
+        }
+
+        type = etu_id_type(can_id);
+        if (is_bridge_type(type))
+        {
+            groups = grow(groups, group_count, sizeof(rp_group));
+            memset(&groups[group_count], 0, sizeof(rp_group));
+            groups[group_count].can_id = can_id;
+            groups[group_count].seq    = group_count;
+            groups[group_count].first  = answer_count;
+            memcpy(groups[group_count].data, data, ETU_FRAME_LEN);
+            group_count++;
+            trigger_ts = ts;
+        }
+        else if (is_etu_type(type) && (group_count > 0))
+        {
+            answers = grow(answers, answer_count, sizeof(rp_answer));
+            answers[answer_count].delay_us = (uint32_t)(ts - trigger_ts);
+            answers[answer_count].can_id   = can_id;
+            memcpy(answers[answer_count].data, data, ETU_FRAME_LEN);
+            answer_count++;
+            groups[group_count - 1].count++;
+        }
+    }
+
+    fclose(f);
+
+    if (group_count == 0)
+    {
+        fprintf(stderr, "%s: no ETU transfer frames (candump -l format expected)\n", path);
+        return -1;
+    }
+
+    /*
+     * Index by bridge frame ID, recording order kept within an ID
+     */
+    qsort(groups, group_count, sizeof(rp_group), cmp_group);
+
+    for (g = 0; g < group_count; g++)
+    {
+        if ((key_count == 0) || (keys[key_count - 1].can_id != groups[g].can_id))
+        {
+            keys = grow(keys, key_count, sizeof(rp_key));
+            keys[key_count].can_id = groups[g].can_id;
+            keys[key_count].first  = g;
+            keys[key_count].count  = 0;
+            keys[key_count].next   = 0;
+            key_count++;
+        }
+        k = key_count - 1;
+        keys[k].count++;
+    }
+
+    fprintf(stderr, "CAN trace: %u bridge frames (%u IDs), %u ETU frames\n", group_count, key_count, answer_count);
+
+    return 0;
+}
+
+
+static rp_key *key_find(uint32_t can_id)
+{
+    uint32_t lo = 0;
+    uint32_t hi = key_count;
+    uint32_t mid;
+
+    while (lo < hi)
+    {
+        mid = (lo + hi) / 2;
+        if (keys[mid].can_id == can_id)
+        {
+            return &keys[mid];
+        }
+        if (keys[mid].can_id < can_id)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return NULL;
+}
+
+
+/***************************************************************
+ *  ETU side
+ ***************************************************************/
+
+typedef struct {
+    int          sock;
+    rp_pending   pending[RP_MAX_PENDING];
+    int          npending;
+    uint32_t     seq;
+} rp_can;
+
+
+static void can_send(int sock, uint32_t can_id, const uint8_t data[ETU_FRAME_LEN])
+{
+    struct can_frame frame;
+
+    memset(&frame, 0, sizeof(frame));
+    frame.can_id  = can_id | CAN_EFF_FLAG;
+    frame.can_dlc = ETU_FRAME_LEN;
+    memcpy(frame.data, data, ETU_FRAME_LEN);
+
+    while (write(sock, &frame, sizeof(frame)) != sizeof(frame))
+    {
+        if ((errno != ENOBUFS) && (errno != EAGAIN) && (errno != EINTR))
+        {
+            perror("CAN write");
+            return;
+        }
+        usleep(100);
+    }
+
+    can_tx++;
+}
+
+
+/**
+ * @brief Answer one frame of the bridge from the recording.
+ */
+static void on_bridge_frame(rp_can *c, uint32_t can_id, const uint8_t *data, uint8_t dlc, uint64_t now)
+{
+    rp_key    *key;
+    rp_group  *g;
+    rp_answer *a;
+    uint32_t   i;
+
+    if (!is_bridge_type(etu_id_type(can_id)))
+    {
+        can_ignored++;
+        return;
+    }
+    can_rx++;
+
+    key = key_find(can_id);
+    if (key == NULL)
+    {
+        can_unmatched++;
+        fprintf(stderr, "CAN 0x%08X (%s) not in the recording\n", can_id, etu_msg_name(etu_id_type(can_id)));
+        return;
+    }
+
+    /*
+     * More occurrences than recorded: keep the bridge going with the last one
+     */
+    if (key->next >= key->count)
+    {
+        can_unmatched++;
+        g = &groups[key->first + key->count - 1];
+    }
+    else
+    {
+        g = &groups[key->first + key->next++];
+        can_replayed++;
+    }
+
+    if ((dlc != ETU_FRAME_LEN) || (memcmp(g->data, data, ETU_FRAME_LEN) != 0))
+    {
+        can_data_mismatch++;
+    }
+
+    can_answered++;
+    for (i = 0; i < g->count; i++)
+    {
+        a = &answers[g->first + i];
+        if (virtual_timing)
+        {
+            can_send(c->sock, a->can_id, a->data);
+        }
+        else if (c->npending < RP_MAX_PENDING)
+        {
+            c->pending[c->npending].when_us = now + (uint64_t)(a->delay_us / speed);
+            c->pending[c->npending].seq     = c->seq++;
+            c->pending[c->npending].can_id  = a->can_id;
+            memcpy(c->pending[c->npending].data, a->data, ETU_FRAME_LEN);
+            c->npending++;
+        }
+    }
+}
+
+
+/**
+ * @brief Send the delayed answers that are due (in due order).
+ *
+ * @return Microseconds until the next one, -1 if none
+ */
+static int64_t flush_pending(rp_can *c, uint64_t now)
+{
+    int     best;
+    int     i;
+
+    for (;;)
+    {
+        best = -1;
+        for (i = 0; i < c->npending; i++)
+        {
+            if ((best < 0) || (c->pending[i].when_us < c->pending[best].when_us) ||
+                ((c->pending[i].when_us == c->pending[best].when_us) && (c->pending[i].seq < c->pending[best].seq)))
+            {
+                best = i;
+            }
+        }
+        if (best < 0)
+        {
+            return -1;
+        }
+        if (c->pending[best].when_us > now)
+        {
+            return (int64_t)(c->pending[best].when_us - now);
+        }
+
+        can_send(c->sock, c->pending[best].can_id, c->pending[best].data);
+        c->pending[best] = c->pending[--c->npending];
+    }
+}
+
+
+static void *can_thread(void *arg)
+{
+    rp_can           *c = arg;
+    struct can_frame  frame;
+    struct pollfd     pfd;
+    int64_t           wait;
+    int               timeout;
+
+    pfd.fd     = c->sock;
+    pfd.events = POLLIN;
+
+    while (!can_stop)
+    {
+        wait    = flush_pending(c, now_us());
+        timeout = (wait < 0) ? 100 : (int)((wait + 999) / 1000);
+
+        if (poll(&pfd, 1, (timeout > 100) ? 100 : timeout) <= 0)
+        {
+            continue;
+        }
+
+        if (read(c->sock, &frame, sizeof(frame)) != sizeof(frame))
+        {
+            continue;
+        }
+        if (!(frame.can_id & CAN_EFF_FLAG) || (frame.can_id & (CAN_RTR_FLAG | CAN_ERR_FLAG)))
+        {
+            can_ignored++;
+            continue;
+        }
+
+        on_bridge_frame(c, frame.can_id & CAN_EFF_MASK, frame.data, frame.can_dlc, now_us());
+    }
+
+    return NULL;
+}
+
+
+static int can_open(const char *interface)
+{
+    struct sockaddr_can addr;
+    struct ifreq        ifr;
+    int                 sock;
+
+    sock = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+    if (sock < 0)
+    {
+        perror("CAN socket");
+        return -1;
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, interface, IFNAMSIZ - 1);
+    if (ioctl(sock, SIOCGIFINDEX, &ifr) < 0)
+    {
+        fprintf(stderr, "CAN interface %s: %s (ip link add dev %s type vcan; ip link set %s up)\n",
+                interface, strerror(errno), interface, interface);
+        close(sock);
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.can_family  = AF_CAN;
+    addr.can_ifindex = ifr.ifr_ifindex;
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("CAN bind");
+        close(sock);
+        return -1;
+    }
+
+    return sock;
+}
+
+
+/***************************************************************
+ *  Request trace
+ ***************************************************************/
+
+static int parse_request(char *line, rp_request *r)
+{
+    char *tok;
+    char *save = NULL;
+    int   field = 0;
+    int   in_expected = 0;
+    unsigned long v;
+
+    memset(r, 0, sizeof(*r));
+
+    for (tok = strtok_r(line, " \t\r\n", &save); tok != NULL; tok = strtok_r(NULL, " \t\r\n", &save))
+    {
+        if (tok[0] == '#')
+        {
+            break;
+        }
+
+        switch (field)
+        {
+            case 0: r->time_s = strtod(tok, NULL); field++; continue;
+            case 1: r->unit   = (uint8_t)strtoul(tok, NULL, 0); field++; continue;
+            case 2: r->fc     = (uint8_t)strtoul(tok, NULL, 0); field++; continue;
+            case 3: r->addr   = (uint16_t)strtoul(tok, NULL, 0); field++; continue;
+            case 4: r->count  = (uint16_t)strtoul(tok, NULL, 0); field++; continue;
+            default: break;
+        }
+
+        if (strcmp(tok, "=") == 0)
+        {
+            in_expected = 1;
+            r->expect   = EXPECT_VALUES;
+        }
+        else if (in_expected && (strcmp(tok, "ok") == 0))
+        {
+            r->expect = EXPECT_OK;
+        }
+        else if (in_expected && (tok[0] == '!'))
+        {
+            r->expect    = EXPECT_EXCEPTION;
+            r->exception = (uint8_t)strtoul(tok + 1, NULL, 0);
+        }
+        else if (!in_expected && (strncmp(tok, "w:", 2) == 0))
+        {
+            r->waddr = (uint16_t)strtoul(tok + 2, NULL, 0);
+        }
+        else
+        {
+            v = strtoul(tok, NULL, 0);
+            if (in_expected && (r->nexpected < RP_MAX_VALUES))
+            {
+                r->expected[r->nexpected++] = (uint16_t)v;
+            }
+            else if (!in_expected && (r->nvalues < RP_MAX_VALUES))
+            {
+                r->values[r->nvalues++] = (uint16_t)v;
+            }
+        }
+    }
+
+    if (field == 0)
+    {
+        return 1;               /* Blank or comment */
+    }
+    if (field < 5)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int load_requests(const char *path)
+{
+    FILE       *f = fopen(path, "r");
+    char        line[4096];
+    rp_request  r;
+    int         lineno = 0;
+    int         ret;
+
+    if (f == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        lineno++;
+        ret = parse_request(line, &r);
+        if (ret > 0)
+        {
+            continue;
+        }
+        if (ret < 0)
+        {
+            fprintf(stderr, "%s:%d: expected \"time unit fc addr count ...\"\n", path, lineno);
+            fclose(f);
+            return -1;
+        }
+
+        requests = grow(requests, request_count, sizeof(rp_request));
+        requests[request_count++] = r;
+    }
+
+    fclose(f);
+
+    if (request_count == 0)
+    {
+        fprintf(stderr, "%s: no requests\n", path);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/***************************************************************
+ *  Modbus side
+ ***************************************************************/
+
+static int put16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
+    return 2;
+}
+
+
+static int pack_bits(uint8_t *p, const uint16_t *bits, uint16_t n)
+{
+    int bytes = (n + 7) / 8;
+    int i;
+
+    memset(p, 0, (size_t)bytes);
+    for (i = 0; i < n; i++)
+    {
+        if (bits[i])
+        {
+            p[i / 8] |= (uint8_t)(1 << (i % 8));
+        }
+    }
+
+    return bytes;
+}
+
+
+/**
+ * @brief Modbus TCP ADU for @p r.
+ *
+ * @return ADU length, -1 for an unsupported function code
+ */
+static int encode_request(const rp_request *r, uint16_t tid, uint8_t *adu)
+{
+    uint8_t *pdu = adu + 7;
+    int      n   = 0;
+    int      i;
+
+    pdu[n++] = r->fc;
+
+    switch (r->fc)
+    {
+        case 1: case 2: case 3: case 4:
+            n += put16(pdu + n, r->addr);
+            n += put16(pdu + n, r->count);
+            break;
+
+        case 5:
+            n += put16(pdu + n, r->addr);
+            n += put16(pdu + n, (r->nvalues && r->values[0]) ? 0xFF00 : 0x0000);
+            break;
+
+        case 6:
+            n += put16(pdu + n, r->addr);
+            n += put16(pdu + n, r->nvalues ? r->values[0] : 0);
+            break;
+
+        case 15:
+            n += put16(pdu + n, r->addr);
+            n += put16(pdu + n, r->nvalues);
+            pdu[n] = (uint8_t)((r->nvalues + 7) / 8);
+            n++;
+            n += pack_bits(pdu + n, r->values, r->nvalues);
+            break;
+
+        case 16:
+            n += put16(pdu + n, r->addr);
+            n += put16(pdu + n, r->nvalues);
+            pdu[n++] = (uint8_t)(r->nvalues * 2);
+            for (i = 0; i < r->nvalues; i++)
+            {
+                n += put16(pdu + n, r->values[i]);
+            }
+            break;
+
+        case 23:
+            n += put16(pdu + n, r->addr);
+            n += put16(pdu + n, r->count);
+            n += put16(pdu + n, r->waddr);
+            n += put16(pdu + n, r->nvalues);
+            pdu[n++] = (uint8_t)(r->nvalues * 2);
+            for (i = 0; i < r->nvalues; i++)
+            {
+                n += put16(pdu + n, r->values[i]);
+            }
+            break;
+
+        default:
+            return -1;
+    }
+
+    put16(adu, tid);
+    put16(adu + 2, 0);
+    put16(adu + 4, (uint16_t)(n + 1));
+    adu[6] = r->unit;
+
+    return n + 7;
+}
+
+
+/**
+ * @brief Values carried by a response PDU.
+ *
+ * @return Number of values, 0 for write echoes, -1 for an exception
+ *         (code in *exception), -2 for a malformed response
+ */
+static int decode_response(const rp_request *r, const uint8_t *pdu, int len, uint16_t *out, uint8_t *exception)
+{
+    int i;
+
+    if ((len >= 2) && (pdu[0] == (uint8_t)(r->fc | 0x80)))
+    {
+        *exception = pdu[1];
+        return -1;
+    }
+    if ((len < 1) || (pdu[0] != r->fc))
+    {
+        return -2;
+    }
+
+    switch (r->fc)
+    {
+        case 1: case 2:
+            if ((len < 2) || (pdu[1] != (r->count + 7) / 8) || (len < 2 + pdu[1]))
+            {
+                return -2;
+            }
+            for (i = 0; (i < r->count) && (i < RP_MAX_VALUES); i++)
+            {
+                out[i] = (pdu[2 + i / 8] >> (i % 8)) & 1;
+            }
+            return i;
+
+        case 3: case 4: case 23:
+            if ((len < 2) || (pdu[1] != r->count * 2) || (len < 2 + pdu[1]))
+            {
+                return -2;
+            }
+            for (i = 0; (i < r->count) && (i < RP_MAX_VALUES); i++)
+            {
+                out[i] = (uint16_t)((pdu[2 + 2 * i] << 8) | pdu[3 + 2 * i]);
+            }
+            return i;
+
+        default:
+            return (len >= 5) ? 0 : -2;
+    }
+}
+
+
+static int read_full(int sock, uint8_t *buf, int len)
+{
+    int got = 0;
+    int n;
+
+    while (got < len)
+    {
+        n = (int)recv(sock, buf + got, (size_t)(len - got), 0);
+        if (n == 0)
+        {
+            errno = ECONNRESET;
+        }
+        if (n <= 0)
+        {
+            return -1;
+        }
+        got += n;
+    }
+
+    return 0;
+}
+
+
+static int tcp_connect(const char *host, uint16_t port, uint32_t wait_s, pid_t child)
+{
+    struct sockaddr_in sa;
+    struct timeval     tv;
+    uint64_t           deadline = now_us() + (uint64_t)wait_s * 1000000ULL;
+    int                sock;
+    int                one = 1;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port   = htons(port);
+    if (inet_pton(AF_INET, host, &sa.sin_addr) != 1)
+    {
+        fprintf(stderr, "bad address %s\n", host);
+        return -1;
+    }
+
+    for (;;)
+    {
+        sock = socket(AF_INET, SOCK_STREAM, 0);
+        if (sock < 0)
+        {
+            perror("socket");
+            return -1;
+        }
+        if (connect(sock, (struct sockaddr *)&sa, sizeof(sa)) == 0)
+        {
+            break;
+        }
+        close(sock);
+
+        if ((child > 0) && (waitpid(child, NULL, WNOHANG) == child))
+        {
+            fprintf(stderr, "bridge exited during start-up\n");
+            return -1;
+        }
+        if (now_us() > deadline)
+        {
+            fprintf(stderr, "no Modbus listener on %s:%u after %u s\n", host, port, wait_s);
+            return -1;
+        }
+        usleep(50000);
+    }
+
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    tv.tv_sec  = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    return sock;
+}
+
+
+static void write_result(FILE *out, rp_request *r, int n, const uint16_t *values, uint8_t exception)
+{
+    int i;
+
+    fprintf(out, "%.6f %u %u %u %u", r->time_s, r->unit, r->fc, r->addr, r->count);
+    if (r->fc == 23)
+    {
+        fprintf(out, " w:%u", r->waddr);
+    }
+    for (i = 0; i < r->nvalues; i++)
+    {
+        fprintf(out, " %u", r->values[i]);
+    }
+
+    if (n == -1)
+    {
+        fprintf(out, " = !%u\n", exception);
+    }
+    else if (n == 0)
+    {
+        fprintf(out, " = ok\n");
+    }
+    else if (n > 0)
+    {
+        fprintf(out, " =");
+        for (i = 0; i < n; i++)
+        {
+            fprintf(out, " %u", values[i]);
+        }
+        fprintf(out, "\n");
+    }
+    else
+    {
+        fprintf(out, "\n");     /* Timeout or malformed: left unchecked */
+    }
+}
+
+
+static int check_result(const rp_request *r, int n, const uint16_t *values, uint8_t exception)
+{
+    switch (r->expect)
+    {
+        case EXPECT_NONE:
+            return n >= -1;
+        case EXPECT_OK:
+            return n == 0;
+        case EXPECT_EXCEPTION:
+            return (n == -1) && (exception == r->exception);
+        default:
+            return (n == r->nexpected) && (memcmp(values, r->expected, sizeof(uint16_t) * (size_t)n) == 0);
+    }
+}
+
+
+/**
+ * @brief Replay the request trace on @p sock.
+ *
+ * @return 0, or -1 if the connection broke
+ */
+static int run_requests(int *sock, const char *host, uint16_t port, FILE *golden)
+{
+    uint8_t   adu[300];
+    uint8_t   rsp[300];
+    uint16_t  values[RP_MAX_VALUES];
+    uint8_t   exception = 0;
+    uint64_t  start = now_us();
+    uint64_t  due;
+    uint64_t  sent;
+    uint64_t  now;
+    uint16_t  tid = 0;
+    uint16_t  len;
+    uint32_t  i;
+    int       n;
+
+    for (i = 0; i < request_count; i++)
+    {
+        rp_request *r = &requests[i];
+
+        n = encode_request(r, ++tid, adu);
+        if (n < 0)
+        {
+            fprintf(stderr, "request %u: function code %u not supported\n", i + 1, r->fc);
+            req_mismatch++;
+            continue;
+        }
+
+        if (!virtual_timing)
+        {
+            due = start + (uint64_t)((r->time_s - requests[0].time_s) * 1e6 / speed);
+            now = now_us();
+            if (now < due)
+            {
+                usleep((useconds_t)(due - now));
+            }
+            else if (now > due + 1000)
+            {
+                req_late++;
+            }
+        }
+
+        sent = now_us();
+        if (send(*sock, adu, (size_t)n, MSG_NOSIGNAL) != n)
+        {
+            perror("Modbus send");
+            return -1;
+        }
+
+        /*
+         * Answers of earlier, timed out requests are skipped by transaction ID
+         */
+        for (;;)
+        {
+            if (read_full(*sock, rsp, 7) != 0)
+            {
+                n = -3;
+                break;
+            }
+            len = (uint16_t)((rsp[4] << 8) | rsp[5]);
+            if ((len < 2) || (len > sizeof(rsp) - 6) || (read_full(*sock, rsp + 7, len - 1) != 0))
+            {
+                n = -3;
+                break;
+            }
+            if (((rsp[0] << 8) | rsp[1]) == tid)
+            {
+                n = decode_response(r, rsp + 7, len - 1, values, &exception);
+                break;
+            }
+        }
+
+        if (n == -3)
+        {
+            req_timeout++;
+            fprintf(stderr, "request %u (fc %u addr %u): no response\n", i + 1, r->fc, r->addr);
+            if (errno != EAGAIN)
+            {
+                /*
+                 * Connection closed by the bridge: reconnect and go on
+                 */
+                close(*sock);
+                *sock = tcp_connect(host, port, 2, 0);
+                if (*sock < 0)
+                {
+                    return -1;
+                }
+            }
+        }
+        else
+        {
+            hist_add(&latency, now_us() - sent);
+
+            if (check_result(r, n, values, exception))
+            {
+                req_ok++;
+            }
+            else
+            {
+                req_mismatch++;
+                fprintf(stderr, "request %u (fc %u addr %u): response differs from the trace\n", i + 1, r->fc, r->addr);
+            }
+        }
+
+        if (golden != NULL)
+        {
+            write_result(golden, r, n, values, exception);
+        }
+    }
+
+    return 0;
+}
+
+
+/***************************************************************
+ *  Bridge process
+ ***************************************************************/
+
+typedef struct {
+    double      user_s;
+    double      sys_s;
+    uint64_t    hwm_kb;
+} rp_cpu;
+
+
+static int read_cpu(pid_t pid, rp_cpu *out)
+{
+    char   path[64];
+    char   buf[1024];
+    char  *p;
+    FILE  *f;
+    unsigned long utime;
+    unsigned long stime;
+    long   hz = sysconf(_SC_CLK_TCK);
+
+    memset(out, 0, sizeof(*out));
+    if (pid <= 0)
+    {
+        return -1;
+    }
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    f = fopen(path, "r");
+    if (f == NULL)
+    {
+        return -1;
+    }
+    p = fgets(buf, sizeof(buf), f);
+    fclose(f);
+
+    /*
+     * Fields after the command name, which may contain spaces
+     */
+    if ((p == NULL) || ((p = strrchr(buf, ')')) == NULL) ||
+        (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2))
+    {
+        return -1;
+    }
+    out->user_s = (double)utime / (double)hz;
+    out->sys_s  = (double)stime / (double)hz;
+
+    snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+    f = fopen(path, "r");
+    if (f != NULL)
+    {
+        while (fgets(buf, sizeof(buf), f) != NULL)
+        {
+            if (sscanf(buf, "VmHWM: %lu", &utime) == 1)
+            {
+                out->hwm_kb = utime;
+            }
+        }
+        fclose(f);
+    }
+
+    return 0;
+}
+
+
+static pid_t start_bridge(char **argv)
+{
+    pid_t pid = fork();
+
+    if (pid == 0)
+    {
+        execvp(argv[0], argv);
+        perror(argv[0]);
+        _exit(127);
+    }
+    if (pid < 0)
+    {
+        perror("fork");
+    }
+
+    return pid;
+}
+
+
+static void stop_bridge(pid_t pid)
+{
+    int i;
+
+    kill(pid, SIGTERM);
+    for (i = 0; i < 50; i++)
+    {
+        if (waitpid(pid, NULL, WNOHANG) == pid)
+        {
+            return;
+        }
+        usleep(20000);
+    }
+
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+}
+
+
+/**
+ * @brief CAN only run: wait until the bridge sent every recorded frame again.
+ *
+ * @return 0, or -1 if the bridge exited
+ */
+static int run_can_only(pid_t child, uint32_t duration_s)
+{
+    uint64_t deadline = now_us() + (uint64_t)duration_s * 1000000ULL;
+
+    while ((can_replayed < group_count) && (now_us() < deadline))
+    {
+        if ((child > 0) && (waitpid(child, NULL, WNOHANG) == child))
+        {
+            fprintf(stderr, "bridge exited\n");
+            return -1;
+        }
+        usleep(50000);
+    }
+
+    /*
+     * Answers still on their recorded delay
+     */
+    usleep(virtual_timing ? 50000 : (useconds_t)(200000 / speed));
+
+    can_missing = group_count - can_replayed;
+    if (can_missing > 0)
+    {
+        fprintf(stderr, "%llu of %u recorded bridge frames not sent within %u s\n",
+                (unsigned long long)can_missing, group_count, duration_s);
+    }
+
+    return 0;
+}
+
+
+/***************************************************************
+ *  Metrics
+ ***************************************************************/
+
+static void write_metrics(FILE *out, const char *label, double wall_s, const rp_cpu *cpu, int have_cpu)
+{
+    double   cpu_s   = cpu->user_s + cpu->sys_s;
+    uint64_t units   = can_only ? can_answered : latency.count;
+    double   per_req = units ? cpu_s * 1e6 / (double)units : 0.0;
+
+    fprintf(out, "{\"label\":\"%s\",\"timing\":\"%s\",\"speed\":%.3f,\"wall_s\":%.3f,\n",
+            label, virtual_timing ? "virtual" : "real", speed, wall_s);
+    fprintf(out, " \"requests\":%u,\"ok\":%llu,\"mismatch\":%llu,\"timeout\":%llu,\"late\":%llu,"
+            "\"req_per_s\":%.1f,\n", request_count, (unsigned long long)req_ok, (unsigned long long)req_mismatch,
+            (unsigned long long)req_timeout, (unsigned long long)req_late,
+            (wall_s > 0) ? (double)latency.count / wall_s : 0.0);
+    fprintf(out, " \"lat_mean_us\":%.1f,\"lat_p50_us\":%llu,\"lat_p90_us\":%llu,\"lat_p99_us\":%llu,"
+            "\"lat_p999_us\":%llu,\"lat_max_us\":%llu,\n",
+            latency.count ? (double)latency.sum_us / (double)latency.count : 0.0,
+            (unsigned long long)hist_pct(&latency, 50), (unsigned long long)hist_pct(&latency, 90),
+            (unsigned long long)hist_pct(&latency, 99), (unsigned long long)hist_pct(&latency, 99.9),
+            (unsigned long long)latency.max_us);
+    fprintf(out, " \"can_rx\":%llu,\"can_answered\":%llu,\"can_tx\":%llu,\"can_unmatched\":%llu,"
+            "\"can_data_mismatch\":%llu,\"can_ignored\":%llu,\"can_missing\":%llu",
+            (unsigned long long)can_rx, (unsigned long long)can_answered, (unsigned long long)can_tx,
+            (unsigned long long)can_unmatched, (unsigned long long)can_data_mismatch,
+            (unsigned long long)can_ignored, (unsigned long long)can_missing);
+    if (have_cpu)
+    {
+        fprintf(out, ",\n \"cpu_user_s\":%.3f,\"cpu_sys_s\":%.3f,\"cpu_pct\":%.1f,\"cpu_per_req_us\":%.1f,"
+                "\"rss_peak_kb\":%llu", cpu->user_s, cpu->sys_s, (wall_s > 0) ? 100.0 * cpu_s / wall_s : 0.0,
+                per_req, (unsigned long long)cpu->hwm_kb);
+    }
+    fprintf(out, "}\n");
+}
+
+
+/**
+ * @brief Number stored under "key" in a metrics file, -1 if absent.
+ */
+static double json_number(const char *text, const char *key)
+{
+    char        pattern[64];
+    const char *p;
+
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    p = strstr(text, pattern);
+
+    return (p != NULL) ? strtod(p + strlen(pattern), NULL) : -1.0;
+}
+
+
+/**
+ * @return 1 if p99 latency or CPU per request grew by more than @p tolerance percent
+ */
+static int compare_baseline(const char *path, double tolerance, const rp_cpu *cpu, int have_cpu)
+{
+    static const char *const names[2] = { "lat_p99_us", "cpu_per_req_us" };
+    char    text[4096];
+    FILE   *f = fopen(path, "r");
+    size_t  n;
+    double  base;
+    double  cur[2];
+    uint64_t units  = can_only ? can_answered : latency.count;
+    int     regress = 0;
+    int     i;
+
+    if (f == NULL)
+    {
+        perror(path);
+        return 0;
+    }
+    n = fread(text, 1, sizeof(text) - 1, f);
+    text[n] = '\0';
+    fclose(f);
+
+    cur[0] = (double)hist_pct(&latency, 99);
+    cur[1] = (have_cpu && units) ? (cpu->user_s + cpu->sys_s) * 1e6 / (double)units : -1.0;
+
+    for (i = 0; i < 2; i++)
+    {
+        base = json_number(text, names[i]);
+        if ((base <= 0) || (cur[i] < 0))
+        {
+            continue;
+        }
+        fprintf(stderr, "%-15s baseline %10.1f  now %10.1f  (%+.1f %%)\n", names[i], base, cur[i],
+                100.0 * (cur[i] - base) / base);
+        if (cur[i] > base * (1.0 + tolerance / 100.0))
+        {
+            regress = 1;
+        }
+    }
+
+    return regress;
+}
+
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s -q requests.txt [-c candump.log] [-i vcan0] [-H 127.0.0.1] [-p 502]\n"
+            "          [-V | -x speed] [-t timeout_ms] [-w start_s] [-o golden.txt] [-j metrics.json]\n"
+            "          [-l label] [-B baseline.json] [-T tolerance_pct] [-P pid] [-- bridge command...]\n"
+            "       %s -c candump.log [-d duration_s] ...     (CAN only, no Modbus listener)\n",
+            prog, prog);
+}
+
+
+int main(int argc, char *argv[])
+{
+    const char *can_trace   = NULL;
+    const char *req_trace   = NULL;
+    const char *interface   = "vcan0";
+    const char *host        = "127.0.0.1";
+    const char *golden_path = NULL;
+    const char *json_path   = NULL;
+    const char *baseline    = NULL;
+    const char *label       = "bridge";
+    double      tolerance   = RP_DEFAULT_TOLERANCE;
+    uint16_t    port        = 502;
+    uint32_t    start_s     = RP_DEFAULT_START_S;
+    uint32_t    duration_s  = RP_DEFAULT_DURATION_S;
+    pid_t       pid         = 0;
+    pid_t       child       = 0;
+    FILE       *golden      = NULL;
+    FILE       *json        = stdout;
+    rp_can      can;
+    pthread_t   can_tid;
+    rp_cpu      cpu0;
+    rp_cpu      cpu1;
+    rp_cpu      cpu;
+    int         have_cpu;
+    int         sock        = -1;
+    int         status = RP_EXIT_PASS;
+    uint64_t    t0;
+    double      wall_s;
+    int         opt;
+
+    while ((opt = getopt(argc, argv, "c:q:i:H:p:Vx:t:w:d:o:j:l:B:T:P:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'c': can_trace   = optarg; break;
+            case 'q': req_trace   = optarg; break;
+            case 'i': interface   = optarg; break;
+            case 'H': host        = optarg; break;
+            case 'p': port        = (uint16_t)strtoul(optarg, NULL, 0); break;
+            case 'V': virtual_timing = 1; break;
+            case 'x': speed       = strtod(optarg, NULL); break;
+            case 't': timeout_ms  = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'w': start_s     = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'd': duration_s  = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'o': golden_path = optarg; break;
+            case 'j': json_path   = optarg; break;
+            case 'l': label       = optarg; break;
+            case 'B': baseline    = optarg; break;
+            case 'T': tolerance   = strtod(optarg, NULL); break;
+            case 'P': pid         = (pid_t)strtol(optarg, NULL, 0); break;
+            default:
+                usage(argv[0]);
+                return RP_EXIT_SETUP;
+        }
+    }
+
+    if (((req_trace == NULL) && (can_trace == NULL)) || (speed <= 0))
+    {
+        usage(argv[0]);
+        return RP_EXIT_SETUP;
+    }
+    can_only = (req_trace == NULL);
+
+    if (((req_trace != NULL) && (load_requests(req_trace) != 0)) ||
+        ((can_trace != NULL) && (load_can_trace(can_trace) != 0)))
+    {
+        return RP_EXIT_SETUP;
+    }
+
+    memset(&can, 0, sizeof(can));
+    can.sock = -1;
+    if (can_trace != NULL)
+    {
+        /*
+         * The ETU side is up before the bridge sends its first frame
+         */
+        can.sock = can_open(interface);
+        if ((can.sock < 0) || (pthread_create(&can_tid, NULL, can_thread, &can) != 0))
+        {
+            return RP_EXIT_SETUP;
+        }
+    }
+
+    if (optind < argc)
+    {
+        child = start_bridge(&argv[optind]);
+        if (child < 0)
+        {
+            return RP_EXIT_SETUP;
+        }
+        pid = child;
+    }
+
+    if (!can_only)
+    {
+        sock = tcp_connect(host, port, start_s, child);
+        if (sock < 0)
+        {
+            if (child > 0)
+            {
+                stop_bridge(child);
+            }
+            return RP_EXIT_SETUP;
+        }
+    }
+
+    if ((golden_path != NULL) && !can_only)
+    {
+        golden = fopen(golden_path, "w");
+        if (golden == NULL)
+        {
+            perror(golden_path);
+        }
+    }
+
+    /*
+     * Start-up is not part of the measurement
+     */
+    read_cpu(pid, &cpu0);
+    t0 = now_us();
+
+    if (can_only ? (run_can_only(child, duration_s) != 0) : (run_requests(&sock, host, port, golden) != 0))
+    {
+        status = RP_EXIT_FAIL;
+    }
+
+    wall_s   = (double)(now_us() - t0) / 1e6;
+    have_cpu = (read_cpu(pid, &cpu1) == 0);
+    cpu.user_s = cpu1.user_s - cpu0.user_s;
+    cpu.sys_s  = cpu1.sys_s - cpu0.sys_s;
+    cpu.hwm_kb = cpu1.hwm_kb;
+
+    if (sock >= 0)
+    {
+        close(sock);
+    }
+    if (child > 0)
+    {
+        stop_bridge(child);
+    }
+    if (can.sock >= 0)
+    {
+        can_stop = 1;
+        pthread_join(can_tid, NULL);
+        close(can.sock);
+    }
+    if (golden != NULL)
+    {
+        fclose(golden);
+    }
+
+    if (json_path != NULL)
+    {
+        json = fopen(json_path, "w");
+        if (json == NULL)
+        {
+            perror(json_path);
+            json = stdout;
+        }
+    }
+    write_metrics(json, label, wall_s, &cpu, have_cpu);
+    if (json != stdout)
+    {
+        fclose(json);
+    }
+
+    if (req_mismatch || req_timeout || can_unmatched || can_data_mismatch || can_missing)
+    {
+        status = RP_EXIT_FAIL;
+    }
+    if ((status == RP_EXIT_PASS) && (baseline != NULL) && compare_baseline(baseline, tolerance, &cpu, have_cpu))
+    {
+        status = RP_EXIT_REGRESSION;
+    }
+
+    fprintf(stderr, "%s\n", (status == RP_EXIT_PASS) ? "PASS" : (status == RP_EXIT_REGRESSION) ? "REGRESSION" : "FAIL");
+
+    return status;
+}
@@ -0,0 +1,204 @@
+/**
+ *  @file    rtu_framer.c
+ *  @brief   Modbus RTU frame delimiting on a serial port (t3.5 silence timer)
+ *
+ *  See rtu_framer.h.
+ *
+ *  @author  Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/timerfd.h>
+#include "rtu_framer.h"
+
+
+uint32_t rtu_t35_us(int baud)
+{
+    if ((baud <= 0) || (baud > 19200))
+    {
+        return RTU_T35_FIXED_US;
+    }
+
+    /*
+     * 3.5 characters, rounded up
+     */
+    return (uint32_t)((35ULL * RTU_CHAR_BITS * 1000000ULL + 10ULL * baud - 1) / (10ULL * baud));
+}
+
+
+uint16_t rtu_crc16(const uint8_t *data, int len)
+{
+    uint16_t crc = 0xFFFF;
+    int      i;
+    int      bit;
+
+    for (i = 0; i < len; i++)
+    {
+        crc ^= data[i];
+        for (bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 1) ? (uint16_t)((crc >> 1) ^ 0xA001) : (uint16_t)(crc >> 1);
+        }
+    }
+
+    return crc;
+}
+
+
+int rtu_framer_open(rtu_framer *f, int fd, int baud)
+{
+    memset(f, 0, sizeof(*f));
+    f->fd     = fd;
+    f->t35_us = rtu_t35_us(baud);
+
+    f->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (f->timer_fd < 0)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief (Re)start the silence timer, one shot.
+ */
+static void arm_t35(rtu_framer *f)
+{
+    struct itimerspec its;
+
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec  = f->t35_us / 1000000;
+    its.it_value.tv_nsec = (long)(f->t35_us % 1000000) * 1000;
+    timerfd_settime(f->timer_fd, 0, &its, NULL);
+}
+
+
+/**
+ * @brief The line was silent for t3.5: check what was received.
+ *
+ * @return Frame length if it is a good frame, 0 otherwise
+ */
+static int frame_end(rtu_framer *f, uint8_t *frame, int max)
+{
+    int len = f->len;
+
+    f->len = 0;
+
+    if (f->overrun)
+    {
+        f->overrun = 0;
+        f->stats.overruns++;
+        return 0;
+    }
+    if (len < RTU_MIN_ADU)
+    {
+        f->stats.short_frames++;
+        return 0;
+    }
+    if ((rtu_crc16(f->buf, len) != 0) || (len > max))
+    {
+        f->stats.crc_errors++;
+        return 0;
+    }
+
+    memcpy(frame, f->buf, (size_t)len);
+    f->stats.frames++;
+
+    return len;
+}
+
+
+int rtu_framer_next(rtu_framer *f, uint8_t *frame, int max)
+{
+    struct pollfd   pfd[2];
+    uint8_t         chunk[RTU_MAX_ADU];
+    uint64_t        ticks;
+    ssize_t         n;
+    int             len;
+
+    pfd[0].fd     = f->fd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd     = f->timer_fd;
+    pfd[1].events = POLLIN;
+
+    for (;;)
+    {
+        if (poll(pfd, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+
+        /*
+         * Silence first: bytes that are already waiting as well belong to
+         * the next frame, the timer expired before they were read
+         */
+        if ((read(f->timer_fd, &ticks, sizeof(ticks)) == sizeof(ticks)) && ((f->len > 0) || f->overrun))
+        {
+            len = frame_end(f, frame, max);
+            if (len > 0)
+            {
+                return len;
+            }
+        }
+
+        if ((pfd[0].revents & (POLLERR | POLLHUP | POLLNVAL)) && !(pfd[0].revents & POLLIN))
+        {
+            return -1;
+        }
+        if (!(pfd[0].revents & POLLIN))
+        {
+            continue;
+        }
+
+        n = read(f->fd, chunk, sizeof(chunk));
+        if (n < 0)
+        {
+            if ((errno == EAGAIN) || (errno == EINTR))
+            {
+                continue;
+            }
+            return -1;
+        }
+        if (n == 0)
+        {
+            continue;
+        }
+
+        if (f->overrun || (f->len + n > RTU_MAX_ADU))
+        {
+            /*
+             * No valid frame is this long: drop everything up to the next silence
+             */
+            f->overrun = 1;
+            f->len     = 0;
+        }
+        else
+        {
+            memcpy(f->buf + f->len, chunk, (size_t)n);
+            f->len += (int)n;
+        }
+
+        arm_t35(f);
+    }
+}
+
+
+void rtu_framer_close(rtu_framer *f)
+{
+    if (f->timer_fd >= 0)
+    {
+        close(f->timer_fd);
+    }
+    f->timer_fd = -1;
+}
@@ -0,0 +1,88 @@
+/**
+ *  @file    rtu_framer.h
+ *  @brief   Modbus RTU frame delimiting on a serial port (t3.5 silence timer)
+ *
+ *  An RTU frame has no length field that works for every function code;
+ *  it ends when the line has been silent for 3.5 character times. The
+ *  framer re-arms a timerfd for t3.5 after every read from the port and
+ *  treats its expiry as the end of the frame, then checks length and CRC.
+ *
+ *      baud <= 19200   t3.5 = 3.5 characters of 11 bits
+ *      baud >  19200   t3.5 = 1750 us (fixed, Modbus over serial line 2.5.1.1)
+ *
+ *  The silence is measured from when the bytes are read, so UART FIFO and
+ *  tty latency add to it; the inter-character limit t1.5 is not checked
+ *  for the same reason (bytes are delivered in FIFO-sized bursts).
+ *
+ *  @author  Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#ifndef RTU_FRAMER_H
+#define RTU_FRAMER_H
+
+#include <stdint.h>
+
+
+#define RTU_MAX_ADU             256     /* Unit ID + PDU (253) + CRC (2)         */
+#define RTU_MIN_ADU             4       /* Unit ID + function code + CRC         */
+#define RTU_T35_FIXED_US        1750    /* Above 19200 baud                      */
+#define RTU_CHAR_BITS           11      /* Start + 8 data + parity/stop + stop   */
+
+
+/*
+ * Counters since rtu_framer_open()
+ */
+typedef struct {
+    uint64_t    frames;                 /* Good frames returned                  */
+    uint64_t    crc_errors;
+    uint64_t    short_frames;           /* Fewer than RTU_MIN_ADU bytes          */
+    uint64_t    overruns;               /* Longer than RTU_MAX_ADU, dropped      */
+} rtu_framer_stats;
+
+typedef struct {
+    int                 fd;             /* Serial port, not owned                */
+    int                 timer_fd;
+    uint32_t            t35_us;
+    int                 len;
+    int                 overrun;
+    uint8_t             buf[RTU_MAX_ADU];
+    rtu_framer_stats    stats;
+} rtu_framer;
+
+
+/**
+ * @brief t3.5 for a baud rate, in microseconds.
+ */
+uint32_t rtu_t35_us(int baud);
+
+/**
+ * @brief Modbus CRC-16 (polynomial 0xA001 reflected, init 0xFFFF).
+ *
+ * Sent low byte first, so a frame including its CRC gives 0.
+ */
+uint16_t rtu_crc16(const uint8_t *data, int len);
+
+/**
+ * @brief Set up framing on an open serial port.
+ *
+ * @return 0 on success, -1 if the timer could not be created
+ */
+int rtu_framer_open(rtu_framer *f, int fd, int baud);
+
+/**
+ * @brief Wait for the next complete frame with a good CRC.
+ *
+ * Bad, short and overlong frames are counted and skipped.
+ *
+ * @param frame  Receives the frame including unit ID and CRC
+ * @param max    Size of frame, at least RTU_MAX_ADU
+ *
+ * @return Frame length, -1 on a port error
+ */
+int rtu_framer_next(rtu_framer *f, uint8_t *frame, int max);
+
+void rtu_framer_close(rtu_framer *f);
+
+#endif /* RTU_FRAMER_H */
@@ -0,0 +1,189 @@
+/**
+ *  @file    shm_image_bench.c
+ *  @brief   Snapshot-rate benchmark for the shared-memory register image
+ *
+ *  One writer thread publishes a metering-sized dataset as fast as it can
+ *  (worst case for readers), while N reader threads take snapshots through
+ *  the reader library. Prints snapshots per second and the torn-copy retry
+ *  rate for each reader.
+ *
+ *  Usage: ./shm_image_bench [readers] [seconds]
+ *
+ *  @author  Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "shm_register_image.h"
+
+
+#define BENCH_SHM_NAME      "/modbus_can_image_bench"
+#define BENCH_ENTRIES       9000
+#define BENCH_FIRST_ADDR    3000
+#define BENCH_LAST_ADDR     3143        /* 144 registers, like monitoring_data */
+#define BENCH_MAX_READERS   16
+
+
+static atomic_int  stop_flag;
+
+typedef struct {
+    pthread_t  thread;
+    uint64_t   snapshots;
+    uint64_t   failures;
+    uint64_t   torn;
+} reader_stats;
+
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+
+static void *writer_thread(void *arg)
+{
+    shm_image_t *img = (shm_image_t *)arg;
+    uint16_t     regs[BENCH_LAST_ADDR - BENCH_FIRST_ADDR + 1];
+    uint16_t     value = 0;
+    size_t       i;
+
+    while (!atomic_load(&stop_flag))
+    {
+        /*
+         * Every register carries the same value, so a reader can detect
+         * a torn copy by comparing the first and last entry.
+         */
+        value++;
+        for (i = 0; i < sizeof(regs) / sizeof(regs[0]); i++)
+        {
+            regs[i] = value;
+        }
+
+        shm_image_publish(img, 0, SHM_TABLE_INPUT_REGISTERS, BENCH_FIRST_ADDR,
+                          (uint16_t)(sizeof(regs) / sizeof(regs[0])), regs);
+    }
+
+    return NULL;
+}
+
+
+static void *reader_thread(void *arg)
+{
+    reader_stats *stats = (reader_stats *)arg;
+    shm_image_t  *img;
+    uint16_t      regs[BENCH_LAST_ADDR - BENCH_FIRST_ADDR + 1];
+    int           dataset;
+    int           n;
+
+    img = shm_image_open(BENCH_SHM_NAME);
+    if (img == NULL)
+    {
+        fprintf(stderr, "reader: shm_image_open failed\n");
+        return NULL;
+    }
+
+    dataset = shm_image_find_dataset(img, "monitoring_data");
+
+    while (!atomic_load(&stop_flag))
+    {
+        n = shm_image_snapshot(img, dataset, SHM_TABLE_INPUT_REGISTERS, regs, sizeof(regs), NULL);
+        if (n < 0)
+        {
+            stats->failures++;
+            continue;
+        }
+
+        if (regs[0] != regs[n - 1])
+        {
+            stats->torn++;
+        }
+
+        stats->snapshots++;
+    }
+
+    shm_image_close(img);
+    return NULL;
+}
+
+
+int main(int argc, char *argv[])
+{
+    shm_image_dataset_desc desc = { "monitoring_data", BENCH_FIRST_ADDR, BENCH_LAST_ADDR };
+    uint32_t               entries[SHM_TABLE_COUNT] = { BENCH_ENTRIES, BENCH_ENTRIES, BENCH_ENTRIES, BENCH_ENTRIES };
+    reader_stats           readers[BENCH_MAX_READERS];
+    pthread_t              writer;
+    shm_image_t           *img;
+    uint64_t               total = 0;
+    double                 start;
+    double                 elapsed;
+    int                    nreaders = 2;
+    int                    seconds  = 3;
+    int                    i;
+
+    if (argc > 1)
+    {
+        nreaders = atoi(argv[1]);
+    }
+    if (argc > 2)
+    {
+        seconds = atoi(argv[2]);
+    }
+    if ((nreaders < 1) || (nreaders > BENCH_MAX_READERS))
+    {
+        nreaders = 2;
+    }
+
+    img = shm_image_create(BENCH_SHM_NAME, entries, &desc, 1);
+    if (img == NULL)
+    {
+        perror("shm_image_create");
+        return EXIT_FAILURE;
+    }
+
+    memset(readers, 0, sizeof(readers));
+
+    pthread_create(&writer, NULL, writer_thread, img);
+    for (i = 0; i < nreaders; i++)
+    {
+        pthread_create(&readers[i].thread, NULL, reader_thread, &readers[i]);
+    }
+
+    start = now_sec();
+    sleep((unsigned int)seconds);
+    atomic_store(&stop_flag, 1);
+
+    pthread_join(writer, NULL);
+    for (i = 0; i < nreaders; i++)
+    {
+        pthread_join(readers[i].thread, NULL);
+    }
+    elapsed = now_sec() - start;
+
+    printf("Dataset: %d registers, writer publishing continuously, %d reader(s), %.2f s\n",
+           BENCH_LAST_ADDR - BENCH_FIRST_ADDR + 1, nreaders, elapsed);
+
+    for (i = 0; i < nreaders; i++)
+    {
+        printf("  reader %d: %10.0f snapshots/s  failures %llu  torn %llu\n", i,
+               readers[i].snapshots / elapsed,
+               (unsigned long long)readers[i].failures,
+               (unsigned long long)readers[i].torn);
+        total += readers[i].snapshots;
+    }
+
+    printf("  total   : %10.0f snapshots/s\n", total / elapsed);
+
+    shm_image_destroy(img);
+    return 0;
+}
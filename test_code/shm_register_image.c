@@ -0,0 +1,405 @@
+/**
+ *  @file    shm_register_image.c
+ *  @brief   Shared-memory register image: writer (bridge) and reader library
+ *
+ *  See shm_register_image.h for the segment layout and locking rules.
+ *  This file is linked into the bridge and into every local consumer.
+ *
+ *  @author  Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shm_register_image.h"
+
+
+/*
+ * Size in bytes of one entry of each table
+ */
+static const size_t table_entry_size[SHM_TABLE_COUNT] = {
+    sizeof(uint8_t),    /* SHM_TABLE_BITS            */
+    sizeof(uint8_t),    /* SHM_TABLE_INPUT_BITS      */
+    sizeof(uint16_t),   /* SHM_TABLE_REGISTERS       */
+    sizeof(uint16_t),   /* SHM_TABLE_INPUT_REGISTERS */
+};
+
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+
+/**
+ * @brief Compute the table offsets and the total segment size.
+ */
+static size_t shm_image_layout(shm_image_header *hdr, const uint32_t entries[SHM_TABLE_COUNT])
+{
+    size_t offset;
+    int    table;
+
+    offset = sizeof(shm_image_header) + SHM_IMAGE_MAX_DATASETS * sizeof(shm_image_dataset);
+
+    for (table = 0; table < SHM_TABLE_COUNT; table++)
+    {
+        /*
+         * Keep every table 64-byte aligned
+         */
+        offset = (offset + 63) & ~(size_t)63;
+
+        hdr->table_entries[table] = entries[table];
+        hdr->table_offset[table]  = (uint32_t)offset;
+
+        offset += (size_t)entries[table] * table_entry_size[table];
+    }
+
+    return offset;
+}
+
+
+shm_image_t *shm_image_create(const char *name, const uint32_t entries[SHM_TABLE_COUNT],
+                              const shm_image_dataset_desc *desc, int dataset_count)
+{
+    shm_image_header  layout;
+    shm_image_t      *img;
+    size_t            size;
+    void             *base;
+    int               fd;
+    int               i;
+
+    if ((name == NULL) || (dataset_count < 0) || (dataset_count > SHM_IMAGE_MAX_DATASETS))
+    {
+        return NULL;
+    }
+
+    memset(&layout, 0, sizeof(layout));
+    size = shm_image_layout(&layout, entries);
+
+    /*
+     * Start from a fresh segment so that stale readers of a previous
+     * bridge instance do not keep an incompatible layout mapped.
+     */
+    shm_unlink(name);
+
+    fd = shm_open(name, O_CREAT | O_RDWR | O_EXCL, 0644);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+
+    if (ftruncate(fd, (off_t)size) != 0)
+    {
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (base == MAP_FAILED)
+    {
+        shm_unlink(name);
+        return NULL;
+    }
+
+    img = calloc(1, sizeof(*img));
+    if (img == NULL)
+    {
+        munmap(base, size);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    img->base     = base;
+    img->size     = size;
+    img->writable = 1;
+    pthread_mutex_init(&img->write_lock, NULL);
+    img->hdr      = (shm_image_header *)base;
+    img->datasets = (shm_image_dataset *)(img->base + sizeof(shm_image_header));
+    strncpy(img->name, name, sizeof(img->name) - 1);
+
+    /*
+     * Fill the dataset table before publishing the header magic, so a
+     * reader that sees a valid magic also sees valid descriptors.
+     */
+    for (i = 0; i < dataset_count; i++)
+    {
+        atomic_init(&img->datasets[i].seq, 0);
+        img->datasets[i].first_addr = desc[i].first_addr;
+        img->datasets[i].last_addr  = desc[i].last_addr;
+        strncpy(img->datasets[i].name, desc[i].name, SHM_IMAGE_NAME_LEN - 1);
+    }
+
+    memcpy(img->hdr->table_entries, layout.table_entries, sizeof(layout.table_entries));
+    memcpy(img->hdr->table_offset, layout.table_offset, sizeof(layout.table_offset));
+    img->hdr->version       = SHM_IMAGE_VERSION;
+    img->hdr->dataset_count = (uint32_t)dataset_count;
+    img->hdr->total_size    = (uint32_t)size;
+    atomic_store_explicit(&img->hdr->writer_pid, (uint32_t)getpid(), memory_order_relaxed);
+
+    atomic_thread_fence(memory_order_release);
+    img->hdr->magic = SHM_IMAGE_MAGIC;
+
+    return img;
+}
+
+
+int shm_image_publish(shm_image_t *img, int dataset, int table,
+                      uint16_t start, uint16_t count, const void *src)
+{
+    shm_image_dataset *slot;
+    uint8_t           *dst;
+    uint32_t           seq;
+    size_t             entry_size;
+
+    if ((img == NULL) || !img->writable || (src == NULL) ||
+        (dataset < 0) || (dataset >= (int)img->hdr->dataset_count) ||
+        (table < 0) || (table >= SHM_TABLE_COUNT) ||
+        ((uint32_t)start + count > img->hdr->table_entries[table]))
+    {
+        return -1;
+    }
+
+    slot       = &img->datasets[dataset];
+    entry_size = table_entry_size[table];
+    dst        = img->base + img->hdr->table_offset[table] + (size_t)start * entry_size;
+
+    /*
+     * Only the dataset's own range is under its sequence lock: anything else
+     * would change entries readers of another dataset take as stable
+     */
+    if ((count == 0) || (start < slot->first_addr) || ((uint32_t)start + count - 1 > slot->last_addr))
+    {
+        return -1;
+    }
+
+    /*
+     * The write lock makes this the only writer of the dataset, so a relaxed
+     * load is enough. Odd sequence tells readers a copy is in progress.
+     */
+    pthread_mutex_lock(&img->write_lock);
+
+    seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+    atomic_store_explicit(&slot->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    memcpy(dst, src, (size_t)count * entry_size);
+
+    slot->update_count++;
+    slot->last_update_ns = monotonic_ns();
+
+    atomic_store_explicit(&slot->seq, seq + 2, memory_order_release);
+
+    pthread_mutex_unlock(&img->write_lock);
+
+    return 0;
+}
+
+
+void shm_image_destroy(shm_image_t *img)
+{
+    if (img == NULL)
+    {
+        return;
+    }
+
+    munmap(img->base, img->size);
+    shm_unlink(img->name);
+    pthread_mutex_destroy(&img->write_lock);
+    free(img);
+}
+
+
+/**
+ * @brief Check that the dataset slots and every table of a header read
+ *        from a segment lie inside the mapping, so that a truncated or
+ *        foreign segment cannot send a snapshot past its end.
+ *
+ * @return 0 if everything fits, -1 otherwise
+ */
+static int shm_image_layout_fits(const shm_image_header *hdr, size_t mapped)
+{
+    uint64_t tables_start;
+    uint64_t table_end;
+    int      table;
+
+    tables_start = sizeof(shm_image_header) + (uint64_t)hdr->dataset_count * sizeof(shm_image_dataset);
+    if (tables_start > mapped)
+    {
+        return -1;
+    }
+
+    for (table = 0; table < SHM_TABLE_COUNT; table++)
+    {
+        table_end = (uint64_t)hdr->table_offset[table] +
+                    (uint64_t)hdr->table_entries[table] * table_entry_size[table];
+
+        if ((hdr->table_offset[table] < tables_start) || (table_end > mapped))
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+shm_image_t *shm_image_open(const char *name)
+{
+    shm_image_header  hdr;
+    shm_image_t      *img;
+    struct stat       st;
+    void             *base;
+    int               fd;
+
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+
+    if ((fstat(fd, &st) != 0) || ((size_t)st.st_size < sizeof(shm_image_header)))
+    {
+        close(fd);
+        return NULL;
+    }
+
+    base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (base == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    memcpy(&hdr, base, sizeof(hdr));
+    atomic_thread_fence(memory_order_acquire);
+
+    if ((hdr.magic != SHM_IMAGE_MAGIC) || (hdr.version != SHM_IMAGE_VERSION) ||
+        (hdr.total_size > (uint32_t)st.st_size) || (hdr.dataset_count > SHM_IMAGE_MAX_DATASETS) ||
+        (shm_image_layout_fits(&hdr, (size_t)st.st_size) != 0))
+    {
+        munmap(base, (size_t)st.st_size);
+        return NULL;
+    }
+
+    img = calloc(1, sizeof(*img));
+    if (img == NULL)
+    {
+        munmap(base, (size_t)st.st_size);
+        return NULL;
+    }
+
+    img->base     = base;
+    img->size     = (size_t)st.st_size;
+    img->writable = 0;
+    img->hdr      = (shm_image_header *)base;
+    img->datasets = (shm_image_dataset *)(img->base + sizeof(shm_image_header));
+    strncpy(img->name, name, sizeof(img->name) - 1);
+
+    return img;
+}
+
+
+int shm_image_find_dataset(const shm_image_t *img, const char *name)
+{
+    uint32_t i;
+
+    if ((img == NULL) || (name == NULL))
+    {
+        return -1;
+    }
+
+    for (i = 0; i < img->hdr->dataset_count; i++)
+    {
+        if (strncmp(img->datasets[i].name, name, SHM_IMAGE_NAME_LEN) == 0)
+        {
+            return (int)i;
+        }
+    }
+
+    return -1;
+}
+
+
+int shm_image_snapshot(const shm_image_t *img, int dataset, int table,
+                       void *dst, size_t dst_len, uint32_t *seq_out)
+{
+    shm_image_dataset *slot;
+    const uint8_t     *src;
+    uint32_t           seq_begin;
+    uint32_t           seq_end;
+    uint32_t           count;
+    size_t             bytes;
+    int                attempt;
+
+    if ((img == NULL) || (dst == NULL) ||
+        (dataset < 0) || (dataset >= (int)img->hdr->dataset_count) ||
+        (table < 0) || (table >= SHM_TABLE_COUNT))
+    {
+        return -1;
+    }
+
+    slot  = &img->datasets[dataset];
+    count = (uint32_t)slot->last_addr - slot->first_addr + 1;
+    bytes = (size_t)count * table_entry_size[table];
+
+    if ((bytes > dst_len) || ((uint32_t)slot->last_addr >= img->hdr->table_entries[table]))
+    {
+        return -1;
+    }
+
+    src = img->base + img->hdr->table_offset[table] + (size_t)slot->first_addr * table_entry_size[table];
+
+    for (attempt = 0; attempt < SHM_IMAGE_MAX_RETRIES; attempt++)
+    {
+        seq_begin = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (seq_begin & 1U)
+        {
+            /*
+             * Writer is in the middle of a publish, try again
+             */
+            continue;
+        }
+
+        memcpy(dst, src, bytes);
+
+        atomic_thread_fence(memory_order_acquire);
+        seq_end = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+
+        if (seq_begin == seq_end)
+        {
+            if (seq_out != NULL)
+            {
+                *seq_out = seq_begin;
+            }
+            return (int)count;
+        }
+    }
+
+    return -1;
+}
+
+
+void shm_image_close(shm_image_t *img)
+{
+    if (img == NULL)
+    {
+        return;
+    }
+
+    munmap(img->base, img->size);
+    free(img);
+}
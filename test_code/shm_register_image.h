@@ -0,0 +1,187 @@
+/**
+ *  @file    shm_register_image.h
+ *  @brief   Shared-memory register image published by the Modbus/CAN bridge
+ *
+ *  The bridge mirrors every register table it fills from the CAN side
+ *  (coils, discrete inputs, holding and input registers) into a POSIX
+ *  shared-memory segment. Co-located consumers (historian, HMI) map the
+ *  segment read-only and take consistent snapshots of one dataset at a time
+ *  without any system call.
+ *
+ *  Consistency is provided by one sequence lock per dataset:
+ *  - The writer (CAN path) makes the sequence odd, copies the data and makes
+ *    it even again. It never waits for readers. Publishes from several
+ *    bridge threads are serialized by a process-local mutex.
+ *  - A reader copies the dataset range and retries if the sequence was odd
+ *    or changed while it was copying.
+ *
+ *  Segment layout:
+ *  [shm_image_header][shm_image_dataset x SHM_IMAGE_MAX_DATASETS][tables]
+ *
+ *  @author  Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#ifndef SHM_REGISTER_IMAGE_H
+#define SHM_REGISTER_IMAGE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+
+#define SHM_IMAGE_NAME              "/modbus_can_image"
+#define SHM_IMAGE_MAGIC             0x4D42494DU   /* "MBIM" */
+#define SHM_IMAGE_VERSION           1
+
+#define SHM_IMAGE_MAX_DATASETS      16
+#define SHM_IMAGE_NAME_LEN          32
+#define SHM_IMAGE_MAX_RETRIES       1000          /* Reader gives up after this many torn copies */
+
+
+/*
+ * Register tables, same order as modbus_mapping_t
+ */
+#define SHM_TABLE_BITS              0   /* tab_bits            (FC 1)  */
+#define SHM_TABLE_INPUT_BITS        1   /* tab_input_bits      (FC 2)  */
+#define SHM_TABLE_REGISTERS         2   /* tab_registers       (FC 3)  */
+#define SHM_TABLE_INPUT_REGISTERS   3   /* tab_input_registers (FC 4)  */
+#define SHM_TABLE_COUNT             4
+
+
+/*
+ * Dataset descriptor handed to shm_image_create()
+ */
+typedef struct {
+    const char *name;          /* Dataset name like "monitoring_data" */
+    uint16_t    first_addr;    /* First 0-based Modbus address        */
+    uint16_t    last_addr;     /* Last 0-based Modbus address         */
+} shm_image_dataset_desc;
+
+
+/*
+ * Per-dataset slot in the segment, one cache line each so that a writer
+ * bumping one sequence does not disturb readers of another dataset.
+ */
+typedef struct {
+    _Atomic uint32_t seq;                       /* Sequence lock, odd = write in progress */
+    uint16_t         first_addr;
+    uint16_t         last_addr;
+    uint32_t         update_count;              /* Completed publishes                    */
+    uint32_t         reserved;
+    uint64_t         last_update_ns;            /* CLOCK_MONOTONIC of last publish        */
+    char             name[SHM_IMAGE_NAME_LEN];
+} __attribute__((aligned(64))) shm_image_dataset;
+
+
+/*
+ * Segment header
+ */
+typedef struct {
+    uint32_t         magic;
+    uint32_t         version;
+    uint32_t         dataset_count;
+    uint32_t         table_entries[SHM_TABLE_COUNT];   /* Entries per table                   */
+    uint32_t         table_offset[SHM_TABLE_COUNT];    /* Byte offset of each table in segment */
+    uint32_t         total_size;
+    _Atomic uint32_t writer_pid;
+} __attribute__((aligned(64))) shm_image_header;
+
+
+/*
+ * Handle to a mapped segment (writer or reader side)
+ */
+typedef struct {
+    shm_image_header   *hdr;
+    shm_image_dataset  *datasets;
+    uint8_t            *base;
+    size_t              size;
+    int                 writable;
+    pthread_mutex_t     write_lock;            /* Serializes writer threads, never shared with readers */
+    char                name[SHM_IMAGE_NAME_LEN];
+} shm_image_t;
+
+
+/***************************************************************
+ *  Writer API (bridge)
+ ***************************************************************/
+
+/**
+ * @brief Create (or re-create) the shared-memory register image.
+ *
+ * @param name          Segment name, e.g. SHM_IMAGE_NAME
+ * @param entries       Entries per table, indexed by SHM_TABLE_*
+ * @param desc          Dataset descriptors
+ * @param dataset_count Number of descriptors (<= SHM_IMAGE_MAX_DATASETS)
+ *
+ * @return Handle on success, NULL on failure
+ */
+shm_image_t *shm_image_create(const char *name, const uint32_t entries[SHM_TABLE_COUNT],
+                              const shm_image_dataset_desc *desc, int dataset_count);
+
+/**
+ * @brief Publish a freshly read register range of one dataset.
+ *
+ * Copies @p count entries starting at 0-based address @p start from @p src
+ * into the given table under the dataset's sequence lock. Never waits for
+ * readers, only for another bridge thread publishing at the same time.
+ *
+ * @param img      Writer handle
+ * @param dataset  Dataset index as passed to shm_image_create()
+ * @param table    SHM_TABLE_* index
+ * @param start    First 0-based Modbus address
+ * @param count    Number of entries (bits or registers)
+ * @param src      Source entries (uint8_t for bit tables, uint16_t for registers)
+ *
+ * @return 0 on success, -1 on invalid arguments or a range outside the dataset
+ */
+int shm_image_publish(shm_image_t *img, int dataset, int table,
+                      uint16_t start, uint16_t count, const void *src);
+
+/**
+ * @brief Unmap and unlink the segment.
+ */
+void shm_image_destroy(shm_image_t *img);
+
+
+/***************************************************************
+ *  Reader API (historian, HMI, tools)
+ ***************************************************************/
+
+/**
+ * @brief Map an existing register image read-only.
+ *
+ * @return Handle on success, NULL if the segment is missing or incompatible
+ */
+shm_image_t *shm_image_open(const char *name);
+
+/**
+ * @brief Look up a dataset index by name.
+ *
+ * @return Dataset index, or -1 if not found
+ */
+int shm_image_find_dataset(const shm_image_t *img, const char *name);
+
+/**
+ * @brief Take a consistent snapshot of a whole dataset from one table.
+ *
+ * @param img      Reader handle
+ * @param dataset  Dataset index
+ * @param table    SHM_TABLE_* index
+ * @param dst      Destination buffer
+ * @param dst_len  Size of @p dst in bytes
+ * @param seq_out  Optional: sequence number of the snapshot (changes on every publish)
+ *
+ * @return Number of entries copied, -1 on error or if no stable copy was obtained
+ */
+int shm_image_snapshot(const shm_image_t *img, int dataset, int table,
+                       void *dst, size_t dst_len, uint32_t *seq_out);
+
+/**
+ * @brief Unmap a reader handle.
+ */
+void shm_image_close(shm_image_t *img);
+
+#endif /* SHM_REGISTER_IMAGE_H */
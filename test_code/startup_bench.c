@@ -0,0 +1,405 @@
+/**
+ *  @file    startup_bench.c
+ *  @brief   Start-up benchmark: time from exec of the bridge to first served request
+ *
+ *  Starts the bridge (or any Modbus TCP server) as a child process, then
+ *  polls 127.0.0.1:<port> with a Read Holding Registers request and records,
+ *  per run:
+ *
+ *    listen   connection accepted by the listener
+ *    reply    first Modbus response of any kind (busy exception 0x06 counts)
+ *    served   first normal response (CAN up, register data returned)
+ *    notify   READY=1 received on NOTIFY_SOCKET (sd_notify protocol)
+ *
+ *  Usage (on the target, as root, bridge stopped):
+ *
+ *    gcc -O2 startup_bench.c -o startup_bench
+ *    ./startup_bench [-p port] [-a address] [-n runs] ./am437x_TCP_ETU_COMMUNICATE
+ *
+ *  The address must be a CAN register (e.g. 1 for the first monitoring
+ *  register) so that "served" measures the CAN bring-up. Results are printed
+ *  in milliseconds, min / median / max over the runs.
+ *
+ *  @author  Abinash
+ *
+ *  @bug No known bugs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <stddef.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+
+#define BENCH_DEFAULT_PORT      502
+#define BENCH_DEFAULT_ADDR      1
+#define BENCH_DEFAULT_RUNS      5
+#define BENCH_MAX_RUNS          100
+#define BENCH_TIMEOUT_MS        60000   /* Give up on a run after this         */
+#define BENCH_POLL_MS           2       /* Connect / request retry interval    */
+#define BENCH_STOP_WAIT_MS      3000    /* SIGTERM, then SIGKILL               */
+
+#define STAGE_LISTEN            0
+#define STAGE_REPLY             1
+#define STAGE_SERVED            2
+#define STAGE_NOTIFY            3
+#define STAGE_COUNT             4
+
+static const char *const stage_names[STAGE_COUNT] = { "listen", "reply", "served", "notify" };
+
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000;
+}
+
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+
+/**
+ * @brief Non-blocking check for READY=1 on the notification socket.
+ */
+static int notify_ready(int notify_fd)
+{
+    char    buf[512];
+    ssize_t n;
+
+    while ((n = recv(notify_fd, buf, sizeof(buf) - 1, MSG_DONTWAIT)) > 0)
+    {
+        buf[n] = '\0';
+        if ((strncmp(buf, "READY=1", 7) == 0) || strstr(buf, "\nREADY=1"))
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief Send one FC 0x03 request and wait for the answer.
+ *
+ * @return Function code of the response (0x03 or 0x83), -1 on error/timeout
+ */
+static int modbus_probe(int fd, uint16_t transaction, uint16_t address, uint8_t *exception)
+{
+    uint8_t        adu[12];
+    uint8_t        rsp[260];
+    struct pollfd  pfd;
+    size_t         got = 0;
+    ssize_t        n;
+
+    adu[0]  = (uint8_t)(transaction >> 8);
+    adu[1]  = (uint8_t)transaction;
+    adu[2]  = 0;                            /* Protocol ID */
+    adu[3]  = 0;
+    adu[4]  = 0;                            /* Length      */
+    adu[5]  = 6;
+    adu[6]  = 1;                            /* Unit ID     */
+    adu[7]  = 0x03;
+    adu[8]  = (uint8_t)(address >> 8);
+    adu[9]  = (uint8_t)address;
+    adu[10] = 0;                            /* Quantity    */
+    adu[11] = 1;
+
+    if (send(fd, adu, sizeof(adu), MSG_NOSIGNAL) != (ssize_t)sizeof(adu))
+    {
+        return -1;
+    }
+
+    pfd.fd     = fd;
+    pfd.events = POLLIN;
+
+    /*
+     * MBAP header + function code + exception code / byte count
+     */
+    while (got < 9)
+    {
+        if (poll(&pfd, 1, BENCH_TIMEOUT_MS) <= 0)
+        {
+            return -1;
+        }
+
+        n = recv(fd, rsp + got, sizeof(rsp) - got, 0);
+        if (n <= 0)
+        {
+            return -1;
+        }
+        got += (size_t)n;
+    }
+
+    *exception = rsp[8];
+
+    return rsp[7];
+}
+
+
+/**
+ * @brief One start-up measurement.
+ *
+ * @return 0 if every stage was reached, -1 otherwise
+ */
+static int run_once(char *const argv[], uint16_t port, uint16_t address,
+                    const char *notify_path, int notify_fd, uint64_t stage_us[STAGE_COUNT])
+{
+    struct sockaddr_in  sa;
+    uint64_t            start;
+    uint64_t            deadline;
+    uint16_t            transaction = 0;
+    uint8_t             exception;
+    pid_t               pid;
+    int                 status;
+    int                 fd = -1;
+    int                 fc;
+    int                 s;
+
+    for (s = 0; s < STAGE_COUNT; s++)
+    {
+        stage_us[s] = 0;
+    }
+
+    while (notify_ready(notify_fd))
+    {
+        /* Drain messages of a previous run */
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family      = AF_INET;
+    sa.sin_port        = htons(port);
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    start = now_us();
+
+    pid = fork();
+    if (pid < 0)
+    {
+        perror("fork");
+        return -1;
+    }
+
+    if (pid == 0)
+    {
+        setenv("NOTIFY_SOCKET", notify_path, 1);
+        execvp(argv[0], argv);
+        perror(argv[0]);
+        _exit(127);
+    }
+
+    deadline = start + (uint64_t)BENCH_TIMEOUT_MS * 1000;
+
+    while ((now_us() < deadline) && (!stage_us[STAGE_SERVED] || !stage_us[STAGE_NOTIFY]))
+    {
+        if (!stage_us[STAGE_NOTIFY] && notify_ready(notify_fd))
+        {
+            stage_us[STAGE_NOTIFY] = now_us() - start;
+        }
+
+        if (waitpid(pid, &status, WNOHANG) == pid)
+        {
+            fprintf(stderr, "server exited during start-up (status 0x%x)\n", status);
+            pid = -1;
+            break;
+        }
+
+        if (stage_us[STAGE_SERVED])
+        {
+            usleep(BENCH_POLL_MS * 1000);
+            continue;
+        }
+
+        if (fd < 0)
+        {
+            fd = socket(AF_INET, SOCK_STREAM, 0);
+            if (fd < 0)
+            {
+                perror("socket");
+                break;
+            }
+
+            if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0)
+            {
+                close(fd);
+                fd = -1;
+                usleep(BENCH_POLL_MS * 1000);
+                continue;
+            }
+
+            if (!stage_us[STAGE_LISTEN])
+            {
+                stage_us[STAGE_LISTEN] = now_us() - start;
+            }
+        }
+
+        fc = modbus_probe(fd, ++transaction, address, &exception);
+        if (fc < 0)
+        {
+            close(fd);
+            fd = -1;
+            usleep(BENCH_POLL_MS * 1000);
+            continue;
+        }
+
+        if (!stage_us[STAGE_REPLY])
+        {
+            stage_us[STAGE_REPLY] = now_us() - start;
+        }
+
+        if (fc == 0x03)
+        {
+            stage_us[STAGE_SERVED] = now_us() - start;
+        }
+        else if (exception != 0x06)
+        {
+            fprintf(stderr, "address %u: exception 0x%02x (not busy), is it a CAN register?\n",
+                    address, exception);
+            usleep(BENCH_POLL_MS * 1000);
+        }
+        else
+        {
+            usleep(BENCH_POLL_MS * 1000);
+        }
+    }
+
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+
+    if (pid > 0)
+    {
+        kill(pid, SIGTERM);
+        deadline = now_us() + (uint64_t)BENCH_STOP_WAIT_MS * 1000;
+        while ((waitpid(pid, &status, WNOHANG) == 0) && (now_us() < deadline))
+        {
+            usleep(10000);
+        }
+        if (now_us() >= deadline)
+        {
+            kill(pid, SIGKILL);
+            waitpid(pid, &status, 0);
+        }
+    }
+
+    for (s = 0; s < STAGE_COUNT; s++)
+    {
+        if (!stage_us[s])
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+    static uint64_t     results[STAGE_COUNT][BENCH_MAX_RUNS];
+    struct sockaddr_un  sun;
+    uint64_t            stage_us[STAGE_COUNT];
+    uint16_t            port    = BENCH_DEFAULT_PORT;
+    uint16_t            address = BENCH_DEFAULT_ADDR;
+    int                 runs    = BENCH_DEFAULT_RUNS;
+    int                 done[STAGE_COUNT] = { 0 };
+    int                 notify_fd;
+    int                 opt;
+    int                 r;
+    int                 s;
+
+    while ((opt = getopt(argc, argv, "+p:a:n:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'p': port    = (uint16_t)atoi(optarg); break;
+            case 'a': address = (uint16_t)atoi(optarg); break;
+            case 'n': runs    = atoi(optarg);           break;
+            default:  optind  = argc;                   break;
+        }
+    }
+
+    if ((optind >= argc) || (runs < 1) || (runs > BENCH_MAX_RUNS))
+    {
+        fprintf(stderr, "usage: %s [-p port] [-a address] [-n runs(1..%d)] <server> [args...]\n",
+                argv[0], BENCH_MAX_RUNS);
+        return 2;
+    }
+
+    /*
+     * Notification socket handed to the server in NOTIFY_SOCKET
+     */
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    snprintf(sun.sun_path, sizeof(sun.sun_path), "/tmp/startup_bench.%d", (int)getpid());
+    unlink(sun.sun_path);
+
+    notify_fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if ((notify_fd < 0) || (bind(notify_fd, (struct sockaddr *)&sun, sizeof(sun)) != 0))
+    {
+        perror("notify socket");
+        return 1;
+    }
+
+    for (r = 0; r < runs; r++)
+    {
+        if (run_once(&argv[optind], port, address, sun.sun_path, notify_fd, stage_us) != 0)
+        {
+            fprintf(stderr, "run %d: incomplete\n", r + 1);
+        }
+
+        printf("run %2d:", r + 1);
+        for (s = 0; s < STAGE_COUNT; s++)
+        {
+            if (stage_us[s])
+            {
+                results[s][done[s]++] = stage_us[s];
+                printf("  %s %8.1f ms", stage_names[s], stage_us[s] / 1000.0);
+            }
+            else
+            {
+                printf("  %s        - ms", stage_names[s]);
+            }
+        }
+        printf("\n");
+    }
+
+    printf("\n%-8s %6s %10s %10s %10s\n", "stage", "runs", "min ms", "median ms", "max ms");
+    for (s = 0; s < STAGE_COUNT; s++)
+    {
+        if (done[s] == 0)
+        {
+            printf("%-8s %6d %10s %10s %10s\n", stage_names[s], 0, "-", "-", "-");
+            continue;
+        }
+
+        qsort(results[s], (size_t)done[s], sizeof(uint64_t), cmp_u64);
+        printf("%-8s %6d %10.1f %10.1f %10.1f\n", stage_names[s], done[s],
+               results[s][0] / 1000.0, results[s][done[s] / 2] / 1000.0,
+               results[s][done[s] - 1] / 1000.0);
+    }
+
+    close(notify_fd);
+    unlink(sun.sun_path);
+
+    return 0;
+}